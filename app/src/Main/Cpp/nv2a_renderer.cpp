@@ -573,8 +573,17 @@ void NV2ARenderer::handleTextureUpload(uint32_t command) {
     }
     
     if (memory) {
-        const uint8_t* src = memory->getRamPointer() + dest;
-        uploadTexture(dest, src, size);
+        // One unwatched host run is uploaded in place. Anything else, such
+        // as a range split by a watch, is gathered with readBlock so that
+        // watches see the read.
+        XboxMemory::HostSpan span = memory->getHostSpan(dest, size);
+        if (span.data && !span.watched && span.size == size) {
+            uploadTexture(dest, span.data, size);
+        } else {
+            std::vector<uint8_t> staging(size);
+            memory->readBlock(dest, staging.data(), size);
+            uploadTexture(dest, staging.data(), size);
+        }
     } else {
         LOGE("No memory assigned for texture upload");
     }
@@ -604,6 +613,22 @@ void NV2ARenderer::handleRegisterWrite(uint32_t reg, uint32_t value) {
         case 0x3000: 
             textureFilteringEnabled = (value & 1);
             break;
+
+        case 0x4000:
+            dmaState.source = value;
+            break;
+
+        case 0x4004:
+            dmaState.dest = value;
+            break;
+
+        case 0x4008:
+            dmaState.size = value;
+            break;
+
+        case 0x400C:
+            processDMA();
+            break;
     }
 }
 
@@ -718,8 +743,11 @@ void NV2ARenderer::deswizzleTexture(uint8_t*, const uint8_t*, uint32_t, uint32_t
     
 }
 
+// RAM to RAM copies run on the DMA engine and the CPU hears of them
+// through its completion; anything touching device pages is done here.
 void NV2ARenderer::processDMA() {
-    
+    if (!memory || dmaState.size == 0) return;
+    memory->dmaTransfer(dmaState.source, dmaState.dest, dmaState.size, DMA_TAG);
 }
 
 uint32_t NV2ARenderer::readRegister(uint32_t addr) {
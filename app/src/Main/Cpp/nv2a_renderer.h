@@ -20,6 +20,8 @@ public:
     static constexpr uint32_t TEXTURE_MEMORY = 128 * 1024 * 1024;
     static constexpr uint32_t MAX_VERTICES = 65536;
     static constexpr uint32_t MAX_COMMANDS = 16384;
+    // Tags the GPU's transfers on the DMA engine.
+    static constexpr uint32_t DMA_TAG = 1;
    
     NV2ARenderer(XboxMemory* memory);
     NV2ARenderer();
@@ -0,0 +1,30 @@
+#pragma once
+#include <cstdint>
+#include <cstdio>
+
+// Each native test is a plain main that counts failed CHECKs and returns
+// testResult() as its exit status.
+inline int failures = 0;
+
+#define CHECK(condition)                                                    \
+    do {                                                                    \
+        if (!(condition)) {                                                 \
+            std::fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #condition); \
+            failures++;                                                     \
+        }                                                                   \
+    } while (0)
+
+inline int testResult(const char* name) {
+    if (failures) {
+        std::fprintf(stderr, "%d check(s) failed\n", failures);
+        return 1;
+    }
+    std::printf("%s passed\n", name);
+    return 0;
+}
+
+// Fill pattern for guest memory fixtures. It repeats every 256 bytes within
+// a page but differs between pages, so a copy from the wrong page shows.
+inline uint8_t patternByte(uint32_t offset) {
+    return static_cast<uint8_t>(offset * 7 + (offset >> 12));
+}
@@ -0,0 +1,93 @@
+#include "test_support.h"
+#include "xbox_dma.h"
+
+static void fillSource(XboxMemory& memory, uint32_t src, uint32_t size) {
+    for (uint32_t offset = 0; offset < size; offset++) {
+        memory.write8(src + offset, patternByte(offset));
+    }
+}
+
+static bool copied(XboxMemory& memory, uint32_t dest, uint32_t size) {
+    for (uint32_t offset = 0; offset < size; offset++) {
+        if (memory.read8(dest + offset) != patternByte(offset)) return false;
+    }
+    return true;
+}
+
+// A submitted descriptor is copied by the worker and handed back once,
+// with its destination reported as a code write when it is taken.
+static void testSubmit() {
+    XboxMemory memory;
+    uint32_t codeWrites = 0;
+    memory.setCodeWriteCallback([&codeWrites](uint32_t, uint32_t) { codeWrites++; });
+
+    XboxDma dma(&memory);
+    const uint32_t src = 0x100000, dest = 0x200000, size = 0x23456;
+    fillSource(memory, src, size);
+    memory.markCodeRange(dest, 16);
+
+    CHECK(dma.submit({src, dest, size, 7}));
+    dma.drain();
+    CHECK(copied(memory, dest, size));
+    CHECK(codeWrites == 0);
+
+    XboxDma::Completion completion;
+    CHECK(dma.takeCompletion(completion));
+    CHECK(completion.descriptor.src == src && completion.descriptor.dest == dest);
+    CHECK(completion.descriptor.size == size && completion.descriptor.tag == 7);
+    CHECK(!completion.overlapped);
+    CHECK(codeWrites == 1);
+    CHECK(!dma.takeCompletion(completion));
+
+    CHECK(!dma.submit({src, XboxMemory::GPU_BASE, 16, 0}));
+    memory.setCodeWriteCallback(nullptr);
+}
+
+// dmaTransfer queues RAM to RAM copies on the attached engine and copies
+// anything touching device pages itself.
+static void testTransferRouting() {
+    XboxMemory memory;
+    const uint32_t src = 0x300000, dest = 0x380000, size = 0x1000;
+    fillSource(memory, src, size);
+    {
+        XboxDma dma(&memory);
+        CHECK(memory.dmaTransfer(src, dest, size, 3));
+        dma.drain();
+        CHECK(copied(memory, dest, size));
+
+        XboxDma::Completion completion;
+        CHECK(dma.takeCompletion(completion) && completion.descriptor.tag == 3);
+        CHECK(!memory.dmaTransfer(src, XboxMemory::GPU_BASE, 16, 3));
+        CHECK(!dma.takeCompletion(completion));
+    }
+
+    CHECK(!memory.dmaTransfer(src, dest + size, size));
+    CHECK(copied(memory, dest + size, size));
+}
+
+static void testDmaWindow() {
+    XboxMemory memory;
+    memory.openDmaWindow(0x10000, 0x20000, 0x1000);
+    memory.write32(0x30000, 1);
+    memory.write32(0x8000, 1);
+    CHECK(!memory.closeDmaWindow());
+
+    memory.openDmaWindow(0x10000, 0x20000, 0x1000);
+    memory.write32(0x20FFE, 1);
+    CHECK(memory.closeDmaWindow());
+
+    memory.openDmaWindow(0x10000, 0x20000, 0x1000);
+    uint8_t block[8] = {};
+    memory.writeBlock(0xFFFC, block, sizeof(block));
+    CHECK(memory.closeDmaWindow());
+
+    memory.write32(0x10000, 1);
+    CHECK(!memory.closeDmaWindow());
+}
+
+int main() {
+    testSubmit();
+    testTransferRouting();
+    testDmaWindow();
+    return testResult("xbox_dma_test");
+}
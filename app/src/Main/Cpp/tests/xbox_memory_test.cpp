@@ -0,0 +1,69 @@
+#include "test_support.h"
+#include "xbox_memory.h"
+#include <cstdlib>
+#include <string>
+#include <unistd.h>
+
+template <typename T>
+static T expected(uint32_t offset) {
+    T value = 0;
+    for (uint32_t i = 0; i < sizeof(T); i++) {
+        value |= static_cast<T>(patternByte(offset + i)) << (8 * i);
+    }
+    return value;
+}
+
+static std::string writeBiosImage() {
+    const char* dir = std::getenv("TMPDIR");
+    std::string path = std::string(dir ? dir : "/tmp") + "/xbox_bios_XXXXXX";
+    int fd = mkstemp(&path[0]);
+    if (fd < 0) return "";
+
+    std::string image(XboxMemory::BIOS_SIZE, '\0');
+    for (uint32_t offset = 0; offset < XboxMemory::BIOS_SIZE; offset++) {
+        image[offset] = static_cast<char>(patternByte(offset));
+    }
+    bool written = write(fd, image.data(), image.size()) == static_cast<ssize_t>(image.size());
+    close(fd);
+    return written ? path : "";
+}
+
+// BIOS pages are read-only page table entries, so every width has to come
+// back through the flag-stripped host pointer, including accesses that
+// straddle two pages.
+static void testBiosReads() {
+    std::string path = writeBiosImage();
+    CHECK(!path.empty());
+    if (path.empty()) return;
+
+    XboxMemory memory;
+    CHECK(memory.loadBios(path));
+    unlink(path.c_str());
+
+    const uint32_t offsets[] = {0, 1, 3, 0x7FF, 0xFFC, 0xFFD, 0xFFF, 0x1000, 0x1001, 0x12345,
+                                XboxMemory::BIOS_SIZE - 8};
+    for (uint32_t offset : offsets) {
+        uint32_t address = XboxMemory::BIOS_BASE + offset;
+        CHECK(memory.read8(address) == expected<uint8_t>(offset));
+        CHECK(memory.read16(address) == expected<uint16_t>(offset));
+        CHECK(memory.read32(address) == expected<uint32_t>(offset));
+        CHECK(memory.read64(address) == expected<uint64_t>(offset));
+
+        uint8_t block[16];
+        memory.readBlock(address, block, 8);
+        for (uint32_t i = 0; i < 8; i++) {
+            CHECK(block[i] == patternByte(offset + i));
+        }
+    }
+
+    memory.write32(XboxMemory::BIOS_BASE + 0x100, 0xDEADBEEF);
+    XboxMemory::Fault fault;
+    CHECK(XboxMemory::takeFault(fault) && fault.write && fault.present);
+    CHECK(memory.read32(XboxMemory::BIOS_BASE + 0x100) == expected<uint32_t>(0x100));
+    CHECK(!XboxMemory::faultPending());
+}
+
+int main() {
+    testBiosReads();
+    return testResult("xbox_memory_test");
+}
@@ -1,7 +1,5 @@
 #include "x86_core.h"
 #include <android/log.h>
-#include <stdexcept>
-#include <arm_neon.h>
 #include <unistd.h>
 #include <sys/mman.h>
 #include <cstring>
@@ -9,6 +7,10 @@
 #include <algorithm>
 #include <cstdio>
 
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
 #define LOG_TAG "X86Core"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
@@ -16,23 +18,226 @@
 #define LOGD(...) __android_log_print(ANDROID_LOG_DEBUG, LOG_TAG, __VA_ARGS__)
 
 constexpr size_t JIT_CACHE_SIZE = 16 * 1024 * 1024;
+constexpr uint32_t JIT_CACHE_SEGMENTS = 16;
+constexpr size_t JIT_SEGMENT_SIZE = JIT_CACHE_SIZE / JIT_CACHE_SEGMENTS;
 constexpr uint32_t MAX_BLOCK_SIZE = 256;
+constexpr uint32_t MAX_BLOCK_INSTRUCTIONS = 64;
 constexpr uint32_t JIT_THRESHOLD = 10;
+constexpr uint32_t JIT_OPTIMIZE_SAMPLES = 32;
+constexpr size_t JIT_CODE_ALIGN = 16;
+constexpr uint32_t JIT_CHAIN_BUDGET = 1024;
+constexpr uint16_t DECODE_FAILED = 0xFFFF;
+constexpr uint32_t MAX_INSTRUCTION_LENGTH = 15;
+
+namespace {
+
+JITOp makeJITOp(JITOpcode opcode, uint32_t guestAddr) {
+    JITOp op{};
+    op.opcode = opcode;
+    op.dst = JIT_NONE;
+    op.src1 = JIT_NONE;
+    op.src2 = JIT_NONE;
+    op.size = 4;
+    op.guestAddr = guestAddr;
+    return op;
+}
+
+// Clears flag bits that are overwritten before anything can observe them.
+// Every op that may leave the block, including faulting memory accesses,
+// observes all flags.
+void eliminateDeadFlags(JITBlockIR& ir) {
+    uint16_t live = JIT_FLAGS_ARITH;
+    for (auto op = ir.ops.rbegin(); op != ir.ops.rend(); ++op) {
+        switch (op->opcode) {
+            case JITOpcode::Alu:
+            case JITOpcode::AluImm:
+            case JITOpcode::FpuCompareFlags: {
+                uint16_t written = op->flagMask;
+                op->flagMask &= live;
+                live &= ~written;
+                break;
+            }
+            case JITOpcode::Load:
+            case JITOpcode::Store:
+            case JITOpcode::Exit:
+            case JITOpcode::ExitReg:
+            case JITOpcode::ExitCond:
+            case JITOpcode::CodeCheck:
+            case JITOpcode::FpuCheck:
+                live = JIT_FLAGS_ARITH;
+                break;
+            default:
+                break;
+        }
+    }
+
+    ir.ops.erase(std::remove_if(ir.ops.begin(), ir.ops.end(), [](const JITOp& op) {
+        if (op.flagMask != 0) return false;
+        return op.opcode == JITOpcode::FpuCompareFlags ||
+               ((op.opcode == JITOpcode::Alu || op.opcode == JITOpcode::AluImm) &&
+                (op.aluOp == JITAluOp::Cmp || op.aluOp == JITAluOp::Test));
+    }), ir.ops.end());
+}
+
+uint32_t foldAluImm(JITAluOp aluOp, uint32_t a, uint32_t imm) {
+    switch (aluOp) {
+        case JITAluOp::Add: return a + imm;
+        case JITAluOp::Or: return a | imm;
+        case JITAluOp::And: return a & imm;
+        case JITAluOp::Sub: return a - imm;
+        case JITAluOp::Xor: return a ^ imm;
+        case JITAluOp::Inc: return a + 1;
+        case JITAluOp::Dec: return a - 1;
+        case JITAluOp::Not: return ~a;
+        case JITAluOp::Neg: return 0 - a;
+        case JITAluOp::Shl: return a << (imm & 31);
+        case JITAluOp::Shr: return a >> (imm & 31);
+        case JITAluOp::Sar: return static_cast<uint32_t>(static_cast<int32_t>(a) >> (imm & 31));
+        case JITAluOp::Imul: return static_cast<uint32_t>(static_cast<int32_t>(a) * static_cast<int32_t>(imm));
+        default: return a;
+    }
+}
+
+// Carries LoadImm values forward: constant sources turn Move, Lea and ALU
+// ops into immediates, and flag-free ALU ops on constants fold away. Any
+// other write to a register ends what is known about it. Runs after
+// eliminateDeadFlags so that flag-free ops are visible.
+void propagateConstants(JITBlockIR& ir) {
+    constexpr uint8_t TRACKED = JIT_T2 + 1;
+    bool known[TRACKED] = {};
+    uint32_t value[TRACKED] = {};
+    auto isKnown = [&](uint8_t reg) { return reg < TRACKED && known[reg]; };
+    auto setConstant = [](JITOp& op, uint32_t imm) {
+        JITOp constant = makeJITOp(JITOpcode::LoadImm, op.guestAddr);
+        constant.dst = op.dst;
+        constant.imm = imm;
+        op = constant;
+    };
+
+    for (JITOp& op : ir.ops) {
+        switch (op.opcode) {
+            case JITOpcode::Move:
+                if (isKnown(op.src1)) setConstant(op, value[op.src1]);
+                break;
+            case JITOpcode::Lea:
+                if (isKnown(op.src2)) {
+                    op.imm += value[op.src2] << op.scale;
+                    op.src2 = JIT_NONE;
+                    op.scale = 0;
+                }
+                if (isKnown(op.src1)) {
+                    op.imm += value[op.src1];
+                    op.src1 = JIT_NONE;
+                }
+                if (op.src1 == JIT_NONE && op.src2 == JIT_NONE) setConstant(op, op.imm);
+                break;
+            case JITOpcode::Alu:
+                if (op.flagMask == 0 && op.dst == op.src2 &&
+                    (op.aluOp == JITAluOp::Xor || op.aluOp == JITAluOp::Sub)) {
+                    setConstant(op, 0);
+                    break;
+                }
+                if (!isKnown(op.src2)) break;
+                op.opcode = JITOpcode::AluImm;
+                op.imm = value[op.src2];
+                op.src2 = JIT_NONE;
+                [[fallthrough]];
+            case JITOpcode::AluImm:
+                if (op.flagMask == 0 && isKnown(op.dst) &&
+                    op.aluOp != JITAluOp::Cmp && op.aluOp != JITAluOp::Test) {
+                    setConstant(op, foldAluImm(op.aluOp, value[op.dst], op.imm));
+                }
+                break;
+            default:
+                break;
+        }
+
+        if (op.dst < TRACKED) {
+            known[op.dst] = op.opcode == JITOpcode::LoadImm;
+            value[op.dst] = op.imm;
+        }
+    }
+}
+
+// Removes LoadImm, Move and Lea results in temporaries that nothing reads,
+// which is what constant propagation leaves behind. Temporaries are dead
+// at every block exit.
+void eliminateDeadTemps(JITBlockIR& ir) {
+    auto bit = [](uint8_t reg) -> uint8_t {
+        return reg >= JIT_T0 && reg <= JIT_T2 ? 1u << (reg - JIT_T0) : 0;
+    };
+    uint8_t live = 0;
+    std::vector<bool> dead(ir.ops.size());
+    for (size_t i = ir.ops.size(); i-- > 0;) {
+        const JITOp& op = ir.ops[i];
+        bool pure = op.opcode == JITOpcode::LoadImm || op.opcode == JITOpcode::Move || op.opcode == JITOpcode::Lea;
+        if (pure && bit(op.dst) && !(live & bit(op.dst))) {
+            dead[i] = true;
+            continue;
+        }
+
+        bool alu = op.opcode == JITOpcode::Alu || op.opcode == JITOpcode::AluImm;
+        bool writesDst = pure || op.opcode == JITOpcode::Load || op.opcode == JITOpcode::Extend ||
+                         op.opcode == JITOpcode::FpuToBits || op.opcode == JITOpcode::FpuStatus ||
+                         op.opcode == JITOpcode::VecLaneLoad ||
+                         (alu && op.aluOp != JITAluOp::Cmp && op.aluOp != JITAluOp::Test);
+        if (writesDst) live &= ~bit(op.dst);
+        live |= bit(op.src1) | bit(op.src2) | (alu ? bit(op.dst) : 0);
+    }
+
+    size_t kept = 0;
+    for (size_t i = 0; i < ir.ops.size(); i++) {
+        if (!dead[i]) ir.ops[kept++] = ir.ops[i];
+    }
+    ir.ops.resize(kept);
+}
+
+}
 
 X86Core::X86Core(XboxMemory* memory) :
+    traceEnabled(false),
+    xmmRegisters(),
+    mxcsr(0x1F80),
+    fpu(),
     memory(memory),
     state(CpuState::Running),
+    kernel(nullptr),
     eip(0xFF000000),
     eflags(0x00000002),
+    exceptionPending(false),
+    pendingException(0),
+    lastDecodedPage(nullptr),
+    lastDecodedPageNumber(0),
+    jitCacheKey(0),
+    jitPersistedDirty(false),
+    jitWorkersRunning(false),
+    hotness(HOTNESS_TABLE_SIZE),
     jitCacheBase(nullptr),
+    fastmemBase(memory->getFastmemBase()),
     jitCacheUsed(0),
-    executionCounts(),
-    fpu(),
-    xmmRegisters(),
+    jitSegment(0),
+    jitSegmentBlocks(JIT_CACHE_SEGMENTS),
     jitEnabled(true),
     jitThreshold(JIT_THRESHOLD),
-    traceEnabled(false),
-    kernel(nullptr)  
+    jitOptimizeThreshold(JIT_OPTIMIZE_SAMPLES),
+    jitFault(false),
+    jitChainBudget(0),
+    jitCodeDirty(false),
+    atBlockHead(true),
+    decoder(memory),
+    flagsOp(ALU_NONE),
+    flagsA(0),
+    flagsB(0),
+    flagsResult(0),
+    flagsSize(4),
+    fpuPrecisionEnabled(false),
+    deferredCodePages(XboxMemory::CODE_PAGE_COUNT / 64),
+    deferredCodeWrites(false),
+    idtBase(0),
+    idtLimit(0),
+    pendingInterrupts(),
+    interruptsPending(false),
+    tscEpoch(std::chrono::steady_clock::now())
 {
 
     eax = ebx = ecx = edx = 0;
@@ -52,13 +257,26 @@ X86Core::X86Core(XboxMemory* memory) :
     
     if (jitCacheBase == MAP_FAILED) {
         LOGE("Failed to allocate JIT cache");
+        jitCacheBase = nullptr;
         jitEnabled = false;
     } else {
         LOGI("JIT cache allocated at %p (size: %zu bytes)", jitCacheBase, JIT_CACHE_SIZE);
+        jitEmitter = std::make_unique<JITEmitter>(buildContextLayout());
+        LOGI("JIT backend: %s", JITEmitter::hostName());
+        if (fastmemBase) {
+            installFastmemHandler();
+        }
+        startCompileWorkers();
     }
+
+    memory->setCodeWriteCallback([this](uint32_t address, uint32_t size) {
+        onCodeWrite(address, size);
+    });
 }
 
 X86Core::~X86Core() {
+    stopCompileWorkers();
+    memory->setCodeWriteCallback(nullptr);
     if (jitCacheBase) {
         munmap(jitCacheBase, JIT_CACHE_SIZE);
     }
@@ -69,29 +287,52 @@ void X86Core::reset() {
     esi = edi = esp = ebp = 0;
     eip = 0xFF000000;
     eflags = 0x00000002;
+    flagsOp = ALU_NONE;
     cs = 0xF000;
     ds = es = fs = gs = ss = 0x0000;
     cr0 = 0x60000011;
     cr2 = cr3 = cr4 = 0;
     state = CpuState::Running;
+    exceptionPending = false;
+    XboxMemory::clearFault();
+    idtBase = 0;
+    idtLimit = 0;
+    pendingInterrupts.fill(0);
+    interruptsPending = false;
+    tscEpoch = std::chrono::steady_clock::now();
 
     for (auto& reg : xmmRegisters) {
         memset(reg.data, 0, sizeof(reg.data));
     }
+    mxcsr = 0x1F80;
 
     fpu.controlWord = 0x037F;
     fpu.statusWord = 0;
     fpu.tagWord = 0xFFFF;
     breakpoints.clear();
     jit_cache.clear();
-    executionCounts.clear();
+    jitIncoming.clear();
+    jitPageBlocks.clear();
+    for (auto& pending : jitPending) {
+        pending.second = true;
+    }
+    std::fill(hotness.begin(), hotness.end(), HotnessEntry{});
+    atBlockHead = true;
+    flushDecodedCache();
 
     if (jitCacheBase) {
         jitCacheUsed = 0;
+        jitSegment = 0;
+        for (auto& blocks : jitSegmentBlocks) {
+            blocks.clear();
+        }
+        jitFastmemSites.clear();
     }
 }
 
 void X86Core::execute(uint32_t cycles) {
+    // A fault taken on this thread outside guest code is not the guest's.
+    XboxMemory::clearFault();
     uint32_t executed = 0;
     while (executed < cycles && state == CpuState::Running) {
         executeStep();
@@ -102,9 +343,17 @@ void X86Core::execute(uint32_t cycles) {
 void X86Core::executeStep() {
     if (state != CpuState::Running) return;
 
-    if (memory->read8(eip) == 0x0F && memory->read8(eip + 1) == 0x3F) {
-        handleXboxSpecificOpcode();
-        return;
+    CoreScope stepping(steppingCore, this);
+    if (deferredCodeWrites.load(std::memory_order_acquire)) {
+        applyDeferredCodeWrites();
+    }
+
+    if (interruptsPending) {
+        deliverPendingInterrupt();
+        if (XboxMemory::faultPending()) {
+            deliverException(eip);
+            return;
+        }
     }
 
     if (auto bp = breakpoints.find(eip); bp != breakpoints.end()) {
@@ -113,36 +362,176 @@ void X86Core::executeStep() {
         return;
     }
 
-    executionCounts[eip]++;
+    if (atBlockHead && !jitPending.empty()) {
+        publishCompiledBlocks();
+    }
 
-    if (jitEnabled && executionCounts[eip] > jitThreshold) {
-        if (auto block = jit_cache.find(eip); block != jit_cache.end()) {
+    if (atBlockHead && jitEnabled && breakpoints.empty() &&
+        (countBlockHead(eip) > jitThreshold || jitPersisted.count(eip))) {
+        auto block = jit_cache.find(eip);
+        if (block == jit_cache.end()) {
+            requestBlock(eip, JITTier::Baseline);
+            block = jit_cache.find(eip);
+        } else if (block->second.tier == JITTier::Baseline && block->second.compiled_code &&
+                   ++block->second.samples >= jitOptimizeThreshold) {
+            requestBlock(eip, JITTier::Optimized);
+            block = jit_cache.find(eip);
+        }
+        if (block != jit_cache.end() && block->second.compiled_code) {
             executeCompiledBlock(block->second);
+            // A faulting block exits with eip on the faulting instruction.
+            if (jitFault) {
+                deliverException(eip);
+            }
             return;
-        } else {
-            compileBlock(eip);
-            if (auto new_block = jit_cache.find(eip); new_block != jit_cache.end()) {
-                executeCompiledBlock(new_block->second);
-                return;
+        }
+    }
+
+    uint32_t start = eip;
+    atBlockHead = true;
+    DecodedInstruction decoded;
+    if (fetchDecoded(eip, decoded)) {
+        eip += decoded.insn.length;
+        (this->*decoded.handler)(decoded.insn);
+        atBlockHead = eip != start + decoded.insn.length;
+    } else if (memory->read8(eip) == 0x0F && memory->read8(eip + 1) == 0x3F) {
+        handleXboxSpecificOpcode();
+        // The legacy handlers do not report their length, so anything that
+        // moved eip further than one instruction is treated as a branch.
+        atBlockHead = eip - start - 1 >= MAX_INSTRUCTION_LENGTH;
+    } else if (!XboxMemory::faultPending()) {
+        decodeAndExecute(memory->read8(eip++));
+    }
+
+    if (exceptionPending || XboxMemory::faultPending()) {
+        deliverException(start);
+    }
+}
+
+uint32_t X86Core::countBlockHead(uint32_t address) {
+    HotnessEntry& entry = hotness[(address ^ (address >> 12)) & (HOTNESS_TABLE_SIZE - 1)];
+    if (entry.address != address) {
+        entry.address = address;
+        entry.count = 0;
+    }
+    if (entry.count <= jitThreshold) {
+        entry.count++;
+    }
+    return entry.count;
+}
+
+bool X86Core::fetchDecoded(uint32_t address, DecodedInstruction& decoded) {
+    uint32_t pageNumber = address >> DECODED_PAGE_SHIFT;
+    if (!lastDecodedPage || lastDecodedPageNumber != pageNumber) {
+        auto& page = decodedPages[pageNumber];
+        if (!page) {
+            page = std::make_unique<DecodedPage>();
+            page->slots.fill(0);
+            memory->markCodeRange(pageNumber << DECODED_PAGE_SHIFT, DECODED_PAGE_SIZE);
+        }
+        lastDecodedPage = page.get();
+        lastDecodedPageNumber = pageNumber;
+    }
+
+    uint16_t& slot = lastDecodedPage->slots[address & (DECODED_PAGE_SIZE - 1)];
+    if (slot == DECODE_FAILED) {
+        return false;
+    }
+    if (slot != 0) {
+        decoded = lastDecodedPage->instructions[slot - 1];
+        return true;
+    }
+
+    X86Instruction insn;
+    InstructionHandler handler = decoder.decode(address, insn) ? handlerFor(insn) : nullptr;
+    if (!handler) {
+        slot = DECODE_FAILED;
+        return false;
+    }
+
+    decoded.handler = handler;
+    decoded.insn = insn;
+
+    // Instructions straddling a page boundary are decoded on every visit so
+    // that a write to the second page cannot leave a stale entry behind.
+    if (((address + insn.length - 1) >> DECODED_PAGE_SHIFT) == pageNumber) {
+        lastDecodedPage->instructions.push_back(decoded);
+        slot = static_cast<uint16_t>(lastDecodedPage->instructions.size());
+    }
+    return true;
+}
+
+void X86Core::invalidateCode(uint32_t address, uint32_t size) {
+    uint64_t writeEnd = static_cast<uint64_t>(address) + size;
+    for (auto& pending : jitPending) {
+        uint64_t reach = static_cast<uint64_t>(pending.first) + MAX_BLOCK_SIZE + MAX_INSTRUCTION_LENGTH;
+        if (pending.first < writeEnd && address < reach) {
+            pending.second = true;
+        }
+    }
+
+    uint32_t last = static_cast<uint32_t>((writeEnd - 1) >> DECODED_PAGE_SHIFT);
+    for (uint32_t page = address >> DECODED_PAGE_SHIFT;; page++) {
+        if (decodedPages.erase(page) && lastDecodedPageNumber == page) {
+            lastDecodedPage = nullptr;
+        }
+
+        auto blocks = jitPageBlocks.find(page);
+        if (blocks != jitPageBlocks.end()) {
+            std::vector<uint32_t> starts = blocks->second;
+            for (uint32_t start : starts) {
+                auto block = jit_cache.find(start);
+                if (block == jit_cache.end()) continue;
+                uint64_t blockEnd = static_cast<uint64_t>(start) + std::max(block->second.size, 1u);
+                if (start < writeEnd && address < blockEnd) {
+                    invalidateJITBlock(start);
+                    jitCodeDirty = true;
+                }
+            }
+            if (jitPageBlocks.count(page)) {
+                memory->markCodeRange(page << DECODED_PAGE_SHIFT, DECODED_PAGE_SIZE);
             }
         }
+        if (page == last) break;
     }
+}
+
+thread_local X86Core* X86Core::steppingCore = nullptr;
 
-    try {
-        uint8_t opcode = memory->read8(eip++);
-        
-        switch (opcode) {
-            case 0x90: break; 
-            case 0xC3: ret(); return;
-            case 0xEB: jmp_rel8(); return;
-            default: decodeAndExecute(opcode);
+void X86Core::onCodeWrite(uint32_t address, uint32_t size) {
+    if (steppingCore == this) {
+        invalidateCode(address, size);
+        return;
+    }
+
+    uint32_t last = static_cast<uint32_t>((static_cast<uint64_t>(address) + size - 1) >> DECODED_PAGE_SHIFT);
+    for (uint32_t page = address >> DECODED_PAGE_SHIFT;; page++) {
+        deferredCodePages[page >> 6].fetch_or(1ull << (page & 63), std::memory_order_relaxed);
+        if (page == last) break;
+    }
+    deferredCodeWrites.store(true, std::memory_order_release);
+}
+
+// Clearing the flag first means a write racing with the scan either has
+// its bit taken here or sets the flag again for the next instruction.
+void X86Core::applyDeferredCodeWrites() {
+    deferredCodeWrites.exchange(false, std::memory_order_acquire);
+    for (uint32_t word = 0; word < deferredCodePages.size(); word++) {
+        if (!deferredCodePages[word].load(std::memory_order_relaxed)) continue;
+        uint64_t bits = deferredCodePages[word].exchange(0, std::memory_order_acquire);
+        while (bits) {
+            uint32_t page = word * 64 + __builtin_ctzll(bits);
+            bits &= bits - 1;
+            invalidateCode(page << DECODED_PAGE_SHIFT, DECODED_PAGE_SIZE);
         }
-    } catch (const std::exception& e) {
-        LOGE("CPU Exception: %s at 0x%08X", e.what(), eip);
-        state = CpuState::Error;
     }
 }
 
+void X86Core::flushDecodedCache() {
+    decodedPages.clear();
+    lastDecodedPage = nullptr;
+}
+
 void X86Core::handleXboxSpecificOpcode() {
     
     eip += 2;
@@ -205,380 +594,1228 @@ void X86Core::handlePerformanceCounter() {
     LOGW("Xbox Performance Counter opcode not implemented");
 }
 
-void X86Core::compileBlock(uint32_t start_addr) {
-    if (jitCacheUsed + MAX_BLOCK_SIZE > JIT_CACHE_SIZE) {
-        LOGW("JIT cache full, flushing");
-        flushJITCache();
+// Translation goes to the worker pool. Persisted blocks only need to be
+// emitted, which is cheap enough to do inline, as is everything when no
+// worker could be started.
+void X86Core::requestBlock(uint32_t start_addr, JITTier tier) {
+    if (jitPending.count(start_addr)) return;
+
+    auto persisted = jitPersisted.find(start_addr);
+    if (jitWorkers.empty() || (persisted != jitPersisted.end() && persisted->second.tier >= tier)) {
+        if (tier == JITTier::Optimized) {
+            invalidateJITBlock(start_addr);
+        }
+        compileBlock(start_addr, tier);
+        return;
+    }
+
+    // A full queue leaves the block to the interpreter; it is requested
+    // again on a later visit.
+    if (jitPending.size() >= JIT_QUEUE_CAPACITY || !jitJobs->push(JITCompileJob{start_addr, tier, fpuPrecise()})) {
+        return;
+    }
+    jitPending[start_addr] = false;
+    {
+        std::lock_guard<std::mutex> lock(jitWakeMutex);
+    }
+    jitWake.notify_one();
+}
+
+void X86Core::compileBlock(uint32_t start_addr, JITTier tier) {
+    JITBlockIR ir;
+    std::vector<uint8_t> code;
+    JITCodeInfo info;
+    bool restored = jitEmitter && restoreBlock(start_addr, ir, tier);
+    bool translated = jitEmitter && (restored || translateBlock(start_addr, ir, tier, fpuPrecise())) &&
+                      jitEmitter->compile(ir, code, info);
+    if (installBlock(start_addr, tier, ir, code, info, translated) && !restored) {
+        persistBlock(ir, tier);
     }
+}
 
+// An optimized block replaces its baseline block in place. Incoming links
+// survive in jitIncoming and are pointed at the new code; the old code
+// stays unused in the cache until its segment is recycled.
+void X86Core::publishCompiledBlocks() {
+    JITCompileResult result;
+    while (jitResults->pop(result)) {
+        uint32_t start_addr = result.job.startAddr;
+        auto pending = jitPending.find(start_addr);
+        if (pending == jitPending.end()) continue;
+        bool stale = pending->second;
+        jitPending.erase(pending);
+        if (stale) continue;
+
+        invalidateJITBlock(start_addr);
+        if (installBlock(start_addr, result.job.tier, result.ir, result.code, result.info, result.translated)) {
+            persistBlock(result.ir, result.job.tier);
+        }
+    }
+}
+
+bool X86Core::installBlock(uint32_t start_addr, JITTier tier, const JITBlockIR& ir,
+                           const std::vector<uint8_t>& code, JITCodeInfo& info, bool translated) {
     JITBlock block;
     block.start_addr = start_addr;
+    block.tier = tier;
+    block.samples = 0;
     block.size = 0;
+    block.compiled_code = nullptr;
+    block.code_size = 0;
+    block.chain_offset = 0;
+
+    if (!translated) {
+        trackBlockPages(jit_cache[start_addr] = block);
+        return false;
+    }
+
+    size_t reserved = (code.size() + JIT_CODE_ALIGN - 1) & ~(JIT_CODE_ALIGN - 1);
+    if (reserved > JIT_SEGMENT_SIZE) {
+        trackBlockPages(jit_cache[start_addr] = block);
+        return false;
+    }
+    if (jitCacheUsed + reserved > (jitSegment + 1) * JIT_SEGMENT_SIZE) {
+        evictSegment((jitSegment + 1) % JIT_CACHE_SEGMENTS);
+    }
+
+    block.size = ir.endAddr - start_addr;
     block.compiled_code = reinterpret_cast<uint8_t*>(jitCacheBase) + jitCacheUsed;
+    block.code_size = static_cast<uint32_t>(code.size());
+    block.chain_offset = info.chainOffset;
+    block.exits = std::move(info.exits);
+    memcpy(block.compiled_code, code.data(), code.size());
+    for (const JITFastmemSite& site : info.fastmemSites) {
+        jitFastmemSites[block.compiled_code + site.accessOffset] = {block.compiled_code + site.patchOffset,
+                                                                    block.compiled_code + site.stubOffset};
+    }
+    jitCacheUsed += reserved;
+    jitSegmentBlocks[jitSegment].push_back(start_addr);
+
+    __builtin___clear_cache(reinterpret_cast<char*>(block.compiled_code), 
+                           reinterpret_cast<char*>(block.compiled_code) + block.code_size);
+    LOGD("Compiled %s block at 0x%08X (%u guest instructions, %u bytes -> %u bytes)",
+         tier == JITTier::Optimized ? "optimized" : "baseline",
+         start_addr, ir.instructionCount, block.size, block.code_size);
+    JITBlock& installed = jit_cache[start_addr] = std::move(block);
+    trackBlockPages(installed);
+    linkBlock(installed);
+    return true;
+}
 
-    uint32_t current_addr = start_addr;
-    uint8_t* code_ptr = block.compiled_code;
-    bool end_block = false;
-
-    while (current_addr < start_addr + MAX_BLOCK_SIZE && !end_block) {
-        uint8_t opcode = memory->read8(current_addr);
-        
-        if (opcode == 0x0F && memory->read8(current_addr + 1) == 0x3F) {
-            emitXboxOpcode(code_ptr, memory->read8(current_addr + 2));
-            current_addr += 3;
-            block.size += 3;
-            continue;
-        }
-        
-        switch (opcode) {
-            case 0x8B: { 
-                uint8_t modrm = memory->read8(current_addr + 1);
-                emitMOV(code_ptr, modrm);
-                current_addr += 2;
-                block.size += 2;
-                break;
-            }
-            case 0x89: { 
-                uint8_t modrm = memory->read8(current_addr + 1);
-                emitMOV(code_ptr, modrm);
-                current_addr += 2;
-                block.size += 2;
-                break;
-            }
-            case 0x01: { 
-                uint8_t modrm = memory->read8(current_addr + 1);
-                emitADD(code_ptr, modrm);
-                current_addr += 2;
-                block.size += 2;
-                break;
-            }
-            case 0x03: { 
-                uint8_t modrm = memory->read8(current_addr + 1);
-                emitADD(code_ptr, modrm);
-                current_addr += 2;
-                block.size += 2;
-                break;
-            }
-            case 0xC3: { 
-                emitRET(code_ptr);
-                current_addr += 1;
-                block.size += 1;
-                end_block = true;
-                break;
-            }
-            case 0xEB: { 
-                emitJMP(code_ptr, memory->read8(current_addr + 1));
-                current_addr += 2;
-                block.size += 2;
-                end_block = true;
-                break;
-            }
-            default:
-                end_block = true;
+// The code cache is a ring of segments filled in order. Moving on to the
+// next segment drops every block still living in it, oldest code first;
+// their predecessors are unlinked through jitIncoming and hot blocks are
+// simply translated again on their next visit.
+void X86Core::evictSegment(uint32_t segment) {
+    uint8_t* base = reinterpret_cast<uint8_t*>(jitCacheBase) + segment * JIT_SEGMENT_SIZE;
+    size_t evicted = 0;
+    for (uint32_t start : jitSegmentBlocks[segment]) {
+        auto block = jit_cache.find(start);
+        if (block == jit_cache.end()) continue;
+        uint8_t* code = block->second.compiled_code;
+        if (code >= base && code < base + JIT_SEGMENT_SIZE) {
+            invalidateJITBlock(start);
+            evicted++;
         }
     }
+    jitSegmentBlocks[segment].clear();
+    jitFastmemSites.erase(jitFastmemSites.lower_bound(base), jitFastmemSites.lower_bound(base + JIT_SEGMENT_SIZE));
+    jitSegment = segment;
+    jitCacheUsed = segment * JIT_SEGMENT_SIZE;
+    LOGD("Evicted %zu blocks from JIT cache segment %u", evicted, segment);
+}
 
-    if (block.size > 0) {
-        jit_cache[start_addr] = block;
-        jitCacheUsed += block.size;
-        __builtin___clear_cache(reinterpret_cast<char*>(block.compiled_code), 
-                               reinterpret_cast<char*>(block.compiled_code) + block.size);
-        LOGD("Compiled block at 0x%08X (size: %u bytes)", start_addr, block.size);
+void X86Core::trackBlockPages(const JITBlock& block) {
+    uint32_t size = std::max(block.size, 1u);
+    uint32_t last = (block.start_addr + size - 1) >> DECODED_PAGE_SHIFT;
+    for (uint32_t page = block.start_addr >> DECODED_PAGE_SHIFT;; page++) {
+        jitPageBlocks[page].push_back(block.start_addr);
+        if (page == last) break;
     }
+    memory->markCodeRange(block.start_addr, size);
+}
+
+bool X86Core::isJITCode(const uint8_t* pc) const {
+    const uint8_t* cache = static_cast<const uint8_t*>(jitCacheBase);
+    return cache && pc >= cache && pc < cache + JIT_CACHE_SIZE;
 }
 
 void X86Core::executeCompiledBlock(JITBlock& block) {
-    typedef void (*JITFunction)();
+    typedef void (*JITFunction)(X86Core*);
     auto func = reinterpret_cast<JITFunction>(block.compiled_code);
-    func();
+    materializeFlags();
+    jitFault = false;
+    jitCodeDirty = false;
+    jitChainBudget = JIT_CHAIN_BUDGET;
+
+    // Only faults taken while this thread runs translated code belong to
+    // the fastmem handler.
+    CoreScope running(runningCore, this);
+    func(this);
 }
 
-void X86Core::decodeAndExecute(uint8_t opcode) {
-    switch (opcode) {
-        case 0x8B: mov_r32_rm32(); break;
-        case 0x89: mov_rm32_r32(); break;
-        case 0x01: add_rm32_r32(); break;
-        case 0x03: add_r32_rm32(); break;
-        case 0xE9: jmp_rel32(); break;
-        case 0xEB: jmp_rel8(); break;
-        case 0xC3: ret(); break;
-        case 0xD8: case 0xD9: case 0xDA: case 0xDB:
-        case 0xDC: case 0xDD: case 0xDE: case 0xDF:
-            handleFPUOpcode(opcode);
-            break;
-        case 0x0F:
-            handleSSEOpcode(memory->read8(eip++));
-            break;
-        default:
-            LOGE("Unknown opcode: 0x%02X at 0x%08X", opcode, eip-1);
-            state = CpuState::Error;
+void X86Core::linkBlock(JITBlock& block) {
+    for (const JITExitStub& exit : block.exits) {
+        uint8_t* site = block.compiled_code + exit.patchOffset;
+        jitIncoming[exit.target].push_back(site);
+        auto successor = jit_cache.find(exit.target);
+        if (successor != jit_cache.end() && successor->second.compiled_code) {
+            JITEmitter::linkExit(site, successor->second.compiled_code + successor->second.chain_offset);
+        }
     }
-}
 
-void X86Core::aluAdd(uint32_t& dest, uint32_t src) {
-    uint32_t result = dest + src;
-    eflags = (eflags & ~0x8D5) | 
-             ((result == 0) << 6) |
-             ((result >> 31) & 1) |
-             ((result < dest) << 0) |
-             ((((dest ^ src ^ 0x80000000) & (dest ^ result)) >> 30) & 0x4);
-    dest = result;
+    auto incoming = jitIncoming.find(block.start_addr);
+    if (incoming != jitIncoming.end()) {
+        for (uint8_t* site : incoming->second) {
+            JITEmitter::linkExit(site, block.compiled_code + block.chain_offset);
+        }
+    }
 }
 
-void X86Core::aluSub(uint32_t& dest, uint32_t src) {
-    uint32_t result = dest - src;
-    eflags = (eflags & ~0x8D5) | 
-             ((result == 0) << 6) |
-             ((result >> 31) & 1) |
-             ((dest < src) << 0) |
-             ((((dest ^ src) & (dest ^ result)) >> 30) & 0x4);
-    dest = result;
-}
+void X86Core::invalidateJITBlock(uint32_t start_addr) {
+    auto it = jit_cache.find(start_addr);
+    if (it == jit_cache.end()) return;
 
-void X86Core::aluMul(uint32_t& dest, uint32_t src) {
-    uint32x2_t a = vdup_n_u32(dest);
-    uint32x2_t b = vdup_n_u32(src);
-    uint64x2_t result = vmull_u32(a, b);
-    uint64_t low = vgetq_lane_u64(result, 0);
-    dest = low & 0xFFFFFFFF;
-    uint32_t high = (low >> 32) & 0xFFFFFFFF;
-    eflags = (eflags & ~0x801) | ((high != 0) << 0);
-}
+    JITBlock& block = it->second;
+    if (block.compiled_code) {
+        for (const JITExitStub& exit : block.exits) {
+            auto& sites = jitIncoming[exit.target];
+            sites.erase(std::remove(sites.begin(), sites.end(), block.compiled_code + exit.patchOffset), sites.end());
+        }
 
-void X86Core::updateFlags(uint32_t result, uint32_t a, uint32_t b, uint32_t operation) {
-    uint32_t flags = 0;
-    flags |= (result == 0) << 6;
-    flags |= (result & 0x80000000) >> 31;
-    
-    switch (operation) {
-        case ALU_ADD: flags |= (result < a) << 0; break;
-        case ALU_SUB: flags |= (a < b) << 0; break;
-        case ALU_MUL: flags |= 0; break;
+        auto incoming = jitIncoming.find(start_addr);
+        if (incoming != jitIncoming.end()) {
+            for (uint8_t* site : incoming->second) {
+                JITEmitter::unlinkExit(site);
+            }
+        }
     }
-    
-    switch (operation) {
-        case ALU_ADD: {
-            uint32_t sign_a = a & 0x80000000;
-            uint32_t sign_b = b & 0x80000000;
-            uint32_t sign_r = result & 0x80000000;
-            flags |= (sign_a == sign_b && sign_a != sign_r) ? 0x800 : 0;
+
+    uint32_t last = (start_addr + std::max(block.size, 1u) - 1) >> DECODED_PAGE_SHIFT;
+    for (uint32_t page = start_addr >> DECODED_PAGE_SHIFT;; page++) {
+        auto blocks = jitPageBlocks.find(page);
+        if (blocks != jitPageBlocks.end()) {
+            auto& starts = blocks->second;
+            starts.erase(std::remove(starts.begin(), starts.end(), start_addr), starts.end());
+            if (starts.empty()) jitPageBlocks.erase(blocks);
+        }
+        if (page == last) break;
+    }
+    jit_cache.erase(it);
+}
+
+bool X86Core::translateBlock(uint32_t start_addr, JITBlockIR& ir, JITTier tier, bool precise) {
+    ir.startAddr = start_addr;
+    ir.endAddr = start_addr;
+    ir.instructionCount = 0;
+    ir.ops.clear();
+
+    uint32_t current_addr = start_addr;
+    bool endBlock = false;
+
+    while (!endBlock && ir.instructionCount < MAX_BLOCK_INSTRUCTIONS &&
+           current_addr - start_addr < MAX_BLOCK_SIZE) {
+        X86Instruction insn;
+        if (!decoder.decode(current_addr, insn)) {
             break;
         }
-        case ALU_SUB: {
-            uint32_t sign_a = a & 0x80000000;
-            uint32_t sign_b = b & 0x80000000;
-            uint32_t sign_r = result & 0x80000000;
-            flags |= (sign_a != sign_b && sign_a != sign_r) ? 0x800 : 0;
+
+        // Optimized traces run through forward direct jumps. The skipped
+        // bytes stay inside the block's range, so code tracking still
+        // covers everything the trace was built from.
+        if (tier == JITTier::Optimized && (insn.opcode == 0xE9 || insn.opcode == 0xEB) && !insn.prefixes) {
+            uint32_t target = current_addr + insn.length + insn.imm;
+            if (target >= current_addr + insn.length && target - start_addr < MAX_BLOCK_SIZE) {
+                current_addr = target;
+                ir.instructionCount++;
+                continue;
+            }
+        }
+
+        size_t rollback = ir.ops.size();
+        if (!translateInstruction(insn, ir, endBlock, precise)) {
+            ir.ops.resize(rollback);
             break;
         }
+
+        if (!endBlock) {
+            bool stores = std::any_of(ir.ops.begin() + rollback, ir.ops.end(),
+                                      [](const JITOp& op) { return op.opcode == JITOpcode::Store; });
+            if (stores) {
+                JITOp check = makeJITOp(JITOpcode::CodeCheck, current_addr);
+                check.imm = current_addr + insn.length;
+                ir.ops.push_back(check);
+            }
+        }
+
+        current_addr += insn.length;
+        ir.instructionCount++;
+    }
+    // The block stops short of an instruction that could not be fetched,
+    // and the interpreter raises that fault when it gets there.
+    XboxMemory::clearFault();
+
+    if (ir.instructionCount == 0) {
+        return false;
     }
-    
-    eflags = (eflags & ~0x8D5) | flags;
-}
 
-void X86Core::mov_r32_rm32() {
-    uint8_t modrm = memory->read8(eip++);
-    uint8_t reg = (modrm >> 3) & 7;
-    uint32_t value = readOperand(modrm);
-    setRegister(reg, value);
+    ir.endAddr = current_addr;
+    if (!endBlock) {
+        JITOp exit = makeJITOp(JITOpcode::Exit, current_addr);
+        exit.imm = current_addr;
+        ir.ops.push_back(exit);
+    }
+    if (tier == JITTier::Optimized) {
+        eliminateDeadFlags(ir);
+        propagateConstants(ir);
+        eliminateDeadTemps(ir);
+    }
+    return true;
 }
 
-void X86Core::mov_rm32_r32() {
-    uint8_t modrm = memory->read8(eip++);
-    uint8_t reg = (modrm >> 3) & 7;
-    uint32_t value = getRegister(reg);
-    writeOperand(modrm, value);
+bool X86Core::translateInstruction(const X86Instruction& insn, JITBlockIR& ir, bool& endBlock, bool precise) {
+    static const JITAluOp group1[8] = {
+        JITAluOp::Add, JITAluOp::Or, JITAluOp::Add, JITAluOp::Sub,
+        JITAluOp::And, JITAluOp::Sub, JITAluOp::Xor, JITAluOp::Cmp
+    };
+
+    // Operand-size, rep and fs/gs-relative forms stay in the interpreter,
+    // except where the prefix selects an SSE instruction.
+    const bool vector = (insn.opcode >> 8) == 0x0F && sseForm(sseKernelId(insn)).shape != SSE_INVALID;
+    const uint8_t allowedPrefixes = vector ? X86Instruction::PREFIX_OPSIZE | X86Instruction::PREFIX_REP |
+                                             X86Instruction::PREFIX_REPNE
+                                           : X86Instruction::PREFIX_LOCK;
+    if ((insn.prefixes & ~allowedPrefixes) ||
+        insn.segment == X86Instruction::SEG_FS || insn.segment == X86Instruction::SEG_GS) {
+        return false;
+    }
+
+    const uint32_t addr = insn.address;
+    const uint32_t next = insn.address + insn.length;
+    std::vector<JITOp>& ops = ir.ops;
+
+    auto flagsFor = [](JITAluOp aluOp) -> uint16_t {
+        switch (aluOp) {
+            case JITAluOp::Inc:
+            case JITAluOp::Dec: return JIT_FLAGS_NO_CF;
+            case JITAluOp::Not: return 0;
+            case JITAluOp::Imul: return JIT_FLAG_CF | JIT_FLAG_OF;
+            default: return JIT_FLAGS_ARITH;
+        }
+    };
+    auto writesDest = [](JITAluOp aluOp) {
+        return aluOp != JITAluOp::Cmp && aluOp != JITAluOp::Test;
+    };
+    auto loadImm = [&](uint8_t dst, uint32_t imm) {
+        JITOp op = makeJITOp(JITOpcode::LoadImm, addr);
+        op.dst = dst;
+        op.imm = imm;
+        ops.push_back(op);
+    };
+    auto move = [&](uint8_t dst, uint8_t src) {
+        if (dst == src) return;
+        JITOp op = makeJITOp(JITOpcode::Move, addr);
+        op.dst = dst;
+        op.src1 = src;
+        ops.push_back(op);
+    };
+    auto lea = [&](uint8_t dst, uint8_t base, uint8_t index, uint8_t scale, uint32_t disp) {
+        JITOp op = makeJITOp(JITOpcode::Lea, addr);
+        op.dst = dst;
+        op.src1 = base == X86Instruction::NO_REG ? static_cast<uint8_t>(JIT_NONE) : base;
+        op.src2 = index == X86Instruction::NO_REG ? static_cast<uint8_t>(JIT_NONE) : index;
+        op.scale = scale;
+        op.imm = disp;
+        ops.push_back(op);
+    };
+    auto effectiveAddress = [&](uint8_t dst) {
+        lea(dst, insn.base, insn.index, insn.scale, static_cast<uint32_t>(insn.disp));
+    };
+    auto load = [&](uint8_t dst, uint8_t address, uint8_t size, bool sign) {
+        JITOp op = makeJITOp(JITOpcode::Load, addr);
+        op.dst = dst;
+        op.src1 = address;
+        op.size = size;
+        op.sign = sign;
+        ops.push_back(op);
+    };
+    auto store = [&](uint8_t address, uint8_t src, uint8_t size) {
+        JITOp op = makeJITOp(JITOpcode::Store, addr);
+        op.src1 = address;
+        op.src2 = src;
+        op.size = size;
+        ops.push_back(op);
+    };
+    auto alu = [&](JITAluOp aluOp, uint8_t dst, uint8_t src, uint16_t flagMask) {
+        JITOp op = makeJITOp(JITOpcode::Alu, addr);
+        op.aluOp = aluOp;
+        op.dst = dst;
+        op.src2 = src;
+        op.flagMask = flagMask;
+        ops.push_back(op);
+    };
+    auto aluImm = [&](JITAluOp aluOp, uint8_t dst, uint32_t imm, uint16_t flagMask) {
+        JITOp op = makeJITOp(JITOpcode::AluImm, addr);
+        op.aluOp = aluOp;
+        op.dst = dst;
+        op.imm = imm;
+        op.flagMask = flagMask;
+        ops.push_back(op);
+    };
+    auto push = [&](uint8_t src) {
+        lea(JIT_T0, JIT_ESP, X86Instruction::NO_REG, 0, static_cast<uint32_t>(-4));
+        store(JIT_T0, src, 4);
+        move(JIT_ESP, JIT_T0);
+    };
+    auto readRm = [&]() -> uint8_t {
+        if (insn.isRegisterOperand()) return insn.rm;
+        effectiveAddress(JIT_T0);
+        load(JIT_T1, JIT_T0, 4, false);
+        return JIT_T1;
+    };
+    auto modifyRm = [&](bool writeBack, const std::function<void(uint8_t)>& body) {
+        if (insn.isRegisterOperand()) {
+            body(insn.rm);
+            return;
+        }
+        effectiveAddress(JIT_T0);
+        load(JIT_T1, JIT_T0, 4, false);
+        body(JIT_T1);
+        if (writeBack) store(JIT_T0, JIT_T1, 4);
+    };
+    auto exitTo = [&](uint32_t target) {
+        JITOp op = makeJITOp(JITOpcode::Exit, addr);
+        op.imm = target;
+        ops.push_back(op);
+        endBlock = true;
+    };
+    auto exitToReg = [&](uint8_t src) {
+        JITOp op = makeJITOp(JITOpcode::ExitReg, addr);
+        op.src1 = src;
+        ops.push_back(op);
+        endBlock = true;
+    };
+    auto exitCond = [&](uint8_t cond, uint32_t taken) {
+        JITOp op = makeJITOp(JITOpcode::ExitCond, addr);
+        op.cond = cond;
+        op.imm = taken;
+        op.imm2 = next;
+        ops.push_back(op);
+        endBlock = true;
+    };
+    auto shift = [&](uint8_t group, uint32_t count) -> bool {
+        JITAluOp aluOp;
+        switch (group) {
+            case 4: case 6: aluOp = JITAluOp::Shl; break;
+            case 5: aluOp = JITAluOp::Shr; break;
+            case 7: aluOp = JITAluOp::Sar; break;
+            default: return false;
+        }
+        count &= 31;
+        if (count == 0) return true;
+        uint16_t flagMask = JIT_FLAG_CF | JIT_FLAG_ZF | JIT_FLAG_SF | JIT_FLAG_PF;
+        if (count == 1) flagMask |= JIT_FLAG_OF;
+        modifyRm(true, [&](uint8_t target) { aluImm(aluOp, target, count, flagMask); });
+        return true;
+    };
+
+    const uint16_t opcode = insn.opcode;
+
+    if (opcode < 0x40) {
+        uint8_t group = opcode >> 3;
+        if (group == 2 || group == 3) return false;
+        JITAluOp aluOp = group1[group];
+        switch (opcode & 7) {
+            case 1:
+                modifyRm(writesDest(aluOp), [&](uint8_t target) {
+                    alu(aluOp, target, insn.reg, flagsFor(aluOp));
+                });
+                return true;
+            case 3:
+                alu(aluOp, insn.reg, readRm(), flagsFor(aluOp));
+                return true;
+            case 5:
+                aluImm(aluOp, JIT_EAX, insn.imm, flagsFor(aluOp));
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    if (opcode >= 0x40 && opcode <= 0x4F) {
+        JITAluOp aluOp = opcode < 0x48 ? JITAluOp::Inc : JITAluOp::Dec;
+        aluImm(aluOp, opcode & 7, 1, flagsFor(aluOp));
+        return true;
+    }
+
+    if (opcode >= 0x50 && opcode <= 0x57) {
+        push(opcode & 7);
+        return true;
+    }
+
+    if (opcode >= 0x58 && opcode <= 0x5F) {
+        load(JIT_T1, JIT_ESP, 4, false);
+        aluImm(JITAluOp::Add, JIT_ESP, 4, 0);
+        move(opcode & 7, JIT_T1);
+        return true;
+    }
+
+    if ((opcode >= 0x70 && opcode <= 0x7F) || (opcode >= 0x0F80 && opcode <= 0x0F8F)) {
+        exitCond(opcode & 0xF, next + insn.imm);
+        return true;
+    }
+
+    if (opcode >= 0xB8 && opcode <= 0xBF) {
+        loadImm(opcode & 7, insn.imm);
+        return true;
+    }
+
+    // x87 is only translated in the double format; fpuSetControlWord drops
+    // every translation when the guest switches precision. Translated code
+    // does not maintain the last-instruction pointers.
+    if (opcode >= 0xD8 && opcode <= 0xDF) {
+        if (precise) return false;
+
+        // Checks the stack before the instruction has any effect, so that
+        // over- and underflow are left to the interpreter.
+        auto fpuCheck = [&](uint8_t valid, bool push) {
+            JITOp op = makeJITOp(JITOpcode::FpuCheck, addr);
+            op.imm = ((1u << (valid * 2)) - 1) | (push ? 0xC000 : 0);
+            op.imm2 = push ? 0xC000 : 0;
+            ops.push_back(op);
+        };
+        auto fpuStack = [&](JITOpcode opcode) { ops.push_back(makeJITOp(opcode, addr)); };
+        auto fpuRead = [&](uint8_t f, uint8_t index) {
+            JITOp op = makeJITOp(JITOpcode::FpuRead, addr);
+            op.dst = f;
+            op.imm = index;
+            ops.push_back(op);
+        };
+        auto fpuWrite = [&](uint8_t index, uint8_t f) {
+            JITOp op = makeJITOp(JITOpcode::FpuWrite, addr);
+            op.src1 = f;
+            op.imm = index;
+            ops.push_back(op);
+        };
+        auto fpuArith = [&](JITFpuOp fpuOp, uint8_t dst, uint8_t src) {
+            JITOp op = makeJITOp(JITOpcode::FpuArith, addr);
+            op.fpuOp = fpuOp;
+            op.dst = dst;
+            op.src2 = src;
+            ops.push_back(op);
+        };
+        auto fpuCompare = [&](JITOpcode opcode, uint8_t index) {
+            fpuRead(JIT_F0, 0);
+            fpuRead(JIT_F1, index);
+            JITOp op = makeJITOp(opcode, addr);
+            op.src1 = JIT_F0;
+            op.src2 = JIT_F1;
+            op.flagMask = opcode == JITOpcode::FpuCompareFlags ? JIT_FLAGS_ARITH : 0;
+            ops.push_back(op);
+        };
+        auto fpuLoadMemory = [&](uint8_t f, uint8_t size, bool integer) {
+            effectiveAddress(JIT_T0);
+            load(JIT_T1, JIT_T0, 4, false);
+            if (size == 8) {
+                lea(JIT_T0, JIT_T0, X86Instruction::NO_REG, 0, 4);
+                load(JIT_T2, JIT_T0, 4, false);
+            }
+            JITOp op = makeJITOp(JITOpcode::FpuFromBits, addr);
+            op.dst = f;
+            op.src1 = JIT_T1;
+            op.src2 = size == 8 ? static_cast<uint8_t>(JIT_T2) : static_cast<uint8_t>(JIT_NONE);
+            op.size = size;
+            op.sign = integer;
+            ops.push_back(op);
+        };
+        auto fpuStoreMemory = [&](uint8_t f, uint8_t size) {
+            for (uint8_t word = 0; word < size / 4; word++) {
+                JITOp op = makeJITOp(JITOpcode::FpuToBits, addr);
+                op.dst = word ? JIT_T2 : JIT_T1;
+                op.src1 = f;
+                op.size = size;
+                op.scale = word;
+                ops.push_back(op);
+            }
+            effectiveAddress(JIT_T0);
+            store(JIT_T0, JIT_T1, 4);
+            if (size == 8) {
+                lea(JIT_T0, JIT_T0, X86Instruction::NO_REG, 0, 4);
+                store(JIT_T0, JIT_T2, 4);
+            }
+        };
+        // dst = dst op src for the D8 arithmetic group; the reversed forms
+        // compute into src instead. The result is written to ST(target).
+        auto fpuBinary = [&](uint8_t group, uint8_t target, uint8_t dst, uint8_t src) {
+            static const JITFpuOp groupOps[8] = {
+                JITFpuOp::Add, JITFpuOp::Mul, JITFpuOp::Add, JITFpuOp::Add,
+                JITFpuOp::Sub, JITFpuOp::Sub, JITFpuOp::Div, JITFpuOp::Div
+            };
+            if (group == 5 || group == 7) std::swap(dst, src);
+            fpuArith(groupOps[group], dst, src);
+            fpuWrite(target, dst);
+        };
+        auto fpuLoadConstant = [&](uint64_t bits) {
+            fpuCheck(0, true);
+            JITOp op = makeJITOp(JITOpcode::FpuConst, addr);
+            op.dst = JIT_F0;
+            op.imm = static_cast<uint32_t>(bits);
+            op.imm2 = static_cast<uint32_t>(bits >> 32);
+            ops.push_back(op);
+            fpuStack(JITOpcode::FpuPush);
+            fpuWrite(0, JIT_F0);
+        };
+
+        const uint8_t escape = opcode & 7;
+        const uint8_t i = insn.rm;
+        const bool compareGroup = insn.reg == 2 || insn.reg == 3;
+
+        if (!insn.isRegisterOperand()) {
+            switch ((escape << 3) | insn.reg) {
+                case 0x00: case 0x01: case 0x04: case 0x05: case 0x06: case 0x07:
+                case 0x10: case 0x11: case 0x14: case 0x15: case 0x16: case 0x17:
+                case 0x20: case 0x21: case 0x24: case 0x25: case 0x26: case 0x27:
+                    fpuCheck(1, false);
+                    fpuLoadMemory(JIT_F1, escape == 4 ? 8 : 4, escape == 2);
+                    fpuRead(JIT_F0, 0);
+                    fpuBinary(insn.reg, 0, JIT_F0, JIT_F1);
+                    return true;
+                case 0x02: case 0x03: case 0x22: case 0x23: {
+                    fpuCheck(1, false);
+                    fpuLoadMemory(JIT_F1, escape == 4 ? 8 : 4, false);
+                    fpuRead(JIT_F0, 0);
+                    JITOp op = makeJITOp(JITOpcode::FpuCompare, addr);
+                    op.src1 = JIT_F0;
+                    op.src2 = JIT_F1;
+                    ops.push_back(op);
+                    if (insn.reg == 3) fpuStack(JITOpcode::FpuPop);
+                    return true;
+                }
+                case 0x08: case 0x18: case 0x28:
+                    fpuCheck(0, true);
+                    fpuLoadMemory(JIT_F0, escape == 5 ? 8 : 4, escape == 3);
+                    fpuStack(JITOpcode::FpuPush);
+                    fpuWrite(0, JIT_F0);
+                    return true;
+                case 0x0A: case 0x0B: case 0x2A: case 0x2B:
+                    fpuCheck(1, false);
+                    fpuRead(JIT_F0, 0);
+                    fpuStoreMemory(JIT_F0, escape == 5 ? 8 : 4);
+                    if (insn.reg == 3) fpuStack(JITOpcode::FpuPop);
+                    return true;
+                default:
+                    return false;
+            }
+        }
+
+        switch (escape) {
+            case 0:
+                fpuCheck(i + 1, false);
+                if (compareGroup) {
+                    fpuCompare(JITOpcode::FpuCompare, i);
+                    if (insn.reg == 3) fpuStack(JITOpcode::FpuPop);
+                } else {
+                    fpuRead(JIT_F0, 0);
+                    fpuRead(JIT_F1, i);
+                    fpuBinary(insn.reg, 0, JIT_F0, JIT_F1);
+                }
+                return true;
+            case 1:
+                if (insn.reg == 0) {
+                    fpuCheck(i + 1, true);
+                    fpuRead(JIT_F0, i);
+                    fpuStack(JITOpcode::FpuPush);
+                    fpuWrite(0, JIT_F0);
+                    return true;
+                }
+                if (insn.reg == 1) {
+                    fpuCheck(i + 1, false);
+                    fpuRead(JIT_F0, 0);
+                    fpuRead(JIT_F1, i);
+                    fpuWrite(0, JIT_F1);
+                    fpuWrite(i, JIT_F0);
+                    return true;
+                }
+                switch (insn.modrm) {
+                    case 0xE0:
+                    case 0xE1:
+                    case 0xFA:
+                        fpuCheck(1, false);
+                        fpuRead(JIT_F0, 0);
+                        fpuArith(insn.modrm == 0xE0 ? JITFpuOp::Neg : insn.modrm == 0xE1 ? JITFpuOp::Abs : JITFpuOp::Sqrt,
+                                 JIT_F0, JIT_F0);
+                        fpuWrite(0, JIT_F0);
+                        return true;
+                    case 0xE8:
+                        fpuLoadConstant(0x3FF0000000000000ull);
+                        return true;
+                    case 0xEE:
+                        fpuLoadConstant(0);
+                        return true;
+                    default:
+                        return false;
+                }
+            case 2:
+                if (insn.modrm != 0xE9) return false;
+                fpuCheck(2, false);
+                fpuCompare(JITOpcode::FpuCompare, 1);
+                fpuStack(JITOpcode::FpuPop);
+                fpuStack(JITOpcode::FpuPop);
+                return true;
+            case 3:
+            case 7:
+                if (insn.reg == 5 || insn.reg == 6) {
+                    fpuCheck(i + 1, false);
+                    fpuCompare(JITOpcode::FpuCompareFlags, i);
+                    if (escape == 7) fpuStack(JITOpcode::FpuPop);
+                    return true;
+                }
+                if (insn.modrm == 0xE0 && escape == 7) {
+                    JITOp op = makeJITOp(JITOpcode::FpuStatus, addr);
+                    op.dst = JIT_T1;
+                    ops.push_back(op);
+                    aluImm(JITAluOp::And, JIT_EAX, 0xFFFF0000, 0);
+                    alu(JITAluOp::Or, JIT_EAX, JIT_T1, 0);
+                    return true;
+                }
+                return false;
+            case 4:
+            case 6:
+                if (escape == 6 && insn.modrm == 0xD9) {
+                    fpuCheck(2, false);
+                    fpuCompare(JITOpcode::FpuCompare, 1);
+                    fpuStack(JITOpcode::FpuPop);
+                    fpuStack(JITOpcode::FpuPop);
+                    return true;
+                }
+                if (compareGroup) return false;
+                fpuCheck(i + 1, false);
+                fpuRead(JIT_F0, i);
+                fpuRead(JIT_F1, 0);
+                fpuBinary(insn.reg >= 4 ? insn.reg ^ 1 : insn.reg, i, JIT_F0, JIT_F1);
+                if (escape == 6) fpuStack(JITOpcode::FpuPop);
+                return true;
+            default:
+                if (insn.reg < 2 || insn.reg > 5) return false;
+                fpuCheck(i + 1, false);
+                if (compareGroup) {
+                    fpuRead(JIT_F0, 0);
+                    fpuWrite(i, JIT_F0);
+                } else {
+                    fpuCompare(JITOpcode::FpuCompare, i);
+                }
+                if (insn.reg & 1) fpuStack(JITOpcode::FpuPop);
+                return true;
+        }
+    }
+
+    // SSE instructions move data between guest registers, memory and the
+    // xmm file with lane ops and leave the arithmetic to the shared kernels.
+    // Memory operands are gathered into the scratch register first.
+    if (vector) {
+        const uint32_t kernel = sseKernelId(insn);
+        const SSEForm form = sseForm(kernel);
+        const bool memoryForm = kernel & SSE_MEMORY;
+        if (memoryForm ? form.bytes == 0 : !form.registerForm) return false;
+
+        auto laneLoad = [&](uint8_t dst, uint8_t xmm, uint8_t lane) {
+            JITOp op = makeJITOp(JITOpcode::VecLaneLoad, addr);
+            op.dst = dst;
+            op.imm = xmm;
+            op.imm2 = lane;
+            ops.push_back(op);
+        };
+        auto laneStore = [&](uint8_t xmm, uint8_t lane, uint8_t src) {
+            JITOp op = makeJITOp(JITOpcode::VecLaneStore, addr);
+            op.src1 = src;
+            op.imm = xmm;
+            op.imm2 = lane;
+            ops.push_back(op);
+        };
+        auto runKernel = [&](uint8_t dst, uint8_t src) {
+            JITOp op = makeJITOp(JITOpcode::VectorKernel, addr);
+            op.imm = kernel;
+            op.imm2 = dst | (src << 8) | ((insn.imm & 0xFF) << 16);
+            ops.push_back(op);
+        };
+        // Lanes past the operand read as zero, as they do in sseRead.
+        auto gather = [&]() -> uint8_t {
+            effectiveAddress(JIT_T0);
+            bool zeroed = false;
+            for (uint8_t lane = 0; lane < 4; lane++) {
+                if (lane * 4 < form.bytes) {
+                    if (lane) lea(JIT_T0, JIT_T0, X86Instruction::NO_REG, 0, 4);
+                    load(JIT_T1, JIT_T0, form.bytes < 4 ? form.bytes : 4, false);
+                } else if (!zeroed) {
+                    loadImm(JIT_T1, 0);
+                    zeroed = true;
+                }
+                laneStore(JIT_XMM_SCRATCH, lane, JIT_T1);
+            }
+            return JIT_XMM_SCRATCH;
+        };
+        auto source = [&]() -> uint8_t { return memoryForm ? gather() : insn.rm; };
+
+        switch (form.shape) {
+            case SSE_COMPUTE:
+                runKernel(insn.reg, source());
+                return true;
+            case SSE_COMPUTE_GPR:
+                if (memoryForm) {
+                    effectiveAddress(JIT_T0);
+                    load(JIT_T1, JIT_T0, form.bytes, false);
+                } else {
+                    move(JIT_T1, insn.rm);
+                }
+                laneStore(JIT_XMM_SCRATCH, 0, JIT_T1);
+                runKernel(insn.reg, JIT_XMM_SCRATCH);
+                return true;
+            case SSE_TO_GPR:
+                runKernel(JIT_XMM_SCRATCH, source());
+                laneLoad(JIT_T1, JIT_XMM_SCRATCH, 0);
+                move(insn.reg, JIT_T1);
+                return true;
+            case SSE_STORE:
+                if (!memoryForm) {
+                    runKernel(insn.rm, insn.reg);
+                    return true;
+                }
+                effectiveAddress(JIT_T0);
+                for (uint8_t i = 0; i < form.bytes / 4; i++) {
+                    laneLoad(JIT_T1, insn.reg, form.offset / 4 + i);
+                    if (i) lea(JIT_T0, JIT_T0, X86Instruction::NO_REG, 0, 4);
+                    store(JIT_T0, JIT_T1, 4);
+                }
+                return true;
+            case SSE_STORE_GPR:
+                laneLoad(JIT_T1, insn.reg, 0);
+                if (memoryForm) {
+                    effectiveAddress(JIT_T0);
+                    store(JIT_T0, JIT_T1, 4);
+                } else {
+                    move(insn.rm, JIT_T1);
+                }
+                return true;
+            case SSE_SHIFT:
+                runKernel(insn.rm, insn.rm);
+                return true;
+            case SSE_COMPARE_FLAGS: {
+                auto fromBits = [&](uint8_t f) {
+                    JITOp op = makeJITOp(JITOpcode::FpuFromBits, addr);
+                    op.dst = f;
+                    op.src1 = JIT_T1;
+                    op.src2 = form.bytes == 8 ? static_cast<uint8_t>(JIT_T2) : static_cast<uint8_t>(JIT_NONE);
+                    op.size = form.bytes;
+                    ops.push_back(op);
+                };
+                if (memoryForm) {
+                    effectiveAddress(JIT_T0);
+                    load(JIT_T1, JIT_T0, 4, false);
+                    if (form.bytes == 8) {
+                        lea(JIT_T0, JIT_T0, X86Instruction::NO_REG, 0, 4);
+                        load(JIT_T2, JIT_T0, 4, false);
+                    }
+                } else {
+                    laneLoad(JIT_T1, insn.rm, 0);
+                    if (form.bytes == 8) laneLoad(JIT_T2, insn.rm, 1);
+                }
+                fromBits(JIT_F1);
+                laneLoad(JIT_T1, insn.reg, 0);
+                if (form.bytes == 8) laneLoad(JIT_T2, insn.reg, 1);
+                fromBits(JIT_F0);
+                JITOp op = makeJITOp(JITOpcode::FpuCompareFlags, addr);
+                op.src1 = JIT_F0;
+                op.src2 = JIT_F1;
+                op.flagMask = JIT_FLAGS_ARITH;
+                ops.push_back(op);
+                return true;
+            }
+            default:
+                // Hints, fences and MOVNTI; the rest touches x87 or MXCSR state.
+                switch (opcode) {
+                    case 0x0F18:
+                        return true;
+                    case 0x0FAE:
+                        return insn.reg == 7 || (insn.isRegisterOperand() && insn.reg >= 5);
+                    case 0x0FC3:
+                        effectiveAddress(JIT_T0);
+                        store(JIT_T0, insn.reg, 4);
+                        return true;
+                    default:
+                        return false;
+                }
+        }
+    }
+
+    switch (opcode) {
+        case 0x68:
+        case 0x6A:
+            loadImm(JIT_T1, insn.imm);
+            push(JIT_T1);
+            return true;
+        case 0x69:
+        case 0x6B:
+            move(insn.reg, readRm());
+            aluImm(JITAluOp::Imul, insn.reg, insn.imm, flagsFor(JITAluOp::Imul));
+            return true;
+        case 0x81:
+        case 0x83: {
+            if (insn.reg == 2 || insn.reg == 3) return false;
+            JITAluOp aluOp = group1[insn.reg];
+            modifyRm(writesDest(aluOp), [&](uint8_t target) {
+                aluImm(aluOp, target, insn.imm, flagsFor(aluOp));
+            });
+            return true;
+        }
+        case 0x85:
+            alu(JITAluOp::Test, readRm(), insn.reg, flagsFor(JITAluOp::Test));
+            return true;
+        case 0x89:
+            if (insn.isRegisterOperand()) {
+                move(insn.rm, insn.reg);
+            } else {
+                effectiveAddress(JIT_T0);
+                store(JIT_T0, insn.reg, 4);
+            }
+            return true;
+        case 0x8B:
+            if (insn.isRegisterOperand()) {
+                move(insn.reg, insn.rm);
+            } else {
+                effectiveAddress(JIT_T0);
+                load(insn.reg, JIT_T0, 4, false);
+            }
+            return true;
+        case 0x8D:
+            if (insn.isRegisterOperand()) return false;
+            effectiveAddress(insn.reg);
+            return true;
+        case 0x90:
+        case 0x9B:
+            return true;
+        case 0xA9:
+            aluImm(JITAluOp::Test, JIT_EAX, insn.imm, flagsFor(JITAluOp::Test));
+            return true;
+        case 0xC1:
+            return shift(insn.reg, insn.imm);
+        case 0xD1:
+            return shift(insn.reg, 1);
+        case 0xC2:
+        case 0xC3:
+            load(JIT_T1, JIT_ESP, 4, false);
+            aluImm(JITAluOp::Add, JIT_ESP, 4 + (opcode == 0xC2 ? insn.imm : 0), 0);
+            exitToReg(JIT_T1);
+            return true;
+        case 0xC7:
+            if (insn.reg != 0) return false;
+            if (insn.isRegisterOperand()) {
+                loadImm(insn.rm, insn.imm);
+            } else {
+                effectiveAddress(JIT_T0);
+                loadImm(JIT_T1, insn.imm);
+                store(JIT_T0, JIT_T1, 4);
+            }
+            return true;
+        case 0xE8:
+            loadImm(JIT_T1, next);
+            push(JIT_T1);
+            exitTo(next + insn.imm);
+            return true;
+        case 0xE9:
+        case 0xEB:
+            exitTo(next + insn.imm);
+            return true;
+        case 0xF7:
+            switch (insn.reg) {
+                case 0:
+                case 1:
+                    aluImm(JITAluOp::Test, readRm(), insn.imm, flagsFor(JITAluOp::Test));
+                    return true;
+                case 2:
+                case 3: {
+                    JITAluOp aluOp = insn.reg == 2 ? JITAluOp::Not : JITAluOp::Neg;
+                    modifyRm(true, [&](uint8_t target) { aluImm(aluOp, target, 0, flagsFor(aluOp)); });
+                    return true;
+                }
+                default:
+                    return false;
+            }
+        case 0xFF:
+            switch (insn.reg) {
+                case 0:
+                case 1: {
+                    JITAluOp aluOp = insn.reg == 0 ? JITAluOp::Inc : JITAluOp::Dec;
+                    modifyRm(true, [&](uint8_t target) { aluImm(aluOp, target, 1, flagsFor(aluOp)); });
+                    return true;
+                }
+                case 2:
+                    if (insn.isRegisterOperand()) {
+                        move(JIT_T2, insn.rm);
+                    } else {
+                        effectiveAddress(JIT_T0);
+                        load(JIT_T2, JIT_T0, 4, false);
+                    }
+                    loadImm(JIT_T1, next);
+                    push(JIT_T1);
+                    exitToReg(JIT_T2);
+                    return true;
+                case 4:
+                    exitToReg(readRm());
+                    return true;
+                case 6:
+                    push(readRm());
+                    return true;
+                default:
+                    return false;
+            }
+        case 0x0FAF:
+            alu(JITAluOp::Imul, insn.reg, readRm(), flagsFor(JITAluOp::Imul));
+            return true;
+        case 0x0FB6:
+        case 0x0FB7:
+        case 0x0FBE:
+        case 0x0FBF: {
+            uint8_t size = (opcode & 1) ? 2 : 1;
+            bool sign = opcode >= 0x0FBE;
+            if (insn.isRegisterOperand()) {
+                JITOp op = makeJITOp(JITOpcode::Extend, addr);
+                op.dst = insn.reg;
+                op.src1 = size == 1 ? (insn.rm & 3) : insn.rm;
+                op.scale = (size == 1 && insn.rm >= 4) ? 8 : 0;
+                op.size = size;
+                op.sign = sign;
+                ops.push_back(op);
+            } else {
+                effectiveAddress(JIT_T0);
+                load(insn.reg, JIT_T0, size, sign);
+            }
+            return true;
+        }
+        default:
+            return false;
+    }
 }
 
-void X86Core::add_rm32_r32() {
-    uint8_t modrm = memory->read8(eip++);
-    uint32_t src = getRegister((modrm >> 3) & 7);
-    uint32_t dest = readOperand(modrm);
-    aluAdd(dest, src);
-    writeOperand(modrm, dest);
+JITContextLayout X86Core::buildContextLayout() {
+    auto offsetOf = [this](const void* field) {
+        return static_cast<uint32_t>(reinterpret_cast<const uint8_t*>(field) -
+                                     reinterpret_cast<const uint8_t*>(this));
+    };
+
+    JITContextLayout layout;
+    const uint32_t* slots[JIT_GUEST_REGS] = {&eax, &ecx, &edx, &ebx, &esp, &ebp, &esi, &edi};
+    for (uint8_t i = 0; i < JIT_GUEST_REGS; i++) {
+        layout.regOffset[i] = offsetOf(slots[i]);
+    }
+    layout.eipOffset = offsetOf(&eip);
+    layout.eflagsOffset = offsetOf(&eflags);
+    layout.faultOffset = offsetOf(&jitFault);
+    layout.chainBudgetOffset = offsetOf(&jitChainBudget);
+    layout.codeDirtyOffset = offsetOf(&jitCodeDirty);
+    layout.blockHeadOffset = offsetOf(&atBlockHead);
+    layout.fpuStatusOffset = offsetOf(&fpu.statusWord);
+    layout.fpuTagOffset = offsetOf(&fpu.tagWord);
+    layout.fpuStackOffset = offsetOf(fpu.fast);
+    layout.xmmOffset = offsetOf(&xmmRegisters[0]);
+    layout.xmmScratchOffset = offsetOf(&sseScratch);
+    layout.fastmemOffset = offsetOf(&fastmemBase);
+    layout.fastmem = fastmemBase != nullptr;
+    layout.readMemory = &X86Core::jitReadMemory;
+    layout.writeMemory = &X86Core::jitWriteMemory;
+    layout.vectorKernel = &X86Core::jitVectorKernel;
+    return layout;
 }
 
-void X86Core::add_r32_rm32() {
-    uint8_t modrm = memory->read8(eip++);
-    uint8_t reg = (modrm >> 3) & 7;
-    uint32_t src = readOperand(modrm);
-    uint32_t dest = getRegister(reg);
-    aluAdd(dest, src);
-    setRegister(reg, dest);
+// A fault leaves jitFault set; the block exits at the faulting
+// instruction and executeStep delivers the exception.
+uint32_t X86Core::jitReadMemory(void* context, uint32_t address, uint32_t size) {
+    X86Core* cpu = static_cast<X86Core*>(context);
+    uint32_t value;
+    switch (size) {
+        case 1: value = cpu->memory->read8(address); break;
+        case 2: value = cpu->memory->read16(address); break;
+        default: value = cpu->memory->read32(address); break;
+    }
+    cpu->jitFault = XboxMemory::faultPending();
+    return value;
 }
 
-void X86Core::jmp_rel8() {
-    int8_t offset = memory->read8(eip++);
-    eip += offset;
+void X86Core::jitWriteMemory(void* context, uint32_t address, uint32_t value, uint32_t size) {
+    X86Core* cpu = static_cast<X86Core*>(context);
+    switch (size) {
+        case 1: cpu->memory->write8(address, static_cast<uint8_t>(value)); break;
+        case 2: cpu->memory->write16(address, static_cast<uint16_t>(value)); break;
+        default: cpu->memory->write32(address, value); break;
+    }
+    cpu->jitFault = XboxMemory::faultPending();
 }
 
-void X86Core::jmp_rel32() {
-    int32_t offset = memory->read32(eip);
-    eip += 4 + offset;
+void X86Core::decodeAndExecute(uint8_t opcode) {
+    LOGE("Unknown opcode: 0x%02X at 0x%08X", opcode, eip-1);
+    raiseException(EXCEPTION_INVALID_OPCODE);
 }
 
-void X86Core::ret() {
-    eip = memory->read32(esp);
-    esp += 4;
+void X86Core::aluAdd(uint32_t& dest, uint32_t src) {
+    uint32_t result = dest + src;
+    updateFlags(result, dest, src, ALU_ADD);
+    dest = result;
 }
 
-void X86Core::handleFPUOpcode(uint8_t opcode) {
-    uint8_t modrm = memory->read8(eip++);
-    switch (opcode) {
-        case 0xD8: fpuGroup1(modrm); break;
-        case 0xD9: fpuGroup2(modrm); break;
-        case 0xDA: fpuGroup3(modrm); break;
-        case 0xDB: fpuGroup4(modrm); break;
-        case 0xDC: fpuGroup5(modrm); break;
-        case 0xDD: fpuGroup6(modrm); break;
-        case 0xDE: fpuGroup7(modrm); break;
-        case 0xDF: fpuGroup8(modrm); break;
-    }
+void X86Core::aluSub(uint32_t& dest, uint32_t src) {
+    uint32_t result = dest - src;
+    updateFlags(result, dest, src, ALU_SUB);
+    dest = result;
 }
 
-void X86Core::fpuGroup1(uint8_t modrm) {
-    uint8_t op = (modrm >> 3) & 7;
-    switch (op) {
-        case 0: fpuFadd(modrm); break;
-        case 1: fpuFmul(modrm); break;
-        case 2: fpuFcom(modrm); break;
-        case 3: fpuFcomp(modrm); break;
-        case 4: fpuFsub(modrm); break;
-        case 5: fpuFsubr(modrm); break;
-        case 6: fpuFdiv(modrm); break;
-        case 7: fpuFdivr(modrm); break;
-    }
-}
-
-void X86Core::fpuGroup2(uint8_t) { LOGW("FPU Group2 instruction not implemented"); }
-void X86Core::fpuGroup3(uint8_t) { LOGW("FPU Group3 instruction not implemented"); }
-void X86Core::fpuGroup4(uint8_t) { LOGW("FPU Group4 instruction not implemented"); }
-void X86Core::fpuGroup5(uint8_t) { LOGW("FPU Group5 instruction not implemented"); }
-void X86Core::fpuGroup6(uint8_t) { LOGW("FPU Group6 instruction not implemented"); }
-void X86Core::fpuGroup7(uint8_t) { LOGW("FPU Group7 instruction not implemented"); }
-void X86Core::fpuGroup8(uint8_t) { LOGW("FPU Group8 instruction not implemented"); }
-void X86Core::fpuFadd(uint8_t) { LOGW("FPU FADD instruction not implemented"); }
-void X86Core::fpuFmul(uint8_t) { LOGW("FPU FMUL instruction not implemented"); }
-void X86Core::fpuFcom(uint8_t) { LOGW("FPU FCOM instruction not implemented"); }
-void X86Core::fpuFcomp(uint8_t) { LOGW("FPU FCOMP instruction not implemented"); }
-void X86Core::fpuFsub(uint8_t) { LOGW("FPU FSUB instruction not implemented"); }
-void X86Core::fpuFsubr(uint8_t) { LOGW("FPU FSUBR instruction not implemented"); }
-void X86Core::fpuFdiv(uint8_t) { LOGW("FPU FDIV instruction not implemented"); }
-void X86Core::fpuFdivr(uint8_t) { LOGW("FPU FDIVR instruction not implemented"); }
-
-void X86Core::handleSSEOpcode(uint8_t opcode) {
-    uint8_t modrm = memory->read8(eip++);
-    switch (opcode) {
-        case 0x10: sseMovups(modrm); break;
-        case 0x58: sseAddps(modrm); break;
-        case 0x59: sseMulps(modrm); break;
-        case 0x5C: sseSubps(modrm); break;
-        case 0x5E: sseDivps(modrm); break;
-        default:
-            LOGE("Unknown SSE opcode: 0x0F%02X", opcode);
-            state = CpuState::Error;
-    }
+void X86Core::aluMul(uint32_t& dest, uint32_t src) {
+#ifdef __ARM_NEON
+    uint32x2_t a = vdup_n_u32(dest);
+    uint32x2_t b = vdup_n_u32(src);
+    uint64x2_t result = vmull_u32(a, b);
+    uint64_t low = vgetq_lane_u64(result, 0);
+#else
+    uint64_t low = static_cast<uint64_t>(dest) * src;
+#endif
+    uint32_t high = (low >> 32) & 0xFFFFFFFF;
+    updateFlags(low & 0xFFFFFFFF, dest, high, ALU_MUL);
+    dest = low & 0xFFFFFFFF;
 }
 
-void X86Core::sseMovups(uint8_t modrm) {
-    uint8_t reg = (modrm >> 3) & 7;
-    uint32_t addr = readOperand(modrm);
-    for (int i = 0; i < 4; i++) {
-        uint32_t val = memory->read32(addr + i*4);
-        memcpy(&xmmRegisters[reg].data[i*4], &val, 4);
+void X86Core::updateFlags(uint32_t result, uint32_t a, uint32_t b, uint32_t operation, uint8_t size) {
+    if (operation == ALU_MUL) {
+        materializeFlags();
+    } else if (operation == ALU_INC || operation == ALU_DEC) {
+        eflags = (eflags & ~JIT_FLAG_CF) | (carryFlag() ? JIT_FLAG_CF : 0);
     }
+    flagsOp = operation;
+    flagsA = a;
+    flagsB = b;
+    flagsResult = result;
+    flagsSize = size;
 }
 
-void X86Core::sseAddps(uint8_t modrm) {
-    uint8_t reg1 = (modrm >> 3) & 7;
-    uint8_t reg2 = modrm & 7;
-    float32x4_t a = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data));
-    float32x4_t b = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg2].data));
-    float32x4_t result = vaddq_f32(a, b);
-    vst1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data), result);
+void X86Core::setResultFlags(uint32_t result, uint8_t size, bool carry, bool overflow, bool auxCarry) {
+    uint32_t mask = size == 4 ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+    result &= mask;
+    uint32_t flags = (carry ? JIT_FLAG_CF : 0) | (overflow ? JIT_FLAG_OF : 0) |
+                     (auxCarry ? JIT_FLAG_AF : 0) | (result == 0 ? JIT_FLAG_ZF : 0) |
+                     (((result >> (size * 8 - 1)) & 1) ? JIT_FLAG_SF : 0) |
+                     (__builtin_parity(result & 0xFF) ? 0 : JIT_FLAG_PF);
+    eflags = (eflags & ~JIT_FLAGS_ARITH) | flags;
+    flagsOp = ALU_NONE;
 }
 
-void X86Core::sseMulps(uint8_t modrm) {
-    uint8_t reg1 = (modrm >> 3) & 7;
-    uint8_t reg2 = modrm & 7;
-    float32x4_t a = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data));
-    float32x4_t b = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg2].data));
-    float32x4_t result = vmulq_f32(a, b);
-    vst1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data), result);
+void X86Core::setFlag(uint32_t flag, bool value) {
+    materializeFlags();
+    eflags = value ? (eflags | flag) : (eflags & ~flag);
 }
 
-void X86Core::sseSubps(uint8_t modrm) {
-    uint8_t reg1 = (modrm >> 3) & 7;
-    uint8_t reg2 = modrm & 7;
-    float32x4_t a = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data));
-    float32x4_t b = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg2].data));
-    float32x4_t result = vsubq_f32(a, b);
-    vst1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data), result);
+void X86Core::materializeFlags() {
+    if (flagsOp == ALU_NONE) return;
+    eflags = getEFLAGS();
+    flagsOp = ALU_NONE;
 }
 
-void X86Core::sseDivps(uint8_t modrm) {
-    uint8_t reg1 = (modrm >> 3) & 7;
-    uint8_t reg2 = modrm & 7;
-    float32x4_t a = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data));
-    float32x4_t b = vld1q_f32(reinterpret_cast<float*>(xmmRegisters[reg2].data));
-    float32x4_t result = vdivq_f32(a, b);
-    vst1q_f32(reinterpret_cast<float*>(xmmRegisters[reg1].data), result);
+uint32_t X86Core::lazyFlagMask() const {
+    switch (flagsOp) {
+        case ALU_NONE: return 0;
+        case ALU_MUL: return JIT_FLAG_CF | JIT_FLAG_OF;
+        case ALU_INC:
+        case ALU_DEC: return JIT_FLAGS_NO_CF;
+        default: return JIT_FLAGS_ARITH;
+    }
 }
 
-void X86Core::emitMOV(uint8_t*& code, uint8_t modrm) {
-    *code++ = 0x8B;
-    *code++ = modrm;
+// Lazy operands and results are stored truncated to flagsSize bytes.
+bool X86Core::carryFlag() const {
+    switch (flagsOp) {
+        case ALU_NONE:
+        case ALU_INC:
+        case ALU_DEC: return eflags & JIT_FLAG_CF;
+        case ALU_ADD: return flagsResult < flagsA;
+        case ALU_SUB: return flagsA < flagsB;
+        case ALU_MUL: return flagsB != 0;
+        default: return false;
+    }
 }
 
-void X86Core::emitADD(uint8_t*& code, uint8_t modrm) {
-    *code++ = 0x01;
-    *code++ = modrm;
+bool X86Core::parityFlag() const {
+    if (flagsOp == ALU_NONE || flagsOp == ALU_MUL) return eflags & JIT_FLAG_PF;
+    return !__builtin_parity(flagsResult & 0xFF);
 }
 
-void X86Core::emitRET(uint8_t*& code) {
-    *code++ = 0xC3;
+bool X86Core::auxCarryFlag() const {
+    switch (flagsOp) {
+        case ALU_NONE:
+        case ALU_MUL: return eflags & JIT_FLAG_AF;
+        case ALU_ADD:
+        case ALU_SUB:
+        case ALU_INC:
+        case ALU_DEC: return (flagsA ^ flagsB ^ flagsResult) & 0x10;
+        default: return false;
+    }
 }
 
-void X86Core::emitJMP(uint8_t*& code, int8_t offset) {
-    *code++ = 0xEB;
-    *code++ = offset;
+bool X86Core::zeroFlag() const {
+    if (flagsOp == ALU_NONE || flagsOp == ALU_MUL) return eflags & JIT_FLAG_ZF;
+    return flagsResult == 0;
 }
 
-void X86Core::emitXboxOpcode(uint8_t*& code, uint8_t op) {
-    
-    *code++ = 0x0F;
-    *code++ = 0x3F;
-    *code++ = op;
+bool X86Core::signFlag() const {
+    if (flagsOp == ALU_NONE || flagsOp == ALU_MUL) return eflags & JIT_FLAG_SF;
+    return (flagsResult >> (flagsSize * 8 - 1)) & 1;
 }
 
-uint32_t X86Core::readOperand(uint8_t modrm) {
-    uint8_t mod = (modrm >> 6) & 3;
-    uint8_t rm = modrm & 7;
-    
-    switch (mod) {
-        case 0: return memory->read32(getRegister(rm));
-        case 1: return memory->read32(getRegister(rm) + (int8_t)memory->read8(eip++));
-        case 2: return memory->read32(getRegister(rm) + memory->read32(eip));
-        case 3: return getRegister(rm);
-        default: return 0;
+bool X86Core::overflowFlag() const {
+    uint32_t sign = flagsSize * 8 - 1;
+    switch (flagsOp) {
+        case ALU_NONE: return eflags & JIT_FLAG_OF;
+        case ALU_ADD:
+        case ALU_INC: return (((flagsA ^ flagsResult) & (flagsB ^ flagsResult)) >> sign) & 1;
+        case ALU_SUB:
+        case ALU_DEC: return (((flagsA ^ flagsB) & (flagsA ^ flagsResult)) >> sign) & 1;
+        case ALU_MUL: return flagsB != 0;
+        default: return false;
     }
 }
 
-void X86Core::writeOperand(uint8_t modrm, uint32_t value) {
-    uint8_t mod = (modrm >> 6) & 3;
-    uint8_t rm = modrm & 7;
-    
-    switch (mod) {
-        case 0: memory->write32(getRegister(rm), value); break;
-        case 1: memory->write32(getRegister(rm) + (int8_t)memory->read8(eip++), value); break;
-        case 2: memory->write32(getRegister(rm) + memory->read32(eip), value); break;
-        case 3: setRegister(rm, value); break;
+bool X86Core::testCondition(uint8_t cond) const {
+    bool result;
+    switch (cond >> 1) {
+        case 0: result = overflowFlag(); break;
+        case 1: result = carryFlag(); break;
+        case 2: result = zeroFlag(); break;
+        case 3: result = carryFlag() || zeroFlag(); break;
+        case 4: result = signFlag(); break;
+        case 5: result = parityFlag(); break;
+        case 6: result = signFlag() != overflowFlag(); break;
+        default: result = zeroFlag() || signFlag() != overflowFlag(); break;
     }
+    return (cond & 1) ? !result : result;
+}
+
+uint32_t X86Core::getEFLAGS() const {
+    uint32_t mask = lazyFlagMask();
+    if (!mask) return eflags;
+    uint32_t flags = (carryFlag() ? JIT_FLAG_CF : 0) | (parityFlag() ? JIT_FLAG_PF : 0) |
+                     (auxCarryFlag() ? JIT_FLAG_AF : 0) | (zeroFlag() ? JIT_FLAG_ZF : 0) |
+                     (signFlag() ? JIT_FLAG_SF : 0) | (overflowFlag() ? JIT_FLAG_OF : 0);
+    return (eflags & ~mask) | (flags & mask);
 }
 
 void X86Core::flushJITCache() {
     jit_cache.clear();
+    jitIncoming.clear();
+    jitPageBlocks.clear();
     jitCacheUsed = 0;
+    jitSegment = 0;
+    for (auto& blocks : jitSegmentBlocks) {
+        blocks.clear();
+    }
+    jitFastmemSites.clear();
+    for (auto& pending : jitPending) {
+        pending.second = true;
+    }
     LOGI("JIT cache flushed");
 }
 
@@ -612,20 +1849,59 @@ void X86Core::setRegister(uint8_t reg, uint32_t value) {
 void X86Core::dumpRegisters() const {
     LOGI("EAX: 0x%08X EBX: 0x%08X ECX: 0x%08X EDX: 0x%08X", eax, ebx, ecx, edx);
     LOGI("ESI: 0x%08X EDI: 0x%08X ESP: 0x%08X EBP: 0x%08X", esi, edi, esp, ebp);
-    LOGI("EIP: 0x%08X EFLAGS: 0x%08X", eip, eflags);
+    LOGI("EIP: 0x%08X EFLAGS: 0x%08X", eip, getEFLAGS());
     LOGI("CS: 0x%04X DS: 0x%04X ES: 0x%04X FS: 0x%04X GS: 0x%04X SS: 0x%04X", cs, ds, es, fs, gs, ss);
 }
 
 void X86Core::dumpJITCache() const {
-    LOGI("JIT Cache Usage: %zu/%zu bytes (%.1f%%)", 
+    LOGI("JIT Cache Usage: %zu/%zu bytes (%.1f%%), segment %u of %u", 
          jitCacheUsed, JIT_CACHE_SIZE, 
-         (float)jitCacheUsed/JIT_CACHE_SIZE*100);
-    LOGI("Compiled Blocks: %zu", jit_cache.size());
+         (float)jitCacheUsed/JIT_CACHE_SIZE*100, jitSegment + 1, JIT_CACHE_SEGMENTS);
+    size_t optimized = std::count_if(jit_cache.begin(), jit_cache.end(), [](const auto& entry) {
+        return entry.second.tier == JITTier::Optimized && entry.second.compiled_code;
+    });
+    LOGI("Compiled Blocks: %zu (%zu optimized, %zu compiling)", jit_cache.size(), optimized, jitPending.size());
 }
 
-void X86Core::handleInterrupt(unsigned char interruptNumber) {
-    
-    LOGW("Interrupt %d handled", interruptNumber);
+void X86Core::raiseException(uint8_t exception) {
+    if (!exceptionPending) {
+        exceptionPending = true;
+        pendingException = exception;
+    }
+}
+
+// A memory fault is taken before anything the instruction raised itself,
+// since an operand that could not be read is the first thing to go wrong.
+void X86Core::deliverException(uint32_t faultingEip) {
+    uint8_t exception = pendingException;
+    uint32_t errorCode = 0;
+    XboxMemory::Fault fault;
+    if (XboxMemory::takeFault(fault)) {
+        exception = EXCEPTION_PAGE_FAULT;
+        errorCode = (fault.present ? 1 : 0) | (fault.write ? 2 : 0);
+        cr2 = fault.address;
+    }
+    exceptionPending = false;
+    eip = faultingEip;
+    atBlockHead = true;
+
+    if (exceptionHandler && exceptionHandler(exception, errorCode)) return;
+
+    if (exception == EXCEPTION_PAGE_FAULT) {
+        LOGE("Page fault %s 0x%08X at 0x%08X", (errorCode & 2) ? "writing" : "reading", cr2, eip);
+    } else {
+        LOGE("CPU exception %u at 0x%08X", exception, eip);
+    }
+    state = CpuState::Error;
+}
+
+void X86Core::setExceptionHandler(std::function<bool(uint8_t exception, uint32_t errorCode)> handler) {
+    exceptionHandler = std::move(handler);
+}
+
+void X86Core::setPortHandlers(PortRead read, PortWrite write) {
+    portRead = std::move(read);
+    portWrite = std::move(write);
 }
 
 void X86Core::setKernel(XboxKernel* kernelPtr) {
@@ -644,6 +1920,10 @@ void X86Core::setJITThreshold(uint32_t threshold) {
     jitThreshold = threshold;
 }
 
+void X86Core::setJITOptimizeThreshold(uint32_t samples) {
+    jitOptimizeThreshold = samples;
+}
+
 void X86Core::setDebugCallback(std::function<void(uint32_t, const std::string&)> callback) {
     debugCallback = callback;
 }
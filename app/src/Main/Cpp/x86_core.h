@@ -1,9 +1,19 @@
 #pragma once
 #include "xbox_memory.h"
 #include "xbox_kernel.h"  
+#include "x86_decoder.h"
+#include "x86_jit.h"
+#include "bounded_queue.h"
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
 #include <functional>
-#include <arm_neon.h>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
 #include <unordered_map>
 #include <vector>
 #include <string>
@@ -20,8 +30,29 @@ public:
     void executeStep();
     void execute(uint32_t cycles);
     
+    // Requests an external interrupt. It is held until IF is set, then
+    // delivered through the guest's IDT before the next instruction, lowest
+    // vector first, waking a halted CPU. A vector with no present interrupt
+    // or trap gate is dropped.
     void handleInterrupt(uint8_t interrupt);
     void raiseException(uint8_t exception);
+
+    // A guest exception (#DE, #UD, or #PF from an unmapped access) abandons
+    // the instruction raising it, leaves eip on that instruction and, for #PF,
+    // the address in cr2. Registers the instruction changed before the
+    // fault are not rolled back. The handler may redirect the guest and
+    // return true to keep running; without one, or when it declines, the
+    // CPU stops in Error.
+    static constexpr uint8_t EXCEPTION_DIVIDE = 0;
+    static constexpr uint8_t EXCEPTION_INVALID_OPCODE = 6;
+    static constexpr uint8_t EXCEPTION_PAGE_FAULT = 14;
+    void setExceptionHandler(std::function<bool(uint8_t exception, uint32_t errorCode)> handler);
+
+    // IN and OUT are passed to these with the access size in bytes. Reads
+    // from a port nobody answers return all ones; writes to one are dropped.
+    using PortRead = std::function<uint32_t(uint16_t port, uint8_t size)>;
+    using PortWrite = std::function<void(uint16_t port, uint32_t value, uint8_t size)>;
+    void setPortHandlers(PortRead read, PortWrite write);
     
     uint32_t getRegister(uint8_t reg) const;
     void setRegister(uint8_t reg, uint32_t value);
@@ -48,24 +79,40 @@ public:
     void dumpJITCache() const;
     
     void enableJIT(bool enable);
+    // x87 values are host doubles by default, which translated code can
+    // keep in host registers. Precise mode honours a control word asking
+    // for 64-bit precision with 80-bit arithmetic in the interpreter.
+    void enableFpuPrecision(bool enable);
     void flushJITCache();
     void setJITThreshold(uint32_t threshold);
+    void setJITOptimizeThreshold(uint32_t samples);
+
+    // Translations persist across runs in a file keyed by the executable
+    // image. Blocks found there are compiled on first sight instead of
+    // waiting out the hotness threshold.
+    bool openTranslationCache(const std::string& path, uint32_t imageKey);
+    bool saveTranslationCache();
 
-    struct XMMRegister {
+    struct alignas(16) XMMRegister {
         uint8_t data[16];
     };
     std::array<XMMRegister, 8> xmmRegisters;
+    uint32_t mxcsr;
 
+    // TOP lives in statusWord and tagWord only distinguishes empty (11)
+    // from valid (00); the full tags are rebuilt when the environment is
+    // stored. Registers are indexed physically in both storage formats.
     struct FPUState {
         uint16_t controlWord;
         uint16_t statusWord;
         uint16_t tagWord;
-        uint8_t lastOpcode;
+        uint16_t lastOpcode;
         uint32_t lastIP;
         uint16_t lastCS;
         uint32_t lastDP;
         uint16_t lastDS;
         uint8_t st[8][10];
+        double fast[8];
     } fpu;
 
     void setKernel(XboxKernel* kernelPtr);  
@@ -91,19 +138,147 @@ private:
     
     std::unordered_map<uint32_t, std::function<void()>> breakpoints;
     std::function<void(uint32_t, const std::string&)> debugCallback;
+    std::function<bool(uint8_t, uint32_t)> exceptionHandler;
+
+    // Raised while an instruction runs and delivered once it has been
+    // abandoned, together with any memory fault it took.
+    bool exceptionPending;
+    uint8_t pendingException;
+    void deliverException(uint32_t faultingEip);
     
+    // Warm blocks get a baseline translation that skips the IR passes. The
+    // dispatcher samples entries into baseline blocks (a chained loop is
+    // seen once per chain budget), and blocks sampled often enough are
+    // retranslated as optimized traces.
+    enum class JITTier : uint8_t {
+        Baseline,
+        Optimized
+    };
+
     struct JITBlock {
         uint32_t start_addr;
+        JITTier tier;
+        uint32_t samples;
         uint32_t size;
         uint8_t* compiled_code;
+        uint32_t code_size;
+        uint32_t chain_offset;
+        std::vector<JITExitStub> exits;
     };
     
+    typedef void (X86Core::*InstructionHandler)(const X86Instruction& insn);
+
+    static constexpr uint32_t DECODED_PAGE_SHIFT = XboxMemory::CODE_PAGE_SHIFT;
+    static constexpr uint32_t DECODED_PAGE_SIZE = 1u << DECODED_PAGE_SHIFT;
+
+    struct DecodedInstruction {
+        InstructionHandler handler;
+        X86Instruction insn;
+    };
+
+    struct DecodedPage {
+        std::array<uint16_t, DECODED_PAGE_SIZE> slots;
+        std::vector<DecodedInstruction> instructions;
+    };
+
+    std::unordered_map<uint32_t, std::unique_ptr<DecodedPage>> decodedPages;
+    DecodedPage* lastDecodedPage;
+    uint32_t lastDecodedPageNumber;
+
     std::unordered_map<uint32_t, JITBlock> jit_cache;
-    std::unordered_map<uint32_t, uint32_t> executionCounts;
+    std::unordered_map<uint32_t, std::vector<uint8_t*>> jitIncoming;
+    std::unordered_map<uint32_t, std::vector<uint32_t>> jitPageBlocks;
+
+    // IR rather than host code is persisted: compiled blocks embed helper
+    // addresses and chain links that do not survive a restart. Entries are
+    // checked against a hash of the guest bytes they were built from.
+    struct PersistedBlock {
+        JITTier tier;
+        uint32_t endAddr;
+        uint32_t instructionCount;
+        uint32_t codeHash;
+        std::vector<JITOp> ops;
+    };
+
+    std::unordered_map<uint32_t, PersistedBlock> jitPersisted;
+    std::string jitCachePath;
+    uint32_t jitCacheKey;
+    bool jitPersistedDirty;
+
+    // Hot blocks are translated on worker threads while the interpreter
+    // keeps running them. Finished code is installed by the emulation
+    // thread at the next block head. A job whose guest bytes are written,
+    // or whose cache is flushed, before then is marked stale and dropped.
+    static constexpr size_t JIT_QUEUE_CAPACITY = 64;
+
+    struct JITCompileJob {
+        uint32_t startAddr;
+        JITTier tier;
+        bool fpuPrecise;
+    };
+
+    struct JITCompileResult {
+        JITCompileJob job;
+        bool translated;
+        JITBlockIR ir;
+        std::vector<uint8_t> code;
+        JITCodeInfo info;
+    };
+
+    // The rings live on the heap: translated code reaches the fields below
+    // through short immediate offsets from the context.
+    std::unique_ptr<BoundedQueue<JITCompileJob, JIT_QUEUE_CAPACITY>> jitJobs;
+    std::unique_ptr<BoundedQueue<JITCompileResult, JIT_QUEUE_CAPACITY>> jitResults;
+    std::unordered_map<uint32_t, bool> jitPending;   // start -> stale
+    std::vector<std::thread> jitWorkers;
+    std::atomic<bool> jitWorkersRunning;
+    std::mutex jitWakeMutex;
+    std::condition_variable jitWake;
+
+    // Direct-mapped execution counters for block heads. A colliding address
+    // simply takes over the entry and starts counting from one again.
+    static constexpr uint32_t HOTNESS_TABLE_SIZE = 4096;
+
+    struct HotnessEntry {
+        uint32_t address;
+        uint32_t count;
+    };
+
+    std::vector<HotnessEntry> hotness;
     void* jitCacheBase;
+    uint8_t* fastmemBase;
     size_t jitCacheUsed;
+    uint32_t jitSegment;
+    std::vector<std::vector<uint32_t>> jitSegmentBlocks;
     bool jitEnabled;
     uint32_t jitThreshold;
+    uint32_t jitOptimizeThreshold;
+    bool jitFault;
+    uint32_t jitChainBudget;
+    bool jitCodeDirty;
+    bool atBlockHead;
+
+    // Arena accesses in installed code, keyed by the host address of the
+    // access instruction. A fault there patches the site over to its slow
+    // path; entries go away with the segment holding the code.
+    struct FastmemSite {
+        uint8_t* site;
+        const uint8_t* stub;
+    };
+    std::map<const uint8_t*, FastmemSite> jitFastmemSites;
+    bool isJITCode(const uint8_t* pc) const;
+    static thread_local X86Core* runningCore;
+
+    // Points a thread-local core pointer at a core for one scope.
+    struct CoreScope {
+        X86Core*& slot;
+        X86Core* previous;
+        CoreScope(X86Core*& slot, X86Core* core) : slot(slot), previous(slot) { slot = core; }
+        ~CoreScope() { slot = previous; }
+    };
+
+    X86Decoder decoder;
+    std::unique_ptr<JITEmitter> jitEmitter;
     
     enum ALUOperation {
         ALU_ADD,
@@ -114,15 +289,65 @@ private:
         ALU_OR,
         ALU_XOR,
         ALU_SHL,
-        ALU_SHR
+        ALU_SHR,
+        ALU_INC,
+        ALU_DEC,
+        ALU_NONE
     };
+
+    // Arithmetic flags are evaluated lazily from the last ALU operation.
+    // While flagsOp != ALU_NONE the CF/PF/AF/ZF/SF/OF bits of eflags are stale.
+    uint32_t flagsOp;
+    uint32_t flagsA;
+    uint32_t flagsB;
+    uint32_t flagsResult;
+    uint8_t flagsSize;
+
+    bool fpuPrecisionEnabled;
+
+    // Code writes are reported on the writing thread, but invalidation
+    // touches jit_cache and the decoded pages, which belong to the
+    // emulation thread. Writes from any other thread (DMA, HLE, the
+    // renderer) only mark their pages here; the emulation thread applies
+    // them before its next instruction.
+    static thread_local X86Core* steppingCore;
+    std::vector<std::atomic<uint64_t>> deferredCodePages;
+    std::atomic<bool> deferredCodeWrites;
+    void onCodeWrite(uint32_t address, uint32_t size);
+    void applyDeferredCodeWrites();
+
+    // The IDT loaded by LIDT; a zero limit until the guest loads one.
+    // Everything runs at ring 0, so delivery never switches stacks.
+    uint32_t idtBase;
+    uint16_t idtLimit;
+    // External requests waiting for IF, a bit per vector.
+    std::array<uint64_t, 4> pendingInterrupts;
+    bool interruptsPending;
+    bool deliverInterrupt(uint8_t vector, uint32_t returnEip);
+    void deliverPendingInterrupt();
     
     void aluAdd(uint32_t& dest, uint32_t src);
     void aluSub(uint32_t& dest, uint32_t src);
     void aluMul(uint32_t& dest, uint32_t src);
-    void updateFlags(uint32_t result, uint32_t a, uint32_t b, uint32_t operation);
+    void updateFlags(uint32_t result, uint32_t a, uint32_t b, uint32_t operation, uint8_t size = 4);
+    void setResultFlags(uint32_t result, uint8_t size, bool carry, bool overflow, bool auxCarry);
+    void setFlag(uint32_t flag, bool value);
+    void materializeFlags();
+    uint32_t lazyFlagMask() const;
+    bool carryFlag() const;
+    bool parityFlag() const;
+    bool auxCarryFlag() const;
+    bool zeroFlag() const;
+    bool signFlag() const;
+    bool overflowFlag() const;
+    bool testCondition(uint8_t cond) const;
     
     void decodeAndExecute(uint8_t opcode);
+    bool fetchDecoded(uint32_t address, DecodedInstruction& decoded);
+    static const std::array<InstructionHandler, 512>& handlerTable();
+    InstructionHandler handlerFor(const X86Instruction& insn) const;
+    void invalidateCode(uint32_t address, uint32_t size);
+    void flushDecodedCache();
     
     void handleXboxSpecificOpcode();  
     void handleSyscall();             
@@ -130,48 +355,183 @@ private:
     void handleCacheControl();        
     void handlePerformanceCounter();  
     
-    void handleFPUOpcode(uint8_t opcode);
-    void fpuGroup1(uint8_t modrm);
-    void fpuGroup2(uint8_t modrm);
-    void fpuGroup3(uint8_t modrm);
-    void fpuGroup4(uint8_t modrm);
-    void fpuGroup5(uint8_t modrm);
-    void fpuGroup6(uint8_t modrm);
-    void fpuGroup7(uint8_t modrm);
-    void fpuGroup8(uint8_t modrm);
-    void fpuFadd(uint8_t modrm);
-    void fpuFsub(uint8_t modrm);
-    void fpuFmul(uint8_t modrm);
-    void fpuFdiv(uint8_t modrm);
-    void fpuFcom(uint8_t modrm);
-    void fpuFcomp(uint8_t modrm);
-    void fpuFsubr(uint8_t modrm);
-    void fpuFdivr(uint8_t modrm);
-    
-    void handleSSEOpcode(uint8_t opcode);
-    void sseMovups(uint8_t modrm);
-    void sseAddps(uint8_t modrm);
-    void sseMulps(uint8_t modrm);
-    void sseSubps(uint8_t modrm);
-    void sseDivps(uint8_t modrm);
-    
-    uint32_t readOperand(uint8_t modrm);
-    void writeOperand(uint8_t modrm, uint32_t value);
-    
-    void compileBlock(uint32_t start_addr);
+    // x87 values are host doubles unless precise mode is enabled and the
+    // control word asks for 64-bit precision, in which case fpuExecute runs
+    // on 80-bit images in fpu.st.
+    bool fpuPrecise() const;
+    void fpuSwitchStorage(bool wasPrecise);
+    void fpuSetControlWord(uint16_t value);
+    void fpuReset();
+    template <typename T> void fpuExecute(const X86Instruction& insn);
+    template <typename T> void fpuMemoryOp(const X86Instruction& insn);
+    template <typename T> void fpuRegisterOp(const X86Instruction& insn);
+    template <typename T> T fpuLoad(uint32_t address, uint8_t format);
+    template <typename T> void fpuStore(uint32_t address, uint8_t format, T value);
+    template <typename T> void fpuStoreEnvironment(uint32_t address);
+    void fpuLoadEnvironment(uint32_t address);
+    
+    void fpuSaveState(uint32_t address);
+    void fpuRestoreState(uint32_t address);
+
+    // An SSE kernel id is the 0F opcode byte, the mandatory prefix in bits
+    // 8-9, the /reg of the shift groups in bits 10-12 and SSE_MEMORY for
+    // memory forms. The interpreter and translated code share the kernels.
+    enum SSEShape : uint8_t {
+        SSE_INVALID,
+        SSE_COMPUTE,          // xmm = kernel(xmm, xmm/m)
+        SSE_COMPUTE_GPR,      // xmm = kernel(xmm, r/m32)
+        SSE_TO_GPR,           // r32 = kernel(xmm/m)
+        SSE_STORE,            // xmm/m = xmm
+        SSE_STORE_GPR,        // r/m32 = xmm
+        SSE_SHIFT,            // xmm = kernel(xmm, imm8)
+        SSE_COMPARE_FLAGS,    // EFLAGS = compare(xmm, xmm/m)
+        SSE_SPECIAL
+    };
+    struct SSEForm {
+        SSEShape shape;
+        uint8_t bytes;        // memory operand width, 0 = no memory form
+        bool registerForm;
+        uint8_t offset;       // first byte of the register a store writes
+    };
+    static constexpr uint32_t SSE_MEMORY = 0x2000;
+    static uint32_t sseKernelId(const X86Instruction& insn);
+    static SSEForm sseForm(uint32_t kernel);
+    void sseKernel(uint32_t kernel, XMMRegister& dst, const XMMRegister& src, uint8_t imm);
+    XMMRegister sseRead(uint32_t address, uint8_t bytes);
+    void sseWrite(uint32_t address, const XMMRegister& value, uint8_t offset, uint8_t bytes);
+    void sseSpecial(const X86Instruction& insn);
+    static void jitVectorKernel(void* context, uint32_t kernel, uint32_t operands);
+    // Memory operands of translated SSE instructions are gathered here.
+    XMMRegister sseScratch;
+    
+    uint32_t effectiveAddress(const X86Instruction& insn) const;
+    uint32_t readOperand(const X86Instruction& insn);
+    uint32_t readOperand(const X86Instruction& insn, uint8_t size);
+    void writeOperand(const X86Instruction& insn, uint32_t value);
+    void writeOperand(const X86Instruction& insn, uint8_t size, uint32_t value);
+    uint32_t readRegister(uint8_t reg, uint8_t size) const;
+    void writeRegister(uint8_t reg, uint8_t size, uint32_t value);
+    uint32_t readMemory(uint32_t address, uint8_t size);
+    void writeMemory(uint32_t address, uint8_t size, uint32_t value);
+    uint16_t* segmentRegister(uint8_t index);
+    void push(uint32_t value);
+    uint32_t pop();
+    uint32_t aluOperation(uint8_t op, uint32_t a, uint32_t b, uint8_t size);
+    uint32_t incDec(uint32_t value, bool decrement, uint8_t size);
+    uint32_t shiftOperation(uint8_t op, uint32_t value, uint8_t count, uint8_t size);
+    uint32_t signedMultiply(uint32_t a, uint32_t b, uint8_t size);
+    void bitTest(const X86Instruction& insn, uint32_t bit, uint8_t op);
+    void invalidInstruction(const X86Instruction& insn);
+    
+    uint32_t countBlockHead(uint32_t address);
+    void requestBlock(uint32_t start_addr, JITTier tier);
+    void compileBlock(uint32_t start_addr, JITTier tier);
+    bool installBlock(uint32_t start_addr, JITTier tier, const JITBlockIR& ir,
+                      const std::vector<uint8_t>& code, JITCodeInfo& info, bool translated);
+    void startCompileWorkers();
+    void stopCompileWorkers();
+    void compileWorker();
+    void publishCompiledBlocks();
+    uint32_t guestCodeHash(uint32_t start_addr, uint32_t end_addr);
+    bool restoreBlock(uint32_t start_addr, JITBlockIR& ir, JITTier& tier);
+    void persistBlock(const JITBlockIR& ir, JITTier tier);
     void executeCompiledBlock(JITBlock& block);
-    bool isCommonOpcode(uint8_t opcode);
-    void emitMOV(uint8_t*& code, uint8_t modrm);
-    void emitADD(uint8_t*& code, uint8_t modrm);
-    void emitRET(uint8_t*& code);
-    void emitJMP(uint8_t*& code, int8_t offset);
-    void emitXboxOpcode(uint8_t*& code, uint8_t op);  
-    
-    void mov_r32_rm32();
-    void mov_rm32_r32();
-    void add_r32_rm32();
-    void add_rm32_r32();
-    void jmp_rel8();
-    void jmp_rel32();
-    void ret();
+    void linkBlock(JITBlock& block);
+    void evictSegment(uint32_t segment);
+    void trackBlockPages(const JITBlock& block);
+    void invalidateJITBlock(uint32_t start_addr);
+    bool translateBlock(uint32_t start_addr, JITBlockIR& ir, JITTier tier, bool precise);
+    bool translateInstruction(const X86Instruction& insn, JITBlockIR& ir, bool& endBlock, bool precise);
+    JITContextLayout buildContextLayout();
+    static void installFastmemHandler();
+    static void fastmemSignal(int sig, siginfo_t* info, void* context);
+    bool handleFastmemFault(void* address, void* context);
+    static uint32_t jitReadMemory(void* context, uint32_t address, uint32_t size);
+    static void jitWriteMemory(void* context, uint32_t address, uint32_t value, uint32_t size);
+    
+    void alu_rm_r(const X86Instruction& insn);
+    void alu_r_rm(const X86Instruction& insn);
+    void alu_acc_imm(const X86Instruction& insn);
+    void group1(const X86Instruction& insn);
+    void inc_reg(const X86Instruction& insn);
+    void dec_reg(const X86Instruction& insn);
+    void push_reg(const X86Instruction& insn);
+    void pop_reg(const X86Instruction& insn);
+    void push_sreg(const X86Instruction& insn);
+    void pop_sreg(const X86Instruction& insn);
+    void pushad(const X86Instruction& insn);
+    void popad(const X86Instruction& insn);
+    void push_imm(const X86Instruction& insn);
+    void imul_r_rm_imm(const X86Instruction& insn);
+    void jcc(const X86Instruction& insn);
+    void test_rm_r(const X86Instruction& insn);
+    void xchg_rm_r(const X86Instruction& insn);
+    void mov_rm_r(const X86Instruction& insn);
+    void mov_r_rm(const X86Instruction& insn);
+    void mov_rm_sreg(const X86Instruction& insn);
+    void lea(const X86Instruction& insn);
+    void mov_sreg_rm(const X86Instruction& insn);
+    void pop_rm(const X86Instruction& insn);
+    void nop(const X86Instruction& insn);
+    void xchg_acc_reg(const X86Instruction& insn);
+    void cwde(const X86Instruction& insn);
+    void cdq(const X86Instruction& insn);
+    void pushfd(const X86Instruction& insn);
+    void popfd(const X86Instruction& insn);
+    void sahf(const X86Instruction& insn);
+    void lahf(const X86Instruction& insn);
+    void test_acc_imm(const X86Instruction& insn);
+    void movs(const X86Instruction& insn);
+    void cmps(const X86Instruction& insn);
+    void stos(const X86Instruction& insn);
+    void lods(const X86Instruction& insn);
+    void scas(const X86Instruction& insn);
+    void mov_r_imm(const X86Instruction& insn);
+    void group2(const X86Instruction& insn);
+    void ret_imm(const X86Instruction& insn);
+    void ret(const X86Instruction& insn);
+    void mov_rm_imm(const X86Instruction& insn);
+    void enter(const X86Instruction& insn);
+    void leave(const X86Instruction& insn);
+    void int3(const X86Instruction& insn);
+    void int_imm(const X86Instruction& insn);
+    void iret(const X86Instruction& insn);
+    void loop(const X86Instruction& insn);
+    void jecxz(const X86Instruction& insn);
+    void call_rel(const X86Instruction& insn);
+    void jmp_rel(const X86Instruction& insn);
+    void xlat(const X86Instruction& insn);
+    void in_acc(const X86Instruction& insn);
+    void out_acc(const X86Instruction& insn);
+    void hlt(const X86Instruction& insn);
+    void flag_control(const X86Instruction& insn);
+    void group3(const X86Instruction& insn);
+    void group4(const X86Instruction& insn);
+    void group5(const X86Instruction& insn);
+    void cpuid(const X86Instruction& insn);
+    void rdtsc(const X86Instruction& insn);
+    void group7(const X86Instruction& insn);
+    void cmovcc(const X86Instruction& insn);
+    void setcc(const X86Instruction& insn);
+    void bt_rm_r(const X86Instruction& insn);
+    void bt_rm_imm(const X86Instruction& insn);
+    void shld(const X86Instruction& insn);
+    void shrd(const X86Instruction& insn);
+    void imul_r_rm(const X86Instruction& insn);
+    void cmpxchg(const X86Instruction& insn);
+    void movzx(const X86Instruction& insn);
+    void movsx(const X86Instruction& insn);
+    void bsf(const X86Instruction& insn);
+    void bsr(const X86Instruction& insn);
+    void xadd(const X86Instruction& insn);
+    void bswap(const X86Instruction& insn);
+    void cmpxchg8b(const X86Instruction& insn);
+    void fpu_escape(const X86Instruction& insn);
+    void sse_op(const X86Instruction& insn);
+
+    // Left at the end, out of the way of the offsets translated code uses.
+    PortRead portRead;
+    PortWrite portWrite;
+    // RDTSC counts at the 733 MHz of the Xbox CPU from the last reset.
+    std::chrono::steady_clock::time_point tscEpoch;
 };
\ No newline at end of file
@@ -0,0 +1,187 @@
+#include "x86_decoder.h"
+#include "xbox_memory.h"
+
+constexpr uint8_t MAX_INSTRUCTION_LENGTH = 15;
+
+namespace {
+
+constexpr uint16_t N = 0x000;   // no operand bytes
+constexpr uint16_t M = 0x001;   // ModRM (+ SIB, displacement)
+constexpr uint16_t IB = 0x002;  // imm8
+constexpr uint16_t IW = 0x004;  // imm16
+constexpr uint16_t IZ = 0x008;  // imm16 or imm32 by operand size
+constexpr uint16_t MO = 0x010;  // moffs32
+constexpr uint16_t G3 = 0x020;  // F6/F7: immediate only for /0 and /1
+constexpr uint16_t B = 0x040;   // 8-bit operand size
+constexpr uint16_t P = 0x080;   // prefix byte
+constexpr uint16_t X = 0x100;   // invalid or not emulated: raises #UD
+
+constexpr uint16_t oneByteMap[256] = {
+    /* 00 */ M|B, M, M|B, M, IB|B, IZ, N, N,  M|B, M, M|B, M, IB|B, IZ, N, X,
+    /* 10 */ M|B, M, M|B, M, IB|B, IZ, N, N,  M|B, M, M|B, M, IB|B, IZ, N, N,
+    /* 20 */ M|B, M, M|B, M, IB|B, IZ, P, X,  M|B, M, M|B, M, IB|B, IZ, P, X,
+    /* 30 */ M|B, M, M|B, M, IB|B, IZ, P, X,  M|B, M, M|B, M, IB|B, IZ, P, X,
+    /* 40 */ N, N, N, N, N, N, N, N,  N, N, N, N, N, N, N, N,
+    /* 50 */ N, N, N, N, N, N, N, N,  N, N, N, N, N, N, N, N,
+    /* 60 */ N, N, X, X, P, P, P, X,  IZ, M|IZ, IB, M|IB, X, X, X, X,
+    /* 70 */ IB, IB, IB, IB, IB, IB, IB, IB,  IB, IB, IB, IB, IB, IB, IB, IB,
+    /* 80 */ M|IB|B, M|IZ, M|IB|B, M|IB, M|B, M, M|B, M,  M|B, M, M|B, M, M, M, M, M,
+    /* 90 */ N, N, N, N, N, N, N, N,  N, N, X, N, N, N, N, N,
+    /* A0 */ MO|B, MO, MO|B, MO, B, N, B, N,  IB|B, IZ, B, N, B, N, B, N,
+    /* B0 */ IB|B, IB|B, IB|B, IB|B, IB|B, IB|B, IB|B, IB|B,  IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,
+    /* C0 */ M|IB|B, M|IB, IW, N, X, X, M|IB|B, M|IZ,  IW|IB, N, X, X, N, IB, X, N,
+    /* D0 */ M|B, M, M|B, M, X, X, X, B,  M, M, M, M, M, M, M, M,
+    /* E0 */ IB, IB, IB, IB, IB|B, IB, IB|B, IB,  IZ, IZ, X, IB, B, N, B, N,
+    /* F0 */ P, X, P, P, N, N, M|G3|B, M|G3,  N, N, N, N, N, N, M|B, M,
+};
+
+constexpr uint16_t twoByteMap[256] = {
+    /* 00 */ X, M, X, X, X, X, X, X,  N, N, X, X, X, M, X, X,
+    /* 10 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* 20 */ X, X, X, X, X, X, X, X,  M, M, M, M, M, M, M, M,
+    /* 30 */ X, N, X, X, X, X, X, X,  X, X, X, X, X, X, X, X,
+    /* 40 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* 50 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* 60 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* 70 */ M|IB, M|IB, M|IB, M|IB, M, M, M, N,  X, X, X, X, X, X, M, M,
+    /* 80 */ IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,  IZ, IZ, IZ, IZ, IZ, IZ, IZ, IZ,
+    /* 90 */ M|B, M|B, M|B, M|B, M|B, M|B, M|B, M|B,  M|B, M|B, M|B, M|B, M|B, M|B, M|B, M|B,
+    /* A0 */ N, N, N, M, M|IB, M, X, X,  N, N, X, M, M|IB, M, M, M,
+    /* B0 */ M|B, M, X, M, X, X, M, M,  X, X, M|IB, M, M, M, M, M,
+    /* C0 */ M|B, M, M|IB, M, M|IB, M|IB, M|IB, M,  N, N, N, N, N, N, N, N,
+    /* D0 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* E0 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+    /* F0 */ M, M, M, M, M, M, M, M,  M, M, M, M, M, M, M, M,
+};
+
+}
+
+X86Decoder::X86Decoder(XboxMemory* memory) : memory(memory) {}
+
+bool X86Decoder::decode(uint32_t address, X86Instruction& insn) {
+    insn = X86Instruction();
+    insn.address = address;
+    insn.segment = X86Instruction::SEG_DEFAULT;
+    insn.base = X86Instruction::NO_REG;
+    insn.index = X86Instruction::NO_REG;
+
+    uint32_t cursor = address;
+    uint8_t byte = memory->read8(cursor++);
+    while (oneByteMap[byte] & P) {
+        switch (byte) {
+            case 0x26: insn.segment = X86Instruction::SEG_ES; break;
+            case 0x2E: insn.segment = X86Instruction::SEG_CS; break;
+            case 0x36: insn.segment = X86Instruction::SEG_SS; break;
+            case 0x3E: insn.segment = X86Instruction::SEG_DS; break;
+            case 0x64: insn.segment = X86Instruction::SEG_FS; break;
+            case 0x65: insn.segment = X86Instruction::SEG_GS; break;
+            case 0x66: insn.prefixes |= X86Instruction::PREFIX_OPSIZE; break;
+            case 0xF0: insn.prefixes |= X86Instruction::PREFIX_LOCK; break;
+            case 0xF2: insn.prefixes |= X86Instruction::PREFIX_REPNE; break;
+            case 0xF3: insn.prefixes |= X86Instruction::PREFIX_REP; break;
+        }
+        if (cursor - address >= MAX_INSTRUCTION_LENGTH) {
+            return false;
+        }
+        byte = memory->read8(cursor++);
+    }
+
+    uint16_t opcode = byte;
+    uint16_t layout = oneByteMap[byte];
+    if (byte == 0x0F) {
+        byte = memory->read8(cursor++);
+        opcode = 0x0F00 | byte;
+        layout = twoByteMap[byte];
+    }
+    if (layout & X) {
+        return false;
+    }
+    insn.opcode = opcode;
+
+    bool opsize16 = insn.prefixes & X86Instruction::PREFIX_OPSIZE;
+    insn.operandSize = (layout & B) ? 1 : (opsize16 ? 2 : 4);
+
+    if ((layout & M) && !decodeModrm(cursor, insn)) {
+        return false;
+    }
+    if (layout & MO) {
+        insn.disp = static_cast<int32_t>(readImmediate(cursor, 4, false));
+    }
+    if ((layout & G3) && insn.reg <= 1) {
+        layout |= (layout & B) ? IB : IZ;
+    }
+
+    uint32_t* target = &insn.imm;
+    if (layout & IZ) {
+        *target = readImmediate(cursor, opsize16 ? 2 : 4, true);
+        target = &insn.imm2;
+    }
+    if (layout & IW) {
+        *target = readImmediate(cursor, 2, false);
+        target = &insn.imm2;
+    }
+    if (layout & IB) {
+        *target = readImmediate(cursor, 1, true);
+    }
+
+    // Bytes past the end of mapped memory read as zero. The fault is left
+    // pending for whoever runs the instruction to raise.
+    if (XboxMemory::faultPending()) {
+        return false;
+    }
+
+    if (cursor - address > MAX_INSTRUCTION_LENGTH) {
+        return false;
+    }
+    insn.length = static_cast<uint8_t>(cursor - address);
+    return true;
+}
+
+bool X86Decoder::decodeModrm(uint32_t& cursor, X86Instruction& insn) {
+    insn.hasModrm = true;
+    insn.modrm = memory->read8(cursor++);
+    insn.mod = (insn.modrm >> 6) & 3;
+    insn.reg = (insn.modrm >> 3) & 7;
+    insn.rm = insn.modrm & 7;
+
+    if (insn.mod == 3) {
+        return true;
+    }
+
+    uint8_t dispSize = insn.mod == 1 ? 1 : (insn.mod == 2 ? 4 : 0);
+
+    if (insn.rm == 4) {
+        uint8_t sib = memory->read8(cursor++);
+        insn.scale = (sib >> 6) & 3;
+        uint8_t index = (sib >> 3) & 7;
+        uint8_t base = sib & 7;
+        insn.index = index == 4 ? X86Instruction::NO_REG : index;
+        if (base == 5 && insn.mod == 0) {
+            dispSize = 4;
+        } else {
+            insn.base = base;
+        }
+    } else if (insn.rm == 5 && insn.mod == 0) {
+        dispSize = 4;
+    } else {
+        insn.base = insn.rm;
+    }
+
+    if (dispSize) {
+        insn.disp = static_cast<int32_t>(readImmediate(cursor, dispSize, true));
+    }
+    return true;
+}
+
+uint32_t X86Decoder::readImmediate(uint32_t& cursor, uint8_t size, bool sign) {
+    uint32_t value = 0;
+    for (uint8_t i = 0; i < size; i++) {
+        value |= static_cast<uint32_t>(memory->read8(cursor + i)) << (i * 8);
+    }
+    cursor += size;
+    if (sign && size < 4) {
+        uint32_t shift = 32 - size * 8;
+        value = static_cast<uint32_t>(static_cast<int32_t>(value << shift) >> shift);
+    }
+    return value;
+}
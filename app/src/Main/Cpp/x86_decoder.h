@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+
+class XboxMemory;
+
+struct X86Instruction {
+    static constexpr uint8_t NO_REG = 0xFF;
+
+    static constexpr uint8_t PREFIX_OPSIZE = 0x01;
+    static constexpr uint8_t PREFIX_LOCK = 0x02;
+    static constexpr uint8_t PREFIX_REP = 0x04;
+    static constexpr uint8_t PREFIX_REPNE = 0x08;
+
+    enum Segment : uint8_t {
+        SEG_ES,
+        SEG_CS,
+        SEG_SS,
+        SEG_DS,
+        SEG_FS,
+        SEG_GS,
+        SEG_DEFAULT = 0xFF
+    };
+
+    uint32_t address;
+    uint16_t opcode;
+    uint8_t length;
+
+    uint8_t prefixes;
+    uint8_t segment;
+    uint8_t operandSize;
+
+    bool hasModrm;
+    uint8_t modrm;
+    uint8_t mod;
+    uint8_t reg;
+    uint8_t rm;
+
+    uint8_t base;
+    uint8_t index;
+    uint8_t scale;
+    int32_t disp;
+
+    uint32_t imm;
+    uint32_t imm2;
+
+    bool isRegisterOperand() const { return mod == 3; }
+};
+
+class X86Decoder {
+public:
+    explicit X86Decoder(XboxMemory* memory);
+
+    // Decodes one instruction of the one-byte or 0F map. Returns false for
+    // invalid encodings, the 0F38/0F3A maps, the Xbox 0F3F escape and
+    // 16-bit addressing (0x67), which callers handle on their slow path.
+    bool decode(uint32_t address, X86Instruction& insn);
+
+private:
+    XboxMemory* memory;
+
+    bool decodeModrm(uint32_t& cursor, X86Instruction& insn);
+    uint32_t readImmediate(uint32_t& cursor, uint8_t size, bool sign);
+};
@@ -0,0 +1,830 @@
+#include "x86_core.h"
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+constexpr uint16_t FPU_IE = 0x0001;
+constexpr uint16_t FPU_ZE = 0x0004;
+constexpr uint16_t FPU_SF = 0x0040;
+constexpr uint16_t FPU_ES = 0x0080;
+constexpr uint16_t FPU_C0 = 0x0100;
+constexpr uint16_t FPU_C1 = 0x0200;
+constexpr uint16_t FPU_C2 = 0x0400;
+constexpr uint16_t FPU_TOP = 0x3800;
+constexpr uint16_t FPU_C3 = 0x4000;
+constexpr uint16_t FPU_BUSY = 0x8000;
+constexpr uint16_t FPU_CONDITION = FPU_C0 | FPU_C1 | FPU_C2 | FPU_C3;
+constexpr uint16_t FPU_EXCEPTIONS = 0x003F;
+
+constexpr uint32_t ENVIRONMENT_SIZE = 28;
+constexpr uint32_t EXTENDED_SIZE = 10;
+
+// Memory operand formats. The first four match bits 1-2 of the D8/DA/DC/DE
+// escapes, whose memory forms all share the same arithmetic group.
+enum FPUFormat : uint8_t {
+    FPU_F32,
+    FPU_I32,
+    FPU_F64,
+    FPU_I16,
+    FPU_I64,
+    FPU_F80,
+    FPU_BCD
+};
+
+long double extendedToHost(const uint8_t* image) {
+    uint64_t mantissa;
+    memcpy(&mantissa, image, sizeof(mantissa));
+    uint16_t signExponent = image[8] | (image[9] << 8);
+    int exponent = signExponent & 0x7FFF;
+
+    long double value;
+    if (exponent == 0x7FFF) {
+        value = (mantissa << 1) ? std::numeric_limits<long double>::quiet_NaN()
+                                : std::numeric_limits<long double>::infinity();
+    } else {
+        value = std::ldexp(static_cast<long double>(mantissa), (exponent ? exponent : 1) - 16383 - 63);
+    }
+    return (signExponent & 0x8000) ? -value : value;
+}
+
+void hostToExtended(long double value, uint8_t* image) {
+    uint16_t signExponent = std::signbit(value) ? 0x8000 : 0;
+    uint64_t mantissa = 0;
+
+    if (std::isnan(value)) {
+        signExponent |= 0x7FFF;
+        mantissa = 0xC000000000000000ull;
+    } else if (std::isinf(value)) {
+        signExponent |= 0x7FFF;
+        mantissa = 0x8000000000000000ull;
+    } else if (value != 0) {
+        int exponent;
+        long double fraction = std::frexp(std::fabs(value), &exponent);
+        int biased = exponent - 1 + 16383;
+        long double scaled = std::nearbyint(std::ldexp(fraction, biased > 0 ? 64 : 64 + biased - 1));
+        if (scaled >= 18446744073709551616.0L) {
+            scaled /= 2;
+            biased++;
+        }
+        mantissa = static_cast<uint64_t>(scaled);
+        if (biased >= 0x7FFF) {
+            mantissa = 0x8000000000000000ull;
+            biased = 0x7FFF;
+        }
+        signExponent |= biased > 0 ? biased : 0;
+    }
+
+    memcpy(image, &mantissa, sizeof(mantissa));
+    image[8] = signExponent & 0xFF;
+    image[9] = signExponent >> 8;
+}
+
+template <typename T> T loadSlot(const X86Core::FPUState& fpu, uint8_t physical);
+template <typename T> void storeSlot(X86Core::FPUState& fpu, uint8_t physical, T value);
+
+template <>
+double loadSlot<double>(const X86Core::FPUState& fpu, uint8_t physical) {
+    return fpu.fast[physical];
+}
+
+template <>
+long double loadSlot<long double>(const X86Core::FPUState& fpu, uint8_t physical) {
+    return extendedToHost(fpu.st[physical]);
+}
+
+template <>
+void storeSlot<double>(X86Core::FPUState& fpu, uint8_t physical, double value) {
+    fpu.fast[physical] = value;
+}
+
+template <>
+void storeSlot<long double>(X86Core::FPUState& fpu, uint8_t physical, long double value) {
+    hostToExtended(value, fpu.st[physical]);
+}
+
+// The masked response to an invalid operation: the negative "indefinite" QNaN.
+template <typename T>
+T indefinite() {
+    return -std::numeric_limits<T>::quiet_NaN();
+}
+
+template <typename T>
+class FPUStack {
+public:
+    explicit FPUStack(X86Core::FPUState& fpu) : fpu(fpu) {}
+
+    uint8_t top() const { return (fpu.statusWord >> 11) & 7; }
+    uint8_t physical(uint8_t i) const { return (top() + i) & 7; }
+    bool isEmpty(uint8_t i) const { return ((fpu.tagWord >> (physical(i) * 2)) & 3) == 3; }
+
+    // Reading an empty register is a stack underflow; with IE masked the
+    // operation continues on the indefinite NaN.
+    T get(uint8_t i) {
+        if (isEmpty(i)) {
+            fpu.statusWord = (fpu.statusWord & ~FPU_C1) | FPU_IE | FPU_SF;
+            return indefinite<T>();
+        }
+        return loadSlot<T>(fpu, physical(i));
+    }
+
+    void set(uint8_t i, T value) {
+        uint8_t slot = physical(i);
+        storeSlot<T>(fpu, slot, value);
+        fpu.tagWord &= ~(3u << (slot * 2));
+    }
+
+    void push(T value) {
+        if (!isEmpty(7)) {
+            fpu.statusWord |= FPU_IE | FPU_SF | FPU_C1;
+            value = indefinite<T>();
+        }
+        setTop(physical(7));
+        set(0, value);
+    }
+
+    void pop() {
+        fpu.tagWord |= 3u << (physical(0) * 2);
+        setTop(physical(1));
+    }
+
+    void free(uint8_t i) { fpu.tagWord |= 3u << (physical(i) * 2); }
+    void setTop(uint8_t value) { fpu.statusWord = (fpu.statusWord & ~FPU_TOP) | (value << 11); }
+    void setCondition(uint16_t bits) { fpu.statusWord = (fpu.statusWord & ~FPU_CONDITION) | bits; }
+    void raise(uint16_t exceptions) { fpu.statusWord |= exceptions; }
+
+private:
+    X86Core::FPUState& fpu;
+};
+
+template <typename T>
+T arithmetic(uint8_t op, T a, T b, FPUStack<T>& stack) {
+    T result;
+    switch (op) {
+        case 0: result = a + b; break;
+        case 1: result = a * b; break;
+        case 4: result = a - b; break;
+        case 5: result = b - a; break;
+        case 6: result = a / b; break;
+        default: result = b / a; break;
+    }
+
+    if (std::isnan(result) && !std::isnan(a) && !std::isnan(b)) {
+        stack.raise(FPU_IE);
+    } else if (op >= 6 && std::isinf(result) && (op == 6 ? b : a) == 0 && std::isfinite(op == 6 ? a : b)) {
+        stack.raise(FPU_ZE);
+    }
+    return result;
+}
+
+template <typename T>
+uint16_t compare(T a, T b) {
+    if (std::isnan(a) || std::isnan(b)) return FPU_C3 | FPU_C2 | FPU_C0;
+    if (a < b) return FPU_C0;
+    if (a == b) return FPU_C3;
+    return 0;
+}
+
+template <typename T>
+T roundToInteger(T value, uint16_t controlWord) {
+    switch ((controlWord >> 10) & 3) {
+        case 0: return std::nearbyint(value);
+        case 1: return std::floor(value);
+        case 2: return std::ceil(value);
+        default: return std::trunc(value);
+    }
+}
+
+// Tag word encoding used by FSTENV/FSAVE: valid, zero, special, empty.
+template <typename T>
+uint16_t fullTag(T value) {
+    switch (std::fpclassify(value)) {
+        case FP_ZERO: return 1;
+        case FP_NORMAL: return 0;
+        default: return 2;
+    }
+}
+
+}
+
+bool X86Core::fpuPrecise() const {
+    return fpuPrecisionEnabled && ((fpu.controlWord >> 8) & 3) == 3;
+}
+
+void X86Core::enableFpuPrecision(bool enable) {
+    bool wasPrecise = fpuPrecise();
+    fpuPrecisionEnabled = enable;
+    fpuSwitchStorage(wasPrecise);
+}
+
+void X86Core::fpuSetControlWord(uint16_t value) {
+    bool wasPrecise = fpuPrecise();
+    fpu.controlWord = value | 0x0040;
+    fpuSwitchStorage(wasPrecise);
+}
+
+// Switching between double and extended precision moves the register file
+// into the other storage format. Translated blocks only handle the double
+// format, so they are dropped on every switch.
+void X86Core::fpuSwitchStorage(bool wasPrecise) {
+    if (fpuPrecise() == wasPrecise) return;
+
+    for (uint8_t slot = 0; slot < 8; slot++) {
+        if (wasPrecise) {
+            fpu.fast[slot] = static_cast<double>(extendedToHost(fpu.st[slot]));
+        } else {
+            hostToExtended(fpu.fast[slot], fpu.st[slot]);
+        }
+    }
+    flushJITCache();
+}
+
+void X86Core::fpuReset() {
+    bool wasPrecise = fpuPrecise();
+    fpu.controlWord = 0x037F;
+    fpu.statusWord = 0;
+    fpu.tagWord = 0xFFFF;
+    fpu.lastOpcode = 0;
+    fpu.lastIP = 0;
+    fpu.lastCS = 0;
+    fpu.lastDP = 0;
+    fpu.lastDS = 0;
+    fpuSwitchStorage(wasPrecise);
+}
+
+void X86Core::fpu_escape(const X86Instruction& insn) {
+    if (fpuPrecise()) {
+        fpuExecute<long double>(insn);
+    } else {
+        fpuExecute<double>(insn);
+    }
+}
+
+template <typename T>
+void X86Core::fpuExecute(const X86Instruction& insn) {
+    uint8_t escape = insn.opcode & 7;
+    bool memoryForm = !insn.isRegisterOperand();
+
+    // Control instructions leave the last-instruction pointers and C1 alone.
+    bool control = (memoryForm && (escape == 1 || escape == 5) && insn.reg >= 4) ||
+                   (escape == 3 && (insn.modrm == 0xE2 || insn.modrm == 0xE3)) ||
+                   (escape == 7 && insn.modrm == 0xE0);
+    if (!control) {
+        fpu.lastOpcode = ((escape << 8) | insn.modrm) & 0x07FF;
+        fpu.lastIP = insn.address;
+        fpu.lastCS = cs;
+        if (memoryForm) {
+            fpu.lastDP = effectiveAddress(insn);
+            fpu.lastDS = ds;
+        }
+        fpu.statusWord &= ~FPU_C1;
+    }
+
+    if (memoryForm) {
+        fpuMemoryOp<T>(insn);
+    } else {
+        fpuRegisterOp<T>(insn);
+    }
+
+    // Unmasked exceptions are only summarised; #MF is never delivered.
+    if (fpu.statusWord & ~fpu.controlWord & FPU_EXCEPTIONS) {
+        fpu.statusWord |= FPU_ES | FPU_BUSY;
+    } else {
+        fpu.statusWord &= ~(FPU_ES | FPU_BUSY);
+    }
+}
+
+template <typename T>
+void X86Core::fpuMemoryOp(const X86Instruction& insn) {
+    FPUStack<T> stack(fpu);
+    uint32_t address = effectiveAddress(insn);
+    uint8_t escape = insn.opcode & 7;
+
+    if (!(escape & 1)) {
+        T operand = fpuLoad<T>(address, escape >> 1);
+        T st0 = stack.get(0);
+        if (insn.reg == 2 || insn.reg == 3) {
+            stack.setCondition(compare(st0, operand));
+            if (insn.reg == 3) stack.pop();
+        } else {
+            stack.set(0, arithmetic(insn.reg, st0, operand, stack));
+        }
+        return;
+    }
+
+    // Integer stores of FISTTP truncate regardless of the rounding control.
+    auto storeInteger = [&](uint8_t format, bool truncate, bool pop) {
+        T value = stack.get(0);
+        fpuStore<T>(address, format, truncate && std::isfinite(value) ? std::trunc(value) : value);
+        if (pop) stack.pop();
+    };
+    auto storeValue = [&](uint8_t format, bool pop) {
+        fpuStore<T>(address, format, stack.get(0));
+        if (pop) stack.pop();
+    };
+
+    switch ((escape << 3) | insn.reg) {
+        case 0x08: stack.push(fpuLoad<T>(address, FPU_F32)); break;
+        case 0x0A: storeValue(FPU_F32, false); break;
+        case 0x0B: storeValue(FPU_F32, true); break;
+        case 0x0C: fpuLoadEnvironment(address); break;
+        case 0x0D: fpuSetControlWord(memory->read16(address)); break;
+        case 0x0E:
+            fpuStoreEnvironment<T>(address);
+            fpu.controlWord |= FPU_EXCEPTIONS;
+            break;
+        case 0x0F: memory->write16(address, fpu.controlWord); break;
+
+        case 0x18: stack.push(fpuLoad<T>(address, FPU_I32)); break;
+        case 0x19: storeInteger(FPU_I32, true, true); break;
+        case 0x1A: storeInteger(FPU_I32, false, false); break;
+        case 0x1B: storeInteger(FPU_I32, false, true); break;
+        case 0x1D: stack.push(fpuLoad<T>(address, FPU_F80)); break;
+        case 0x1F: storeValue(FPU_F80, true); break;
+
+        case 0x28: stack.push(fpuLoad<T>(address, FPU_F64)); break;
+        case 0x29: storeInteger(FPU_I64, true, true); break;
+        case 0x2A: storeValue(FPU_F64, false); break;
+        case 0x2B: storeValue(FPU_F64, true); break;
+        case 0x2C: {
+            fpuLoadEnvironment(address);
+            bool precise = fpuPrecise();
+            uint8_t top = (fpu.statusWord >> 11) & 7;
+            for (uint8_t i = 0; i < 8; i++) {
+                uint8_t image[EXTENDED_SIZE];
+                memory->readBlock(address + ENVIRONMENT_SIZE + i * EXTENDED_SIZE, image, EXTENDED_SIZE);
+                uint8_t slot = (top + i) & 7;
+                if (precise) {
+                    memcpy(fpu.st[slot], image, EXTENDED_SIZE);
+                } else {
+                    fpu.fast[slot] = static_cast<double>(extendedToHost(image));
+                }
+            }
+            break;
+        }
+        case 0x2E:
+            fpuStoreEnvironment<T>(address);
+            for (uint8_t i = 0; i < 8; i++) {
+                uint8_t image[EXTENDED_SIZE];
+                hostToExtended(loadSlot<T>(fpu, stack.physical(i)), image);
+                memory->writeBlock(address + ENVIRONMENT_SIZE + i * EXTENDED_SIZE, image, EXTENDED_SIZE);
+            }
+            fpuReset();
+            break;
+        case 0x2F: memory->write16(address, fpu.statusWord); break;
+
+        case 0x38: stack.push(fpuLoad<T>(address, FPU_I16)); break;
+        case 0x39: storeInteger(FPU_I16, true, true); break;
+        case 0x3A: storeInteger(FPU_I16, false, false); break;
+        case 0x3B: storeInteger(FPU_I16, false, true); break;
+        case 0x3C: stack.push(fpuLoad<T>(address, FPU_BCD)); break;
+        case 0x3D: stack.push(fpuLoad<T>(address, FPU_I64)); break;
+        case 0x3E: storeInteger(FPU_BCD, false, true); break;
+        case 0x3F: storeInteger(FPU_I64, false, true); break;
+
+        default:
+            invalidInstruction(insn);
+            break;
+    }
+}
+
+template <typename T>
+void X86Core::fpuRegisterOp(const X86Instruction& insn) {
+    FPUStack<T> stack(fpu);
+    uint8_t escape = insn.opcode & 7;
+    uint8_t i = insn.rm;
+
+    auto compareWith = [&](uint8_t index, uint8_t pops) {
+        stack.setCondition(compare(stack.get(0), stack.get(index)));
+        while (pops--) stack.pop();
+    };
+    auto compareFlags = [&](bool pop) {
+        uint16_t bits = compare(stack.get(0), stack.get(i));
+        materializeFlags();
+        eflags = (eflags & ~JIT_FLAGS_ARITH) | ((bits & FPU_C3) ? JIT_FLAG_ZF : 0) |
+                 ((bits & FPU_C2) ? JIT_FLAG_PF : 0) | ((bits & FPU_C0) ? JIT_FLAG_CF : 0);
+        if (pop) stack.pop();
+    };
+    auto exchange = [&]() {
+        T st0 = stack.get(0);
+        T sti = stack.get(i);
+        stack.set(0, sti);
+        stack.set(i, st0);
+    };
+    auto storeTo = [&](bool pop) {
+        stack.set(i, stack.get(0));
+        if (pop) stack.pop();
+    };
+    // DC and DE write ST(i), and their sub/div encodings are the reverse of D8's.
+    auto arithmeticToSTi = [&](bool pop) {
+        uint8_t op = insn.reg >= 4 ? insn.reg ^ 1 : insn.reg;
+        stack.set(i, arithmetic(op, stack.get(i), stack.get(0), stack));
+        if (pop) stack.pop();
+    };
+    auto conditionalMove = [&](uint8_t cond) {
+        if (testCondition(cond)) stack.set(0, stack.get(i));
+    };
+
+    static const uint8_t fcmovConditions[4] = {0x2, 0x4, 0x6, 0xA};
+
+    switch (escape) {
+        case 0:
+            if (insn.reg == 2 || insn.reg == 3) {
+                compareWith(i, insn.reg - 2);
+            } else {
+                stack.set(0, arithmetic(insn.reg, stack.get(0), stack.get(i), stack));
+            }
+            return;
+        case 1:
+            break;
+        case 2:
+            if (insn.reg < 4) {
+                conditionalMove(fcmovConditions[insn.reg]);
+            } else if (insn.modrm == 0xE9) {
+                compareWith(1, 2);
+            } else {
+                invalidInstruction(insn);
+            }
+            return;
+        case 3:
+            if (insn.reg < 4) {
+                conditionalMove(fcmovConditions[insn.reg] | 1);
+            } else if (insn.reg == 5 || insn.reg == 6) {
+                compareFlags(false);
+            } else if (insn.modrm == 0xE2) {
+                fpu.statusWord &= ~(FPU_EXCEPTIONS | FPU_SF | FPU_ES | FPU_BUSY);
+            } else if (insn.modrm == 0xE3) {
+                fpuReset();
+            } else if (insn.modrm != 0xE0 && insn.modrm != 0xE1 && insn.modrm != 0xE4) {
+                invalidInstruction(insn);
+            }
+            return;
+        case 4:
+            if (insn.reg == 2 || insn.reg == 3) {
+                compareWith(i, insn.reg - 2);
+            } else {
+                arithmeticToSTi(false);
+            }
+            return;
+        case 5:
+            switch (insn.reg) {
+                case 0: stack.free(i); break;
+                case 1: exchange(); break;
+                case 2: storeTo(false); break;
+                case 3: storeTo(true); break;
+                case 4: compareWith(i, 0); break;
+                case 5: compareWith(i, 1); break;
+                default: invalidInstruction(insn); break;
+            }
+            return;
+        case 6:
+            if (insn.reg == 2) {
+                compareWith(i, 1);
+            } else if (insn.reg == 3) {
+                if (i == 1) {
+                    compareWith(1, 2);
+                } else {
+                    invalidInstruction(insn);
+                }
+            } else {
+                arithmeticToSTi(true);
+            }
+            return;
+        default:
+            switch (insn.reg) {
+                case 0: stack.free(i); stack.pop(); break;
+                case 1: exchange(); break;
+                case 2:
+                case 3: storeTo(true); break;
+                case 4:
+                    if (i == 0) {
+                        writeRegister(0, 2, fpu.statusWord);
+                    } else {
+                        invalidInstruction(insn);
+                    }
+                    break;
+                case 5:
+                case 6: compareFlags(true); break;
+                default: invalidInstruction(insn); break;
+            }
+            return;
+    }
+
+    // D9: loads, exchanges, constants and the transcendental group.
+    switch (insn.reg) {
+        case 0: stack.push(stack.get(i)); return;
+        case 1: exchange(); return;
+        case 2:
+            if (i != 0) invalidInstruction(insn);
+            return;
+        case 3: storeTo(true); return;
+        default:
+            break;
+    }
+
+    static const long double constants[7] = {
+        1.0L,
+        3.321928094887362347870319429489390175864831393L,
+        1.442695040888963407359924681001892137426645954L,
+        3.141592653589793238462643383279502884197169399L,
+        0.301029995663981195213738894724493026768189881L,
+        0.693147180559945309417232121458176568075500134L,
+        0.0L
+    };
+
+    T st0;
+    switch (insn.modrm) {
+        case 0xE0: stack.set(0, -stack.get(0)); break;
+        case 0xE1: stack.set(0, std::fabs(stack.get(0))); break;
+        case 0xE4: stack.setCondition(compare(stack.get(0), T(0))); break;
+        case 0xE5: {
+            uint16_t bits = FPU_C3 | FPU_C0;
+            st0 = loadSlot<T>(fpu, stack.physical(0));
+            if (!stack.isEmpty(0)) {
+                switch (std::fpclassify(st0)) {
+                    case FP_NAN: bits = FPU_C0; break;
+                    case FP_INFINITE: bits = FPU_C2 | FPU_C0; break;
+                    case FP_ZERO: bits = FPU_C3; break;
+                    case FP_SUBNORMAL: bits = FPU_C3 | FPU_C2; break;
+                    default: bits = FPU_C2; break;
+                }
+            }
+            stack.setCondition(bits | (std::signbit(st0) ? FPU_C1 : 0));
+            break;
+        }
+        case 0xE8: case 0xE9: case 0xEA: case 0xEB:
+        case 0xEC: case 0xED: case 0xEE:
+            stack.push(static_cast<T>(constants[insn.modrm - 0xE8]));
+            break;
+        case 0xF0:
+            st0 = stack.get(0);
+            stack.set(0, std::expm1(st0 * static_cast<T>(constants[5])));
+            break;
+        case 0xF1:
+        case 0xF9: {
+            st0 = stack.get(0);
+            T logarithm = insn.modrm == 0xF1 ? std::log2(st0) : std::log1p(st0) / static_cast<T>(constants[5]);
+            stack.set(1, stack.get(1) * logarithm);
+            stack.pop();
+            break;
+        }
+        case 0xF2:
+            stack.set(0, std::tan(stack.get(0)));
+            stack.push(T(1));
+            break;
+        case 0xF3:
+            stack.set(1, std::atan2(stack.get(1), stack.get(0)));
+            stack.pop();
+            break;
+        case 0xF4: {
+            st0 = stack.get(0);
+            T exponent = std::logb(st0);
+            stack.set(0, exponent);
+            stack.push(std::isfinite(exponent) ? std::scalbn(st0, -static_cast<int>(exponent)) : st0);
+            break;
+        }
+        case 0xF5:
+        case 0xF8: {
+            // The remainder is always complete, so C2 is never left set.
+            st0 = stack.get(0);
+            T divisor = stack.get(1);
+            T quotient = insn.modrm == 0xF5 ? std::nearbyint(st0 / divisor) : std::trunc(st0 / divisor);
+            T remainder = insn.modrm == 0xF5 ? std::remainder(st0, divisor) : std::fmod(st0, divisor);
+            uint64_t q = std::isfinite(quotient) ? static_cast<uint64_t>(std::fmod(std::fabs(quotient), T(8))) : 0;
+            stack.set(0, remainder);
+            stack.setCondition(((q & 4) ? FPU_C0 : 0) | ((q & 2) ? FPU_C3 : 0) | ((q & 1) ? FPU_C1 : 0));
+            break;
+        }
+        case 0xF6: stack.setTop(stack.physical(7)); break;
+        case 0xF7: stack.setTop(stack.physical(1)); break;
+        case 0xFA:
+            st0 = stack.get(0);
+            if (st0 < 0) stack.raise(FPU_IE);
+            stack.set(0, std::sqrt(st0));
+            break;
+        case 0xFB:
+            st0 = stack.get(0);
+            stack.set(0, std::sin(st0));
+            stack.push(std::cos(st0));
+            break;
+        case 0xFC: stack.set(0, roundToInteger(stack.get(0), fpu.controlWord)); break;
+        case 0xFD: {
+            T scale = stack.get(1);
+            st0 = stack.get(0);
+            stack.set(0, std::isfinite(scale) ? std::scalbn(st0, static_cast<int>(std::trunc(scale))) : st0 * scale);
+            break;
+        }
+        case 0xFE: stack.set(0, std::sin(stack.get(0))); break;
+        case 0xFF: stack.set(0, std::cos(stack.get(0))); break;
+        default:
+            invalidInstruction(insn);
+            break;
+    }
+}
+
+template <typename T>
+T X86Core::fpuLoad(uint32_t address, uint8_t format) {
+    switch (format) {
+        case FPU_F32: {
+            uint32_t bits = memory->read32(address);
+            float value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        case FPU_I32: return static_cast<int32_t>(memory->read32(address));
+        case FPU_I16: return static_cast<int16_t>(memory->read16(address));
+        case FPU_F64:
+        case FPU_I64: {
+            uint64_t bits = memory->read32(address) | (static_cast<uint64_t>(memory->read32(address + 4)) << 32);
+            if (format == FPU_I64) return static_cast<T>(static_cast<int64_t>(bits));
+            double value;
+            memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+        case FPU_F80: {
+            uint8_t image[EXTENDED_SIZE];
+            memory->readBlock(address, image, EXTENDED_SIZE);
+            return static_cast<T>(extendedToHost(image));
+        }
+        default: {
+            uint8_t packed[EXTENDED_SIZE];
+            memory->readBlock(address, packed, EXTENDED_SIZE);
+            T value = 0;
+            for (int i = 8; i >= 0; i--) {
+                value = value * 100 + (packed[i] >> 4) * 10 + (packed[i] & 0xF);
+            }
+            return (packed[9] & 0x80) ? -value : value;
+        }
+    }
+}
+
+template <typename T>
+void X86Core::fpuStore(uint32_t address, uint8_t format, T value) {
+    switch (format) {
+        case FPU_F32: {
+            float single = static_cast<float>(value);
+            uint32_t bits;
+            memcpy(&bits, &single, sizeof(bits));
+            memory->write32(address, bits);
+            return;
+        }
+        case FPU_F64: {
+            double wide = static_cast<double>(value);
+            uint64_t bits;
+            memcpy(&bits, &wide, sizeof(bits));
+            memory->write32(address, static_cast<uint32_t>(bits));
+            memory->write32(address + 4, static_cast<uint32_t>(bits >> 32));
+            return;
+        }
+        case FPU_F80: {
+            uint8_t image[EXTENDED_SIZE];
+            hostToExtended(value, image);
+            memory->writeBlock(address, image, EXTENDED_SIZE);
+            return;
+        }
+        default:
+            break;
+    }
+
+    // Out-of-range and NaN values store the integer indefinite and raise IE.
+    T rounded = roundToInteger(value, fpu.controlWord);
+    T limit = format == FPU_I16 ? T(32768) : format == FPU_I32 ? T(2147483648.0)
+            : format == FPU_I64 ? T(9223372036854775808.0) : T(1e18);
+    bool valid = std::isfinite(rounded) && rounded < limit &&
+                 (format == FPU_BCD ? rounded > -limit : rounded >= -limit);
+    if (!valid) {
+        fpu.statusWord |= FPU_IE;
+    }
+
+    switch (format) {
+        case FPU_I16:
+            memory->write16(address, valid ? static_cast<uint16_t>(static_cast<int16_t>(rounded)) : 0x8000);
+            break;
+        case FPU_I32:
+            memory->write32(address, valid ? static_cast<uint32_t>(static_cast<int32_t>(rounded)) : 0x80000000);
+            break;
+        case FPU_I64: {
+            uint64_t bits = valid ? static_cast<uint64_t>(static_cast<int64_t>(rounded)) : 0x8000000000000000ull;
+            memory->write32(address, static_cast<uint32_t>(bits));
+            memory->write32(address + 4, static_cast<uint32_t>(bits >> 32));
+            break;
+        }
+        default: {
+            uint8_t packed[EXTENDED_SIZE] = {0, 0, 0, 0, 0, 0, 0, 0xC0, 0xFF, 0xFF};
+            if (valid) {
+                uint64_t magnitude = static_cast<uint64_t>(std::fabs(rounded));
+                for (uint32_t i = 0; i < 9; i++) {
+                    packed[i] = static_cast<uint8_t>((magnitude % 10) | (((magnitude / 10) % 10) << 4));
+                    magnitude /= 100;
+                }
+                packed[9] = std::signbit(rounded) ? 0x80 : 0;
+            }
+            memory->writeBlock(address, packed, EXTENDED_SIZE);
+            break;
+        }
+    }
+}
+
+// 32-bit protected-mode layout; the 16-bit operand-size form is not used.
+template <typename T>
+void X86Core::fpuStoreEnvironment(uint32_t address) {
+    uint16_t tags = 0;
+    for (uint8_t slot = 0; slot < 8; slot++) {
+        uint16_t tag = ((fpu.tagWord >> (slot * 2)) & 3) == 3 ? 3 : fullTag(loadSlot<T>(fpu, slot));
+        tags |= tag << (slot * 2);
+    }
+
+    memory->write32(address, 0xFFFF0000 | fpu.controlWord);
+    memory->write32(address + 4, 0xFFFF0000 | fpu.statusWord);
+    memory->write32(address + 8, 0xFFFF0000 | tags);
+    memory->write32(address + 12, fpu.lastIP);
+    memory->write32(address + 16, fpu.lastCS | (static_cast<uint32_t>(fpu.lastOpcode) << 16));
+    memory->write32(address + 20, fpu.lastDP);
+    memory->write32(address + 24, 0xFFFF0000 | fpu.lastDS);
+}
+
+void X86Core::fpuLoadEnvironment(uint32_t address) {
+    fpuSetControlWord(memory->read16(address));
+    fpu.statusWord = memory->read16(address + 4);
+
+    uint16_t tags = memory->read16(address + 8);
+    fpu.tagWord = 0;
+    for (uint8_t slot = 0; slot < 8; slot++) {
+        if (((tags >> (slot * 2)) & 3) == 3) {
+            fpu.tagWord |= 3u << (slot * 2);
+        }
+    }
+
+    fpu.lastIP = memory->read32(address + 12);
+    uint32_t selector = memory->read32(address + 16);
+    fpu.lastCS = selector & 0xFFFF;
+    fpu.lastOpcode = (selector >> 16) & 0x07FF;
+    fpu.lastDP = memory->read32(address + 20);
+    fpu.lastDS = memory->read16(address + 24);
+}
+
+// The x87 half of the FXSAVE image: an abridged tag byte with one bit per
+// non-empty register, and ST(i) in stack order at 16-byte strides.
+void X86Core::fpuSaveState(uint32_t address) {
+    uint8_t tags = 0;
+    for (uint8_t slot = 0; slot < 8; slot++) {
+        if (((fpu.tagWord >> (slot * 2)) & 3) != 3) {
+            tags |= 1u << slot;
+        }
+    }
+
+    memory->write16(address, fpu.controlWord);
+    memory->write16(address + 2, fpu.statusWord);
+    memory->write16(address + 4, tags);
+    memory->write16(address + 6, fpu.lastOpcode);
+    memory->write32(address + 8, fpu.lastIP);
+    memory->write32(address + 12, fpu.lastCS);
+    memory->write32(address + 16, fpu.lastDP);
+    memory->write32(address + 20, fpu.lastDS);
+
+    bool precise = fpuPrecise();
+    uint8_t top = (fpu.statusWord >> 11) & 7;
+    for (uint8_t i = 0; i < 8; i++) {
+        uint8_t image[16] = {};
+        uint8_t slot = (top + i) & 7;
+        if (precise) {
+            memcpy(image, fpu.st[slot], EXTENDED_SIZE);
+        } else {
+            hostToExtended(fpu.fast[slot], image);
+        }
+        memory->writeBlock(address + 32 + i * 16, image, sizeof(image));
+    }
+}
+
+void X86Core::fpuRestoreState(uint32_t address) {
+    fpuSetControlWord(memory->read16(address));
+    fpu.statusWord = memory->read16(address + 2);
+
+    uint8_t tags = memory->read8(address + 4);
+    fpu.tagWord = 0;
+    for (uint8_t slot = 0; slot < 8; slot++) {
+        if (!(tags & (1u << slot))) {
+            fpu.tagWord |= 3u << (slot * 2);
+        }
+    }
+
+    fpu.lastOpcode = memory->read16(address + 6) & 0x07FF;
+    fpu.lastIP = memory->read32(address + 8);
+    fpu.lastCS = memory->read16(address + 12);
+    fpu.lastDP = memory->read32(address + 16);
+    fpu.lastDS = memory->read16(address + 20);
+
+    bool precise = fpuPrecise();
+    uint8_t top = (fpu.statusWord >> 11) & 7;
+    for (uint8_t i = 0; i < 8; i++) {
+        uint8_t image[EXTENDED_SIZE];
+        memory->readBlock(address + 32 + i * 16, image, EXTENDED_SIZE);
+        uint8_t slot = (top + i) & 7;
+        if (precise) {
+            memcpy(fpu.st[slot], image, EXTENDED_SIZE);
+        } else {
+            fpu.fast[slot] = static_cast<double>(extendedToHost(image));
+        }
+    }
+}
@@ -0,0 +1,1133 @@
+#include "x86_core.h"
+#include <android/log.h>
+
+#define LOG_TAG "X86Core"
+#define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr uint32_t FLAG_TF = 0x100;
+constexpr uint32_t FLAG_IF = 0x200;
+constexpr uint32_t FLAG_DF = 0x400;
+constexpr uint32_t POPF_MASK = 0x00247FD5;
+
+inline uint32_t sizeMask(uint8_t size) {
+    return size == 4 ? 0xFFFFFFFF : (1u << (size * 8)) - 1;
+}
+
+inline int32_t signExtend(uint32_t value, uint8_t size) {
+    uint32_t shift = 32 - size * 8;
+    return static_cast<int32_t>(value << shift) >> shift;
+}
+
+}
+
+const std::array<X86Core::InstructionHandler, 512>& X86Core::handlerTable() {
+    static const std::array<InstructionHandler, 512> table = [] {
+        std::array<InstructionHandler, 512> t{};
+        auto set = [&t](uint16_t first, uint16_t last, InstructionHandler handler) {
+            for (uint16_t op = first; op <= last; op++) {
+                t[op] = handler;
+            }
+        };
+
+        for (uint16_t op = 0x00; op < 0x40; op += 8) {
+            set(op + 0, op + 1, &X86Core::alu_rm_r);
+            set(op + 2, op + 3, &X86Core::alu_r_rm);
+            set(op + 4, op + 5, &X86Core::alu_acc_imm);
+        }
+        for (uint16_t op = 0x06; op < 0x20; op += 8) {
+            set(op, op, &X86Core::push_sreg);
+            set(op + 1, op + 1, &X86Core::pop_sreg);
+        }
+        set(0x40, 0x47, &X86Core::inc_reg);
+        set(0x48, 0x4F, &X86Core::dec_reg);
+        set(0x50, 0x57, &X86Core::push_reg);
+        set(0x58, 0x5F, &X86Core::pop_reg);
+        set(0x60, 0x60, &X86Core::pushad);
+        set(0x61, 0x61, &X86Core::popad);
+        set(0x68, 0x68, &X86Core::push_imm);
+        set(0x69, 0x69, &X86Core::imul_r_rm_imm);
+        set(0x6A, 0x6A, &X86Core::push_imm);
+        set(0x6B, 0x6B, &X86Core::imul_r_rm_imm);
+        set(0x70, 0x7F, &X86Core::jcc);
+        set(0x80, 0x83, &X86Core::group1);
+        set(0x84, 0x85, &X86Core::test_rm_r);
+        set(0x86, 0x87, &X86Core::xchg_rm_r);
+        set(0x88, 0x89, &X86Core::mov_rm_r);
+        set(0x8A, 0x8B, &X86Core::mov_r_rm);
+        set(0x8C, 0x8C, &X86Core::mov_rm_sreg);
+        set(0x8D, 0x8D, &X86Core::lea);
+        set(0x8E, 0x8E, &X86Core::mov_sreg_rm);
+        set(0x8F, 0x8F, &X86Core::pop_rm);
+        set(0x90, 0x90, &X86Core::nop);
+        set(0x91, 0x97, &X86Core::xchg_acc_reg);
+        set(0x98, 0x98, &X86Core::cwde);
+        set(0x99, 0x99, &X86Core::cdq);
+        set(0x9C, 0x9C, &X86Core::pushfd);
+        set(0x9D, 0x9D, &X86Core::popfd);
+        set(0x9B, 0x9B, &X86Core::nop);
+        set(0x9E, 0x9E, &X86Core::sahf);
+        set(0x9F, 0x9F, &X86Core::lahf);
+        set(0xA0, 0xA1, &X86Core::mov_r_rm);
+        set(0xA2, 0xA3, &X86Core::mov_rm_r);
+        set(0xA4, 0xA5, &X86Core::movs);
+        set(0xA6, 0xA7, &X86Core::cmps);
+        set(0xA8, 0xA9, &X86Core::test_acc_imm);
+        set(0xAA, 0xAB, &X86Core::stos);
+        set(0xAC, 0xAD, &X86Core::lods);
+        set(0xAE, 0xAF, &X86Core::scas);
+        set(0xB0, 0xBF, &X86Core::mov_r_imm);
+        set(0xC0, 0xC1, &X86Core::group2);
+        set(0xC2, 0xC2, &X86Core::ret_imm);
+        set(0xC3, 0xC3, &X86Core::ret);
+        set(0xC6, 0xC7, &X86Core::mov_rm_imm);
+        set(0xC8, 0xC8, &X86Core::enter);
+        set(0xC9, 0xC9, &X86Core::leave);
+        set(0xCC, 0xCC, &X86Core::int3);
+        set(0xCD, 0xCD, &X86Core::int_imm);
+        set(0xCF, 0xCF, &X86Core::iret);
+        set(0xD0, 0xD3, &X86Core::group2);
+        set(0xD7, 0xD7, &X86Core::xlat);
+        set(0xD8, 0xDF, &X86Core::fpu_escape);
+        set(0xE0, 0xE2, &X86Core::loop);
+        set(0xE3, 0xE3, &X86Core::jecxz);
+        set(0xE4, 0xE5, &X86Core::in_acc);
+        set(0xE6, 0xE7, &X86Core::out_acc);
+        set(0xE8, 0xE8, &X86Core::call_rel);
+        set(0xE9, 0xE9, &X86Core::jmp_rel);
+        set(0xEB, 0xEB, &X86Core::jmp_rel);
+        set(0xEC, 0xED, &X86Core::in_acc);
+        set(0xEE, 0xEF, &X86Core::out_acc);
+        set(0xF4, 0xF4, &X86Core::hlt);
+        set(0xF5, 0xF5, &X86Core::flag_control);
+        set(0xF6, 0xF7, &X86Core::group3);
+        set(0xF8, 0xFD, &X86Core::flag_control);
+        set(0xFE, 0xFE, &X86Core::group4);
+        set(0xFF, 0xFF, &X86Core::group5);
+
+        set(0x101, 0x101, &X86Core::group7);
+        set(0x108, 0x109, &X86Core::nop);
+        set(0x10D, 0x10D, &X86Core::nop);
+        set(0x110, 0x118, &X86Core::sse_op);
+        set(0x119, 0x11F, &X86Core::nop);
+        set(0x128, 0x12F, &X86Core::sse_op);
+        set(0x140, 0x14F, &X86Core::cmovcc);
+        set(0x131, 0x131, &X86Core::rdtsc);
+        set(0x150, 0x17F, &X86Core::sse_op);
+        set(0x180, 0x18F, &X86Core::jcc);
+        set(0x190, 0x19F, &X86Core::setcc);
+        set(0x1A0, 0x1A0, &X86Core::push_sreg);
+        set(0x1A1, 0x1A1, &X86Core::pop_sreg);
+        set(0x1A2, 0x1A2, &X86Core::cpuid);
+        set(0x1A3, 0x1A3, &X86Core::bt_rm_r);
+        set(0x1A4, 0x1A5, &X86Core::shld);
+        set(0x1A8, 0x1A8, &X86Core::push_sreg);
+        set(0x1A9, 0x1A9, &X86Core::pop_sreg);
+        set(0x1AB, 0x1AB, &X86Core::bt_rm_r);
+        set(0x1AC, 0x1AD, &X86Core::shrd);
+        set(0x1AE, 0x1AE, &X86Core::sse_op);
+        set(0x1AF, 0x1AF, &X86Core::imul_r_rm);
+        set(0x1B0, 0x1B1, &X86Core::cmpxchg);
+        set(0x1B3, 0x1B3, &X86Core::bt_rm_r);
+        set(0x1B6, 0x1B7, &X86Core::movzx);
+        set(0x1BA, 0x1BA, &X86Core::bt_rm_imm);
+        set(0x1BB, 0x1BB, &X86Core::bt_rm_r);
+        set(0x1BC, 0x1BC, &X86Core::bsf);
+        set(0x1BD, 0x1BD, &X86Core::bsr);
+        set(0x1BE, 0x1BF, &X86Core::movsx);
+        set(0x1C0, 0x1C1, &X86Core::xadd);
+        set(0x1C2, 0x1C6, &X86Core::sse_op);
+        set(0x1C7, 0x1C7, &X86Core::cmpxchg8b);
+        set(0x1C8, 0x1CF, &X86Core::bswap);
+        set(0x1D0, 0x1FF, &X86Core::sse_op);
+        return t;
+    }();
+    return table;
+}
+
+X86Core::InstructionHandler X86Core::handlerFor(const X86Instruction& insn) const {
+    // There are no segment bases yet, so fs/gs-relative accesses fall back
+    // to the legacy path and fault there instead of touching flat memory.
+    if (insn.segment == X86Instruction::SEG_FS || insn.segment == X86Instruction::SEG_GS) {
+        return nullptr;
+    }
+    uint16_t index = insn.opcode < 0x100 ? insn.opcode : (0x100 | (insn.opcode & 0xFF));
+    return handlerTable()[index];
+}
+
+uint32_t X86Core::effectiveAddress(const X86Instruction& insn) const {
+    uint32_t address = static_cast<uint32_t>(insn.disp);
+    if (insn.base != X86Instruction::NO_REG) {
+        address += getRegister(insn.base);
+    }
+    if (insn.index != X86Instruction::NO_REG) {
+        address += getRegister(insn.index) << insn.scale;
+    }
+    return address;
+}
+
+uint32_t X86Core::readOperand(const X86Instruction& insn) {
+    return readOperand(insn, insn.operandSize);
+}
+
+uint32_t X86Core::readOperand(const X86Instruction& insn, uint8_t size) {
+    if (insn.isRegisterOperand()) {
+        return readRegister(insn.rm, size);
+    }
+    return readMemory(effectiveAddress(insn), size);
+}
+
+void X86Core::writeOperand(const X86Instruction& insn, uint32_t value) {
+    writeOperand(insn, insn.operandSize, value);
+}
+
+void X86Core::writeOperand(const X86Instruction& insn, uint8_t size, uint32_t value) {
+    if (insn.isRegisterOperand()) {
+        writeRegister(insn.rm, size, value);
+        return;
+    }
+    writeMemory(effectiveAddress(insn), size, value);
+}
+
+uint32_t X86Core::readRegister(uint8_t reg, uint8_t size) const {
+    switch (size) {
+        case 1: return (getRegister(reg & 3) >> ((reg & 4) ? 8 : 0)) & 0xFF;
+        case 2: return getRegister(reg) & 0xFFFF;
+        default: return getRegister(reg);
+    }
+}
+
+void X86Core::writeRegister(uint8_t reg, uint8_t size, uint32_t value) {
+    switch (size) {
+        case 1: {
+            uint32_t shift = (reg & 4) ? 8 : 0;
+            uint32_t full = getRegister(reg & 3);
+            setRegister(reg & 3, (full & ~(0xFFu << shift)) | ((value & 0xFF) << shift));
+            break;
+        }
+        case 2:
+            setRegister(reg, (getRegister(reg) & 0xFFFF0000) | (value & 0xFFFF));
+            break;
+        default:
+            setRegister(reg, value);
+            break;
+    }
+}
+
+uint32_t X86Core::readMemory(uint32_t address, uint8_t size) {
+    switch (size) {
+        case 1: return memory->read8(address);
+        case 2: return memory->read16(address);
+        default: return memory->read32(address);
+    }
+}
+
+void X86Core::writeMemory(uint32_t address, uint8_t size, uint32_t value) {
+    switch (size) {
+        case 1: memory->write8(address, static_cast<uint8_t>(value)); break;
+        case 2: memory->write16(address, static_cast<uint16_t>(value)); break;
+        default: memory->write32(address, value); break;
+    }
+}
+
+uint16_t* X86Core::segmentRegister(uint8_t index) {
+    switch (index) {
+        case X86Instruction::SEG_ES: return &es;
+        case X86Instruction::SEG_CS: return &cs;
+        case X86Instruction::SEG_SS: return &ss;
+        case X86Instruction::SEG_DS: return &ds;
+        case X86Instruction::SEG_FS: return &fs;
+        case X86Instruction::SEG_GS: return &gs;
+        default: return nullptr;
+    }
+}
+
+void X86Core::push(uint32_t value) {
+    memory->write32(esp - 4, value);
+    esp -= 4;
+}
+
+uint32_t X86Core::pop() {
+    uint32_t value = memory->read32(esp);
+    esp += 4;
+    return value;
+}
+
+uint32_t X86Core::aluOperation(uint8_t op, uint32_t a, uint32_t b, uint8_t size) {
+    uint32_t mask = sizeMask(size);
+    uint32_t sign = size * 8 - 1;
+    a &= mask;
+    b &= mask;
+
+    uint32_t result;
+    switch (op) {
+        case 0:
+            result = (a + b) & mask;
+            updateFlags(result, a, b, ALU_ADD, size);
+            break;
+        case 1:
+            result = a | b;
+            updateFlags(result, a, b, ALU_OR, size);
+            break;
+        case 2: {
+            uint32_t carry = carryFlag();
+            result = (a + b + carry) & mask;
+            setResultFlags(result, size, static_cast<uint64_t>(a) + b + carry > mask,
+                           (((a ^ result) & (b ^ result)) >> sign) & 1, (a ^ b ^ result) & 0x10);
+            break;
+        }
+        case 3: {
+            uint32_t borrow = carryFlag();
+            result = (a - b - borrow) & mask;
+            setResultFlags(result, size, static_cast<uint64_t>(a) < static_cast<uint64_t>(b) + borrow,
+                           (((a ^ b) & (a ^ result)) >> sign) & 1, (a ^ b ^ result) & 0x10);
+            break;
+        }
+        case 4:
+            result = a & b;
+            updateFlags(result, a, b, ALU_AND, size);
+            break;
+        case 6:
+            result = a ^ b;
+            updateFlags(result, a, b, ALU_XOR, size);
+            break;
+        default:
+            result = (a - b) & mask;
+            updateFlags(result, a, b, ALU_SUB, size);
+            break;
+    }
+    return result;
+}
+
+uint32_t X86Core::incDec(uint32_t value, bool decrement, uint8_t size) {
+    uint32_t mask = sizeMask(size);
+    value &= mask;
+    uint32_t result = (decrement ? value - 1 : value + 1) & mask;
+    updateFlags(result, value, 1, decrement ? ALU_DEC : ALU_INC, size);
+    return result;
+}
+
+uint32_t X86Core::shiftOperation(uint8_t op, uint32_t value, uint8_t count, uint8_t size) {
+    uint32_t mask = sizeMask(size);
+    uint32_t bits = size * 8;
+    uint32_t msb = bits - 1;
+    value &= mask;
+    count &= 31;
+    if (count == 0) {
+        return value;
+    }
+
+    switch (op) {
+        case 0:
+        case 1: {
+            uint32_t n = count % bits;
+            uint32_t result = value;
+            if (n) {
+                result = op == 0 ? (value << n) | (value >> (bits - n)) : (value >> n) | (value << (bits - n));
+                result &= mask;
+            }
+            bool carry = op == 0 ? (result & 1) : ((result >> msb) & 1);
+            bool overflow = op == 0 ? (((result >> msb) & 1) != carry)
+                                    : ((((result >> msb) ^ (result >> (msb - 1))) & 1) != 0);
+            setFlag(JIT_FLAG_CF, carry);
+            setFlag(JIT_FLAG_OF, overflow);
+            return result;
+        }
+        case 2:
+        case 3: {
+            uint32_t n = count % (bits + 1);
+            bool carry = carryFlag();
+            uint32_t result = value;
+            for (uint32_t i = 0; i < n; i++) {
+                bool out;
+                if (op == 2) {
+                    out = (result >> msb) & 1;
+                    result = ((result << 1) | carry) & mask;
+                } else {
+                    out = result & 1;
+                    result = (result >> 1) | (static_cast<uint32_t>(carry) << msb);
+                }
+                carry = out;
+            }
+            bool overflow = op == 2 ? (((result >> msb) & 1) != carry)
+                                    : ((((result >> msb) ^ (result >> (msb - 1))) & 1) != 0);
+            setFlag(JIT_FLAG_CF, carry);
+            setFlag(JIT_FLAG_OF, overflow);
+            return result;
+        }
+        case 5: {
+            uint32_t result = value >> count;
+            setResultFlags(result, size, (value >> (count - 1)) & 1, (value >> msb) & 1, false);
+            return result;
+        }
+        case 7: {
+            int32_t extended = signExtend(value, size);
+            uint32_t result = static_cast<uint32_t>(extended >> count) & mask;
+            setResultFlags(result, size, (extended >> (count - 1)) & 1, false, false);
+            return result;
+        }
+        default: {
+            uint32_t result = (value << count) & mask;
+            bool carry = count <= bits && ((value >> (bits - count)) & 1);
+            setResultFlags(result, size, carry, ((result >> msb) & 1) != carry, false);
+            return result;
+        }
+    }
+}
+
+uint32_t X86Core::signedMultiply(uint32_t a, uint32_t b, uint8_t size) {
+    int64_t product = static_cast<int64_t>(signExtend(a, size)) * signExtend(b, size);
+    uint32_t result = static_cast<uint32_t>(product) & sizeMask(size);
+    bool overflow = product != signExtend(result, size);
+    setResultFlags(result, size, overflow, overflow, false);
+    return result;
+}
+
+void X86Core::bitTest(const X86Instruction& insn, uint32_t bit, uint8_t op) {
+    uint32_t value = readOperand(insn);
+    setFlag(JIT_FLAG_CF, (value >> bit) & 1);
+    switch (op) {
+        case 1: writeOperand(insn, value | (1u << bit)); break;
+        case 2: writeOperand(insn, value & ~(1u << bit)); break;
+        case 3: writeOperand(insn, value ^ (1u << bit)); break;
+    }
+}
+
+void X86Core::invalidInstruction(const X86Instruction& insn) {
+    LOGE("Invalid instruction 0x%04X /%d at 0x%08X", insn.opcode, insn.reg, insn.address);
+    raiseException(EXCEPTION_INVALID_OPCODE);
+}
+
+void X86Core::alu_rm_r(const X86Instruction& insn) {
+    uint8_t op = (insn.opcode >> 3) & 7;
+    uint32_t result = aluOperation(op, readOperand(insn), readRegister(insn.reg, insn.operandSize), insn.operandSize);
+    if (op != 7) {
+        writeOperand(insn, result);
+    }
+}
+
+void X86Core::alu_r_rm(const X86Instruction& insn) {
+    uint8_t op = (insn.opcode >> 3) & 7;
+    uint32_t result = aluOperation(op, readRegister(insn.reg, insn.operandSize), readOperand(insn), insn.operandSize);
+    if (op != 7) {
+        writeRegister(insn.reg, insn.operandSize, result);
+    }
+}
+
+void X86Core::alu_acc_imm(const X86Instruction& insn) {
+    uint8_t op = (insn.opcode >> 3) & 7;
+    uint32_t result = aluOperation(op, readRegister(0, insn.operandSize), insn.imm, insn.operandSize);
+    if (op != 7) {
+        writeRegister(0, insn.operandSize, result);
+    }
+}
+
+void X86Core::group1(const X86Instruction& insn) {
+    uint32_t result = aluOperation(insn.reg, readOperand(insn), insn.imm, insn.operandSize);
+    if (insn.reg != 7) {
+        writeOperand(insn, result);
+    }
+}
+
+void X86Core::inc_reg(const X86Instruction& insn) {
+    uint8_t reg = insn.opcode & 7;
+    writeRegister(reg, insn.operandSize, incDec(readRegister(reg, insn.operandSize), false, insn.operandSize));
+}
+
+void X86Core::dec_reg(const X86Instruction& insn) {
+    uint8_t reg = insn.opcode & 7;
+    writeRegister(reg, insn.operandSize, incDec(readRegister(reg, insn.operandSize), true, insn.operandSize));
+}
+
+void X86Core::push_reg(const X86Instruction& insn) {
+    push(getRegister(insn.opcode & 7));
+}
+
+void X86Core::pop_reg(const X86Instruction& insn) {
+    uint32_t value = pop();
+    setRegister(insn.opcode & 7, value);
+}
+
+// 06/0E/16/1E and 0F A0/A8. The selector is pushed zero-extended.
+void X86Core::push_sreg(const X86Instruction& insn) {
+    uint8_t index = insn.opcode < 0x100 ? insn.opcode >> 3 : 4 + ((insn.opcode >> 3) & 1);
+    push(*segmentRegister(index));
+}
+
+void X86Core::pop_sreg(const X86Instruction& insn) {
+    uint8_t index = insn.opcode < 0x100 ? insn.opcode >> 3 : 4 + ((insn.opcode >> 3) & 1);
+    *segmentRegister(index) = static_cast<uint16_t>(pop());
+}
+
+void X86Core::pushad(const X86Instruction&) {
+    uint32_t original = esp;
+    for (uint8_t reg = 0; reg < 8; reg++) {
+        push(reg == 4 ? original : getRegister(reg));
+    }
+}
+
+void X86Core::popad(const X86Instruction&) {
+    for (int reg = 7; reg >= 0; reg--) {
+        uint32_t value = pop();
+        if (reg != 4) {
+            setRegister(reg, value);
+        }
+    }
+}
+
+void X86Core::push_imm(const X86Instruction& insn) {
+    push(insn.imm);
+}
+
+void X86Core::imul_r_rm_imm(const X86Instruction& insn) {
+    writeRegister(insn.reg, insn.operandSize, signedMultiply(readOperand(insn), insn.imm, insn.operandSize));
+}
+
+void X86Core::jcc(const X86Instruction& insn) {
+    if (testCondition(insn.opcode & 0xF)) {
+        eip += insn.imm;
+    }
+}
+
+void X86Core::test_rm_r(const X86Instruction& insn) {
+    aluOperation(4, readOperand(insn), readRegister(insn.reg, insn.operandSize), insn.operandSize);
+}
+
+void X86Core::xchg_rm_r(const X86Instruction& insn) {
+    uint32_t value = readOperand(insn);
+    writeOperand(insn, readRegister(insn.reg, insn.operandSize));
+    writeRegister(insn.reg, insn.operandSize, value);
+}
+
+void X86Core::mov_rm_r(const X86Instruction& insn) {
+    writeOperand(insn, readRegister(insn.reg, insn.operandSize));
+}
+
+void X86Core::mov_r_rm(const X86Instruction& insn) {
+    writeRegister(insn.reg, insn.operandSize, readOperand(insn));
+}
+
+void X86Core::mov_rm_sreg(const X86Instruction& insn) {
+    uint16_t* sreg = segmentRegister(insn.reg);
+    if (!sreg) {
+        invalidInstruction(insn);
+        return;
+    }
+    writeOperand(insn, insn.isRegisterOperand() ? insn.operandSize : 2, *sreg);
+}
+
+void X86Core::lea(const X86Instruction& insn) {
+    writeRegister(insn.reg, insn.operandSize, effectiveAddress(insn));
+}
+
+void X86Core::mov_sreg_rm(const X86Instruction& insn) {
+    uint16_t* sreg = segmentRegister(insn.reg);
+    if (!sreg || insn.reg == X86Instruction::SEG_CS) {
+        invalidInstruction(insn);
+        return;
+    }
+    *sreg = static_cast<uint16_t>(readOperand(insn, 2));
+}
+
+void X86Core::pop_rm(const X86Instruction& insn) {
+    uint32_t value = pop();
+    writeOperand(insn, value);
+}
+
+void X86Core::nop(const X86Instruction&) {}
+
+void X86Core::xchg_acc_reg(const X86Instruction& insn) {
+    uint8_t reg = insn.opcode & 7;
+    uint32_t value = readRegister(0, insn.operandSize);
+    writeRegister(0, insn.operandSize, readRegister(reg, insn.operandSize));
+    writeRegister(reg, insn.operandSize, value);
+}
+
+void X86Core::cwde(const X86Instruction& insn) {
+    if (insn.operandSize == 2) {
+        writeRegister(0, 2, signExtend(eax, 1));
+    } else {
+        eax = signExtend(eax, 2);
+    }
+}
+
+void X86Core::cdq(const X86Instruction& insn) {
+    if (insn.operandSize == 2) {
+        writeRegister(2, 2, (eax & 0x8000) ? 0xFFFF : 0);
+    } else {
+        edx = static_cast<uint32_t>(static_cast<int32_t>(eax) >> 31);
+    }
+}
+
+void X86Core::pushfd(const X86Instruction&) {
+    push(getEFLAGS() & 0x00FCFFFF);
+}
+
+void X86Core::popfd(const X86Instruction&) {
+    eflags = (pop() & POPF_MASK) | 0x2;
+    flagsOp = ALU_NONE;
+}
+
+void X86Core::sahf(const X86Instruction&) {
+    materializeFlags();
+    eflags = (eflags & ~0xD5u) | (readRegister(4, 1) & 0xD5);
+}
+
+void X86Core::lahf(const X86Instruction&) {
+    writeRegister(4, 1, (getEFLAGS() & 0xD5) | 0x02);
+}
+
+void X86Core::test_acc_imm(const X86Instruction& insn) {
+    aluOperation(4, readRegister(0, insn.operandSize), insn.imm, insn.operandSize);
+}
+
+void X86Core::movs(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t step = (eflags & FLAG_DF) ? -static_cast<uint32_t>(size) : size;
+    bool repeat = insn.prefixes & (X86Instruction::PREFIX_REP | X86Instruction::PREFIX_REPNE);
+    while (!repeat || ecx) {
+        writeMemory(edi, size, readMemory(esi, size));
+        esi += step;
+        edi += step;
+        if (!repeat) break;
+        ecx--;
+    }
+}
+
+void X86Core::cmps(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t step = (eflags & FLAG_DF) ? -static_cast<uint32_t>(size) : size;
+    bool repeat = insn.prefixes & (X86Instruction::PREFIX_REP | X86Instruction::PREFIX_REPNE);
+    bool whileEqual = insn.prefixes & X86Instruction::PREFIX_REP;
+    while (!repeat || ecx) {
+        aluOperation(7, readMemory(esi, size), readMemory(edi, size), size);
+        esi += step;
+        edi += step;
+        if (!repeat) break;
+        ecx--;
+        if (zeroFlag() != whileEqual) break;
+    }
+}
+
+void X86Core::stos(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t step = (eflags & FLAG_DF) ? -static_cast<uint32_t>(size) : size;
+    bool repeat = insn.prefixes & (X86Instruction::PREFIX_REP | X86Instruction::PREFIX_REPNE);
+    uint32_t value = readRegister(0, size);
+    while (!repeat || ecx) {
+        writeMemory(edi, size, value);
+        edi += step;
+        if (!repeat) break;
+        ecx--;
+    }
+}
+
+void X86Core::lods(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t step = (eflags & FLAG_DF) ? -static_cast<uint32_t>(size) : size;
+    bool repeat = insn.prefixes & (X86Instruction::PREFIX_REP | X86Instruction::PREFIX_REPNE);
+    while (!repeat || ecx) {
+        writeRegister(0, size, readMemory(esi, size));
+        esi += step;
+        if (!repeat) break;
+        ecx--;
+    }
+}
+
+void X86Core::scas(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t step = (eflags & FLAG_DF) ? -static_cast<uint32_t>(size) : size;
+    bool repeat = insn.prefixes & (X86Instruction::PREFIX_REP | X86Instruction::PREFIX_REPNE);
+    bool whileEqual = insn.prefixes & X86Instruction::PREFIX_REP;
+    while (!repeat || ecx) {
+        aluOperation(7, readRegister(0, size), readMemory(edi, size), size);
+        edi += step;
+        if (!repeat) break;
+        ecx--;
+        if (zeroFlag() != whileEqual) break;
+    }
+}
+
+void X86Core::mov_r_imm(const X86Instruction& insn) {
+    writeRegister(insn.opcode & 7, insn.operandSize, insn.imm);
+}
+
+void X86Core::group2(const X86Instruction& insn) {
+    uint32_t count;
+    switch (insn.opcode) {
+        case 0xC0: case 0xC1: count = insn.imm; break;
+        case 0xD0: case 0xD1: count = 1; break;
+        default: count = ecx; break;
+    }
+    writeOperand(insn, shiftOperation(insn.reg, readOperand(insn), count & 31, insn.operandSize));
+}
+
+void X86Core::ret_imm(const X86Instruction& insn) {
+    eip = pop();
+    esp += insn.imm & 0xFFFF;
+}
+
+void X86Core::ret(const X86Instruction&) {
+    eip = pop();
+}
+
+void X86Core::mov_rm_imm(const X86Instruction& insn) {
+    writeOperand(insn, insn.imm);
+}
+
+void X86Core::enter(const X86Instruction& insn) {
+    uint32_t frameSize = insn.imm & 0xFFFF;
+    uint8_t level = insn.imm2 & 31;
+    push(ebp);
+    uint32_t frame = esp;
+    for (uint8_t i = 1; i < level; i++) {
+        ebp -= 4;
+        push(memory->read32(ebp));
+    }
+    if (level) {
+        push(frame);
+    }
+    ebp = frame;
+    esp -= frameSize;
+}
+
+void X86Core::leave(const X86Instruction&) {
+    esp = ebp;
+    ebp = pop();
+}
+
+// Software interrupts ignore IF. One without a present gate does nothing,
+// so titles that never load an IDT keep running past their debug traps.
+void X86Core::int3(const X86Instruction&) {
+    deliverInterrupt(3, eip);
+}
+
+void X86Core::int_imm(const X86Instruction& insn) {
+    deliverInterrupt(insn.imm & 0xFF, eip);
+}
+
+void X86Core::iret(const X86Instruction& insn) {
+    if (insn.operandSize != 4) {
+        invalidInstruction(insn);
+        return;
+    }
+    uint32_t target = pop();
+    cs = static_cast<uint16_t>(pop());
+    eflags = (pop() & POPF_MASK) | 0x2;
+    flagsOp = ALU_NONE;
+    eip = target;
+}
+
+void X86Core::handleInterrupt(uint8_t interrupt) {
+    pendingInterrupts[interrupt >> 6] |= 1ull << (interrupt & 63);
+    interruptsPending = true;
+    if (state == CpuState::Halted && (eflags & FLAG_IF)) {
+        state = CpuState::Running;
+    }
+}
+
+// Only 32-bit interrupt and trap gates are delivered; anything else, or a
+// vector past the limit, counts as not present. A fault reading the gate
+// or pushing the frame is left pending for the caller with esp restored.
+bool X86Core::deliverInterrupt(uint8_t vector, uint32_t returnEip) {
+    uint32_t offset = vector * 8u;
+    if (offset + 7 > idtLimit) return false;
+
+    uint64_t gate = memory->read64(idtBase + offset);
+    if (XboxMemory::faultPending()) return false;
+    uint8_t type = (gate >> 40) & 0x9F;
+    if (type != 0x8E && type != 0x8F) return false;
+
+    uint32_t stack = esp;
+    push(getEFLAGS() & 0x00FCFFFF);
+    push(cs);
+    push(returnEip);
+    if (XboxMemory::faultPending()) {
+        esp = stack;
+        return false;
+    }
+
+    eflags &= ~(type == 0x8E ? FLAG_IF | FLAG_TF : FLAG_TF);
+    cs = static_cast<uint16_t>(gate >> 16);
+    eip = static_cast<uint32_t>(gate & 0xFFFF) | (static_cast<uint32_t>(gate >> 32) & 0xFFFF0000);
+    atBlockHead = true;
+    return true;
+}
+
+void X86Core::deliverPendingInterrupt() {
+    if (!(eflags & FLAG_IF)) return;
+    for (uint32_t word = 0; word < pendingInterrupts.size(); word++) {
+        uint64_t bits = pendingInterrupts[word];
+        if (!bits) continue;
+        pendingInterrupts[word] = bits & (bits - 1);
+        interruptsPending = (pendingInterrupts[0] | pendingInterrupts[1] | pendingInterrupts[2] |
+                             pendingInterrupts[3]) != 0;
+        deliverInterrupt(static_cast<uint8_t>(word * 64 + __builtin_ctzll(bits)), eip);
+        return;
+    }
+    interruptsPending = false;
+}
+
+void X86Core::loop(const X86Instruction& insn) {
+    ecx--;
+    bool taken = ecx != 0;
+    if (insn.opcode == 0xE0) taken = taken && !zeroFlag();
+    if (insn.opcode == 0xE1) taken = taken && zeroFlag();
+    if (taken) {
+        eip += insn.imm;
+    }
+}
+
+void X86Core::jecxz(const X86Instruction& insn) {
+    if (ecx == 0) {
+        eip += insn.imm;
+    }
+}
+
+void X86Core::call_rel(const X86Instruction& insn) {
+    push(eip);
+    eip += insn.imm;
+}
+
+void X86Core::jmp_rel(const X86Instruction& insn) {
+    eip += insn.imm;
+}
+
+void X86Core::xlat(const X86Instruction&) {
+    writeRegister(0, 1, readMemory(ebx + (eax & 0xFF), 1));
+}
+
+// E4-E7 take an imm8 port, EC-EF the port in dx.
+void X86Core::in_acc(const X86Instruction& insn) {
+    uint16_t port = (insn.opcode & 8) ? static_cast<uint16_t>(edx) : insn.imm & 0xFF;
+    uint8_t size = insn.operandSize;
+    writeRegister(0, size, portRead ? portRead(port, size) : sizeMask(size));
+}
+
+void X86Core::out_acc(const X86Instruction& insn) {
+    uint16_t port = (insn.opcode & 8) ? static_cast<uint16_t>(edx) : insn.imm & 0xFF;
+    if (portWrite) {
+        portWrite(port, readRegister(0, insn.operandSize), insn.operandSize);
+    }
+}
+
+void X86Core::hlt(const X86Instruction&) {
+    state = CpuState::Halted;
+}
+
+void X86Core::flag_control(const X86Instruction& insn) {
+    switch (insn.opcode) {
+        case 0xF5: setFlag(JIT_FLAG_CF, !carryFlag()); break;
+        case 0xF8: setFlag(JIT_FLAG_CF, false); break;
+        case 0xF9: setFlag(JIT_FLAG_CF, true); break;
+        case 0xFA: eflags &= ~FLAG_IF; break;
+        case 0xFB: eflags |= FLAG_IF; break;
+        case 0xFC: eflags &= ~FLAG_DF; break;
+        case 0xFD: eflags |= FLAG_DF; break;
+    }
+}
+
+void X86Core::group3(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t bits = size * 8;
+    uint32_t mask = sizeMask(size);
+
+    auto readPair = [&]() -> uint64_t {
+        switch (size) {
+            case 1: return eax & 0xFFFF;
+            case 2: return ((edx & 0xFFFF) << 16) | (eax & 0xFFFF);
+            default: return (static_cast<uint64_t>(edx) << 32) | eax;
+        }
+    };
+    auto writePair = [&](uint32_t low, uint32_t high) {
+        if (size == 1) {
+            writeRegister(0, 2, (low & 0xFF) | ((high & 0xFF) << 8));
+        } else {
+            writeRegister(0, size, low);
+            writeRegister(2, size, high);
+        }
+    };
+
+    switch (insn.reg) {
+        case 0:
+        case 1:
+            aluOperation(4, readOperand(insn), insn.imm, size);
+            break;
+        case 2:
+            writeOperand(insn, ~readOperand(insn));
+            break;
+        case 3:
+            writeOperand(insn, aluOperation(5, 0, readOperand(insn), size));
+            break;
+        case 4: {
+            uint64_t product = static_cast<uint64_t>(readRegister(0, size)) * readOperand(insn);
+            writePair(static_cast<uint32_t>(product) & mask, static_cast<uint32_t>(product >> bits));
+            bool overflow = (product >> bits) != 0;
+            setFlag(JIT_FLAG_CF, overflow);
+            setFlag(JIT_FLAG_OF, overflow);
+            break;
+        }
+        case 5: {
+            int64_t product = static_cast<int64_t>(signExtend(readRegister(0, size), size)) *
+                              signExtend(readOperand(insn), size);
+            uint32_t low = static_cast<uint32_t>(product) & mask;
+            writePair(low, static_cast<uint32_t>(static_cast<uint64_t>(product) >> bits));
+            bool overflow = product != signExtend(low, size);
+            setFlag(JIT_FLAG_CF, overflow);
+            setFlag(JIT_FLAG_OF, overflow);
+            break;
+        }
+        case 6: {
+            uint32_t divisor = readOperand(insn);
+            if (divisor == 0) {
+                raiseException(EXCEPTION_DIVIDE);
+                return;
+            }
+            uint64_t dividend = readPair();
+            uint64_t quotient = dividend / divisor;
+            if (quotient > mask) {
+                raiseException(EXCEPTION_DIVIDE);
+                return;
+            }
+            writePair(static_cast<uint32_t>(quotient), static_cast<uint32_t>(dividend % divisor));
+            break;
+        }
+        default: {
+            int64_t divisor = signExtend(readOperand(insn), size);
+            if (divisor == 0) {
+                raiseException(EXCEPTION_DIVIDE);
+                return;
+            }
+            uint64_t pair = readPair();
+            int64_t dividend = size == 4 ? static_cast<int64_t>(pair)
+                                         : signExtend(static_cast<uint32_t>(pair), size * 2);
+            if (divisor == -1 && dividend == INT64_MIN) {
+                raiseException(EXCEPTION_DIVIDE);
+                return;
+            }
+            int64_t quotient = dividend / divisor;
+            int64_t limit = int64_t(1) << (bits - 1);
+            if (quotient >= limit || quotient < -limit) {
+                raiseException(EXCEPTION_DIVIDE);
+                return;
+            }
+            writePair(static_cast<uint32_t>(quotient) & mask, static_cast<uint32_t>(dividend % divisor) & mask);
+            break;
+        }
+    }
+}
+
+void X86Core::group4(const X86Instruction& insn) {
+    if (insn.reg > 1) {
+        invalidInstruction(insn);
+        return;
+    }
+    writeOperand(insn, incDec(readOperand(insn), insn.reg == 1, insn.operandSize));
+}
+
+void X86Core::group5(const X86Instruction& insn) {
+    switch (insn.reg) {
+        case 0:
+        case 1:
+            writeOperand(insn, incDec(readOperand(insn), insn.reg == 1, insn.operandSize));
+            break;
+        case 2: {
+            uint32_t target = readOperand(insn);
+            push(eip);
+            eip = target;
+            break;
+        }
+        case 4:
+            eip = readOperand(insn);
+            break;
+        case 6:
+            push(readOperand(insn));
+            break;
+        default:
+            invalidInstruction(insn);
+            break;
+    }
+}
+
+// LIDT and SIDT. The rest of group 7 (descriptor tables other than the
+// IDT, machine status word, INVLPG) is not emulated.
+void X86Core::group7(const X86Instruction& insn) {
+    if (insn.mod == 3 || (insn.reg != 1 && insn.reg != 3)) {
+        invalidInstruction(insn);
+        return;
+    }
+    uint32_t address = effectiveAddress(insn);
+    if (insn.reg == 1) {
+        memory->write16(address, idtLimit);
+        memory->write32(address + 2, idtBase);
+        return;
+    }
+    uint16_t limit = memory->read16(address);
+    uint32_t base = memory->read32(address + 2);
+    if (XboxMemory::faultPending()) return;
+    idtLimit = limit;
+    idtBase = insn.operandSize == 4 ? base : base & 0x00FFFFFF;
+}
+
+// Reports the Xbox's Pentium III (Coppermine) so titles pick their MMX/SSE paths.
+void X86Core::cpuid(const X86Instruction&) {
+    switch (eax) {
+        case 0:
+            eax = 2;
+            ebx = 0x756E6547;
+            edx = 0x49656E69;
+            ecx = 0x6C65746E;
+            break;
+        case 1:
+            eax = 0x00000683;
+            ebx = 0;
+            ecx = 0;
+            edx = 0x0383F9FF;
+            break;
+        case 2:
+            eax = 0x03020101;
+            ebx = 0;
+            ecx = 0;
+            edx = 0x0C040843;
+            break;
+        default:
+            eax = ebx = ecx = edx = 0;
+            break;
+    }
+}
+
+void X86Core::rdtsc(const X86Instruction&) {
+    auto elapsed = std::chrono::steady_clock::now() - tscEpoch;
+    uint64_t nanoseconds = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+    uint64_t ticks = nanoseconds * 11 / 15;
+    eax = static_cast<uint32_t>(ticks);
+    edx = static_cast<uint32_t>(ticks >> 32);
+}
+
+void X86Core::cmovcc(const X86Instruction& insn) {
+    uint32_t value = readOperand(insn);
+    if (testCondition(insn.opcode & 0xF)) {
+        writeRegister(insn.reg, insn.operandSize, value);
+    }
+}
+
+void X86Core::setcc(const X86Instruction& insn) {
+    writeOperand(insn, testCondition(insn.opcode & 0xF) ? 1 : 0);
+}
+
+void X86Core::bt_rm_r(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t offset = readRegister(insn.reg, size);
+    X86Instruction target = insn;
+    if (!insn.isRegisterOperand()) {
+        target.disp += (signExtend(offset, size) >> (size == 4 ? 5 : 4)) * size;
+    }
+    bitTest(target, offset & (size * 8 - 1), (insn.opcode >> 3) & 3);
+}
+
+void X86Core::bt_rm_imm(const X86Instruction& insn) {
+    if (insn.reg < 4) {
+        invalidInstruction(insn);
+        return;
+    }
+    bitTest(insn, insn.imm & (insn.operandSize * 8 - 1), insn.reg - 4);
+}
+
+void X86Core::shld(const X86Instruction& insn) {
+    uint32_t count = (insn.opcode == 0x0FA4 ? insn.imm : ecx) & 31;
+    uint8_t size = insn.operandSize;
+    uint32_t bits = size * 8;
+    if (count == 0 || count > bits) return;
+    uint32_t dest = readOperand(insn);
+    uint64_t combined = (static_cast<uint64_t>(dest) << bits) | readRegister(insn.reg, size);
+    uint32_t result = static_cast<uint32_t>((combined << count) >> bits) & sizeMask(size);
+    setResultFlags(result, size, (dest >> (bits - count)) & 1, ((result ^ dest) >> (bits - 1)) & 1, false);
+    writeOperand(insn, result);
+}
+
+void X86Core::shrd(const X86Instruction& insn) {
+    uint32_t count = (insn.opcode == 0x0FAC ? insn.imm : ecx) & 31;
+    uint8_t size = insn.operandSize;
+    uint32_t bits = size * 8;
+    if (count == 0 || count > bits) return;
+    uint32_t dest = readOperand(insn);
+    uint64_t combined = (static_cast<uint64_t>(readRegister(insn.reg, size)) << bits) | dest;
+    uint32_t result = static_cast<uint32_t>(combined >> count) & sizeMask(size);
+    setResultFlags(result, size, (dest >> (count - 1)) & 1, ((result ^ dest) >> (bits - 1)) & 1, false);
+    writeOperand(insn, result);
+}
+
+void X86Core::imul_r_rm(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    writeRegister(insn.reg, size, signedMultiply(readRegister(insn.reg, size), readOperand(insn), size));
+}
+
+void X86Core::cmpxchg(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t dest = readOperand(insn);
+    uint32_t accumulator = readRegister(0, size);
+    aluOperation(7, accumulator, dest, size);
+    if (accumulator == dest) {
+        writeOperand(insn, readRegister(insn.reg, size));
+    } else {
+        writeRegister(0, size, dest);
+    }
+}
+
+void X86Core::movzx(const X86Instruction& insn) {
+    writeRegister(insn.reg, insn.operandSize, readOperand(insn, (insn.opcode & 1) ? 2 : 1));
+}
+
+void X86Core::movsx(const X86Instruction& insn) {
+    uint8_t sourceSize = (insn.opcode & 1) ? 2 : 1;
+    writeRegister(insn.reg, insn.operandSize, signExtend(readOperand(insn, sourceSize), sourceSize));
+}
+
+void X86Core::bsf(const X86Instruction& insn) {
+    uint32_t value = readOperand(insn);
+    setFlag(JIT_FLAG_ZF, value == 0);
+    if (value) {
+        writeRegister(insn.reg, insn.operandSize, __builtin_ctz(value));
+    }
+}
+
+void X86Core::bsr(const X86Instruction& insn) {
+    uint32_t value = readOperand(insn);
+    setFlag(JIT_FLAG_ZF, value == 0);
+    if (value) {
+        writeRegister(insn.reg, insn.operandSize, 31 - __builtin_clz(value));
+    }
+}
+
+void X86Core::xadd(const X86Instruction& insn) {
+    uint8_t size = insn.operandSize;
+    uint32_t dest = readOperand(insn);
+    uint32_t sum = aluOperation(0, dest, readRegister(insn.reg, size), size);
+    writeRegister(insn.reg, size, dest);
+    writeOperand(insn, sum);
+}
+
+void X86Core::bswap(const X86Instruction& insn) {
+    uint8_t reg = insn.opcode & 7;
+    setRegister(reg, __builtin_bswap32(getRegister(reg)));
+}
+
+void X86Core::cmpxchg8b(const X86Instruction& insn) {
+    if (insn.reg != 1 || insn.isRegisterOperand()) {
+        invalidInstruction(insn);
+        return;
+    }
+    uint32_t address = effectiveAddress(insn);
+    uint32_t low = memory->read32(address);
+    uint32_t high = memory->read32(address + 4);
+    bool equal = low == eax && high == edx;
+    if (equal) {
+        memory->write32(address, ebx);
+        memory->write32(address + 4, ecx);
+    } else {
+        eax = low;
+        edx = high;
+    }
+    setFlag(JIT_FLAG_ZF, equal);
+}
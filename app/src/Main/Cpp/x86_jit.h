@@ -0,0 +1,183 @@
+#pragma once
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+enum JITReg : uint8_t {
+    JIT_EAX = 0,
+    JIT_ECX,
+    JIT_EDX,
+    JIT_EBX,
+    JIT_ESP,
+    JIT_EBP,
+    JIT_ESI,
+    JIT_EDI,
+    JIT_T0,
+    JIT_T1,
+    JIT_T2,
+    JIT_NONE = 0xFF
+};
+
+constexpr uint8_t JIT_GUEST_REGS = 8;
+
+// Host FP temporaries for x87 ops. They do not survive Load, Store or
+// VectorKernel.
+enum JITFloatReg : uint8_t {
+    JIT_F0 = 0,
+    JIT_F1
+};
+
+// Vector operand index naming the SSE memory-operand scratch register.
+constexpr uint8_t JIT_XMM_SCRATCH = 8;
+
+constexpr uint16_t JIT_FLAG_CF = 0x001;
+constexpr uint16_t JIT_FLAG_PF = 0x004;
+constexpr uint16_t JIT_FLAG_AF = 0x010;
+constexpr uint16_t JIT_FLAG_ZF = 0x040;
+constexpr uint16_t JIT_FLAG_SF = 0x080;
+constexpr uint16_t JIT_FLAG_OF = 0x800;
+constexpr uint16_t JIT_FLAGS_ARITH = 0x8D5;
+constexpr uint16_t JIT_FLAGS_NO_CF = JIT_FLAGS_ARITH & ~JIT_FLAG_CF;
+
+enum class JITOpcode : uint8_t {
+    LoadImm,    // dst = imm
+    Move,       // dst = src1
+    Lea,        // dst = src1 + (src2 << scale) + imm
+    Load,       // dst = [src1], size bytes, sign-extended if sign
+    Store,      // [src1] = src2, size bytes
+    Alu,        // dst = dst aluOp src2
+    AluImm,     // dst = dst aluOp imm
+    Extend,     // dst = extend(src1 >> scale, size bytes)
+    Exit,       // eip = imm
+    ExitReg,    // eip = src1
+    ExitCond,   // eip = cond ? imm : imm2
+    CodeCheck,  // eip = imm and leave if a store overwrote translated code
+    FpuCheck,   // unless (tags rotated to TOP) & imm == imm2, interpret guestAddr next
+    FpuPush,    // TOP -= 1 and tag the new ST(0) valid
+    FpuPop,     // tag ST(0) empty and TOP += 1
+    FpuRead,    // F[dst] = ST(imm)
+    FpuWrite,   // ST(imm) = F[src1]
+    FpuConst,   // F[dst] = double with bits imm2:imm
+    FpuFromBits, // F[dst] = int32 src1 if sign, else float src1 or double src2:src1 by size
+    FpuToBits,  // dst = word scale of F[src1] encoded as a size-byte float
+    FpuArith,   // F[dst] = F[dst] fpuOp F[src2]
+    FpuCompare, // C3/C2/C0 of the status word = compare F[src1], F[src2]
+    FpuCompareFlags, // ZF/PF/CF (flagMask) = compare F[src1], F[src2]
+    FpuStatus,  // dst = FPU status word
+    VecLaneLoad,  // dst = dword imm2 of xmm imm
+    VecLaneStore, // dword imm2 of xmm imm = src1
+    VectorKernel  // run SSE kernel imm on xmm imm2 & 0xFF, xmm (imm2 >> 8) & 0xFF, imm8 imm2 >> 16
+};
+
+enum class JITFpuOp : uint8_t {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Neg,
+    Abs,
+    Sqrt
+};
+
+enum class JITAluOp : uint8_t {
+    Add,
+    Or,
+    And,
+    Sub,
+    Xor,
+    Cmp,
+    Test,
+    Inc,
+    Dec,
+    Not,
+    Neg,
+    Shl,
+    Shr,
+    Sar,
+    Imul
+};
+
+struct JITOp {
+    JITOpcode opcode;
+    JITAluOp aluOp;
+    JITFpuOp fpuOp;
+    uint8_t dst;
+    uint8_t src1;
+    uint8_t src2;
+    uint8_t size;
+    uint8_t scale;
+    uint8_t cond;
+    bool sign;
+    uint16_t flagMask;
+    uint32_t imm;
+    uint32_t imm2;
+    uint32_t guestAddr;
+};
+
+struct JITBlockIR {
+    uint32_t startAddr;
+    uint32_t endAddr;
+    uint32_t instructionCount;
+    std::vector<JITOp> ops;
+};
+
+struct JITExitStub {
+    uint32_t target;
+    uint32_t patchOffset;
+};
+
+// A guest access made directly through the fastmem arena. When it faults,
+// the instruction at patchOffset is overwritten with a jump to the helper
+// call at stubOffset, which returns to just after the access.
+struct JITFastmemSite {
+    uint32_t accessOffset;
+    uint32_t patchOffset;
+    uint32_t stubOffset;
+};
+
+struct JITCodeInfo {
+    uint32_t chainOffset;
+    std::vector<JITExitStub> exits;
+    std::vector<JITFastmemSite> fastmemSites;
+};
+
+struct JITContextLayout {
+    uint32_t regOffset[JIT_GUEST_REGS];
+    uint32_t eipOffset;
+    uint32_t eflagsOffset;
+    uint32_t faultOffset;
+    uint32_t chainBudgetOffset;
+    uint32_t codeDirtyOffset;
+    uint32_t blockHeadOffset;
+    uint32_t fpuStatusOffset;
+    uint32_t fpuTagOffset;
+    uint32_t fpuStackOffset;
+    uint32_t xmmOffset;
+    uint32_t xmmScratchOffset;
+    uint32_t fastmemOffset;     // context slot holding the arena base
+    bool fastmem;
+    uint32_t (*readMemory)(void* context, uint32_t address, uint32_t size);
+    void (*writeMemory)(void* context, uint32_t address, uint32_t value, uint32_t size);
+    void (*vectorKernel)(void* context, uint32_t kernel, uint32_t operands);
+};
+
+class JITEmitter {
+public:
+    explicit JITEmitter(const JITContextLayout& layout);
+
+    bool compile(const JITBlockIR& ir, std::vector<uint8_t>& code, JITCodeInfo& info);
+
+    // Exit stubs fall through to the dispatcher until linked to a successor's
+    // chain entry. Both calls rewrite live code and flush the icache.
+    static void linkExit(uint8_t* site, const uint8_t* target);
+    static void unlinkExit(uint8_t* site);
+
+    // Sends a fastmem site to its slow path for good. Called from the fault
+    // handler on the thread running the code.
+    static void patchFastmemSite(uint8_t* site, const uint8_t* stub);
+
+    static const char* hostName();
+
+private:
+    JITContextLayout layout;
+};
@@ -0,0 +1,887 @@
+#include "x86_jit.h"
+
+#if defined(__aarch64__)
+
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t CTX = 19;
+constexpr uint32_t WZR = 31;
+constexpr uint32_t X16 = 16;
+constexpr uint32_t SCRATCH_A = 9;
+constexpr uint32_t SCRATCH_B = 10;
+constexpr uint32_t FLAGS = 11;
+constexpr uint32_t FLAG_BIT = 12;
+constexpr uint32_t RESULT = 13;
+constexpr uint32_t SCRATCH_C = 14;
+constexpr uint32_t TEMP_REGS[] = {20, 21, 22};
+constexpr uint32_t FP_SCRATCH = 2;
+
+// eax..edi live in these for the whole block. esi and edi sit in
+// caller-saved registers and are reloaded after helper calls.
+constexpr uint32_t GUEST_REGS[JIT_GUEST_REGS] = {23, 24, 25, 26, 27, 28, 7, 8};
+constexpr uint8_t VOLATILE_GUESTS = 0xC0;
+constexpr uint32_t LINK_FALLTHROUGH = 0x14000001;   // b #4
+
+enum Condition : uint32_t {
+    COND_EQ = 0x0,
+    COND_NE = 0x1,
+    COND_CS = 0x2,
+    COND_CC = 0x3,
+    COND_MI = 0x4,
+    COND_VS = 0x6,
+    COND_LT = 0xB
+};
+
+class ARM64Assembler {
+public:
+    explicit ARM64Assembler(std::vector<uint8_t>& code) : code(code) {}
+
+    size_t position() const { return code.size(); }
+
+    void emit(uint32_t insn) {
+        code.push_back(insn & 0xFF);
+        code.push_back((insn >> 8) & 0xFF);
+        code.push_back((insn >> 16) & 0xFF);
+        code.push_back((insn >> 24) & 0xFF);
+    }
+
+    uint32_t at(size_t pos) const {
+        return code[pos] | (code[pos + 1] << 8) | (code[pos + 2] << 16) |
+               (static_cast<uint32_t>(code[pos + 3]) << 24);
+    }
+
+    void patch(size_t pos, uint32_t insn) {
+        code[pos] = insn & 0xFF;
+        code[pos + 1] = (insn >> 8) & 0xFF;
+        code[pos + 2] = (insn >> 16) & 0xFF;
+        code[pos + 3] = (insn >> 24) & 0xFF;
+    }
+
+    void movImm32(uint32_t rd, uint32_t imm) {
+        emit(0x52800000 | ((imm & 0xFFFF) << 5) | rd);
+        if (imm >> 16) {
+            emit(0x72A00000 | ((imm >> 16) << 5) | rd);
+        }
+    }
+
+    void movImm64(uint32_t rd, uint64_t imm) {
+        emit(0xD2800000 | ((imm & 0xFFFF) << 5) | rd);
+        for (uint32_t hw = 1; hw < 4; hw++) {
+            uint32_t chunk = (imm >> (hw * 16)) & 0xFFFF;
+            if (chunk) {
+                emit(0xF2800000 | (hw << 21) | (chunk << 5) | rd);
+            }
+        }
+    }
+
+    void mov32(uint32_t rd, uint32_t rm) { emit(0x2A0003E0 | (rm << 16) | rd); }
+    void mov64(uint32_t rd, uint32_t rm) { emit(0xAA0003E0 | (rm << 16) | rd); }
+
+    void ldr64(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0xF9400000 | ((offset >> 3) << 10) | (rn << 5) | rt); }
+    void ldr32(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0xB9400000 | ((offset >> 2) << 10) | (rn << 5) | rt); }
+    void str32(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0xB9000000 | ((offset >> 2) << 10) | (rn << 5) | rt); }
+    void ldrb(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0x39400000 | (offset << 10) | (rn << 5) | rt); }
+    void strb(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0x39000000 | (offset << 10) | (rn << 5) | rt); }
+    void ldrh(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0x79400000 | ((offset >> 1) << 10) | (rn << 5) | rt); }
+    void strh(uint32_t rt, uint32_t rn, uint32_t offset) { emit(0x79000000 | ((offset >> 1) << 10) | (rn << 5) | rt); }
+
+    // w[rt] <-> [xn + uxtw(wm)], the fastmem arena addressing form.
+    void ldrArena(uint32_t size, uint32_t rt, uint32_t rn, uint32_t rm) {
+        emit((size == 4 ? 0xB8604800 : size == 2 ? 0x78604800 : 0x38604800) | (rm << 16) | (rn << 5) | rt);
+    }
+    void strArena(uint32_t size, uint32_t rt, uint32_t rn, uint32_t rm) {
+        emit((size == 4 ? 0xB8204800 : size == 2 ? 0x78204800 : 0x38204800) | (rm << 16) | (rn << 5) | rt);
+    }
+
+    // d[rt] <-> [rn + (xm << 3)]
+    void ldrIndexedD(uint32_t rt, uint32_t rn, uint32_t rm) { emit(0xFC607800 | (rm << 16) | (rn << 5) | rt); }
+    void strIndexedD(uint32_t rt, uint32_t rn, uint32_t rm) { emit(0xFC207800 | (rm << 16) | (rn << 5) | rt); }
+
+    void dataReg(uint32_t base, uint32_t rd, uint32_t rn, uint32_t rm, uint32_t shift = 0, uint32_t amount = 0) {
+        emit(base | (shift << 22) | (rm << 16) | (amount << 10) | (rn << 5) | rd);
+    }
+
+    void add(uint32_t rd, uint32_t rn, uint32_t rm, uint32_t lsl = 0) { dataReg(0x0B000000, rd, rn, rm, 0, lsl); }
+    void adds(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x2B000000, rd, rn, rm); }
+    void subs(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x6B000000, rd, rn, rm); }
+    void ands(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x6A000000, rd, rn, rm); }
+    void orr(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x2A000000, rd, rn, rm); }
+    void eor(uint32_t rd, uint32_t rn, uint32_t rm, uint32_t lsr = 0) { dataReg(0x4A000000, rd, rn, rm, lsr ? 1 : 0, lsr); }
+    void bic(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x0A200000, rd, rn, rm); }
+    void orn(uint32_t rd, uint32_t rn, uint32_t rm) { dataReg(0x2A200000, rd, rn, rm); }
+    void tst(uint32_t rn) { ands(WZR, rn, rn); }
+
+    void addImm(uint32_t rd, uint32_t rn, uint32_t imm12) { emit(0x11000000 | (imm12 << 10) | (rn << 5) | rd); }
+    void addImm64(uint32_t rd, uint32_t rn, uint32_t imm12) { emit(0x91000000 | (imm12 << 10) | (rn << 5) | rd); }
+    void subImm(uint32_t rd, uint32_t rn, uint32_t imm12) { emit(0x51000000 | (imm12 << 10) | (rn << 5) | rd); }
+    void addsImm(uint32_t rd, uint32_t rn, uint32_t imm12) { emit(0x31000000 | (imm12 << 10) | (rn << 5) | rd); }
+    void subsImm(uint32_t rd, uint32_t rn, uint32_t imm12) { emit(0x71000000 | (imm12 << 10) | (rn << 5) | rd); }
+    void eorOne(uint32_t rd, uint32_t rn) { emit(0x52000000 | (rn << 5) | rd); }
+
+    void ubfm(uint32_t rd, uint32_t rn, uint32_t immr, uint32_t imms) { emit(0x53000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+    void sbfm(uint32_t rd, uint32_t rn, uint32_t immr, uint32_t imms) { emit(0x13000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+    void bfm(uint32_t rd, uint32_t rn, uint32_t immr, uint32_t imms) { emit(0x33000000 | (immr << 16) | (imms << 10) | (rn << 5) | rd); }
+
+    void ubfx(uint32_t rd, uint32_t rn, uint32_t lsb, uint32_t width) { ubfm(rd, rn, lsb, lsb + width - 1); }
+    void bfi(uint32_t rd, uint32_t rn, uint32_t lsb, uint32_t width) { bfm(rd, rn, (32 - lsb) & 31, width - 1); }
+    void lslImm(uint32_t rd, uint32_t rn, uint32_t shift) { ubfm(rd, rn, (32 - shift) & 31, 31 - shift); }
+    void lsrImm(uint32_t rd, uint32_t rn, uint32_t shift) { ubfm(rd, rn, shift, 31); }
+    void asrImm(uint32_t rd, uint32_t rn, uint32_t shift) { sbfm(rd, rn, shift, 31); }
+
+    void lslv(uint32_t rd, uint32_t rn, uint32_t rm) { emit(0x1AC02000 | (rm << 16) | (rn << 5) | rd); }
+    void lsrv(uint32_t rd, uint32_t rn, uint32_t rm) { emit(0x1AC02400 | (rm << 16) | (rn << 5) | rd); }
+    void orr64Lsl32(uint32_t rd, uint32_t rn, uint32_t rm) { emit(0xAA000000 | (rm << 16) | (32 << 10) | (rn << 5) | rd); }
+    void lsr64By32(uint32_t rd, uint32_t rn) { emit(0xD360FC00 | (rn << 5) | rd); }
+
+    void fpData1(uint32_t base, uint32_t rd, uint32_t rn) { emit(base | (rn << 5) | rd); }
+    void fpData2(uint32_t base, uint32_t rd, uint32_t rn, uint32_t rm) { emit(base | (rm << 16) | (rn << 5) | rd); }
+    void fcmp(uint32_t rn, uint32_t rm) { emit(0x1E602000 | (rm << 16) | (rn << 5)); }
+
+    void smull(uint32_t rd, uint32_t rn, uint32_t rm) { emit(0x9B200000 | (rm << 16) | (WZR << 10) | (rn << 5) | rd); }
+    void cmpSxtw(uint32_t rn, uint32_t rm) { emit(0xEB20C000 | (rm << 16) | (rn << 5) | WZR); }
+    void cset(uint32_t rd, uint32_t cond) { emit(0x1A9F07E0 | ((cond ^ 1) << 12) | rd); }
+
+    void b(int32_t offset) { emit(0x14000000 | ((offset >> 2) & 0x3FFFFFF)); }
+    void bcond(uint32_t cond, int32_t offset) { emit(0x54000000 | (((offset >> 2) & 0x7FFFF) << 5) | cond); }
+    void cbz(uint32_t rt, int32_t offset) { emit(0x34000000 | (((offset >> 2) & 0x7FFFF) << 5) | rt); }
+    void cbnz(uint32_t rt, int32_t offset) { emit(0x35000000 | (((offset >> 2) & 0x7FFFF) << 5) | rt); }
+    void blr(uint32_t rn) { emit(0xD63F0000 | (rn << 5)); }
+    void ret() { emit(0xD65F03C0); }
+
+    static uint32_t branchTo(uint32_t insn, size_t from, size_t to) {
+        int32_t offset = static_cast<int32_t>(to) - static_cast<int32_t>(from);
+        if ((insn & 0xFC000000) == 0x14000000) {
+            return 0x14000000 | ((offset >> 2) & 0x3FFFFFF);
+        }
+        return (insn & 0xFF00001F) | (((offset >> 2) & 0x7FFFF) << 5);
+    }
+
+private:
+    std::vector<uint8_t>& code;
+};
+
+class ARM64Translator {
+public:
+    ARM64Translator(const JITContextLayout& layout, std::vector<uint8_t>& code, JITCodeInfo& info) :
+        layout(layout), as(code), info(info) {}
+
+    bool translate(const JITBlockIR& ir);
+
+private:
+    const JITContextLayout& layout;
+    ARM64Assembler as;
+    JITCodeInfo& info;
+    std::vector<size_t> epilogueBranches;
+    uint8_t usedGuests = 0;
+    uint8_t dirtyGuests = 0;
+    bool fastmem = false;
+
+    struct FastmemStub {
+        JITOp op;
+        uint8_t dirtyGuests;
+        size_t patchPos;
+        size_t accessPos;
+    };
+    std::vector<FastmemStub> fastmemStubs;
+
+    static bool isTemp(uint8_t reg) { return reg >= JIT_T0 && reg != JIT_NONE; }
+    static uint32_t hostReg(uint8_t reg) { return isTemp(reg) ? TEMP_REGS[reg - JIT_T0] : GUEST_REGS[reg]; }
+
+    void readRegInto(uint8_t reg, uint32_t target);
+    void writeReg(uint8_t reg, uint32_t src);
+    void loadGuests(uint8_t mask);
+    void spillGuests(uint8_t mask = 0xFF);
+    void emitHelperCall(const void* helper);
+
+    void emitPrologue();
+    void emitChainEntry();
+    void emitEpilogue();
+    void emitExitTo(uint32_t target);
+    void emitLinkableExit(uint32_t target);
+    void emitExitIfSet(uint32_t flagOffset, uint32_t target);
+    void emitLea(const JITOp& op);
+    void emitLoad(const JITOp& op);
+    void emitStore(const JITOp& op);
+    void emitLoadCall(const JITOp& op);
+    void emitStoreCall(const JITOp& op);
+    void emitFastmemAccess(const JITOp& op);
+    void emitFastmemStubs();
+    void emitAlu(const JITOp& op);
+    void emitFlags(const JITOp& op, uint32_t a, uint32_t b);
+    void emitExtend(const JITOp& op);
+    void emitExitCond(const JITOp& op);
+    void emitCondition(uint8_t cond);
+    void emitFpuSlot(uint32_t index);
+    void emitFpuCheck(const JITOp& op);
+    void emitFpuPush();
+    void emitFpuPop();
+    void emitFpuFromBits(const JITOp& op);
+    void emitFpuToBits(const JITOp& op);
+    void emitFpuArith(const JITOp& op);
+    void emitFpuCompare(const JITOp& op);
+    uint32_t vectorLaneOffset(const JITOp& op) const;
+    void emitVectorKernel(const JITOp& op);
+};
+
+void ARM64Translator::readRegInto(uint8_t reg, uint32_t target) {
+    if (hostReg(reg) != target) {
+        as.mov32(target, hostReg(reg));
+    }
+}
+
+void ARM64Translator::writeReg(uint8_t reg, uint32_t src) {
+    if (hostReg(reg) != src) {
+        as.mov32(hostReg(reg), src);
+    }
+    if (!isTemp(reg)) {
+        dirtyGuests |= 1 << reg;
+    }
+}
+
+void ARM64Translator::loadGuests(uint8_t mask) {
+    for (uint8_t reg = 0; reg < JIT_GUEST_REGS; reg++) {
+        if (mask & (1 << reg)) {
+            as.ldr32(GUEST_REGS[reg], CTX, layout.regOffset[reg]);
+        }
+    }
+}
+
+void ARM64Translator::spillGuests(uint8_t mask) {
+    for (uint8_t reg = 0; reg < JIT_GUEST_REGS; reg++) {
+        if (dirtyGuests & mask & (1 << reg)) {
+            as.str32(GUEST_REGS[reg], CTX, layout.regOffset[reg]);
+        }
+    }
+}
+
+void ARM64Translator::emitHelperCall(const void* helper) {
+    as.mov64(0, CTX);
+    as.movImm64(X16, reinterpret_cast<uint64_t>(helper));
+    as.blr(X16);
+}
+
+void ARM64Translator::emitPrologue() {
+    as.emit(0xA9BA7BFD);            // stp x29, x30, [sp, #-96]!
+    as.emit(0x910003FD);            // mov x29, sp
+    as.emit(0xA90153F3);            // stp x19, x20, [sp, #16]
+    as.emit(0xA9025BF5);            // stp x21, x22, [sp, #32]
+    as.emit(0xA90363F7);            // stp x23, x24, [sp, #48]
+    as.emit(0xA9046BF9);            // stp x25, x26, [sp, #64]
+    as.emit(0xA90573FB);            // stp x27, x28, [sp, #80]
+    as.mov64(CTX, 0);
+}
+
+void ARM64Translator::emitChainEntry() {
+    info.chainOffset = static_cast<uint32_t>(as.position());
+    as.ldr32(SCRATCH_A, CTX, layout.chainBudgetOffset);
+    as.subsImm(SCRATCH_A, SCRATCH_A, 1);
+    as.str32(SCRATCH_A, CTX, layout.chainBudgetOffset);
+    epilogueBranches.push_back(as.position());
+    as.bcond(COND_CC, 0);
+    loadGuests(usedGuests);
+}
+
+void ARM64Translator::emitEpilogue() {
+    size_t target = as.position();
+    for (size_t pos : epilogueBranches) {
+        as.patch(pos, ARM64Assembler::branchTo(as.at(pos), pos, target));
+    }
+    as.emit(0xA94153F3);            // ldp x19, x20, [sp, #16]
+    as.emit(0xA9425BF5);            // ldp x21, x22, [sp, #32]
+    as.emit(0xA94363F7);            // ldp x23, x24, [sp, #48]
+    as.emit(0xA9446BF9);            // ldp x25, x26, [sp, #64]
+    as.emit(0xA94573FB);            // ldp x27, x28, [sp, #80]
+    as.emit(0xA8C67BFD);            // ldp x29, x30, [sp], #96
+    as.ret();
+}
+
+void ARM64Translator::emitExitTo(uint32_t target) {
+    spillGuests();
+    as.movImm32(SCRATCH_A, target);
+    as.str32(SCRATCH_A, CTX, layout.eipOffset);
+    epilogueBranches.push_back(as.position());
+    as.b(0);
+}
+
+void ARM64Translator::emitLinkableExit(uint32_t target) {
+    spillGuests();
+    as.movImm32(SCRATCH_A, target);
+    as.str32(SCRATCH_A, CTX, layout.eipOffset);
+    info.exits.push_back({target, static_cast<uint32_t>(as.position())});
+    as.emit(LINK_FALLTHROUGH);
+    epilogueBranches.push_back(as.position());
+    as.b(0);
+}
+
+void ARM64Translator::emitExitIfSet(uint32_t flagOffset, uint32_t target) {
+    as.ldrb(SCRATCH_A, CTX, flagOffset);
+    size_t skip = as.position();
+    as.cbz(SCRATCH_A, 0);
+    emitExitTo(target);
+    as.patch(skip, ARM64Assembler::branchTo(0x34000000 | SCRATCH_A, skip, as.position()));
+}
+
+void ARM64Translator::emitLea(const JITOp& op) {
+    bool hasBase = op.src1 != JIT_NONE;
+    bool hasIndex = op.src2 != JIT_NONE;
+
+    if (!hasBase && !hasIndex) {
+        as.movImm32(RESULT, op.imm);
+        writeReg(op.dst, RESULT);
+        return;
+    }
+
+    if (hasBase && hasIndex) {
+        as.add(RESULT, hostReg(op.src1), hostReg(op.src2), op.scale);
+    } else if (hasBase) {
+        as.mov32(RESULT, hostReg(op.src1));
+    } else {
+        as.lslImm(RESULT, hostReg(op.src2), op.scale);
+    }
+
+    int32_t disp = static_cast<int32_t>(op.imm);
+    if (disp > 0 && disp < 4096) {
+        as.addImm(RESULT, RESULT, disp);
+    } else if (disp < 0 && disp > -4096) {
+        as.subImm(RESULT, RESULT, -disp);
+    } else if (disp != 0) {
+        as.movImm32(SCRATCH_C, op.imm);
+        as.add(RESULT, RESULT, SCRATCH_C);
+    }
+    writeReg(op.dst, RESULT);
+}
+
+void ARM64Translator::emitLoad(const JITOp& op) {
+    if (fastmem) {
+        emitFastmemAccess(op);
+    } else {
+        emitLoadCall(op);
+    }
+
+    if (op.sign && op.size == 1) {
+        as.sbfm(0, 0, 0, 7);
+    } else if (op.sign && op.size == 2) {
+        as.sbfm(0, 0, 0, 15);
+    }
+    writeReg(op.dst, 0);
+}
+
+void ARM64Translator::emitStore(const JITOp& op) {
+    if (fastmem) {
+        emitFastmemAccess(op);
+    } else {
+        emitStoreCall(op);
+    }
+}
+
+// Helpers see a coherent context: dirty guests are written back first, and
+// the caller-saved ones are reloaded once the call returns. Loads leave the
+// raw value in w0.
+void ARM64Translator::emitLoadCall(const JITOp& op) {
+    spillGuests();
+    dirtyGuests = 0;
+    readRegInto(op.src1, 1);
+    as.movImm32(2, op.size);
+    emitHelperCall(reinterpret_cast<const void*>(layout.readMemory));
+    emitExitIfSet(layout.faultOffset, op.guestAddr);
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+void ARM64Translator::emitStoreCall(const JITOp& op) {
+    spillGuests();
+    dirtyGuests = 0;
+    readRegInto(op.src1, 1);
+    readRegInto(op.src2, 2);
+    as.movImm32(3, op.size);
+    emitHelperCall(reinterpret_cast<const void*>(layout.writeMemory));
+    emitExitIfSet(layout.faultOffset, op.guestAddr);
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+// The access goes straight to the arena. Loading the arena base is the
+// instruction that gets replaced by a branch to the out-of-line helper call.
+void ARM64Translator::emitFastmemAccess(const JITOp& op) {
+    FastmemStub stub{op, dirtyGuests, as.position(), 0};
+    as.ldr64(X16, CTX, layout.fastmemOffset);
+    stub.accessPos = as.position();
+    if (op.opcode == JITOpcode::Load) {
+        as.ldrArena(op.size, 0, X16, hostReg(op.src1));
+    } else {
+        as.strArena(op.size, hostReg(op.src2), X16, hostReg(op.src1));
+    }
+    fastmemStubs.push_back(stub);
+}
+
+// Sits between the last exit and the epilogue, so it is only entered
+// through a patched site.
+void ARM64Translator::emitFastmemStubs() {
+    for (const FastmemStub& stub : fastmemStubs) {
+        info.fastmemSites.push_back({static_cast<uint32_t>(stub.accessPos), static_cast<uint32_t>(stub.patchPos),
+                                     static_cast<uint32_t>(as.position())});
+        dirtyGuests = stub.dirtyGuests;
+        if (stub.op.opcode == JITOpcode::Load) {
+            emitLoadCall(stub.op);
+        } else {
+            emitStoreCall(stub.op);
+        }
+        size_t resume = stub.accessPos + 4;
+        as.b(static_cast<int32_t>(resume) - static_cast<int32_t>(as.position()));
+    }
+}
+
+void ARM64Translator::emitAlu(const JITOp& op) {
+    uint32_t a = hostReg(op.dst);
+    uint32_t b = SCRATCH_B;
+    uint32_t count = op.imm & 31;
+
+    if (op.opcode == JITOpcode::Alu) {
+        b = hostReg(op.src2);
+    } else if (op.aluOp != JITAluOp::Shl && op.aluOp != JITAluOp::Shr && op.aluOp != JITAluOp::Sar) {
+        as.movImm32(SCRATCH_B, op.imm);
+    }
+
+    switch (op.aluOp) {
+        case JITAluOp::Add: as.adds(RESULT, a, b); break;
+        case JITAluOp::Sub:
+        case JITAluOp::Cmp: as.subs(RESULT, a, b); break;
+        case JITAluOp::And:
+        case JITAluOp::Test: as.ands(RESULT, a, b); break;
+        case JITAluOp::Or: as.orr(RESULT, a, b); as.tst(RESULT); break;
+        case JITAluOp::Xor: as.eor(RESULT, a, b); as.tst(RESULT); break;
+        case JITAluOp::Inc: as.addsImm(RESULT, a, 1); as.movImm32(SCRATCH_B, 1); break;
+        case JITAluOp::Dec: as.subsImm(RESULT, a, 1); as.movImm32(SCRATCH_B, 1); break;
+        case JITAluOp::Not: as.orn(RESULT, WZR, a); break;
+        case JITAluOp::Neg: as.subs(RESULT, WZR, a); break;
+        case JITAluOp::Shl: as.lslImm(RESULT, a, count); as.tst(RESULT); break;
+        case JITAluOp::Shr: as.lsrImm(RESULT, a, count); as.tst(RESULT); break;
+        case JITAluOp::Sar: as.asrImm(RESULT, a, count); as.tst(RESULT); break;
+        case JITAluOp::Imul: as.smull(RESULT, a, b); as.cmpSxtw(RESULT, RESULT); break;
+    }
+
+    if (op.flagMask) {
+        emitFlags(op, a, b);
+    }
+
+    if (op.aluOp != JITAluOp::Cmp && op.aluOp != JITAluOp::Test) {
+        writeReg(op.dst, RESULT);
+    }
+}
+
+void ARM64Translator::emitFlags(const JITOp& op, uint32_t a, uint32_t b) {
+    uint32_t count = op.imm & 31;
+    bool arith = op.aluOp == JITAluOp::Add || op.aluOp == JITAluOp::Sub ||
+                 op.aluOp == JITAluOp::Cmp || op.aluOp == JITAluOp::Inc ||
+                 op.aluOp == JITAluOp::Dec || op.aluOp == JITAluOp::Neg;
+
+    as.ldr32(FLAGS, CTX, layout.eflagsOffset);
+    as.movImm32(FLAG_BIT, op.flagMask);
+    as.bic(FLAGS, FLAGS, FLAG_BIT);
+
+    if (op.flagMask & JIT_FLAG_CF) {
+        bool emitted = true;
+        switch (op.aluOp) {
+            case JITAluOp::Add: as.cset(FLAG_BIT, COND_CS); break;
+            case JITAluOp::Sub:
+            case JITAluOp::Cmp:
+            case JITAluOp::Neg: as.cset(FLAG_BIT, COND_CC); break;
+            case JITAluOp::Shl: as.ubfx(FLAG_BIT, a, 32 - count, 1); break;
+            case JITAluOp::Shr:
+            case JITAluOp::Sar: as.ubfx(FLAG_BIT, a, count - 1, 1); break;
+            case JITAluOp::Imul: as.cset(FLAG_BIT, COND_NE); break;
+            default: emitted = false; break;
+        }
+        if (emitted) {
+            as.bfi(FLAGS, FLAG_BIT, 0, 1);
+        }
+    }
+
+    if (op.flagMask & JIT_FLAG_OF) {
+        bool emitted = true;
+        if (arith) {
+            as.cset(FLAG_BIT, COND_VS);
+        } else if (op.aluOp == JITAluOp::Imul) {
+            as.cset(FLAG_BIT, COND_NE);
+        } else if (op.aluOp == JITAluOp::Shl) {
+            as.eor(FLAG_BIT, RESULT, a);
+            as.ubfx(FLAG_BIT, FLAG_BIT, 31, 1);
+        } else if (op.aluOp == JITAluOp::Shr) {
+            as.ubfx(FLAG_BIT, a, 31, 1);
+        } else {
+            emitted = false;
+        }
+        if (emitted) {
+            as.bfi(FLAGS, FLAG_BIT, 11, 1);
+        }
+    }
+
+    if (op.flagMask & JIT_FLAG_ZF) {
+        as.cset(FLAG_BIT, COND_EQ);
+        as.bfi(FLAGS, FLAG_BIT, 6, 1);
+    }
+
+    if (op.flagMask & JIT_FLAG_SF) {
+        as.cset(FLAG_BIT, COND_MI);
+        as.bfi(FLAGS, FLAG_BIT, 7, 1);
+    }
+
+    if (op.flagMask & JIT_FLAG_PF) {
+        as.ubfx(FLAG_BIT, RESULT, 0, 8);
+        as.eor(FLAG_BIT, FLAG_BIT, FLAG_BIT, 4);
+        as.eor(FLAG_BIT, FLAG_BIT, FLAG_BIT, 2);
+        as.eor(FLAG_BIT, FLAG_BIT, FLAG_BIT, 1);
+        as.eorOne(FLAG_BIT, FLAG_BIT);
+        as.bfi(FLAGS, FLAG_BIT, 2, 1);
+    }
+
+    if ((op.flagMask & JIT_FLAG_AF) && arith) {
+        if (op.aluOp == JITAluOp::Neg) {
+            as.eor(FLAG_BIT, a, RESULT);
+        } else {
+            as.eor(FLAG_BIT, a, b);
+            as.eor(FLAG_BIT, FLAG_BIT, RESULT);
+        }
+        as.ubfx(FLAG_BIT, FLAG_BIT, 4, 1);
+        as.bfi(FLAGS, FLAG_BIT, 4, 1);
+    }
+
+    as.str32(FLAGS, CTX, layout.eflagsOffset);
+}
+
+void ARM64Translator::emitExtend(const JITOp& op) {
+    uint32_t src = hostReg(op.src1);
+    if (op.scale) {
+        as.lsrImm(RESULT, src, op.scale);
+        src = RESULT;
+    }
+    uint32_t topBit = op.size == 1 ? 7 : 15;
+    if (op.sign) {
+        as.sbfm(RESULT, src, 0, topBit);
+    } else {
+        as.ubfm(RESULT, src, 0, topBit);
+    }
+    writeReg(op.dst, RESULT);
+}
+
+void ARM64Translator::emitCondition(uint8_t cond) {
+    as.ldr32(SCRATCH_A, CTX, layout.eflagsOffset);
+    switch (cond >> 1) {
+        case 0: as.ubfx(SCRATCH_B, SCRATCH_A, 11, 1); break;
+        case 1: as.ubfx(SCRATCH_B, SCRATCH_A, 0, 1); break;
+        case 2: as.ubfx(SCRATCH_B, SCRATCH_A, 6, 1); break;
+        case 3:
+            as.ubfx(SCRATCH_B, SCRATCH_A, 0, 1);
+            as.ubfx(SCRATCH_C, SCRATCH_A, 6, 1);
+            as.orr(SCRATCH_B, SCRATCH_B, SCRATCH_C);
+            break;
+        case 4: as.ubfx(SCRATCH_B, SCRATCH_A, 7, 1); break;
+        case 5: as.ubfx(SCRATCH_B, SCRATCH_A, 2, 1); break;
+        case 6:
+        case 7:
+            as.ubfx(SCRATCH_B, SCRATCH_A, 7, 1);
+            as.ubfx(SCRATCH_C, SCRATCH_A, 11, 1);
+            as.eor(SCRATCH_B, SCRATCH_B, SCRATCH_C);
+            if ((cond >> 1) == 7) {
+                as.ubfx(SCRATCH_C, SCRATCH_A, 6, 1);
+                as.orr(SCRATCH_B, SCRATCH_B, SCRATCH_C);
+            }
+            break;
+    }
+}
+
+void ARM64Translator::emitExitCond(const JITOp& op) {
+    spillGuests();
+    dirtyGuests = 0;
+    emitCondition(op.cond);
+    size_t branch = as.position();
+    uint32_t insn = (op.cond & 1) ? (0x35000000 | SCRATCH_B) : (0x34000000 | SCRATCH_B);
+    as.emit(insn);
+    emitLinkableExit(op.imm);
+    as.patch(branch, ARM64Assembler::branchTo(insn, branch, as.position()));
+    emitLinkableExit(op.imm2);
+}
+
+// SCRATCH_A = physical slot of ST(index), SCRATCH_B = &fpu.fast[0].
+void ARM64Translator::emitFpuSlot(uint32_t index) {
+    as.ldrh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+    as.ubfx(SCRATCH_A, SCRATCH_A, 11, 3);
+    if (index) {
+        as.addImm(SCRATCH_A, SCRATCH_A, index);
+        as.ubfx(SCRATCH_A, SCRATCH_A, 0, 3);
+    }
+    as.addImm64(SCRATCH_B, CTX, layout.fpuStackOffset);
+}
+
+void ARM64Translator::emitFpuCheck(const JITOp& op) {
+    as.ldrh(SCRATCH_A, CTX, layout.fpuTagOffset);
+    as.dataReg(0x2A000000, SCRATCH_A, SCRATCH_A, SCRATCH_A, 0, 16);
+    as.ldrh(SCRATCH_B, CTX, layout.fpuStatusOffset);
+    as.ubfx(SCRATCH_B, SCRATCH_B, 11, 3);
+    as.add(SCRATCH_B, SCRATCH_B, SCRATCH_B);
+    as.lsrv(SCRATCH_A, SCRATCH_A, SCRATCH_B);
+    as.movImm32(SCRATCH_C, op.imm);
+    as.ands(SCRATCH_A, SCRATCH_A, SCRATCH_C);
+    as.movImm32(SCRATCH_C, op.imm2);
+    as.subs(WZR, SCRATCH_A, SCRATCH_C);
+    size_t skip = as.position();
+    as.bcond(COND_EQ, 0);
+    as.strb(WZR, CTX, layout.blockHeadOffset);
+    emitExitTo(op.guestAddr);
+    as.patch(skip, ARM64Assembler::branchTo(as.at(skip), skip, as.position()));
+}
+
+void ARM64Translator::emitFpuPush() {
+    as.ldrh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+    as.ubfx(SCRATCH_B, SCRATCH_A, 11, 3);
+    as.subImm(SCRATCH_B, SCRATCH_B, 1);
+    as.bfi(SCRATCH_A, SCRATCH_B, 11, 3);
+    as.strh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+
+    as.ubfx(SCRATCH_B, SCRATCH_B, 0, 3);
+    as.add(SCRATCH_B, SCRATCH_B, SCRATCH_B);
+    as.movImm32(SCRATCH_C, 3);
+    as.lslv(SCRATCH_C, SCRATCH_C, SCRATCH_B);
+    as.ldrh(SCRATCH_A, CTX, layout.fpuTagOffset);
+    as.bic(SCRATCH_A, SCRATCH_A, SCRATCH_C);
+    as.strh(SCRATCH_A, CTX, layout.fpuTagOffset);
+}
+
+void ARM64Translator::emitFpuPop() {
+    as.ldrh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+    as.ubfx(SCRATCH_B, SCRATCH_A, 11, 3);
+    as.add(SCRATCH_C, SCRATCH_B, SCRATCH_B);
+    as.movImm32(FLAG_BIT, 3);
+    as.lslv(FLAG_BIT, FLAG_BIT, SCRATCH_C);
+    as.ldrh(SCRATCH_C, CTX, layout.fpuTagOffset);
+    as.orr(SCRATCH_C, SCRATCH_C, FLAG_BIT);
+    as.strh(SCRATCH_C, CTX, layout.fpuTagOffset);
+
+    as.addImm(SCRATCH_B, SCRATCH_B, 1);
+    as.bfi(SCRATCH_A, SCRATCH_B, 11, 3);
+    as.strh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+}
+
+void ARM64Translator::emitFpuFromBits(const JITOp& op) {
+    if (op.sign) {
+        as.fpData1(0x1E620000, op.dst, hostReg(op.src1));           // scvtf d, w
+    } else if (op.size == 4) {
+        as.fpData1(0x1E270000, FP_SCRATCH, hostReg(op.src1));       // fmov s, w
+        as.fpData1(0x1E22C000, op.dst, FP_SCRATCH);                 // fcvt d, s
+    } else {
+        as.mov32(SCRATCH_A, hostReg(op.src1));
+        as.mov32(SCRATCH_B, hostReg(op.src2));
+        as.orr64Lsl32(SCRATCH_A, SCRATCH_A, SCRATCH_B);
+        as.fpData1(0x9E670000, op.dst, SCRATCH_A);                  // fmov d, x
+    }
+}
+
+void ARM64Translator::emitFpuToBits(const JITOp& op) {
+    if (op.size == 4) {
+        as.fpData1(0x1E624000, FP_SCRATCH, op.src1);                // fcvt s, d
+        as.fpData1(0x1E260000, SCRATCH_A, FP_SCRATCH);              // fmov w, s
+    } else {
+        as.fpData1(0x9E660000, SCRATCH_A, op.src1);                 // fmov x, d
+        if (op.scale) {
+            as.lsr64By32(SCRATCH_A, SCRATCH_A);
+        }
+    }
+    writeReg(op.dst, SCRATCH_A);
+}
+
+void ARM64Translator::emitFpuArith(const JITOp& op) {
+    switch (op.fpuOp) {
+        case JITFpuOp::Add: as.fpData2(0x1E602800, op.dst, op.dst, op.src2); break;
+        case JITFpuOp::Sub: as.fpData2(0x1E603800, op.dst, op.dst, op.src2); break;
+        case JITFpuOp::Mul: as.fpData2(0x1E600800, op.dst, op.dst, op.src2); break;
+        case JITFpuOp::Div: as.fpData2(0x1E601800, op.dst, op.dst, op.src2); break;
+        case JITFpuOp::Neg: as.fpData1(0x1E614000, op.dst, op.dst); break;
+        case JITFpuOp::Abs: as.fpData1(0x1E60C000, op.dst, op.dst); break;
+        case JITFpuOp::Sqrt: as.fpData1(0x1E61C000, op.dst, op.dst); break;
+    }
+}
+
+// fcmp: less is LT, equal is EQ and unordered is VS (which is also LT).
+// C0/CF = less or unordered, C2/PF = unordered, C3/ZF = equal or unordered.
+void ARM64Translator::emitFpuCompare(const JITOp& op) {
+    bool flags = op.opcode == JITOpcode::FpuCompareFlags;
+    uint32_t target = flags ? FLAGS : SCRATCH_A;
+    uint32_t cBit = flags ? 0 : 8;
+    uint32_t pBit = flags ? 2 : 10;
+    uint32_t zBit = flags ? 6 : 14;
+
+    as.fcmp(op.src1, op.src2);
+    if (flags) {
+        as.ldr32(FLAGS, CTX, layout.eflagsOffset);
+        as.movImm32(FLAG_BIT, op.flagMask);
+        as.bic(FLAGS, FLAGS, FLAG_BIT);
+    } else {
+        as.ldrh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+        as.bfi(SCRATCH_A, WZR, 9, 1);
+    }
+
+    uint16_t mask = flags ? op.flagMask : JIT_FLAGS_ARITH;
+    if (mask & JIT_FLAG_CF) {
+        as.cset(FLAG_BIT, COND_LT);
+        as.bfi(target, FLAG_BIT, cBit, 1);
+    }
+    if (mask & (JIT_FLAG_PF | JIT_FLAG_ZF)) {
+        as.cset(FLAG_BIT, COND_VS);
+        if (mask & JIT_FLAG_PF) {
+            as.bfi(target, FLAG_BIT, pBit, 1);
+        }
+        if (mask & JIT_FLAG_ZF) {
+            as.cset(SCRATCH_B, COND_EQ);
+            as.orr(SCRATCH_B, SCRATCH_B, FLAG_BIT);
+            as.bfi(target, SCRATCH_B, zBit, 1);
+        }
+    }
+
+    if (flags) {
+        as.str32(FLAGS, CTX, layout.eflagsOffset);
+    } else {
+        as.strh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+    }
+}
+
+uint32_t ARM64Translator::vectorLaneOffset(const JITOp& op) const {
+    uint32_t base = op.imm == JIT_XMM_SCRATCH ? layout.xmmScratchOffset : layout.xmmOffset + op.imm * 16;
+    return base + op.imm2 * 4;
+}
+
+// Kernels touch only xmm state, so just the caller-saved guests are spilled.
+void ARM64Translator::emitVectorKernel(const JITOp& op) {
+    spillGuests(VOLATILE_GUESTS);
+    dirtyGuests &= ~VOLATILE_GUESTS;
+    as.movImm32(1, op.imm);
+    as.movImm32(2, op.imm2);
+    emitHelperCall(reinterpret_cast<const void*>(layout.vectorKernel));
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+bool ARM64Translator::translate(const JITBlockIR& ir) {
+    for (uint32_t offset : layout.regOffset) {
+        if (offset >= 16384 || (offset & 3)) return false;
+    }
+    if (layout.eipOffset >= 16384 || layout.eflagsOffset >= 16384 || layout.faultOffset >= 4096 ||
+        layout.codeDirtyOffset >= 4096 || layout.chainBudgetOffset >= 16384 || (layout.chainBudgetOffset & 3)) {
+        return false;
+    }
+    if (layout.blockHeadOffset >= 4096 || layout.fpuStackOffset >= 4096 || layout.fpuStatusOffset >= 8192 ||
+        layout.fpuTagOffset >= 8192 || ((layout.fpuStatusOffset | layout.fpuTagOffset) & 1)) {
+        return false;
+    }
+    if (layout.xmmOffset + 128 > 16384 || layout.xmmScratchOffset + 16 > 16384 ||
+        ((layout.xmmOffset | layout.xmmScratchOffset) & 3)) {
+        return false;
+    }
+    fastmem = layout.fastmem && layout.fastmemOffset < 32768 && !(layout.fastmemOffset & 7);
+
+    for (const JITOp& op : ir.ops) {
+        // x87 and vector ops name FP registers, xmm registers and temporaries only.
+        if (op.opcode >= JITOpcode::FpuCheck) continue;
+        for (uint8_t reg : {op.dst, op.src1, op.src2}) {
+            if (reg < JIT_GUEST_REGS) usedGuests |= 1 << reg;
+        }
+    }
+
+    emitPrologue();
+    emitChainEntry();
+
+    for (const JITOp& op : ir.ops) {
+        switch (op.opcode) {
+            case JITOpcode::LoadImm:
+                as.movImm32(hostReg(op.dst), op.imm);
+                writeReg(op.dst, hostReg(op.dst));
+                break;
+            case JITOpcode::Move: writeReg(op.dst, hostReg(op.src1)); break;
+            case JITOpcode::Lea: emitLea(op); break;
+            case JITOpcode::Load: emitLoad(op); break;
+            case JITOpcode::Store: emitStore(op); break;
+            case JITOpcode::Alu:
+            case JITOpcode::AluImm: emitAlu(op); break;
+            case JITOpcode::Extend: emitExtend(op); break;
+            case JITOpcode::Exit: emitLinkableExit(op.imm); break;
+            case JITOpcode::ExitReg:
+                spillGuests();
+                as.str32(hostReg(op.src1), CTX, layout.eipOffset);
+                epilogueBranches.push_back(as.position());
+                as.b(0);
+                break;
+            case JITOpcode::ExitCond: emitExitCond(op); break;
+            case JITOpcode::CodeCheck: emitExitIfSet(layout.codeDirtyOffset, op.imm); break;
+            case JITOpcode::FpuCheck: emitFpuCheck(op); break;
+            case JITOpcode::FpuPush: emitFpuPush(); break;
+            case JITOpcode::FpuPop: emitFpuPop(); break;
+            case JITOpcode::FpuRead:
+                emitFpuSlot(op.imm);
+                as.ldrIndexedD(op.dst, SCRATCH_B, SCRATCH_A);
+                break;
+            case JITOpcode::FpuWrite:
+                emitFpuSlot(op.imm);
+                as.strIndexedD(op.src1, SCRATCH_B, SCRATCH_A);
+                break;
+            case JITOpcode::FpuConst:
+                as.movImm64(SCRATCH_A, (static_cast<uint64_t>(op.imm2) << 32) | op.imm);
+                as.fpData1(0x9E670000, op.dst, SCRATCH_A);
+                break;
+            case JITOpcode::FpuFromBits: emitFpuFromBits(op); break;
+            case JITOpcode::FpuToBits: emitFpuToBits(op); break;
+            case JITOpcode::FpuArith: emitFpuArith(op); break;
+            case JITOpcode::FpuCompare:
+            case JITOpcode::FpuCompareFlags: emitFpuCompare(op); break;
+            case JITOpcode::FpuStatus:
+                as.ldrh(SCRATCH_A, CTX, layout.fpuStatusOffset);
+                writeReg(op.dst, SCRATCH_A);
+                break;
+            case JITOpcode::VecLaneLoad:
+                as.ldr32(SCRATCH_A, CTX, vectorLaneOffset(op));
+                writeReg(op.dst, SCRATCH_A);
+                break;
+            case JITOpcode::VecLaneStore: as.str32(hostReg(op.src1), CTX, vectorLaneOffset(op)); break;
+            case JITOpcode::VectorKernel: emitVectorKernel(op); break;
+        }
+    }
+
+    emitFastmemStubs();
+    emitEpilogue();
+    return true;
+}
+
+void writeBranch(uint8_t* site, uint32_t insn) {
+    memcpy(site, &insn, sizeof(insn));
+    __builtin___clear_cache(reinterpret_cast<char*>(site), reinterpret_cast<char*>(site + sizeof(insn)));
+}
+
+}
+
+JITEmitter::JITEmitter(const JITContextLayout& layout) : layout(layout) {}
+
+bool JITEmitter::compile(const JITBlockIR& ir, std::vector<uint8_t>& code, JITCodeInfo& info) {
+    code.clear();
+    info.chainOffset = 0;
+    info.exits.clear();
+    info.fastmemSites.clear();
+    ARM64Translator translator(layout, code, info);
+    return translator.translate(ir);
+}
+
+void JITEmitter::linkExit(uint8_t* site, const uint8_t* target) {
+    int64_t offset = target - site;
+    writeBranch(site, 0x14000000 | ((offset >> 2) & 0x3FFFFFF));
+}
+
+void JITEmitter::unlinkExit(uint8_t* site) {
+    writeBranch(site, LINK_FALLTHROUGH);
+}
+
+void JITEmitter::patchFastmemSite(uint8_t* site, const uint8_t* stub) {
+    int64_t offset = stub - site;
+    writeBranch(site, 0x14000000 | ((offset >> 2) & 0x3FFFFFF));
+}
+
+const char* JITEmitter::hostName() {
+    return "AArch64";
+}
+
+#endif
@@ -0,0 +1,177 @@
+#include "x86_core.h"
+#include "xbox_utils.h"
+#include <android/log.h>
+#include <cstring>
+
+#define LOG_TAG "X86Core"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+constexpr uint32_t CACHE_MAGIC = 0x43544A58;   // "XJTC"
+
+// Bump whenever the IR or a translation rule changes meaning; files
+// written by other versions are discarded.
+constexpr uint32_t CACHE_VERSION = 1;
+
+struct CacheHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t imageKey;
+    uint32_t opSize;
+    uint32_t blockCount;
+};
+
+struct CacheBlockHeader {
+    uint32_t startAddr;
+    uint32_t endAddr;
+    uint32_t instructionCount;
+    uint32_t codeHash;
+    uint32_t tier;
+    uint32_t opCount;
+};
+
+template <typename T>
+void append(std::vector<uint8_t>& out, const T& value) {
+    const uint8_t* bytes = reinterpret_cast<const uint8_t*>(&value);
+    out.insert(out.end(), bytes, bytes + sizeof(T));
+}
+
+class CacheReader {
+public:
+    explicit CacheReader(const std::vector<uint8_t>& data) : data(data), pos(0) {}
+
+    bool read(void* out, size_t size) {
+        if (data.size() - pos < size) return false;
+        memcpy(out, data.data() + pos, size);
+        pos += size;
+        return true;
+    }
+
+private:
+    const std::vector<uint8_t>& data;
+    size_t pos;
+};
+
+// Ops that touch the x87 register stack assume the double-precision
+// format and may only run while the guest has not asked for 64-bit
+// precision.
+bool usesFpuStack(const std::vector<JITOp>& ops) {
+    for (const JITOp& op : ops) {
+        switch (op.opcode) {
+            case JITOpcode::FpuCheck:
+            case JITOpcode::FpuPush:
+            case JITOpcode::FpuPop:
+            case JITOpcode::FpuRead:
+            case JITOpcode::FpuWrite:
+            case JITOpcode::FpuCompare:
+            case JITOpcode::FpuStatus:
+                return true;
+            default:
+                break;
+        }
+    }
+    return false;
+}
+
+}
+
+bool X86Core::openTranslationCache(const std::string& path, uint32_t imageKey) {
+    jitCachePath = path;
+    jitCacheKey = imageKey;
+    jitPersisted.clear();
+    jitPersistedDirty = false;
+
+    std::vector<uint8_t> data = XboxUtils::readFile(path);
+    if (data.empty()) return false;
+
+    CacheReader reader(data);
+    CacheHeader header;
+    if (!reader.read(&header, sizeof(header)) || header.magic != CACHE_MAGIC ||
+        header.version != CACHE_VERSION || header.imageKey != imageKey || header.opSize != sizeof(JITOp)) {
+        LOGW("Discarding stale translation cache %s", path.c_str());
+        return false;
+    }
+
+    for (uint32_t i = 0; i < header.blockCount; i++) {
+        CacheBlockHeader entry;
+        if (!reader.read(&entry, sizeof(entry)) || entry.opCount == 0) break;
+
+        PersistedBlock block;
+        block.tier = entry.tier ? JITTier::Optimized : JITTier::Baseline;
+        block.endAddr = entry.endAddr;
+        block.instructionCount = entry.instructionCount;
+        block.codeHash = entry.codeHash;
+        block.ops.resize(entry.opCount);
+        if (!reader.read(block.ops.data(), entry.opCount * sizeof(JITOp))) break;
+        jitPersisted[entry.startAddr] = std::move(block);
+    }
+
+    LOGI("Loaded %zu translated blocks from %s", jitPersisted.size(), path.c_str());
+    return true;
+}
+
+bool X86Core::saveTranslationCache() {
+    if (jitCachePath.empty() || !jitPersistedDirty) return true;
+
+    std::vector<uint8_t> data;
+    append(data, CacheHeader{CACHE_MAGIC, CACHE_VERSION, jitCacheKey, sizeof(JITOp),
+                             static_cast<uint32_t>(jitPersisted.size())});
+    for (const auto& [start, block] : jitPersisted) {
+        append(data, CacheBlockHeader{start, block.endAddr, block.instructionCount, block.codeHash,
+                                      block.tier == JITTier::Optimized ? 1u : 0u,
+                                      static_cast<uint32_t>(block.ops.size())});
+        const uint8_t* ops = reinterpret_cast<const uint8_t*>(block.ops.data());
+        data.insert(data.end(), ops, ops + block.ops.size() * sizeof(JITOp));
+    }
+
+    if (!XboxUtils::writeFile(jitCachePath, data)) {
+        LOGW("Failed to write translation cache %s", jitCachePath.c_str());
+        return false;
+    }
+    jitPersistedDirty = false;
+    return true;
+}
+
+// Unmapped bytes hash as zero, and the fault is not the guest's.
+uint32_t X86Core::guestCodeHash(uint32_t start_addr, uint32_t end_addr) {
+    std::vector<uint8_t> bytes(end_addr - start_addr);
+    memory->readBlock(start_addr, bytes.data(), static_cast<uint32_t>(bytes.size()));
+    XboxMemory::clearFault();
+    return XboxUtils::calculateCRC32(bytes.data(), bytes.size());
+}
+
+// A persisted block is only used for at least the requested tier, and is
+// dropped once the guest bytes under it no longer match.
+bool X86Core::restoreBlock(uint32_t start_addr, JITBlockIR& ir, JITTier& tier) {
+    auto it = jitPersisted.find(start_addr);
+    if (it == jitPersisted.end()) return false;
+
+    const PersistedBlock& block = it->second;
+    if (block.tier < tier || (fpuPrecise() && usesFpuStack(block.ops))) return false;
+    if (block.endAddr <= start_addr || guestCodeHash(start_addr, block.endAddr) != block.codeHash) {
+        jitPersisted.erase(it);
+        jitPersistedDirty = true;
+        return false;
+    }
+
+    ir.startAddr = start_addr;
+    ir.endAddr = block.endAddr;
+    ir.instructionCount = block.instructionCount;
+    ir.ops = block.ops;
+    tier = block.tier;
+    return true;
+}
+
+void X86Core::persistBlock(const JITBlockIR& ir, JITTier tier) {
+    if (jitCachePath.empty()) return;
+
+    PersistedBlock& block = jitPersisted[ir.startAddr];
+    block.tier = tier;
+    block.endAddr = ir.endAddr;
+    block.instructionCount = ir.instructionCount;
+    block.codeHash = guestCodeHash(ir.startAddr, ir.endAddr);
+    block.ops = ir.ops;
+    jitPersistedDirty = true;
+}
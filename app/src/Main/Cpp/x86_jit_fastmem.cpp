@@ -0,0 +1,96 @@
+#include "x86_core.h"
+#include <android/log.h>
+#include <mutex>
+#include <ucontext.h>
+
+#define LOG_TAG "X86Core"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+std::once_flag handlerOnce;
+struct sigaction previousSegv;
+struct sigaction previousBus;
+
+uintptr_t faultPC(void* context) {
+    ucontext_t* uc = static_cast<ucontext_t*>(context);
+#if defined(__aarch64__)
+    return uc->uc_mcontext.pc;
+#elif defined(__x86_64__)
+    return uc->uc_mcontext.gregs[REG_RIP];
+#else
+    (void)uc;
+    return 0;
+#endif
+}
+
+void setFaultPC(void* context, uintptr_t pc) {
+    ucontext_t* uc = static_cast<ucontext_t*>(context);
+#if defined(__aarch64__)
+    uc->uc_mcontext.pc = pc;
+#elif defined(__x86_64__)
+    uc->uc_mcontext.gregs[REG_RIP] = pc;
+#else
+    (void)uc;
+    (void)pc;
+#endif
+}
+
+// Faults that are not ours go to whoever was installed before us. A default
+// disposition is restored and the access retried, so the process still dies
+// the way it would have without the emulator.
+void chainSignal(int sig, siginfo_t* info, void* context) {
+    const struct sigaction& previous = sig == SIGBUS ? previousBus : previousSegv;
+    if (previous.sa_flags & SA_SIGINFO) {
+        previous.sa_sigaction(sig, info, context);
+    } else if (previous.sa_handler == SIG_DFL || previous.sa_handler == SIG_IGN) {
+        signal(sig, SIG_DFL);
+    } else {
+        previous.sa_handler(sig);
+    }
+}
+
+}
+
+thread_local X86Core* X86Core::runningCore = nullptr;
+
+void X86Core::installFastmemHandler() {
+    std::call_once(handlerOnce, [] {
+        struct sigaction action = {};
+        action.sa_sigaction = &X86Core::fastmemSignal;
+        action.sa_flags = SA_SIGINFO | SA_ONSTACK;
+        sigemptyset(&action.sa_mask);
+        if (sigaction(SIGSEGV, &action, &previousSegv) != 0 || sigaction(SIGBUS, &action, &previousBus) != 0) {
+            LOGW("Failed to install fastmem fault handler");
+            return;
+        }
+        LOGI("Fastmem fault handler installed");
+    });
+}
+
+void X86Core::fastmemSignal(int sig, siginfo_t* info, void* context) {
+    X86Core* core = runningCore;
+    if (core && core->handleFastmemFault(info->si_addr, context)) return;
+    chainSignal(sig, info, context);
+}
+
+// An arena access that hit MMIO, an unmapped range, a protected code page
+// or a page under an open DMA window.
+// The site is patched to jump to its helper call and the faulting access is
+// restarted from there, so the guest sees the same result the interpreter
+// would have produced.
+bool X86Core::handleFastmemFault(void* address, void* context) {
+    if (!memory->isFastmemAddress(address)) return false;
+
+    const uint8_t* pc = reinterpret_cast<const uint8_t*>(faultPC(context));
+    if (!isJITCode(pc)) return false;
+
+    auto entry = jitFastmemSites.find(pc);
+    if (entry == jitFastmemSites.end()) return false;
+
+    JITEmitter::patchFastmemSite(entry->second.site, entry->second.stub);
+    setFaultPC(context, reinterpret_cast<uintptr_t>(entry->second.site));
+    jitFastmemSites.erase(entry);
+    return true;
+}
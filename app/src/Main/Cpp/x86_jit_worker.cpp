@@ -0,0 +1,73 @@
+#include "x86_core.h"
+#include <android/log.h>
+#include <algorithm>
+#include <stdexcept>
+#include <system_error>
+
+#define LOG_TAG "X86Core"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+namespace {
+
+// The emulation and render threads already keep two cores busy.
+constexpr unsigned MAX_COMPILE_WORKERS = 3;
+constexpr unsigned RESERVED_CORES = 2;
+
+}
+
+void X86Core::startCompileWorkers() {
+    unsigned cores = std::thread::hardware_concurrency();
+    unsigned count = cores > RESERVED_CORES ? std::min(cores - RESERVED_CORES, MAX_COMPILE_WORKERS) : 1;
+
+    jitJobs = std::make_unique<BoundedQueue<JITCompileJob, JIT_QUEUE_CAPACITY>>();
+    jitResults = std::make_unique<BoundedQueue<JITCompileResult, JIT_QUEUE_CAPACITY>>();
+    jitWorkersRunning = true;
+    for (unsigned i = 0; i < count; i++) {
+        try {
+            jitWorkers.emplace_back(&X86Core::compileWorker, this);
+        } catch (const std::system_error& e) {
+            LOGW("Failed to start JIT compile worker: %s", e.what());
+            break;
+        }
+    }
+    LOGI("JIT compile workers: %zu", jitWorkers.size());
+}
+
+void X86Core::stopCompileWorkers() {
+    {
+        std::lock_guard<std::mutex> lock(jitWakeMutex);
+        jitWorkersRunning = false;
+    }
+    jitWake.notify_all();
+    for (std::thread& worker : jitWorkers) {
+        worker.join();
+    }
+    jitWorkers.clear();
+}
+
+// Translation only reads guest memory and the emitter only reads its
+// layout, so workers share both with the emulation thread. Everything
+// that touches jit_cache stays on the emulation thread.
+void X86Core::compileWorker() {
+    while (jitWorkersRunning) {
+        JITCompileJob job;
+        if (!jitJobs->pop(job)) {
+            std::unique_lock<std::mutex> lock(jitWakeMutex);
+            jitWake.wait(lock, [this] { return !jitWorkersRunning || !jitJobs->empty(); });
+            continue;
+        }
+
+        JITCompileResult result;
+        result.job = job;
+        try {
+            result.translated = translateBlock(job.startAddr, result.ir, job.tier, job.fpuPrecise) &&
+                                jitEmitter->compile(result.ir, result.code, result.info);
+        } catch (const std::exception&) {
+            result.translated = false;
+        }
+
+        // Cannot fail: no more than JIT_QUEUE_CAPACITY jobs are pending.
+        jitResults->push(std::move(result));
+    }
+}
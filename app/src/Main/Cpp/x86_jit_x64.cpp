@@ -0,0 +1,844 @@
+#include "x86_jit.h"
+
+#if defined(__x86_64__)
+
+#include <cstring>
+
+namespace {
+
+constexpr uint32_t RAX = 0;
+constexpr uint32_t RCX = 1;
+constexpr uint32_t RDX = 2;
+constexpr uint32_t RBX = 3;
+constexpr uint32_t RSP = 4;
+constexpr uint32_t RBP = 5;
+constexpr uint32_t RSI = 6;
+constexpr uint32_t RDI = 7;
+constexpr uint32_t CTX = RBX;
+constexpr uint32_t TEMP_REGS[] = {12, 13, 14};
+
+// eax..edi live in these for the whole block. rsi, rdi and r8-r11 are
+// caller-saved, so the guests they hold are reloaded after helper calls.
+constexpr uint32_t GUEST_REGS[JIT_GUEST_REGS] = {8, 9, 10, 11, RBP, 15, RSI, RDI};
+constexpr uint8_t VOLATILE_GUESTS = 0xCF;
+constexpr uint32_t XMM_SCRATCH = 2;
+constexpr uint32_t NO_INDEX = 4;
+constexpr size_t LINK_JUMP_SIZE = 5;
+
+class X64Assembler {
+public:
+    explicit X64Assembler(std::vector<uint8_t>& code) : code(code) {}
+
+    size_t position() const { return code.size(); }
+
+    void byte(uint8_t value) { code.push_back(value); }
+
+    void dword(uint32_t value) {
+        for (int i = 0; i < 4; i++) byte((value >> (i * 8)) & 0xFF);
+    }
+
+    void qword(uint64_t value) {
+        for (int i = 0; i < 8; i++) byte((value >> (i * 8)) & 0xFF);
+    }
+
+    void patchRel32(size_t pos, size_t target) {
+        uint32_t rel = static_cast<uint32_t>(static_cast<int32_t>(target) - static_cast<int32_t>(pos + 4));
+        for (int i = 0; i < 4; i++) code[pos + i] = (rel >> (i * 8)) & 0xFF;
+    }
+
+    void rex(bool w, uint32_t reg, uint32_t index, uint32_t rm) {
+        uint8_t prefix = 0x40 | (w ? 8 : 0) | (((reg >> 3) & 1) << 2) | (((index >> 3) & 1) << 1) | ((rm >> 3) & 1);
+        if (prefix != 0x40) byte(prefix);
+    }
+
+    void modrm(uint32_t mod, uint32_t reg, uint32_t rm) { byte((mod << 6) | ((reg & 7) << 3) | (rm & 7)); }
+
+    void opRR(uint8_t opcode, uint32_t reg, uint32_t rm, bool w = false) {
+        rex(w, reg, 0, rm);
+        byte(opcode);
+        modrm(3, reg, rm);
+    }
+
+    void op0FRR(uint8_t opcode, uint32_t reg, uint32_t rm) {
+        rex(false, reg, 0, rm);
+        byte(0x0F);
+        byte(opcode);
+        modrm(3, reg, rm);
+    }
+
+    void opRM(uint8_t opcode, uint32_t reg, uint32_t base, uint32_t disp) {
+        rex(false, reg, 0, base);
+        byte(opcode);
+        modrm(2, reg, base);
+        if ((base & 7) == 4) byte(0x24);
+        dword(disp);
+    }
+
+    void op0FRM(uint8_t opcode, uint32_t reg, uint32_t base, uint32_t disp) {
+        rex(false, reg, 0, base);
+        byte(0x0F);
+        byte(opcode);
+        modrm(2, reg, base);
+        if ((base & 7) == 4) byte(0x24);
+        dword(disp);
+    }
+
+    // Scalar SSE with a mandatory prefix, register-direct or [base + index*8 + disp].
+    void sseRR(uint8_t prefix, uint8_t opcode, uint32_t reg, uint32_t rm, bool w = false) {
+        byte(prefix);
+        rex(w, reg, 0, rm);
+        byte(0x0F);
+        byte(opcode);
+        modrm(3, reg, rm);
+    }
+
+    void sseIndexed(uint8_t prefix, uint8_t opcode, uint32_t reg, uint32_t base, uint32_t index, uint32_t disp) {
+        byte(prefix);
+        rex(false, reg, index, base);
+        byte(0x0F);
+        byte(opcode);
+        modrm(2, reg, 4);
+        byte((3 << 6) | ((index & 7) << 3) | (base & 7));
+        dword(disp);
+    }
+
+    // [rax + rcx], the fastmem arena addressing form.
+    void arenaOperand(uint32_t reg) {
+        modrm(0, reg, 4);
+        byte(0x08);
+    }
+
+    void load64(uint32_t dst, uint32_t base, uint32_t disp) {
+        rex(true, dst, 0, base);
+        byte(0x8B);
+        modrm(2, dst, base);
+        if ((base & 7) == 4) byte(0x24);
+        dword(disp);
+    }
+
+    void movRR(uint32_t dst, uint32_t src) { opRR(0x89, src, dst); }
+    void movRR64(uint32_t dst, uint32_t src) { opRR(0x89, src, dst, true); }
+    void load32(uint32_t dst, uint32_t base, uint32_t disp) { opRM(0x8B, dst, base, disp); }
+    void store32(uint32_t base, uint32_t disp, uint32_t src) { opRM(0x89, src, base, disp); }
+    void load16(uint32_t dst, uint32_t base, uint32_t disp) { op0FRM(0xB7, dst, base, disp); }
+
+    void store16(uint32_t base, uint32_t disp, uint32_t src) {
+        byte(0x66);
+        opRM(0x89, src, base, disp);
+    }
+
+    void storeImm8(uint32_t base, uint32_t disp, uint8_t imm) {
+        opRM(0xC6, 0, base, disp);
+        byte(imm);
+    }
+
+    void storeImm32(uint32_t base, uint32_t disp, uint32_t imm) {
+        opRM(0xC7, 0, base, disp);
+        dword(imm);
+    }
+
+    void subImm32(uint32_t base, uint32_t disp, uint32_t imm) {
+        opRM(0x81, 5, base, disp);
+        dword(imm);
+    }
+
+    void cmpByteZero(uint32_t base, uint32_t disp) {
+        opRM(0x80, 7, base, disp);
+        byte(0);
+    }
+
+    void movImm32(uint32_t dst, uint32_t imm) {
+        rex(false, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        dword(imm);
+    }
+
+    void movImm64(uint32_t dst, uint64_t imm) {
+        rex(true, 0, 0, dst);
+        byte(0xB8 + (dst & 7));
+        qword(imm);
+    }
+
+    void aluImm32(uint32_t ext, uint32_t rm, uint32_t imm) {
+        opRR(0x81, ext, rm);
+        dword(imm);
+    }
+
+    void aluImm64(uint32_t ext, uint32_t rm, uint32_t imm) {
+        opRR(0x81, ext, rm, true);
+        dword(imm);
+    }
+
+    void group3(uint32_t ext, uint32_t rm) { opRR(0xF7, ext, rm); }
+
+    void testImm32(uint32_t rm, uint32_t imm) {
+        group3(0, rm);
+        dword(imm);
+    }
+
+    void shiftImm(uint32_t ext, uint32_t rm, uint8_t count) {
+        opRR(0xC1, ext, rm);
+        byte(count);
+    }
+
+    void shiftCl(uint32_t ext, uint32_t rm) { opRR(0xD3, ext, rm); }
+
+    void shiftImm64(uint32_t ext, uint32_t rm, uint8_t count) {
+        opRR(0xC1, ext, rm, true);
+        byte(count);
+    }
+
+    void bitOpImm64(uint32_t ext, uint32_t rm, uint8_t bit) {
+        rex(true, 0, 0, rm);
+        byte(0x0F);
+        byte(0xBA);
+        modrm(3, ext, rm);
+        byte(bit);
+    }
+
+    void lea(uint32_t dst, uint32_t base, uint32_t index, uint32_t scale, uint32_t disp) {
+        bool noBase = base == NO_INDEX;
+        rex(false, dst, index, noBase ? 0 : base);
+        byte(0x8D);
+        modrm(noBase ? 0 : 2, dst, 4);
+        byte((scale << 6) | ((index & 7) << 3) | (noBase ? 5 : (base & 7)));
+        dword(disp);
+    }
+
+    void pushfq() { byte(0x9C); }
+
+    void push(uint32_t reg) {
+        rex(false, 0, 0, reg);
+        byte(0x50 + (reg & 7));
+    }
+
+    void pop(uint32_t reg) {
+        rex(false, 0, 0, reg);
+        byte(0x58 + (reg & 7));
+    }
+
+    void callRax() {
+        byte(0xFF);
+        byte(0xD0);
+    }
+
+    size_t jmp32() {
+        byte(0xE9);
+        size_t pos = position();
+        dword(0);
+        return pos;
+    }
+
+    size_t jcc32(uint8_t cc) {
+        byte(0x0F);
+        byte(0x80 | cc);
+        size_t pos = position();
+        dword(0);
+        return pos;
+    }
+
+    void ret() { byte(0xC3); }
+
+private:
+    std::vector<uint8_t>& code;
+};
+
+class X64Translator {
+public:
+    X64Translator(const JITContextLayout& layout, std::vector<uint8_t>& code, JITCodeInfo& info) :
+        layout(layout), as(code), info(info) {}
+
+    bool translate(const JITBlockIR& ir);
+
+private:
+    const JITContextLayout& layout;
+    X64Assembler as;
+    JITCodeInfo& info;
+    std::vector<size_t> epilogueJumps;
+    uint8_t usedGuests = 0;
+    uint8_t dirtyGuests = 0;
+
+    struct FastmemStub {
+        JITOp op;
+        uint8_t dirtyGuests;
+        size_t patchPos;
+        size_t accessPos;
+        size_t resumePos;
+    };
+    std::vector<FastmemStub> fastmemStubs;
+
+    static bool isTemp(uint8_t reg) { return reg >= JIT_T0 && reg != JIT_NONE; }
+    static uint32_t hostReg(uint8_t reg) { return isTemp(reg) ? TEMP_REGS[reg - JIT_T0] : GUEST_REGS[reg]; }
+
+    void readRegInto(uint8_t reg, uint32_t target);
+    void writeReg(uint8_t reg, uint32_t src);
+    void loadGuests(uint8_t mask);
+    void spillGuests(uint8_t mask = 0xFF);
+    void emitHelperCall(const void* helper);
+
+    void emitPrologue();
+    void emitChainEntry();
+    void emitEpilogue();
+    void emitExitTo(uint32_t target);
+    void emitLinkableExit(uint32_t target);
+    void emitExitIfSet(uint32_t flagOffset, uint32_t target);
+    void emitLea(const JITOp& op);
+    void emitLoad(const JITOp& op);
+    void emitStore(const JITOp& op);
+    void emitLoadCall(const JITOp& op);
+    void emitStoreCall(const JITOp& op);
+    void emitFastmemAccess(const JITOp& op);
+    void emitFastmemStubs();
+    void emitAlu(const JITOp& op);
+    void emitFlags(const JITOp& op);
+    void emitExtend(const JITOp& op);
+    void emitExitCond(const JITOp& op);
+    void emitFpuSlot(uint32_t index);
+    void emitFpuCheck(const JITOp& op);
+    void emitFpuPush();
+    void emitFpuPop();
+    void emitFpuFromBits(const JITOp& op);
+    void emitFpuToBits(const JITOp& op);
+    void emitFpuArith(const JITOp& op);
+    void emitFpuCompare(const JITOp& op);
+    uint32_t vectorLaneOffset(const JITOp& op) const;
+    void emitVectorKernel(const JITOp& op);
+};
+
+void X64Translator::readRegInto(uint8_t reg, uint32_t target) {
+    if (hostReg(reg) != target) {
+        as.movRR(target, hostReg(reg));
+    }
+}
+
+void X64Translator::writeReg(uint8_t reg, uint32_t src) {
+    if (hostReg(reg) != src) {
+        as.movRR(hostReg(reg), src);
+    }
+    if (!isTemp(reg)) {
+        dirtyGuests |= 1 << reg;
+    }
+}
+
+void X64Translator::loadGuests(uint8_t mask) {
+    for (uint8_t reg = 0; reg < JIT_GUEST_REGS; reg++) {
+        if (mask & (1 << reg)) {
+            as.load32(GUEST_REGS[reg], CTX, layout.regOffset[reg]);
+        }
+    }
+}
+
+void X64Translator::spillGuests(uint8_t mask) {
+    for (uint8_t reg = 0; reg < JIT_GUEST_REGS; reg++) {
+        if (dirtyGuests & mask & (1 << reg)) {
+            as.store32(CTX, layout.regOffset[reg], GUEST_REGS[reg]);
+        }
+    }
+}
+
+void X64Translator::emitHelperCall(const void* helper) {
+    as.movRR64(RDI, CTX);
+    as.movImm64(RAX, reinterpret_cast<uint64_t>(helper));
+    as.callRax();
+}
+
+void X64Translator::emitPrologue() {
+    as.push(RBX);
+    as.push(RBP);
+    as.push(12);
+    as.push(13);
+    as.push(14);
+    as.push(15);
+    as.aluImm64(5, RSP, 8);
+    as.movRR64(CTX, RDI);
+}
+
+void X64Translator::emitChainEntry() {
+    info.chainOffset = static_cast<uint32_t>(as.position());
+    as.subImm32(CTX, layout.chainBudgetOffset, 1);
+    epilogueJumps.push_back(as.jcc32(0x2));
+    loadGuests(usedGuests);
+}
+
+void X64Translator::emitEpilogue() {
+    size_t target = as.position();
+    for (size_t pos : epilogueJumps) {
+        as.patchRel32(pos, target);
+    }
+    as.aluImm64(0, RSP, 8);
+    as.pop(15);
+    as.pop(14);
+    as.pop(13);
+    as.pop(12);
+    as.pop(RBP);
+    as.pop(RBX);
+    as.ret();
+}
+
+void X64Translator::emitExitTo(uint32_t target) {
+    spillGuests();
+    as.storeImm32(CTX, layout.eipOffset, target);
+    epilogueJumps.push_back(as.jmp32());
+}
+
+void X64Translator::emitLinkableExit(uint32_t target) {
+    spillGuests();
+    as.storeImm32(CTX, layout.eipOffset, target);
+    info.exits.push_back({target, static_cast<uint32_t>(as.position())});
+    as.jmp32();
+    epilogueJumps.push_back(as.jmp32());
+}
+
+void X64Translator::emitExitIfSet(uint32_t flagOffset, uint32_t target) {
+    as.cmpByteZero(CTX, flagOffset);
+    size_t skip = as.jcc32(0x4);
+    emitExitTo(target);
+    as.patchRel32(skip, as.position());
+}
+
+void X64Translator::emitLea(const JITOp& op) {
+    uint32_t dst = hostReg(op.dst);
+
+    if (op.src1 == JIT_NONE && op.src2 == JIT_NONE) {
+        as.movImm32(dst, op.imm);
+    } else {
+        uint32_t base = op.src1 != JIT_NONE ? hostReg(op.src1) : NO_INDEX;
+        uint32_t index = op.src2 != JIT_NONE ? hostReg(op.src2) : NO_INDEX;
+        as.lea(dst, base, index, op.src2 != JIT_NONE ? op.scale : 0, op.imm);
+    }
+    writeReg(op.dst, dst);
+}
+
+void X64Translator::emitLoad(const JITOp& op) {
+    if (layout.fastmem) {
+        emitFastmemAccess(op);
+    } else {
+        emitLoadCall(op);
+    }
+
+    if (op.sign && op.size == 1) {
+        as.op0FRR(0xBE, RAX, RAX);
+    } else if (op.sign && op.size == 2) {
+        as.op0FRR(0xBF, RAX, RAX);
+    }
+    writeReg(op.dst, RAX);
+}
+
+void X64Translator::emitStore(const JITOp& op) {
+    if (layout.fastmem) {
+        emitFastmemAccess(op);
+    } else {
+        emitStoreCall(op);
+    }
+}
+
+// Helpers see a coherent context: dirty guests are written back first, and
+// the caller-saved ones are reloaded once the call returns. Loads leave the
+// raw value in eax.
+void X64Translator::emitLoadCall(const JITOp& op) {
+    spillGuests();
+    dirtyGuests = 0;
+    readRegInto(op.src1, RSI);
+    as.movImm32(RDX, op.size);
+    emitHelperCall(reinterpret_cast<const void*>(layout.readMemory));
+    emitExitIfSet(layout.faultOffset, op.guestAddr);
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+void X64Translator::emitStoreCall(const JITOp& op) {
+    spillGuests();
+    dirtyGuests = 0;
+    readRegInto(op.src2, RDX);
+    readRegInto(op.src1, RSI);
+    as.movImm32(RCX, op.size);
+    emitHelperCall(reinterpret_cast<const void*>(layout.writeMemory));
+    emitExitIfSet(layout.faultOffset, op.guestAddr);
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+// The access goes straight to the arena. Its first instruction is long
+// enough to take the jump to the helper call emitted out of line.
+void X64Translator::emitFastmemAccess(const JITOp& op) {
+    FastmemStub stub{op, dirtyGuests, as.position(), 0, 0};
+    as.load64(RAX, CTX, layout.fastmemOffset);
+    readRegInto(op.src1, RCX);
+    if (op.opcode == JITOpcode::Store) {
+        readRegInto(op.src2, RDX);
+    }
+
+    stub.accessPos = as.position();
+    if (op.opcode == JITOpcode::Load) {
+        if (op.size == 4) {
+            as.byte(0x8B);
+        } else {
+            as.byte(0x0F);
+            as.byte(op.size == 1 ? 0xB6 : 0xB7);
+        }
+        as.arenaOperand(RAX);
+    } else {
+        if (op.size == 2) as.byte(0x66);
+        as.byte(op.size == 1 ? 0x88 : 0x89);
+        as.arenaOperand(RDX);
+    }
+    stub.resumePos = as.position();
+    fastmemStubs.push_back(stub);
+}
+
+// Sits between the last exit and the epilogue, so it is only entered
+// through a patched site.
+void X64Translator::emitFastmemStubs() {
+    for (const FastmemStub& stub : fastmemStubs) {
+        info.fastmemSites.push_back({static_cast<uint32_t>(stub.accessPos), static_cast<uint32_t>(stub.patchPos),
+                                     static_cast<uint32_t>(as.position())});
+        dirtyGuests = stub.dirtyGuests;
+        if (stub.op.opcode == JITOpcode::Load) {
+            emitLoadCall(stub.op);
+        } else {
+            emitStoreCall(stub.op);
+        }
+        as.patchRel32(as.jmp32(), stub.resumePos);
+    }
+}
+
+void X64Translator::emitAlu(const JITOp& op) {
+    uint32_t a = hostReg(op.dst);
+
+    static const uint8_t regForms[] = {0x01, 0x09, 0x21, 0x29, 0x31, 0x39, 0x85};
+    static const uint8_t immExt[] = {0, 1, 4, 5, 6, 7};
+
+    if (op.opcode == JITOpcode::Alu) {
+        uint32_t b = hostReg(op.src2);
+        if (op.aluOp == JITAluOp::Imul) {
+            as.op0FRR(0xAF, a, b);
+        } else {
+            as.opRR(regForms[static_cast<int>(op.aluOp)], b, a);
+        }
+    } else {
+        switch (op.aluOp) {
+            case JITAluOp::Add:
+            case JITAluOp::Or:
+            case JITAluOp::And:
+            case JITAluOp::Sub:
+            case JITAluOp::Xor:
+            case JITAluOp::Cmp: as.aluImm32(immExt[static_cast<int>(op.aluOp)], a, op.imm); break;
+            case JITAluOp::Test: as.testImm32(a, op.imm); break;
+            case JITAluOp::Inc: as.opRR(0xFF, 0, a); break;
+            case JITAluOp::Dec: as.opRR(0xFF, 1, a); break;
+            case JITAluOp::Not: as.group3(2, a); break;
+            case JITAluOp::Neg: as.group3(3, a); break;
+            case JITAluOp::Shl: as.shiftImm(4, a, op.imm & 31); break;
+            case JITAluOp::Shr: as.shiftImm(5, a, op.imm & 31); break;
+            case JITAluOp::Sar: as.shiftImm(7, a, op.imm & 31); break;
+            case JITAluOp::Imul:
+                as.opRR(0x69, a, a);
+                as.dword(op.imm);
+                break;
+        }
+    }
+
+    if (op.flagMask) {
+        emitFlags(op);
+    }
+
+    if (op.aluOp != JITAluOp::Cmp && op.aluOp != JITAluOp::Test) {
+        writeReg(op.dst, a);
+    }
+}
+
+void X64Translator::emitFlags(const JITOp& op) {
+    bool logic = op.aluOp == JITAluOp::And || op.aluOp == JITAluOp::Or ||
+                 op.aluOp == JITAluOp::Xor || op.aluOp == JITAluOp::Test;
+    uint32_t captured = op.flagMask & ~(logic ? JIT_FLAG_AF : 0);
+
+    as.pushfq();
+    as.pop(RDX);
+    as.aluImm32(4, RDX, captured);
+    as.load32(RCX, CTX, layout.eflagsOffset);
+    as.aluImm32(4, RCX, ~static_cast<uint32_t>(op.flagMask));
+    as.opRR(0x09, RDX, RCX);
+    as.store32(CTX, layout.eflagsOffset, RCX);
+}
+
+void X64Translator::emitExtend(const JITOp& op) {
+    readRegInto(op.src1, RAX);
+    if (op.scale) {
+        as.shiftImm(5, RAX, op.scale);
+    }
+    uint8_t opcode = op.sign ? (op.size == 1 ? 0xBE : 0xBF) : (op.size == 1 ? 0xB6 : 0xB7);
+    as.op0FRR(opcode, RAX, RAX);
+    writeReg(op.dst, RAX);
+}
+
+void X64Translator::emitExitCond(const JITOp& op) {
+    static const uint32_t simpleMasks[] = {JIT_FLAG_OF, JIT_FLAG_CF, JIT_FLAG_ZF,
+                                           JIT_FLAG_CF | JIT_FLAG_ZF, JIT_FLAG_SF, JIT_FLAG_PF};
+    uint8_t kind = op.cond >> 1;
+
+    spillGuests();
+    dirtyGuests = 0;
+    as.load32(RAX, CTX, layout.eflagsOffset);
+    if (kind < 6) {
+        as.testImm32(RAX, simpleMasks[kind]);
+    } else {
+        as.movRR(RCX, RAX);
+        as.shiftImm(5, RCX, 4);
+        as.opRR(0x31, RAX, RCX);
+        as.aluImm32(4, RCX, JIT_FLAG_SF);
+        if (kind == 7) {
+            as.aluImm32(4, RAX, JIT_FLAG_ZF);
+            as.opRR(0x09, RAX, RCX);
+        }
+    }
+
+    size_t notTaken = as.jcc32((op.cond & 1) ? 0x5 : 0x4);
+    emitLinkableExit(op.imm);
+    as.patchRel32(notTaken, as.position());
+    emitLinkableExit(op.imm2);
+}
+
+// rax = physical slot of ST(index).
+void X64Translator::emitFpuSlot(uint32_t index) {
+    as.load16(RAX, CTX, layout.fpuStatusOffset);
+    as.shiftImm(5, RAX, 11);
+    if (index) {
+        as.aluImm32(0, RAX, index);
+    }
+    as.aluImm32(4, RAX, 7);
+}
+
+void X64Translator::emitFpuCheck(const JITOp& op) {
+    as.load16(RAX, CTX, layout.fpuTagOffset);
+    as.movRR(RDX, RAX);
+    as.shiftImm(4, RDX, 16);
+    as.opRR(0x09, RDX, RAX);
+    as.load16(RCX, CTX, layout.fpuStatusOffset);
+    as.shiftImm(5, RCX, 10);
+    as.aluImm32(4, RCX, 0xE);
+    as.shiftCl(5, RAX);
+    as.aluImm32(4, RAX, op.imm);
+    as.aluImm32(7, RAX, op.imm2);
+    size_t skip = as.jcc32(0x4);
+    as.storeImm8(CTX, layout.blockHeadOffset, 0);
+    emitExitTo(op.guestAddr);
+    as.patchRel32(skip, as.position());
+}
+
+void X64Translator::emitFpuPush() {
+    as.load16(RAX, CTX, layout.fpuStatusOffset);
+    as.movRR(RCX, RAX);
+    as.aluImm32(5, RCX, 0x800);
+    as.aluImm32(4, RCX, 0x3800);
+    as.aluImm32(4, RAX, ~0x3800u);
+    as.opRR(0x09, RCX, RAX);
+    as.store16(CTX, layout.fpuStatusOffset, RAX);
+
+    as.shiftImm(5, RCX, 10);
+    as.movImm32(RAX, 3);
+    as.shiftCl(4, RAX);
+    as.group3(2, RAX);
+    as.load16(RDX, CTX, layout.fpuTagOffset);
+    as.opRR(0x21, RAX, RDX);
+    as.store16(CTX, layout.fpuTagOffset, RDX);
+}
+
+void X64Translator::emitFpuPop() {
+    as.load16(RCX, CTX, layout.fpuStatusOffset);
+    as.aluImm32(4, RCX, 0x3800);
+    as.shiftImm(5, RCX, 10);
+    as.movImm32(RAX, 3);
+    as.shiftCl(4, RAX);
+    as.load16(RDX, CTX, layout.fpuTagOffset);
+    as.opRR(0x09, RAX, RDX);
+    as.store16(CTX, layout.fpuTagOffset, RDX);
+
+    as.load16(RAX, CTX, layout.fpuStatusOffset);
+    as.movRR(RCX, RAX);
+    as.aluImm32(0, RCX, 0x800);
+    as.aluImm32(4, RCX, 0x3800);
+    as.aluImm32(4, RAX, ~0x3800u);
+    as.opRR(0x09, RCX, RAX);
+    as.store16(CTX, layout.fpuStatusOffset, RAX);
+}
+
+void X64Translator::emitFpuFromBits(const JITOp& op) {
+    if (op.sign) {
+        as.sseRR(0xF2, 0x2A, op.dst, hostReg(op.src1));
+    } else if (op.size == 4) {
+        as.sseRR(0x66, 0x6E, op.dst, hostReg(op.src1));
+        as.sseRR(0xF3, 0x5A, op.dst, op.dst);
+    } else {
+        readRegInto(op.src1, RAX);
+        readRegInto(op.src2, RCX);
+        as.shiftImm64(4, RCX, 32);
+        as.opRR(0x09, RCX, RAX, true);
+        as.sseRR(0x66, 0x6E, op.dst, RAX, true);
+    }
+}
+
+void X64Translator::emitFpuToBits(const JITOp& op) {
+    if (op.size == 4) {
+        as.sseRR(0xF2, 0x5A, XMM_SCRATCH, op.src1);
+        as.sseRR(0x66, 0x7E, XMM_SCRATCH, RAX);
+    } else {
+        as.sseRR(0x66, 0x7E, op.src1, RAX, true);
+        if (op.scale) {
+            as.shiftImm64(5, RAX, 32);
+        }
+    }
+    writeReg(op.dst, RAX);
+}
+
+void X64Translator::emitFpuArith(const JITOp& op) {
+    switch (op.fpuOp) {
+        case JITFpuOp::Add: as.sseRR(0xF2, 0x58, op.dst, op.src2); break;
+        case JITFpuOp::Sub: as.sseRR(0xF2, 0x5C, op.dst, op.src2); break;
+        case JITFpuOp::Mul: as.sseRR(0xF2, 0x59, op.dst, op.src2); break;
+        case JITFpuOp::Div: as.sseRR(0xF2, 0x5E, op.dst, op.src2); break;
+        case JITFpuOp::Sqrt: as.sseRR(0xF2, 0x51, op.dst, op.dst); break;
+        case JITFpuOp::Neg:
+        case JITFpuOp::Abs:
+            as.sseRR(0x66, 0x7E, op.dst, RAX, true);
+            as.bitOpImm64(op.fpuOp == JITFpuOp::Neg ? 7 : 6, RAX, 63);
+            as.sseRR(0x66, 0x6E, op.dst, RAX, true);
+            break;
+    }
+}
+
+// ucomisd leaves CF/PF/ZF exactly as FCOMI does. Shifted left by eight
+// they also line up with C0/C2/C3 of the status word.
+void X64Translator::emitFpuCompare(const JITOp& op) {
+    as.sseRR(0x66, 0x2E, op.src1, op.src2);
+    if (op.opcode == JITOpcode::FpuCompareFlags) {
+        emitFlags(op);
+        return;
+    }
+    as.pushfq();
+    as.pop(RDX);
+    as.aluImm32(4, RDX, JIT_FLAG_CF | JIT_FLAG_PF | JIT_FLAG_ZF);
+    as.shiftImm(4, RDX, 8);
+    as.load16(RAX, CTX, layout.fpuStatusOffset);
+    as.aluImm32(4, RAX, ~0x4700u);
+    as.opRR(0x09, RDX, RAX);
+    as.store16(CTX, layout.fpuStatusOffset, RAX);
+}
+
+uint32_t X64Translator::vectorLaneOffset(const JITOp& op) const {
+    uint32_t base = op.imm == JIT_XMM_SCRATCH ? layout.xmmScratchOffset : layout.xmmOffset + op.imm * 16;
+    return base + op.imm2 * 4;
+}
+
+// Kernels touch only xmm state, so just the caller-saved guests are spilled.
+void X64Translator::emitVectorKernel(const JITOp& op) {
+    spillGuests(VOLATILE_GUESTS);
+    dirtyGuests &= ~VOLATILE_GUESTS;
+    as.movImm32(RSI, op.imm);
+    as.movImm32(RDX, op.imm2);
+    emitHelperCall(reinterpret_cast<const void*>(layout.vectorKernel));
+    loadGuests(usedGuests & VOLATILE_GUESTS);
+}
+
+bool X64Translator::translate(const JITBlockIR& ir) {
+    for (const JITOp& op : ir.ops) {
+        // x87 and vector ops name FP registers, xmm registers and temporaries only.
+        if (op.opcode >= JITOpcode::FpuCheck) continue;
+        for (uint8_t reg : {op.dst, op.src1, op.src2}) {
+            if (reg < JIT_GUEST_REGS) usedGuests |= 1 << reg;
+        }
+    }
+
+    emitPrologue();
+    emitChainEntry();
+
+    for (const JITOp& op : ir.ops) {
+        switch (op.opcode) {
+            case JITOpcode::LoadImm:
+                as.movImm32(hostReg(op.dst), op.imm);
+                writeReg(op.dst, hostReg(op.dst));
+                break;
+            case JITOpcode::Move: writeReg(op.dst, hostReg(op.src1)); break;
+            case JITOpcode::Lea: emitLea(op); break;
+            case JITOpcode::Load: emitLoad(op); break;
+            case JITOpcode::Store: emitStore(op); break;
+            case JITOpcode::Alu:
+            case JITOpcode::AluImm: emitAlu(op); break;
+            case JITOpcode::Extend: emitExtend(op); break;
+            case JITOpcode::Exit: emitLinkableExit(op.imm); break;
+            case JITOpcode::ExitReg:
+                spillGuests();
+                as.store32(CTX, layout.eipOffset, hostReg(op.src1));
+                epilogueJumps.push_back(as.jmp32());
+                break;
+            case JITOpcode::ExitCond: emitExitCond(op); break;
+            case JITOpcode::CodeCheck: emitExitIfSet(layout.codeDirtyOffset, op.imm); break;
+            case JITOpcode::FpuCheck: emitFpuCheck(op); break;
+            case JITOpcode::FpuPush: emitFpuPush(); break;
+            case JITOpcode::FpuPop: emitFpuPop(); break;
+            case JITOpcode::FpuRead:
+                emitFpuSlot(op.imm);
+                as.sseIndexed(0xF2, 0x10, op.dst, CTX, RAX, layout.fpuStackOffset);
+                break;
+            case JITOpcode::FpuWrite:
+                emitFpuSlot(op.imm);
+                as.sseIndexed(0xF2, 0x11, op.src1, CTX, RAX, layout.fpuStackOffset);
+                break;
+            case JITOpcode::FpuConst:
+                as.movImm64(RAX, (static_cast<uint64_t>(op.imm2) << 32) | op.imm);
+                as.sseRR(0x66, 0x6E, op.dst, RAX, true);
+                break;
+            case JITOpcode::FpuFromBits: emitFpuFromBits(op); break;
+            case JITOpcode::FpuToBits: emitFpuToBits(op); break;
+            case JITOpcode::FpuArith: emitFpuArith(op); break;
+            case JITOpcode::FpuCompare:
+            case JITOpcode::FpuCompareFlags: emitFpuCompare(op); break;
+            case JITOpcode::FpuStatus:
+                as.load16(RAX, CTX, layout.fpuStatusOffset);
+                writeReg(op.dst, RAX);
+                break;
+            case JITOpcode::VecLaneLoad:
+                as.load32(RAX, CTX, vectorLaneOffset(op));
+                writeReg(op.dst, RAX);
+                break;
+            case JITOpcode::VecLaneStore: as.store32(CTX, vectorLaneOffset(op), hostReg(op.src1)); break;
+            case JITOpcode::VectorKernel: emitVectorKernel(op); break;
+        }
+    }
+
+    emitFastmemStubs();
+    emitEpilogue();
+    return true;
+}
+
+}
+
+JITEmitter::JITEmitter(const JITContextLayout& layout) : layout(layout) {}
+
+bool JITEmitter::compile(const JITBlockIR& ir, std::vector<uint8_t>& code, JITCodeInfo& info) {
+    code.clear();
+    info.chainOffset = 0;
+    info.exits.clear();
+    info.fastmemSites.clear();
+    X64Translator translator(layout, code, info);
+    return translator.translate(ir);
+}
+
+void JITEmitter::linkExit(uint8_t* site, const uint8_t* target) {
+    int32_t rel = static_cast<int32_t>(target - (site + LINK_JUMP_SIZE));
+    memcpy(site + 1, &rel, sizeof(rel));
+}
+
+void JITEmitter::unlinkExit(uint8_t* site) {
+    int32_t rel = 0;
+    memcpy(site + 1, &rel, sizeof(rel));
+}
+
+void JITEmitter::patchFastmemSite(uint8_t* site, const uint8_t* stub) {
+    int32_t rel = static_cast<int32_t>(stub - (site + LINK_JUMP_SIZE));
+    site[0] = 0xE9;
+    memcpy(site + 1, &rel, sizeof(rel));
+}
+
+const char* JITEmitter::hostName() {
+    return "x86-64";
+}
+
+#endif
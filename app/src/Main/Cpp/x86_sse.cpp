@@ -0,0 +1,1055 @@
+#include "x86_core.h"
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <type_traits>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Mandatory-prefix classes, bits 8-9 of a kernel id.
+constexpr uint32_t OP_NP = 0x000;
+constexpr uint32_t OP_66 = 0x100;
+constexpr uint32_t OP_F3 = 0x200;
+constexpr uint32_t OP_F2 = 0x300;
+
+constexpr uint32_t MXCSR_WRITABLE = 0xFFBF;   // the Pentium III has no DAZ
+constexpr uint32_t FXSAVE_MXCSR = 24;
+constexpr uint32_t FXSAVE_XMM = 160;
+
+using XMM = X86Core::XMMRegister;
+
+template <typename T>
+T lane(const XMM& reg, size_t i) {
+    T value;
+    memcpy(&value, reg.data + i * sizeof(T), sizeof(T));
+    return value;
+}
+
+template <typename T>
+void setLane(XMM& reg, size_t i, T value) {
+    memcpy(reg.data + i * sizeof(T), &value, sizeof(T));
+}
+
+template <typename T>
+constexpr size_t laneCount() {
+    return sizeof(XMM::data) / sizeof(T);
+}
+
+// dst[i] = f(dst[i], src[i]) for every T-sized lane. Written to a copy so
+// that dst and src may be the same register.
+template <typename T, typename F>
+void lanes(XMM& dst, const XMM& src, F f) {
+    XMM result;
+    for (size_t i = 0; i < laneCount<T>(); i++) {
+        setLane<T>(result, i, f(lane<T>(dst, i), lane<T>(src, i)));
+    }
+    dst = result;
+}
+
+template <typename T>
+T saturate(int32_t value) {
+    if (value < std::numeric_limits<T>::min()) return std::numeric_limits<T>::min();
+    if (value > std::numeric_limits<T>::max()) return std::numeric_limits<T>::max();
+    return static_cast<T>(value);
+}
+
+enum class FloatOp : uint8_t {
+    Add,
+    Sub,
+    Mul,
+    Div,
+    Min,
+    Max,
+    Sqrt,
+    Rcp,
+    Rsqrt
+};
+
+// Every op but MIN and MAX propagates NaNs the x86 way: the first
+// operand's NaN, quietened, wins over the second's, and an invalid
+// operation gives the negative default NaN. ARM prefers a signalling NaN
+// and has a positive default, and compilers commute additions and
+// multiplies, so the results are fixed up with explicit selects.
+constexpr bool propagatesNaN(FloatOp op) {
+    return op != FloatOp::Min && op != FloatOp::Max;
+}
+
+constexpr bool unaryOp(FloatOp op) {
+    return op == FloatOp::Sqrt || op == FloatOp::Rcp || op == FloatOp::Rsqrt;
+}
+
+template <typename T>
+T x86NaN(T result, T a, T b) {
+    using Bits = std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>;
+    constexpr Bits QUIET = Bits(1) << (std::numeric_limits<T>::digits - 2);
+    constexpr Bits DEFAULT_NAN = ~Bits(0) << (std::numeric_limits<T>::digits - 2);
+    Bits bits;
+    if (std::isnan(a)) {
+        memcpy(&bits, &a, sizeof(T));
+        bits |= QUIET;
+    } else if (std::isnan(b)) {
+        memcpy(&bits, &b, sizeof(T));
+        bits |= QUIET;
+    } else if (std::isnan(result)) {
+        bits = DEFAULT_NAN;
+    } else {
+        return result;
+    }
+    memcpy(&result, &bits, sizeof(T));
+    return result;
+}
+
+// MINPS/MAXPS return the second operand when either is NaN or both are zero.
+template <typename T>
+T floatResult(FloatOp op, T a, T b) {
+    switch (op) {
+        case FloatOp::Add: return a + b;
+        case FloatOp::Sub: return a - b;
+        case FloatOp::Mul: return a * b;
+        case FloatOp::Div: return a / b;
+        case FloatOp::Min: return a < b ? a : b;
+        case FloatOp::Max: return a > b ? a : b;
+        case FloatOp::Sqrt: return std::sqrt(b);
+        case FloatOp::Rcp: return 1 / b;
+        default: return 1 / std::sqrt(b);
+    }
+}
+
+template <typename T>
+T floatOp(FloatOp op, T a, T b) {
+    T result = floatResult(op, a, b);
+    return propagatesNaN(op) ? x86NaN(result, unaryOp(op) ? b : a, b) : result;
+}
+
+#if defined(__ARM_NEON)
+float32x4_t x86NaN(float32x4_t result, float32x4_t a, float32x4_t b) {
+    uint32x4_t quiet = vdupq_n_u32(0x00400000);
+    uint32x4_t bits = vbslq_u32(vceqq_f32(result, result), vreinterpretq_u32_f32(result), vdupq_n_u32(0xFFC00000));
+    bits = vbslq_u32(vceqq_f32(b, b), bits, vorrq_u32(vreinterpretq_u32_f32(b), quiet));
+    bits = vbslq_u32(vceqq_f32(a, a), bits, vorrq_u32(vreinterpretq_u32_f32(a), quiet));
+    return vreinterpretq_f32_u32(bits);
+}
+
+float64x2_t x86NaN(float64x2_t result, float64x2_t a, float64x2_t b) {
+    uint64x2_t quiet = vdupq_n_u64(0x0008000000000000);
+    uint64x2_t bits = vbslq_u64(vceqq_f64(result, result), vreinterpretq_u64_f64(result),
+                                vdupq_n_u64(0xFFF8000000000000));
+    bits = vbslq_u64(vceqq_f64(b, b), bits, vorrq_u64(vreinterpretq_u64_f64(b), quiet));
+    bits = vbslq_u64(vceqq_f64(a, a), bits, vorrq_u64(vreinterpretq_u64_f64(a), quiet));
+    return vreinterpretq_f64_u64(bits);
+}
+#elif defined(__SSE2__)
+// The host already quietens NaNs and has the x86 default, so only the
+// operand order needs pinning.
+__m128 x86NaN(__m128 result, __m128 a, __m128 b) {
+    __m128 quiet = _mm_castsi128_ps(_mm_set1_epi32(0x00400000));
+    __m128 nan = _mm_cmpunord_ps(b, b);
+    result = _mm_or_ps(_mm_andnot_ps(nan, result), _mm_and_ps(nan, _mm_or_ps(b, quiet)));
+    nan = _mm_cmpunord_ps(a, a);
+    return _mm_or_ps(_mm_andnot_ps(nan, result), _mm_and_ps(nan, _mm_or_ps(a, quiet)));
+}
+
+__m128d x86NaN(__m128d result, __m128d a, __m128d b) {
+    __m128d quiet = _mm_castsi128_pd(_mm_set1_epi64x(0x0008000000000000));
+    __m128d nan = _mm_cmpunord_pd(b, b);
+    result = _mm_or_pd(_mm_andnot_pd(nan, result), _mm_and_pd(nan, _mm_or_pd(b, quiet)));
+    nan = _mm_cmpunord_pd(a, a);
+    return _mm_or_pd(_mm_andnot_pd(nan, result), _mm_and_pd(nan, _mm_or_pd(a, quiet)));
+}
+#endif
+
+#if defined(__ARM_NEON)
+// RCPPS and RSQRTPS treat denormal inputs as zero and flush tiny results,
+// where the NEON estimates work through them.
+float32x4_t flushDenormals(float32x4_t value) {
+    uint32x4_t bits = vreinterpretq_u32_f32(value);
+    uint32x4_t tiny = vcltq_u32(vandq_u32(bits, vdupq_n_u32(0x7FFFFFFF)), vdupq_n_u32(0x00800000));
+    return vreinterpretq_f32_u32(vbslq_u32(tiny, vandq_u32(bits, vdupq_n_u32(0x80000000)), bits));
+}
+#endif
+
+void packedSingle(FloatOp op, XMM& dst, const XMM& src) {
+#if defined(__ARM_NEON)
+    float32x4_t a = vld1q_f32(reinterpret_cast<const float*>(dst.data));
+    float32x4_t b = vld1q_f32(reinterpret_cast<const float*>(src.data));
+    float32x4_t r;
+    switch (op) {
+        case FloatOp::Add: r = vaddq_f32(a, b); break;
+        case FloatOp::Sub: r = vsubq_f32(a, b); break;
+        case FloatOp::Mul: r = vmulq_f32(a, b); break;
+        case FloatOp::Div: r = vdivq_f32(a, b); break;
+        case FloatOp::Min: r = vbslq_f32(vcltq_f32(a, b), a, b); break;
+        case FloatOp::Max: r = vbslq_f32(vcgtq_f32(a, b), a, b); break;
+        case FloatOp::Sqrt: r = vsqrtq_f32(b); break;
+        // One Newton-Raphson step takes the estimates past the 12 bits x86
+        // guarantees. The rsqrt step multiplies r * r first so that a zero
+        // input meets the step's own 0 * inf case and stays infinite.
+        case FloatOp::Rcp:
+            b = flushDenormals(b);
+            r = flushDenormals(vrecpeq_f32(b));
+            r = flushDenormals(vmulq_f32(r, vrecpsq_f32(b, r)));
+            break;
+        default:
+            b = flushDenormals(b);
+            r = vrsqrteq_f32(b);
+            r = vmulq_f32(r, vrsqrtsq_f32(b, vmulq_f32(r, r)));
+            break;
+    }
+    if (propagatesNaN(op)) r = x86NaN(r, unaryOp(op) ? b : a, b);
+    vst1q_f32(reinterpret_cast<float*>(dst.data), r);
+#elif defined(__SSE2__)
+    __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(dst.data));
+    __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(src.data));
+    __m128 r;
+    switch (op) {
+        case FloatOp::Add: r = _mm_add_ps(a, b); break;
+        case FloatOp::Sub: r = _mm_sub_ps(a, b); break;
+        case FloatOp::Mul: r = _mm_mul_ps(a, b); break;
+        case FloatOp::Div: r = _mm_div_ps(a, b); break;
+        case FloatOp::Min: r = _mm_min_ps(a, b); break;
+        case FloatOp::Max: r = _mm_max_ps(a, b); break;
+        case FloatOp::Sqrt: r = _mm_sqrt_ps(b); break;
+        case FloatOp::Rcp: r = _mm_rcp_ps(b); break;
+        default: r = _mm_rsqrt_ps(b); break;
+    }
+    if (propagatesNaN(op)) r = x86NaN(r, unaryOp(op) ? b : a, b);
+    _mm_storeu_ps(reinterpret_cast<float*>(dst.data), r);
+#else
+    lanes<float>(dst, src, [op](float a, float b) { return floatOp(op, a, b); });
+#endif
+}
+
+void packedDouble(FloatOp op, XMM& dst, const XMM& src) {
+#if defined(__ARM_NEON)
+    float64x2_t a = vld1q_f64(reinterpret_cast<const double*>(dst.data));
+    float64x2_t b = vld1q_f64(reinterpret_cast<const double*>(src.data));
+    float64x2_t r;
+    switch (op) {
+        case FloatOp::Add: r = vaddq_f64(a, b); break;
+        case FloatOp::Sub: r = vsubq_f64(a, b); break;
+        case FloatOp::Mul: r = vmulq_f64(a, b); break;
+        case FloatOp::Div: r = vdivq_f64(a, b); break;
+        case FloatOp::Min: r = vbslq_f64(vcltq_f64(a, b), a, b); break;
+        case FloatOp::Max: r = vbslq_f64(vcgtq_f64(a, b), a, b); break;
+        default: r = vsqrtq_f64(b); break;
+    }
+    if (propagatesNaN(op)) r = x86NaN(r, unaryOp(op) ? b : a, b);
+    vst1q_f64(reinterpret_cast<double*>(dst.data), r);
+#elif defined(__SSE2__)
+    __m128d a = _mm_loadu_pd(reinterpret_cast<const double*>(dst.data));
+    __m128d b = _mm_loadu_pd(reinterpret_cast<const double*>(src.data));
+    __m128d r;
+    switch (op) {
+        case FloatOp::Add: r = _mm_add_pd(a, b); break;
+        case FloatOp::Sub: r = _mm_sub_pd(a, b); break;
+        case FloatOp::Mul: r = _mm_mul_pd(a, b); break;
+        case FloatOp::Div: r = _mm_div_pd(a, b); break;
+        case FloatOp::Min: r = _mm_min_pd(a, b); break;
+        case FloatOp::Max: r = _mm_max_pd(a, b); break;
+        default: r = _mm_sqrt_pd(b); break;
+    }
+    if (propagatesNaN(op)) r = x86NaN(r, unaryOp(op) ? b : a, b);
+    _mm_storeu_pd(reinterpret_cast<double*>(dst.data), r);
+#else
+    lanes<double>(dst, src, [op](double a, double b) { return floatOp(op, a, b); });
+#endif
+}
+
+template <typename T>
+void scalarFloat(FloatOp op, XMM& dst, const XMM& src) {
+    setLane<T>(dst, 0, floatOp(op, lane<T>(dst, 0), lane<T>(src, 0)));
+}
+
+// RCPSS and RSQRTSS take lane 0 of the packed estimate, so a value gets
+// the same approximation whichever form computes it.
+void scalarEstimate(FloatOp op, XMM& dst, const XMM& src) {
+    XMM estimate = dst;
+    packedSingle(op, estimate, src);
+    setLane<float>(dst, 0, lane<float>(estimate, 0));
+}
+
+// CMPPS predicates: eq, lt, le, unord, neq, nlt, nle, ord.
+template <typename T>
+bool comparePredicate(uint8_t predicate, T a, T b) {
+    bool unordered = std::isnan(a) || std::isnan(b);
+    switch (predicate & 7) {
+        case 0: return a == b;
+        case 1: return a < b;
+        case 2: return a <= b;
+        case 3: return unordered;
+        case 4: return !(a == b);
+        case 5: return !(a < b);
+        case 6: return !(a <= b);
+        default: return !unordered;
+    }
+}
+
+template <typename T, typename Bits>
+Bits compareMask(uint8_t predicate, T a, T b) {
+    return comparePredicate(predicate, a, b) ? static_cast<Bits>(~Bits(0)) : 0;
+}
+
+void packedCompareSingle(uint8_t predicate, XMM& dst, const XMM& src) {
+#if defined(__ARM_NEON)
+    float32x4_t a = vld1q_f32(reinterpret_cast<const float*>(dst.data));
+    float32x4_t b = vld1q_f32(reinterpret_cast<const float*>(src.data));
+    uint32x4_t m;
+    switch (predicate & 3) {
+        case 0: m = vceqq_f32(a, b); break;
+        case 1: m = vcltq_f32(a, b); break;
+        case 2: m = vcleq_f32(a, b); break;
+        default: m = vandq_u32(vceqq_f32(a, a), vceqq_f32(b, b)); break;
+    }
+    // Predicate 3 computed "ordered", so unord is its inversion and ord is not.
+    if (((predicate & 3) == 3) != ((predicate & 4) != 0)) {
+        m = vmvnq_u32(m);
+    }
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst.data), m);
+#elif defined(__SSE2__)
+    __m128 a = _mm_loadu_ps(reinterpret_cast<const float*>(dst.data));
+    __m128 b = _mm_loadu_ps(reinterpret_cast<const float*>(src.data));
+    __m128 r;
+    switch (predicate & 7) {
+        case 0: r = _mm_cmpeq_ps(a, b); break;
+        case 1: r = _mm_cmplt_ps(a, b); break;
+        case 2: r = _mm_cmple_ps(a, b); break;
+        case 3: r = _mm_cmpunord_ps(a, b); break;
+        case 4: r = _mm_cmpneq_ps(a, b); break;
+        case 5: r = _mm_cmpnlt_ps(a, b); break;
+        case 6: r = _mm_cmpnle_ps(a, b); break;
+        default: r = _mm_cmpord_ps(a, b); break;
+    }
+    _mm_storeu_ps(reinterpret_cast<float*>(dst.data), r);
+#else
+    XMM result;
+    for (size_t i = 0; i < 4; i++) {
+        setLane<uint32_t>(result, i, compareMask<float, uint32_t>(predicate, lane<float>(dst, i), lane<float>(src, i)));
+    }
+    dst = result;
+#endif
+}
+
+void packedCompareDouble(uint8_t predicate, XMM& dst, const XMM& src) {
+#if defined(__ARM_NEON)
+    float64x2_t a = vld1q_f64(reinterpret_cast<const double*>(dst.data));
+    float64x2_t b = vld1q_f64(reinterpret_cast<const double*>(src.data));
+    uint64x2_t m;
+    switch (predicate & 3) {
+        case 0: m = vceqq_f64(a, b); break;
+        case 1: m = vcltq_f64(a, b); break;
+        case 2: m = vcleq_f64(a, b); break;
+        default: m = vandq_u64(vceqq_f64(a, a), vceqq_f64(b, b)); break;
+    }
+    uint32x4_t bits = vreinterpretq_u32_u64(m);
+    if (((predicate & 3) == 3) != ((predicate & 4) != 0)) {
+        bits = vmvnq_u32(bits);
+    }
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst.data), bits);
+#elif defined(__SSE2__)
+    __m128d a = _mm_loadu_pd(reinterpret_cast<const double*>(dst.data));
+    __m128d b = _mm_loadu_pd(reinterpret_cast<const double*>(src.data));
+    __m128d r;
+    switch (predicate & 7) {
+        case 0: r = _mm_cmpeq_pd(a, b); break;
+        case 1: r = _mm_cmplt_pd(a, b); break;
+        case 2: r = _mm_cmple_pd(a, b); break;
+        case 3: r = _mm_cmpunord_pd(a, b); break;
+        case 4: r = _mm_cmpneq_pd(a, b); break;
+        case 5: r = _mm_cmpnlt_pd(a, b); break;
+        case 6: r = _mm_cmpnle_pd(a, b); break;
+        default: r = _mm_cmpord_pd(a, b); break;
+    }
+    _mm_storeu_pd(reinterpret_cast<double*>(dst.data), r);
+#else
+    XMM result;
+    for (size_t i = 0; i < 2; i++) {
+        setLane<uint64_t>(result, i, compareMask<double, uint64_t>(predicate, lane<double>(dst, i), lane<double>(src, i)));
+    }
+    dst = result;
+#endif
+}
+
+enum class BitOp : uint8_t {
+    And,
+    AndNot,
+    Or,
+    Xor
+};
+
+// ANDNPS/PANDN complement the destination: dst = ~dst & src.
+void bitwise(BitOp op, XMM& dst, const XMM& src) {
+#if defined(__ARM_NEON)
+    uint32x4_t a = vld1q_u32(reinterpret_cast<const uint32_t*>(dst.data));
+    uint32x4_t b = vld1q_u32(reinterpret_cast<const uint32_t*>(src.data));
+    uint32x4_t r;
+    switch (op) {
+        case BitOp::And: r = vandq_u32(a, b); break;
+        case BitOp::AndNot: r = vbicq_u32(b, a); break;
+        case BitOp::Or: r = vorrq_u32(a, b); break;
+        default: r = veorq_u32(a, b); break;
+    }
+    vst1q_u32(reinterpret_cast<uint32_t*>(dst.data), r);
+#elif defined(__SSE2__)
+    __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst.data));
+    __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data));
+    __m128i r;
+    switch (op) {
+        case BitOp::And: r = _mm_and_si128(a, b); break;
+        case BitOp::AndNot: r = _mm_andnot_si128(a, b); break;
+        case BitOp::Or: r = _mm_or_si128(a, b); break;
+        default: r = _mm_xor_si128(a, b); break;
+    }
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst.data), r);
+#else
+    lanes<uint64_t>(dst, src, [op](uint64_t a, uint64_t b) {
+        switch (op) {
+            case BitOp::And: return a & b;
+            case BitOp::AndNot: return ~a & b;
+            case BitOp::Or: return a | b;
+            default: return a ^ b;
+        }
+    });
+#endif
+}
+
+// Out-of-range and NaN conversions produce the integer indefinite value.
+int32_t toInt32(double value, uint8_t rounding) {
+    switch (rounding & 3) {
+        case 0: value = std::nearbyint(value); break;
+        case 1: value = std::floor(value); break;
+        case 2: value = std::ceil(value); break;
+        default: value = std::trunc(value); break;
+    }
+    if (!(value >= -2147483648.0 && value < 2147483648.0)) {
+        return std::numeric_limits<int32_t>::min();
+    }
+    return static_cast<int32_t>(value);
+}
+
+template <typename T>
+void unpack(XMM& dst, const XMM& src, bool high) {
+    constexpr size_t half = laneCount<T>() / 2;
+    size_t first = high ? half : 0;
+    XMM result;
+    for (size_t i = 0; i < half; i++) {
+        setLane<T>(result, 2 * i, lane<T>(dst, first + i));
+        setLane<T>(result, 2 * i + 1, lane<T>(src, first + i));
+    }
+    dst = result;
+}
+
+// Narrows the lanes of dst into the low half and those of src into the high half.
+template <typename From, typename To>
+void pack(XMM& dst, const XMM& src) {
+    constexpr size_t count = laneCount<From>();
+    XMM result;
+    for (size_t i = 0; i < count; i++) {
+        setLane<To>(result, i, saturate<To>(lane<From>(dst, i)));
+        setLane<To>(result, count + i, saturate<To>(lane<From>(src, i)));
+    }
+    dst = result;
+}
+
+enum class ShiftOp : uint8_t {
+    Right,
+    Arithmetic,
+    Left
+};
+
+template <typename T>
+void shiftLanes(XMM& dst, uint64_t count, ShiftOp op) {
+    using Signed = typename std::make_signed<T>::type;
+    constexpr uint64_t bits = sizeof(T) * 8;
+    for (size_t i = 0; i < laneCount<T>(); i++) {
+        T value = lane<T>(dst, i);
+        if (op == ShiftOp::Arithmetic) {
+            value = static_cast<T>(static_cast<Signed>(value) >> (count < bits ? count : bits - 1));
+        } else if (count >= bits) {
+            value = 0;
+        } else {
+            value = op == ShiftOp::Left ? static_cast<T>(value << count) : static_cast<T>(value >> count);
+        }
+        setLane<T>(dst, i, value);
+    }
+}
+
+void shiftBytes(XMM& dst, uint8_t count, bool left) {
+    XMM result{};
+    for (int i = 0; i < 16; i++) {
+        int from = left ? i - count : i + count;
+        if (from >= 0 && from < 16) {
+            result.data[i] = dst.data[from];
+        }
+    }
+    dst = result;
+}
+
+template <typename T>
+void shuffleWords(XMM& dst, const XMM& src, uint8_t order, size_t first) {
+    XMM result = src;
+    for (size_t i = 0; i < 4; i++) {
+        setLane<uint16_t>(result, first + i, lane<uint16_t>(src, first + ((order >> (2 * i)) & 3)));
+    }
+    dst = result;
+}
+
+}
+
+uint32_t X86Core::sseKernelId(const X86Instruction& insn) {
+    uint32_t kernel = insn.opcode & 0xFF;
+    if (insn.prefixes & X86Instruction::PREFIX_REP) {
+        kernel |= OP_F3;
+    } else if (insn.prefixes & X86Instruction::PREFIX_REPNE) {
+        kernel |= OP_F2;
+    } else if (insn.prefixes & X86Instruction::PREFIX_OPSIZE) {
+        kernel |= OP_66;
+    }
+    if ((kernel & 0xFF) >= 0x71 && (kernel & 0xFF) <= 0x73) {
+        kernel |= insn.reg << 10;
+    }
+    if (insn.hasModrm && !insn.isRegisterOperand()) {
+        kernel |= SSE_MEMORY;
+    }
+    return kernel;
+}
+
+// bytes is the width of the memory operand and 0 when there is no memory
+// form. The ps/pd/ss/sd families read 16, 16, 4 and 8 bytes.
+X86Core::SSEForm X86Core::sseForm(uint32_t kernel) {
+    const uint8_t opcode = kernel & 0xFF;
+    const uint32_t prefix = kernel & 0x300;
+    const uint8_t group = (kernel >> 10) & 7;
+    const uint8_t scalar = prefix == OP_F3 ? 4 : prefix == OP_F2 ? 8 : 16;
+    const bool packed = prefix == OP_NP || prefix == OP_66;
+
+    auto form = [](SSEShape shape, uint8_t bytes, bool registerForm = true, uint8_t offset = 0) {
+        return SSEForm{shape, bytes, registerForm, offset};
+    };
+    const SSEForm invalid = form(SSE_INVALID, 0, false);
+
+    switch (opcode) {
+        case 0x10: return form(SSE_COMPUTE, scalar);
+        case 0x11: return form(SSE_STORE, scalar);
+        case 0x12:
+        case 0x16: return packed ? form(SSE_COMPUTE, 8, prefix == OP_NP) : invalid;
+        case 0x13: return packed ? form(SSE_STORE, 8, false) : invalid;
+        case 0x17: return packed ? form(SSE_STORE, 8, false, 8) : invalid;
+        case 0x14:
+        case 0x15:
+        case 0x28:
+        case 0x54: case 0x55: case 0x56: case 0x57:
+        case 0xC6: return packed ? form(SSE_COMPUTE, 16) : invalid;
+        case 0x29: return packed ? form(SSE_STORE, 16) : invalid;
+        case 0x2B: return packed ? form(SSE_STORE, 16, false) : invalid;
+        case 0x2A: return packed ? invalid : form(SSE_COMPUTE_GPR, 4);
+        case 0x2C:
+        case 0x2D: return packed ? invalid : form(SSE_TO_GPR, scalar);
+        case 0x2E:
+        case 0x2F: return packed ? form(SSE_COMPARE_FLAGS, prefix == OP_66 ? 8 : 4) : invalid;
+        case 0x50: return packed ? form(SSE_TO_GPR, 0) : invalid;
+        case 0x51: case 0x58: case 0x59: case 0x5C: case 0x5D: case 0x5E: case 0x5F:
+        case 0xC2: return form(SSE_COMPUTE, scalar);
+        case 0x52:
+        case 0x53: return prefix == OP_NP || prefix == OP_F3 ? form(SSE_COMPUTE, scalar) : invalid;
+        case 0x5A: return form(SSE_COMPUTE, prefix == OP_NP ? 8 : scalar);
+        case 0x5B: return prefix != OP_F2 ? form(SSE_COMPUTE, 16) : invalid;
+        case 0x6E: return prefix == OP_66 ? form(SSE_COMPUTE_GPR, 4) : invalid;
+        case 0x6F: return prefix == OP_66 || prefix == OP_F3 ? form(SSE_COMPUTE, 16) : invalid;
+        case 0x70: return prefix != OP_NP ? form(SSE_COMPUTE, 16) : invalid;
+        case 0x71:
+        case 0x72:
+            return prefix == OP_66 && (group == 2 || group == 4 || group == 6) ? form(SSE_SHIFT, 0) : invalid;
+        case 0x73:
+            return prefix == OP_66 && (group == 2 || group == 3 || group == 6 || group == 7) ? form(SSE_SHIFT, 0) : invalid;
+        case 0x7E:
+            if (prefix == OP_66) return form(SSE_STORE_GPR, 4);
+            return prefix == OP_F3 ? form(SSE_COMPUTE, 8) : invalid;
+        case 0x7F: return prefix == OP_66 || prefix == OP_F3 ? form(SSE_STORE, 16) : invalid;
+        case 0xC4: return prefix == OP_66 ? form(SSE_COMPUTE_GPR, 2) : invalid;
+        case 0xC5:
+        case 0xD7: return prefix == OP_66 ? form(SSE_TO_GPR, 0) : invalid;
+        case 0xD6: return prefix == OP_66 ? form(SSE_STORE, 8) : invalid;
+        case 0xE6: return prefix != OP_NP ? form(SSE_COMPUTE, prefix == OP_F3 ? 8 : 16) : invalid;
+        case 0xE7: return prefix == OP_66 ? form(SSE_STORE, 16, false) : invalid;
+        case 0xF7: return prefix == OP_66 ? form(SSE_SPECIAL, 0) : invalid;
+        case 0x18: return form(SSE_SPECIAL, 1);
+        case 0x77:
+        case 0xAE: return prefix == OP_NP ? form(SSE_SPECIAL, 4) : invalid;
+        case 0xC3: return prefix == OP_NP ? form(SSE_SPECIAL, 4, false) : invalid;
+        default:
+            // The remaining 66-prefixed integer ops of the 60-6D, 74-76 and D1-FE rows.
+            if (prefix != OP_66) return invalid;
+            if ((opcode >= 0x60 && opcode <= 0x6D) || (opcode >= 0x74 && opcode <= 0x76) ||
+                (opcode >= 0xD1 && opcode <= 0xFE && opcode != 0xF0)) {
+                return form(SSE_COMPUTE, 16);
+            }
+            return invalid;
+    }
+}
+
+X86Core::XMMRegister X86Core::sseRead(uint32_t address, uint8_t bytes) {
+    XMMRegister value{};
+    memory->readBlock(address, value.data, bytes);
+    return value;
+}
+
+void X86Core::sseWrite(uint32_t address, const XMMRegister& value, uint8_t offset, uint8_t bytes) {
+    memory->writeBlock(address, value.data + offset, bytes);
+}
+
+// Everything an SSE instruction does once its operands are in registers.
+// Kernels that produce a general-purpose result leave it in dword 0 of dst.
+// dst and src may be the same register.
+void X86Core::sseKernel(uint32_t kernel, XMMRegister& dst, const XMMRegister& src, uint8_t imm) {
+    const bool memoryForm = kernel & SSE_MEMORY;
+    const uint8_t rounding = (mxcsr >> 13) & 3;
+
+    switch (kernel & ~SSE_MEMORY) {
+        case OP_NP | 0x10: case OP_66 | 0x10:
+        case OP_NP | 0x11: case OP_66 | 0x11:
+        case OP_NP | 0x28: case OP_66 | 0x28:
+        case OP_NP | 0x29: case OP_66 | 0x29:
+        case OP_66 | 0x6F: case OP_F3 | 0x6F:
+        case OP_66 | 0x7F: case OP_F3 | 0x7F:
+            dst = src;
+            break;
+
+        // MOVSS/MOVSD zero the upper lanes only when loading from memory.
+        case OP_F3 | 0x10:
+        case OP_F3 | 0x11:
+            if (memoryForm) {
+                dst = src;
+            } else {
+                setLane<uint32_t>(dst, 0, lane<uint32_t>(src, 0));
+            }
+            break;
+        case OP_F2 | 0x10:
+        case OP_F2 | 0x11:
+            if (memoryForm) {
+                dst = src;
+            } else {
+                setLane<uint64_t>(dst, 0, lane<uint64_t>(src, 0));
+            }
+            break;
+
+        case OP_NP | 0x12:
+            setLane<uint64_t>(dst, 0, lane<uint64_t>(src, memoryForm ? 0 : 1));
+            break;
+        case OP_66 | 0x12:
+            setLane<uint64_t>(dst, 0, lane<uint64_t>(src, 0));
+            break;
+        case OP_NP | 0x16:
+        case OP_66 | 0x16:
+            setLane<uint64_t>(dst, 1, lane<uint64_t>(src, 0));
+            break;
+
+        case OP_NP | 0x14: case OP_66 | 0x62: unpack<uint32_t>(dst, src, false); break;
+        case OP_NP | 0x15: case OP_66 | 0x6A: unpack<uint32_t>(dst, src, true); break;
+        case OP_66 | 0x14: case OP_66 | 0x6C: unpack<uint64_t>(dst, src, false); break;
+        case OP_66 | 0x15: case OP_66 | 0x6D: unpack<uint64_t>(dst, src, true); break;
+        case OP_66 | 0x60: unpack<uint8_t>(dst, src, false); break;
+        case OP_66 | 0x61: unpack<uint16_t>(dst, src, false); break;
+        case OP_66 | 0x68: unpack<uint8_t>(dst, src, true); break;
+        case OP_66 | 0x69: unpack<uint16_t>(dst, src, true); break;
+
+        case OP_F3 | 0x2A:
+            setLane<float>(dst, 0, static_cast<float>(lane<int32_t>(src, 0)));
+            break;
+        case OP_F2 | 0x2A:
+            setLane<double>(dst, 0, static_cast<double>(lane<int32_t>(src, 0)));
+            break;
+        case OP_F3 | 0x2C: setLane<int32_t>(dst, 0, toInt32(lane<float>(src, 0), 3)); break;
+        case OP_F3 | 0x2D: setLane<int32_t>(dst, 0, toInt32(lane<float>(src, 0), rounding)); break;
+        case OP_F2 | 0x2C: setLane<int32_t>(dst, 0, toInt32(lane<double>(src, 0), 3)); break;
+        case OP_F2 | 0x2D: setLane<int32_t>(dst, 0, toInt32(lane<double>(src, 0), rounding)); break;
+
+        case OP_NP | 0x50: {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < 4; i++) mask |= (lane<uint32_t>(src, i) >> 31) << i;
+            setLane<uint32_t>(dst, 0, mask);
+            break;
+        }
+        case OP_66 | 0x50:
+            setLane<uint32_t>(dst, 0, static_cast<uint32_t>((lane<uint64_t>(src, 0) >> 63) |
+                                                            ((lane<uint64_t>(src, 1) >> 63) << 1)));
+            break;
+        case OP_66 | 0xD7: {
+            uint32_t mask = 0;
+            for (size_t i = 0; i < 16; i++) mask |= static_cast<uint32_t>(src.data[i] >> 7) << i;
+            setLane<uint32_t>(dst, 0, mask);
+            break;
+        }
+
+        case OP_NP | 0x51: packedSingle(FloatOp::Sqrt, dst, src); break;
+        case OP_66 | 0x51: packedDouble(FloatOp::Sqrt, dst, src); break;
+        case OP_F3 | 0x51: scalarFloat<float>(FloatOp::Sqrt, dst, src); break;
+        case OP_F2 | 0x51: scalarFloat<double>(FloatOp::Sqrt, dst, src); break;
+        case OP_NP | 0x52: packedSingle(FloatOp::Rsqrt, dst, src); break;
+        case OP_F3 | 0x52: scalarEstimate(FloatOp::Rsqrt, dst, src); break;
+        case OP_NP | 0x53: packedSingle(FloatOp::Rcp, dst, src); break;
+        case OP_F3 | 0x53: scalarEstimate(FloatOp::Rcp, dst, src); break;
+
+        case OP_NP | 0x54: case OP_66 | 0x54: case OP_66 | 0xDB: bitwise(BitOp::And, dst, src); break;
+        case OP_NP | 0x55: case OP_66 | 0x55: case OP_66 | 0xDF: bitwise(BitOp::AndNot, dst, src); break;
+        case OP_NP | 0x56: case OP_66 | 0x56: case OP_66 | 0xEB: bitwise(BitOp::Or, dst, src); break;
+        case OP_NP | 0x57: case OP_66 | 0x57: case OP_66 | 0xEF: bitwise(BitOp::Xor, dst, src); break;
+
+        case OP_NP | 0x58: packedSingle(FloatOp::Add, dst, src); break;
+        case OP_66 | 0x58: packedDouble(FloatOp::Add, dst, src); break;
+        case OP_F3 | 0x58: scalarFloat<float>(FloatOp::Add, dst, src); break;
+        case OP_F2 | 0x58: scalarFloat<double>(FloatOp::Add, dst, src); break;
+        case OP_NP | 0x59: packedSingle(FloatOp::Mul, dst, src); break;
+        case OP_66 | 0x59: packedDouble(FloatOp::Mul, dst, src); break;
+        case OP_F3 | 0x59: scalarFloat<float>(FloatOp::Mul, dst, src); break;
+        case OP_F2 | 0x59: scalarFloat<double>(FloatOp::Mul, dst, src); break;
+        case OP_NP | 0x5C: packedSingle(FloatOp::Sub, dst, src); break;
+        case OP_66 | 0x5C: packedDouble(FloatOp::Sub, dst, src); break;
+        case OP_F3 | 0x5C: scalarFloat<float>(FloatOp::Sub, dst, src); break;
+        case OP_F2 | 0x5C: scalarFloat<double>(FloatOp::Sub, dst, src); break;
+        case OP_NP | 0x5D: packedSingle(FloatOp::Min, dst, src); break;
+        case OP_66 | 0x5D: packedDouble(FloatOp::Min, dst, src); break;
+        case OP_F3 | 0x5D: scalarFloat<float>(FloatOp::Min, dst, src); break;
+        case OP_F2 | 0x5D: scalarFloat<double>(FloatOp::Min, dst, src); break;
+        case OP_NP | 0x5E: packedSingle(FloatOp::Div, dst, src); break;
+        case OP_66 | 0x5E: packedDouble(FloatOp::Div, dst, src); break;
+        case OP_F3 | 0x5E: scalarFloat<float>(FloatOp::Div, dst, src); break;
+        case OP_F2 | 0x5E: scalarFloat<double>(FloatOp::Div, dst, src); break;
+        case OP_NP | 0x5F: packedSingle(FloatOp::Max, dst, src); break;
+        case OP_66 | 0x5F: packedDouble(FloatOp::Max, dst, src); break;
+        case OP_F3 | 0x5F: scalarFloat<float>(FloatOp::Max, dst, src); break;
+        case OP_F2 | 0x5F: scalarFloat<double>(FloatOp::Max, dst, src); break;
+
+        case OP_NP | 0x5A: {
+            XMM result;
+            for (size_t i = 0; i < 2; i++) setLane<double>(result, i, lane<float>(src, i));
+            dst = result;
+            break;
+        }
+        case OP_66 | 0x5A: {
+            XMM result{};
+            for (size_t i = 0; i < 2; i++) setLane<float>(result, i, static_cast<float>(lane<double>(src, i)));
+            dst = result;
+            break;
+        }
+        case OP_F3 | 0x5A: setLane<double>(dst, 0, lane<float>(src, 0)); break;
+        case OP_F2 | 0x5A: setLane<float>(dst, 0, static_cast<float>(lane<double>(src, 0))); break;
+        case OP_NP | 0x5B:
+            lanes<uint32_t>(dst, src, [](uint32_t, uint32_t b) {
+                float value = static_cast<float>(static_cast<int32_t>(b));
+                uint32_t bits;
+                memcpy(&bits, &value, sizeof(bits));
+                return bits;
+            });
+            break;
+        case OP_66 | 0x5B:
+        case OP_F3 | 0x5B: {
+            uint8_t mode = (kernel & 0x300) == OP_F3 ? 3 : rounding;
+            XMM result;
+            for (size_t i = 0; i < 4; i++) setLane<int32_t>(result, i, toInt32(lane<float>(src, i), mode));
+            dst = result;
+            break;
+        }
+        case OP_66 | 0xE6:
+        case OP_F2 | 0xE6: {
+            uint8_t mode = (kernel & 0x300) == OP_66 ? 3 : rounding;
+            XMM result{};
+            for (size_t i = 0; i < 2; i++) setLane<int32_t>(result, i, toInt32(lane<double>(src, i), mode));
+            dst = result;
+            break;
+        }
+        case OP_F3 | 0xE6: {
+            XMM result;
+            for (size_t i = 0; i < 2; i++) setLane<double>(result, i, lane<int32_t>(src, i));
+            dst = result;
+            break;
+        }
+
+        case OP_66 | 0x63: pack<int16_t, int8_t>(dst, src); break;
+        case OP_66 | 0x67: pack<int16_t, uint8_t>(dst, src); break;
+        case OP_66 | 0x6B: pack<int32_t, int16_t>(dst, src); break;
+        case OP_66 | 0x64: lanes<int8_t>(dst, src, [](int8_t a, int8_t b) { return static_cast<int8_t>(a > b ? -1 : 0); }); break;
+        case OP_66 | 0x65: lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return static_cast<int16_t>(a > b ? -1 : 0); }); break;
+        case OP_66 | 0x66: lanes<int32_t>(dst, src, [](int32_t a, int32_t b) { return a > b ? -1 : 0; }); break;
+        case OP_66 | 0x74: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return static_cast<uint8_t>(a == b ? 0xFF : 0); }); break;
+        case OP_66 | 0x75: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return static_cast<uint16_t>(a == b ? 0xFFFF : 0); }); break;
+        case OP_66 | 0x76: lanes<uint32_t>(dst, src, [](uint32_t a, uint32_t b) { return a == b ? 0xFFFFFFFFu : 0u; }); break;
+
+        case OP_66 | 0x6E: {
+            XMM result{};
+            setLane<uint32_t>(result, 0, lane<uint32_t>(src, 0));
+            dst = result;
+            break;
+        }
+        case OP_F3 | 0x7E:
+        case OP_66 | 0xD6: {
+            XMM result{};
+            setLane<uint64_t>(result, 0, lane<uint64_t>(src, 0));
+            dst = result;
+            break;
+        }
+
+        case OP_66 | 0x70: {
+            XMM result;
+            for (size_t i = 0; i < 4; i++) setLane<uint32_t>(result, i, lane<uint32_t>(src, (imm >> (2 * i)) & 3));
+            dst = result;
+            break;
+        }
+        case OP_F3 | 0x70: shuffleWords<uint16_t>(dst, src, imm, 4); break;
+        case OP_F2 | 0x70: shuffleWords<uint16_t>(dst, src, imm, 0); break;
+        case OP_NP | 0xC6: {
+            XMM result;
+            setLane<uint32_t>(result, 0, lane<uint32_t>(dst, imm & 3));
+            setLane<uint32_t>(result, 1, lane<uint32_t>(dst, (imm >> 2) & 3));
+            setLane<uint32_t>(result, 2, lane<uint32_t>(src, (imm >> 4) & 3));
+            setLane<uint32_t>(result, 3, lane<uint32_t>(src, (imm >> 6) & 3));
+            dst = result;
+            break;
+        }
+        case OP_66 | 0xC6: {
+            XMM result;
+            setLane<uint64_t>(result, 0, lane<uint64_t>(dst, imm & 1));
+            setLane<uint64_t>(result, 1, lane<uint64_t>(src, (imm >> 1) & 1));
+            dst = result;
+            break;
+        }
+
+        case OP_NP | 0xC2: packedCompareSingle(imm, dst, src); break;
+        case OP_66 | 0xC2: packedCompareDouble(imm, dst, src); break;
+        case OP_F3 | 0xC2:
+            setLane<uint32_t>(dst, 0, compareMask<float, uint32_t>(imm, lane<float>(dst, 0), lane<float>(src, 0)));
+            break;
+        case OP_F2 | 0xC2:
+            setLane<uint64_t>(dst, 0, compareMask<double, uint64_t>(imm, lane<double>(dst, 0), lane<double>(src, 0)));
+            break;
+
+        case OP_66 | 0xC4: setLane<uint16_t>(dst, imm & 7, lane<uint16_t>(src, 0)); break;
+        case OP_66 | 0xC5: setLane<uint32_t>(dst, 0, lane<uint16_t>(src, imm & 7)); break;
+
+        // Shift groups by immediate; /reg is in bits 10-12 of the id.
+        case OP_66 | 0x71 | (2 << 10): shiftLanes<uint16_t>(dst, imm, ShiftOp::Right); break;
+        case OP_66 | 0x71 | (4 << 10): shiftLanes<uint16_t>(dst, imm, ShiftOp::Arithmetic); break;
+        case OP_66 | 0x71 | (6 << 10): shiftLanes<uint16_t>(dst, imm, ShiftOp::Left); break;
+        case OP_66 | 0x72 | (2 << 10): shiftLanes<uint32_t>(dst, imm, ShiftOp::Right); break;
+        case OP_66 | 0x72 | (4 << 10): shiftLanes<uint32_t>(dst, imm, ShiftOp::Arithmetic); break;
+        case OP_66 | 0x72 | (6 << 10): shiftLanes<uint32_t>(dst, imm, ShiftOp::Left); break;
+        case OP_66 | 0x73 | (2 << 10): shiftLanes<uint64_t>(dst, imm, ShiftOp::Right); break;
+        case OP_66 | 0x73 | (3 << 10): shiftBytes(dst, imm, false); break;
+        case OP_66 | 0x73 | (6 << 10): shiftLanes<uint64_t>(dst, imm, ShiftOp::Left); break;
+        case OP_66 | 0x73 | (7 << 10): shiftBytes(dst, imm, true); break;
+
+        // Shifts by the low quadword of src.
+        case OP_66 | 0xD1: shiftLanes<uint16_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Right); break;
+        case OP_66 | 0xD2: shiftLanes<uint32_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Right); break;
+        case OP_66 | 0xD3: shiftLanes<uint64_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Right); break;
+        case OP_66 | 0xE1: shiftLanes<uint16_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Arithmetic); break;
+        case OP_66 | 0xE2: shiftLanes<uint32_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Arithmetic); break;
+        case OP_66 | 0xF1: shiftLanes<uint16_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Left); break;
+        case OP_66 | 0xF2: shiftLanes<uint32_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Left); break;
+        case OP_66 | 0xF3: shiftLanes<uint64_t>(dst, lane<uint64_t>(src, 0), ShiftOp::Left); break;
+
+        case OP_66 | 0xFC: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return static_cast<uint8_t>(a + b); }); break;
+        case OP_66 | 0xFD: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return static_cast<uint16_t>(a + b); }); break;
+        case OP_66 | 0xFE: lanes<uint32_t>(dst, src, [](uint32_t a, uint32_t b) { return a + b; }); break;
+        case OP_66 | 0xD4: lanes<uint64_t>(dst, src, [](uint64_t a, uint64_t b) { return a + b; }); break;
+        case OP_66 | 0xF8: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return static_cast<uint8_t>(a - b); }); break;
+        case OP_66 | 0xF9: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return static_cast<uint16_t>(a - b); }); break;
+        case OP_66 | 0xFA: lanes<uint32_t>(dst, src, [](uint32_t a, uint32_t b) { return a - b; }); break;
+        case OP_66 | 0xFB: lanes<uint64_t>(dst, src, [](uint64_t a, uint64_t b) { return a - b; }); break;
+        case OP_66 | 0xEC: lanes<int8_t>(dst, src, [](int8_t a, int8_t b) { return saturate<int8_t>(a + b); }); break;
+        case OP_66 | 0xED: lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return saturate<int16_t>(a + b); }); break;
+        case OP_66 | 0xE8: lanes<int8_t>(dst, src, [](int8_t a, int8_t b) { return saturate<int8_t>(a - b); }); break;
+        case OP_66 | 0xE9: lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return saturate<int16_t>(a - b); }); break;
+        case OP_66 | 0xDC: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return saturate<uint8_t>(a + b); }); break;
+        case OP_66 | 0xDD: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return saturate<uint16_t>(a + b); }); break;
+        case OP_66 | 0xD8: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return saturate<uint8_t>(a - b); }); break;
+        case OP_66 | 0xD9: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return saturate<uint16_t>(a - b); }); break;
+
+        case OP_66 | 0xDA: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return a < b ? a : b; }); break;
+        case OP_66 | 0xDE: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return a > b ? a : b; }); break;
+        case OP_66 | 0xEA: lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return a < b ? a : b; }); break;
+        case OP_66 | 0xEE: lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return a > b ? a : b; }); break;
+        case OP_66 | 0xE0: lanes<uint8_t>(dst, src, [](uint8_t a, uint8_t b) { return static_cast<uint8_t>((a + b + 1) >> 1); }); break;
+        case OP_66 | 0xE3: lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return static_cast<uint16_t>((a + b + 1) >> 1); }); break;
+
+        case OP_66 | 0xD5:
+            lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) { return static_cast<uint16_t>(a * b); });
+            break;
+        case OP_66 | 0xE4:
+            lanes<uint16_t>(dst, src, [](uint16_t a, uint16_t b) {
+                return static_cast<uint16_t>((static_cast<uint32_t>(a) * b) >> 16);
+            });
+            break;
+        case OP_66 | 0xE5:
+            lanes<int16_t>(dst, src, [](int16_t a, int16_t b) { return static_cast<int16_t>((a * b) >> 16); });
+            break;
+        case OP_66 | 0xF4: {
+            XMM result;
+            for (size_t i = 0; i < 2; i++) {
+                setLane<uint64_t>(result, i, static_cast<uint64_t>(lane<uint32_t>(dst, 2 * i)) * lane<uint32_t>(src, 2 * i));
+            }
+            dst = result;
+            break;
+        }
+        case OP_66 | 0xF5: {
+            XMM result;
+            for (size_t i = 0; i < 4; i++) {
+                int32_t low = lane<int16_t>(dst, 2 * i) * lane<int16_t>(src, 2 * i);
+                int32_t high = lane<int16_t>(dst, 2 * i + 1) * lane<int16_t>(src, 2 * i + 1);
+                setLane<uint32_t>(result, i, static_cast<uint32_t>(low) + static_cast<uint32_t>(high));
+            }
+            dst = result;
+            break;
+        }
+        case OP_66 | 0xF6: {
+            XMM result{};
+            for (size_t half = 0; half < 2; half++) {
+                uint32_t sum = 0;
+                for (size_t i = half * 8; i < half * 8 + 8; i++) {
+                    sum += static_cast<uint32_t>(std::abs(dst.data[i] - src.data[i]));
+                }
+                setLane<uint64_t>(result, half, sum);
+            }
+            dst = result;
+            break;
+        }
+    }
+}
+
+void X86Core::sse_op(const X86Instruction& insn) {
+    const uint32_t kernel = sseKernelId(insn);
+    const SSEForm form = sseForm(kernel);
+    const bool memoryForm = kernel & SSE_MEMORY;
+    if (form.shape == SSE_INVALID || (memoryForm ? form.bytes == 0 : !form.registerForm)) {
+        invalidInstruction(insn);
+        return;
+    }
+
+    const uint8_t imm = static_cast<uint8_t>(insn.imm);
+    auto source = [&]() {
+        return memoryForm ? sseRead(effectiveAddress(insn), form.bytes) : xmmRegisters[insn.rm];
+    };
+
+    switch (form.shape) {
+        case SSE_COMPUTE:
+            sseKernel(kernel, xmmRegisters[insn.reg], source(), imm);
+            break;
+        case SSE_COMPUTE_GPR: {
+            XMMRegister value{};
+            setLane<uint32_t>(value, 0, readOperand(insn, form.bytes));
+            sseKernel(kernel, xmmRegisters[insn.reg], value, imm);
+            break;
+        }
+        case SSE_TO_GPR: {
+            XMMRegister result{};
+            sseKernel(kernel, result, source(), imm);
+            writeRegister(insn.reg, 4, lane<uint32_t>(result, 0));
+            break;
+        }
+        case SSE_STORE:
+            if (memoryForm) {
+                sseWrite(effectiveAddress(insn), xmmRegisters[insn.reg], form.offset, form.bytes);
+            } else {
+                sseKernel(kernel, xmmRegisters[insn.rm], xmmRegisters[insn.reg], imm);
+            }
+            break;
+        case SSE_STORE_GPR:
+            writeOperand(insn, 4, lane<uint32_t>(xmmRegisters[insn.reg], 0));
+            break;
+        case SSE_SHIFT:
+            sseKernel(kernel, xmmRegisters[insn.rm], xmmRegisters[insn.rm], imm);
+            break;
+        case SSE_COMPARE_FLAGS: {
+            // COMISS and UCOMISS only differ in which NaNs raise #I, which is not reported.
+            XMMRegister b = source();
+            bool isDouble = form.bytes == 8;
+            double x = isDouble ? lane<double>(xmmRegisters[insn.reg], 0) : lane<float>(xmmRegisters[insn.reg], 0);
+            double y = isDouble ? lane<double>(b, 0) : lane<float>(b, 0);
+            uint32_t bits = 0;
+            if (std::isnan(x) || std::isnan(y)) {
+                bits = JIT_FLAG_ZF | JIT_FLAG_PF | JIT_FLAG_CF;
+            } else if (x < y) {
+                bits = JIT_FLAG_CF;
+            } else if (x == y) {
+                bits = JIT_FLAG_ZF;
+            }
+            materializeFlags();
+            eflags = (eflags & ~JIT_FLAGS_ARITH) | bits;
+            break;
+        }
+        default:
+            sseSpecial(insn);
+            break;
+    }
+}
+
+// Hints, fences, MXCSR and FXSAVE state, and the non-temporal GPR and masked stores.
+void X86Core::sseSpecial(const X86Instruction& insn) {
+    switch (insn.opcode & 0xFF) {
+        case 0x18:
+            break;
+        case 0x77:
+            fpu.tagWord = 0xFFFF;
+            break;
+        case 0xC3:
+            writeMemory(effectiveAddress(insn), 4, readRegister(insn.reg, 4));
+            break;
+        case 0xF7:
+            for (uint32_t i = 0; i < 16; i++) {
+                if (xmmRegisters[insn.rm].data[i] & 0x80) {
+                    memory->write8(edi + i, xmmRegisters[insn.reg].data[i]);
+                }
+            }
+            break;
+        default:
+            if (insn.isRegisterOperand()) {
+                // LFENCE, MFENCE and SFENCE: guest memory accesses are already ordered.
+                if (insn.reg < 5) invalidInstruction(insn);
+                break;
+            }
+            uint32_t address = effectiveAddress(insn);
+            switch (insn.reg) {
+                case 0:
+                    fpuSaveState(address);
+                    memory->write32(address + FXSAVE_MXCSR, mxcsr);
+                    memory->write32(address + FXSAVE_MXCSR + 4, MXCSR_WRITABLE);
+                    for (uint32_t i = 0; i < 8; i++) {
+                        sseWrite(address + FXSAVE_XMM + i * 16, xmmRegisters[i], 0, 16);
+                    }
+                    break;
+                case 1:
+                    fpuRestoreState(address);
+                    mxcsr = memory->read32(address + FXSAVE_MXCSR) & MXCSR_WRITABLE;
+                    for (uint32_t i = 0; i < 8; i++) {
+                        xmmRegisters[i] = sseRead(address + FXSAVE_XMM + i * 16, 16);
+                    }
+                    break;
+                case 2:
+                    mxcsr = memory->read32(address) & MXCSR_WRITABLE;
+                    break;
+                case 3:
+                    memory->write32(address, mxcsr);
+                    break;
+                case 7:
+                    break;
+                default:
+                    invalidInstruction(insn);
+                    break;
+            }
+            break;
+    }
+}
+
+void X86Core::jitVectorKernel(void* context, uint32_t kernel, uint32_t operands) {
+    X86Core* cpu = static_cast<X86Core*>(context);
+    auto vector = [cpu](uint32_t index) -> XMMRegister& {
+        return index == JIT_XMM_SCRATCH ? cpu->sseScratch : cpu->xmmRegisters[index];
+    };
+    cpu->sseKernel(kernel, vector(operands & 0xFF), vector((operands >> 8) & 0xFF), (operands >> 16) & 0xFF);
+}
@@ -0,0 +1,108 @@
+#include "xbox_dma.h"
+#include <android/log.h>
+#include <system_error>
+
+#define LOG_TAG "XboxDma"
+#define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
+
+XboxDma::XboxDma(XboxMemory* memory) :
+    memory(memory),
+    pending(std::make_unique<BoundedQueue<Descriptor, QUEUE_CAPACITY>>()),
+    completed(std::make_unique<BoundedQueue<Completion, QUEUE_CAPACITY>>()),
+    outstanding(0),
+    inFlight(0),
+    workerRunning(true) {
+
+    try {
+        worker = std::thread(&XboxDma::workerLoop, this);
+        memory->setDmaEngine(this);
+        LOGI("DMA worker started");
+    } catch (const std::system_error& e) {
+        workerRunning = false;
+        LOGW("Failed to start DMA worker, transfers stay synchronous: %s", e.what());
+    }
+}
+
+XboxDma::~XboxDma() {
+    if (!worker.joinable()) return;
+    memory->setDmaEngine(nullptr);
+    drain();
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+        workerRunning = false;
+    }
+    wake.notify_all();
+    worker.join();
+}
+
+bool XboxDma::submit(const Descriptor& descriptor) {
+    if (!worker.joinable() || descriptor.size == 0) return false;
+    if (!XboxMemory::isRamRange(descriptor.src, descriptor.size) ||
+        !XboxMemory::isRamRange(descriptor.dest, descriptor.size)) {
+        return false;
+    }
+
+    if (outstanding.fetch_add(1) >= QUEUE_CAPACITY) {
+        outstanding.fetch_sub(1);
+        return false;
+    }
+    inFlight.fetch_add(1);
+    // Cannot fail: no more than QUEUE_CAPACITY descriptors are outstanding.
+    Descriptor queued = descriptor;
+    pending->push(std::move(queued));
+    {
+        std::lock_guard<std::mutex> lock(wakeMutex);
+    }
+    wake.notify_one();
+    return true;
+}
+
+bool XboxDma::takeCompletion(Completion& completion) {
+    if (!completed->pop(completion)) return false;
+    outstanding.fetch_sub(1);
+    memory->notifyCodeWrite(completion.descriptor.dest, completion.descriptor.size);
+    return true;
+}
+
+void XboxDma::drain() {
+    std::unique_lock<std::mutex> lock(wakeMutex);
+    idle.wait(lock, [this] { return inFlight.load(std::memory_order_acquire) == 0; });
+}
+
+void XboxDma::reset() {
+    drain();
+    Completion completion;
+    while (completed->pop(completion)) {
+        outstanding.fetch_sub(1);
+    }
+}
+
+void XboxDma::workerLoop() {
+    while (workerRunning) {
+        Descriptor descriptor;
+        if (!pending->pop(descriptor)) {
+            std::unique_lock<std::mutex> lock(wakeMutex);
+            wake.wait(lock, [this] { return !workerRunning || !pending->empty(); });
+            continue;
+        }
+
+        Completion completion = {descriptor, copy(descriptor)};
+        // Cannot fail: the completion's slot was reserved by submit.
+        completed->push(std::move(completion));
+        if (inFlight.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            std::lock_guard<std::mutex> lock(wakeMutex);
+            idle.notify_all();
+        }
+    }
+}
+
+// Guest writes to either range are caught by the memory system's DMA
+// window rather than by watches, so loads stay on the fast path and only
+// stores into the window leave it. Overlapping ranges are left to copyRam,
+// which moves them like memmove.
+bool XboxDma::copy(const Descriptor& descriptor) {
+    memory->openDmaWindow(descriptor.src, descriptor.dest, descriptor.size);
+    memory->copyRam(descriptor.src, descriptor.dest, descriptor.size);
+    return memory->closeDmaWindow();
+}
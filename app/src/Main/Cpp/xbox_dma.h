@@ -0,0 +1,83 @@
+#pragma once
+#include "xbox_memory.h"
+#include "bounded_queue.h"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Runs guest RAM to RAM copies on a worker thread, so that large GPU and
+// APU transfers overlap with CPU emulation instead of blocking it.
+// Descriptors run one at a time in the order they were submitted, so a
+// transfer that reads what an earlier one writes sees its result.
+class XboxDma {
+public:
+    static constexpr size_t QUEUE_CAPACITY = 64;
+
+    struct Descriptor {
+        uint32_t src;
+        uint32_t dest;
+        uint32_t size;
+        // Passed back in the completion for the device that submitted it.
+        uint32_t tag;
+    };
+
+    // overlapped is set when the guest wrote to the source or destination
+    // while the copy was running, so the destination may hold a mix of old
+    // and new data. Stores from translated code are caught as well; see
+    // XboxMemory::openDmaWindow.
+    struct Completion {
+        Descriptor descriptor;
+        bool overlapped;
+    };
+
+    // Attaches itself to memory, so that XboxMemory::dmaTransfer hands it
+    // RAM to RAM copies. Anything calling dmaTransfer from another thread
+    // must be stopped before the engine is destroyed.
+    explicit XboxDma(XboxMemory* memory);
+    ~XboxDma();
+
+    XboxDma(const XboxDma&) = delete;
+    XboxDma& operator=(const XboxDma&) = delete;
+
+    // Queues a copy and returns at once. False when either range leaves
+    // RAM, when QUEUE_CAPACITY completions are still untaken or when the
+    // worker could not be started; XboxMemory::dmaTransfer then copies
+    // synchronously. Safe to call from a region handler.
+    bool submit(const Descriptor& descriptor);
+
+    // Emulation thread only. Pops the oldest finished transfer, after
+    // reporting its destination as a code write so translations of the
+    // overwritten guest code are dropped before the guest is told.
+    bool takeCompletion(Completion& completion);
+
+    // Blocks until every queued transfer has finished. The worker takes no
+    // memory locks, so this is safe from a region handler too.
+    void drain();
+
+    // Drains the queue and drops completions the guest has not been told
+    // about, for a system reset.
+    void reset();
+
+private:
+    XboxMemory* memory;
+
+    std::unique_ptr<BoundedQueue<Descriptor, QUEUE_CAPACITY>> pending;
+    std::unique_ptr<BoundedQueue<Completion, QUEUE_CAPACITY>> completed;
+    // Submitted and not yet taken, bounding both queues.
+    std::atomic<size_t> outstanding;
+    // Submitted and not yet copied.
+    std::atomic<size_t> inFlight;
+
+    std::thread worker;
+    std::mutex wakeMutex;
+    std::condition_variable wake;
+    // Signalled under wakeMutex when inFlight drops to zero.
+    std::condition_variable idle;
+    std::atomic<bool> workerRunning;
+
+    void workerLoop();
+    bool copy(const Descriptor& descriptor);
+};
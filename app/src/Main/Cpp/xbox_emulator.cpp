@@ -897,6 +897,11 @@ bool XboxEmulator::loadXbe(const std::string& path) {
 if (kernel) {
     result = kernel->loadXbe(path);
     cpu.setPC(kernel->getEntryPoint() ? kernel->getEntryPoint() : 0x10000);
+    if (result) {
+        uint32_t imageKey = XboxUtils::calculateCRC32(reinterpret_cast<const uint8_t*>(buffer.data()), buffer.size());
+        std::string cachePath = "/data/data/com.xanite.xboxoriginal/files/jit_" + XboxUtils::formatHex(imageKey) + ".bin";
+        cpu.openTranslationCache(cachePath, imageKey);
+    }
     gameLoaded = true;
     LOGI("XBE loaded (forced success): %s (load result: %d)", path.c_str(), result);
 } else {
@@ -918,6 +923,7 @@ XboxEmulator::XboxEmulator() :
     vsyncEnabled(true),
     jitEnabled(true),
     cpu(&memory),
+    dma(&memory),
     gpu(&memory),
     kernel(nullptr)
 {
@@ -1007,6 +1013,7 @@ void XboxEmulator::reset() {
     pause();
     cpu.reset();
     gpu.reset();
+    dma.reset();
     memory.reset();
     
     if (kernel != nullptr) {
@@ -1024,6 +1031,7 @@ void XboxEmulator::reset() {
 
 void XboxEmulator::pause() {
     running = false;
+    cpu.saveTranslationCache();
 }
 
 void XboxEmulator::resume() {
@@ -1117,6 +1125,10 @@ void XboxEmulator::setJITEnabled(bool enabled) {
     cpu.enableJIT(enabled);
 }
 
+void XboxEmulator::setFpuPrecision(bool enabled) {
+    cpu.enableFpuPrecision(enabled);
+}
+
 void XboxEmulator::initializeSystem() {
     if (kernel != nullptr) {
         delete kernel;
@@ -1131,6 +1143,15 @@ void XboxEmulator::handleInterrupts() {
     if (gpu.checkInterrupt()) {
         cpu.handleInterrupt(0x20);
     }
+
+    XboxDma::Completion completion;
+    while (dma.takeCompletion(completion)) {
+        if (completion.overlapped) {
+            LOGD("DMA 0x%08X -> 0x%08X (%u bytes) raced a CPU write", completion.descriptor.src,
+                 completion.descriptor.dest, completion.descriptor.size);
+        }
+        cpu.handleInterrupt(0x21);
+    }
     
     for (uint32_t i = 0; i < controllers.size(); i++) {
         if (controllers[i].buttons != 0) {
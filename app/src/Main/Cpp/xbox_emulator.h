@@ -4,6 +4,7 @@
 #include "xbox_iso_parser.h"
 #include <jni.h>
 #include "xbox_memory.h"
+#include "xbox_dma.h"
 #include "x86_core.h"
 #include "nv2a_renderer.h"
 #include "xbox_kernel.h"
@@ -67,6 +68,7 @@ public:
     void setFrameLimit(bool enabled);
     void setVSync(bool enabled);
     void setJITEnabled(bool enabled);
+    void setFpuPrecision(bool enabled);
 
     XboxMemory* getMemory() { 
         return &memory; 
@@ -76,6 +78,10 @@ public:
         return &gpu; 
     }
 
+    XboxDma* getDma() {
+        return &dma;
+    }
+
     bool loadMcpxBios(const std::string& path) {
         LOGI("Loading MCPX BIOS from: %s", path.c_str());
         return true;
@@ -125,6 +131,8 @@ private:
 
     XboxMemory memory;
     X86Core cpu;
+    // Outlives gpu, whose render thread may still be submitting transfers.
+    XboxDma dma;
     NV2ARenderer gpu;
     XboxKernel* kernel = nullptr;
 
@@ -215,14 +215,20 @@ void XboxKernel::loadSections() {
                
             section->virtualAddr = address;
                    
-            uint8_t* dest = memory->getRamPointer() + address;
+            if (!XboxMemory::isRamRange(address, section->virtualSize)) {
+                LOGE("Section %d at 0x%08X is not backed by RAM", i, address);
+                continue;
+            }
             
+            // writeBlock copies a host run at a time and reports code
+            // writes and watches, so a watch inside the section is fine.
             uint8_t* src = xbeData.data() + section->fileAddr;
-            size_t copySize = std::min(section->virtualSize, section->fileSize);
-            memcpy(dest, src, copySize);
+            uint32_t copySize = std::min(section->virtualSize, section->fileSize);
+            memory->writeBlock(address, src, copySize);
             
             if (section->virtualSize > copySize) {
-                memset(dest + copySize, 0, section->virtualSize - copySize);
+                std::vector<uint8_t> zeros(section->virtualSize - copySize, 0);
+                memory->writeBlock(address + copySize, zeros.data(), static_cast<uint32_t>(zeros.size()));
             }
             
             LOGI("Loaded section %d: VA=0x%08X, Size=%d bytes, Flags=0x%08X",
@@ -442,22 +448,62 @@ uint32_t XboxKernel::syscallOpenFile(uint32_t* args) {
     return (fd >= 0) ? fd : 0xFFFFFFFF;
 }
 
+// The buffer is a guest address. Each host-contiguous stretch of it is
+// handed to the host call directly; a short transfer ends the call. A
+// watched stretch goes through a bounce buffer so the watch sees it.
 uint32_t XboxKernel::syscallReadFile(uint32_t* args) {
     int fd = args[0];
-    void* buffer = reinterpret_cast<void*>(args[1]);
-    size_t size = args[2];
+    uint32_t buffer = args[1];
+    uint32_t size = args[2];
     
-    ssize_t result = read(fd, buffer, size);
-    return (result >= 0) ? result : 0xFFFFFFFF;
+    uint32_t total = 0;
+    while (total < size) {
+        XboxMemory::HostSpan span = memory->getHostSpan(buffer + total, size - total);
+        if (!span.writable) {
+            LOGE("ReadFile into unbacked guest memory at 0x%08X", buffer + total);
+            break;
+        }
+        ssize_t result;
+        if (span.watched) {
+            std::vector<uint8_t> bounce(span.size);
+            result = read(fd, bounce.data(), span.size);
+            if (result > 0) memory->writeBlock(buffer + total, bounce.data(), static_cast<uint32_t>(result));
+        } else {
+            result = read(fd, span.data, span.size);
+            if (result > 0) memory->notifyCodeWrite(buffer + total, static_cast<uint32_t>(result));
+        }
+        if (result < 0) return total ? total : 0xFFFFFFFF;
+        total += static_cast<uint32_t>(result);
+        if (static_cast<uint32_t>(result) < span.size) break;
+    }
+    return total;
 }
 
 uint32_t XboxKernel::syscallWriteFile(uint32_t* args) {
     int fd = args[0];
-    const void* buffer = reinterpret_cast<const void*>(args[1]);
-    size_t size = args[2];
+    uint32_t buffer = args[1];
+    uint32_t size = args[2];
     
-    ssize_t result = write(fd, buffer, size);
-    return (result >= 0) ? result : 0xFFFFFFFF;
+    uint32_t total = 0;
+    while (total < size) {
+        XboxMemory::HostSpan span = memory->getHostSpan(buffer + total, size - total);
+        if (!span.data) {
+            LOGE("WriteFile from unbacked guest memory at 0x%08X", buffer + total);
+            break;
+        }
+        ssize_t result;
+        if (span.watched) {
+            std::vector<uint8_t> bounce(span.size);
+            memory->readBlock(buffer + total, bounce.data(), span.size);
+            result = write(fd, bounce.data(), span.size);
+        } else {
+            result = write(fd, span.data, span.size);
+        }
+        if (result < 0) return total ? total : 0xFFFFFFFF;
+        total += static_cast<uint32_t>(result);
+        if (static_cast<uint32_t>(result) < span.size) break;
+    }
+    return total;
 }
 
 uint32_t XboxKernel::syscallCloseFile(uint32_t* args) {
@@ -1,340 +1,647 @@
 #include "xbox_memory.h"
+#include "xbox_dma.h"
 #include <android/log.h>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/memfd.h>
+#include <linux/falloc.h>
 #include <stdexcept>
 #include <cstring>
 #include <algorithm>
+#include <thread>
 
 #define LOG_TAG "XboxMemory"
 #define LOGI(...) __android_log_print(ANDROID_LOG_INFO, LOG_TAG, __VA_ARGS__)
 #define LOGE(...) __android_log_print(ANDROID_LOG_ERROR, LOG_TAG, __VA_ARGS__)
+#define LOGW(...) __android_log_print(ANDROID_LOG_WARN, LOG_TAG, __VA_ARGS__)
 
 XboxMemory::XboxMemory() : 
-    ram(RAM_SIZE, 0),
-    bios(BIOS_SIZE, 0),
+    ram(nullptr),
+    ramFd(-1),
+    fastmemBase(nullptr),
+    bios(nullptr),
+    pageTable(CODE_PAGE_COUNT),
+    activeReaders(0),
+    watchSet(nullptr),
+    nextWatchId(1),
+    codePageBits(CODE_PAGE_COUNT / 64),
+    codeWriteCallback(nullptr),
+    dmaWindowOpen(false),
+    dmaWindowSrc(0),
+    dmaWindowDest(0),
+    dmaWindowWritten(false),
+    dmaEngine(nullptr),
     memoryCaches(CACHE_BLOCK_COUNT) {
+
+    allocateRam();
+    buildPageTable();
+    mapFastmem();
     
     for (auto& cache : memoryCaches) {
         allocateCacheBlock(cache);
     }
     
-    mapRegion(GPU_BASE, GPU_SIZE,
-        [this](uint32_t addr) { return handleGPURead(addr); },
-        [this](uint32_t addr, uint32_t val) { handleGPUWrite(addr, val); });
+    MmioHandlers gpu = {};
+    gpu.read32 = [](void* context, uint32_t addr) { return static_cast<XboxMemory*>(context)->handleGPURead(addr); };
+    gpu.write32 = [](void* context, uint32_t addr, uint32_t val) {
+        static_cast<XboxMemory*>(context)->handleGPUWrite(addr, val);
+    };
+    mapRegion(GPU_BASE, GPU_SIZE, gpu, this);
     
-    mapRegion(APU_BASE, APU_SIZE,
-        [this](uint32_t addr) { return handleAPURead(addr); },
-        [this](uint32_t addr, uint32_t val) { handleAPUWrite(addr, val); });
+    MmioHandlers apu = {};
+    apu.read32 = [](void* context, uint32_t addr) { return static_cast<XboxMemory*>(context)->handleAPURead(addr); };
+    apu.write32 = [](void* context, uint32_t addr, uint32_t val) {
+        static_cast<XboxMemory*>(context)->handleAPUWrite(addr, val);
+    };
+    mapRegion(APU_BASE, APU_SIZE, apu, this);
 }
 
 XboxMemory::~XboxMemory() {
-  
+    if (fastmemBase) {
+        munmap(fastmemBase, static_cast<size_t>(FASTMEM_SIZE));
+    }
+    munmap(ram, RAM_SIZE);
+    munmap(bios, BIOS_SIZE);
+    if (ramFd >= 0) {
+        close(ramFd);
+    }
+    delete watchSet.load();
+    delete codeWriteCallback.load();
 }
 
-void XboxMemory::allocateCacheBlock(MemoryCache& cache) {
-    cache.data = std::make_unique<uint8_t[]>(CACHE_BLOCK_SIZE);
-    cache.base = 0;
-    cache.size = 0;
-    cache.dirty = false;
-}
+void XboxMemory::allocateRam() {
+    void* image = mmap(nullptr, BIOS_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (image == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate BIOS image");
+    }
+    bios = static_cast<uint8_t*>(image);
 
-uint8_t XboxMemory::read8(uint32_t address) {
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address)) {
-            return cache.data.get()[address - cache.base];
+    ramFd = static_cast<int>(syscall(__NR_memfd_create, "xbox-ram", MFD_CLOEXEC));
+    if (ramFd >= 0 && ftruncate(ramFd, RAM_SIZE) == 0) {
+        void* view = mmap(nullptr, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, ramFd, 0);
+        if (view != MAP_FAILED) {
+            ram = static_cast<uint8_t*>(view);
+            return;
         }
     }
 
-    if (address >= RAM_BASE && address < RAM_BASE + RAM_SIZE) {
-        return ram[address - RAM_BASE];
+    LOGW("memfd unavailable, guest RAM is not shareable");
+    if (ramFd >= 0) {
+        close(ramFd);
+        ramFd = -1;
     }
-    
-    if (address >= BIOS_BASE && address < BIOS_BASE + BIOS_SIZE) {
-        return bios[address - BIOS_BASE];
+    void* view = mmap(nullptr, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (view == MAP_FAILED) {
+        throw std::runtime_error("Failed to allocate guest RAM");
     }
-    
-    if (auto* region = findMappedRegion(address)) {
-        uint32_t value = region->readHandler(address);
-        if (accessCallback) accessCallback(address, value, false, 1);
-        return static_cast<uint8_t>(value);
+    ram = static_cast<uint8_t*>(view);
+}
+
+// Gives every RAM page back to the kernel instead of writing 128 MB of
+// zeros. The pages read as zero and are committed again only once the
+// guest touches them. MADV_DONTNEED would not clear the shared memfd, so
+// that one has its whole range punched out, which both views see.
+void XboxMemory::releaseRam() {
+    if (ramFd >= 0) {
+        if (fallocate(ramFd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 0, RAM_SIZE) == 0) return;
+    } else if (madvise(ram, RAM_SIZE, MADV_DONTNEED) == 0) {
+        return;
     }
-    
-    LOGE("Read8 from unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    LOGW("Failed to release guest RAM pages, clearing them instead");
+    memset(ram, 0, RAM_SIZE);
 }
 
-uint16_t XboxMemory::read16(uint32_t address) {
-    if (address % 2 != 0) {
-        LOGE("Unaligned read16 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
+void XboxMemory::buildPageTable() {
+    for (uint32_t offset = 0; offset < RAM_SIZE; offset += 1u << CODE_PAGE_SHIFT) {
+        pageTable[(RAM_BASE + offset) >> CODE_PAGE_SHIFT].store(reinterpret_cast<uintptr_t>(ram + offset));
     }
+    for (uint32_t offset = 0; offset < BIOS_SIZE; offset += 1u << CODE_PAGE_SHIFT) {
+        pageTable[(BIOS_BASE + offset) >> CODE_PAGE_SHIFT].store(reinterpret_cast<uintptr_t>(bios + offset) |
+                                                                 PAGE_READONLY);
+    }
+}
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 1)) {
-            return *reinterpret_cast<uint16_t*>(&cache.data[address - cache.base]);
+// Claims the pages of a region nobody else owns yet. RAM wins over any
+// region overlapping it, and earlier regions over later ones, matching the
+// order accesses used to be resolved in.
+void XboxMemory::assignRegionPages(MappedRegion* region) {
+    if (region->size == 0) return;
+    uintptr_t entry = reinterpret_cast<uintptr_t>(region) | PAGE_HANDLER;
+    uint32_t last = (region->base + region->size - 1) >> CODE_PAGE_SHIFT;
+    for (uint32_t page = region->base >> CODE_PAGE_SHIFT;; page++) {
+        uintptr_t current = pageTable[page].load();
+        if (!unwatched(current)) {
+            pageTable[page].store(entry | current);
         }
+        if (page == last) break;
     }
+}
 
-    if (address >= RAM_BASE && address + 1 < RAM_BASE + RAM_SIZE) {
-        return *reinterpret_cast<uint16_t*>(&ram[address - RAM_BASE]);
+thread_local XboxMemory::PendingFault XboxMemory::pendingFault = {};
+
+void XboxMemory::raiseFault(uint32_t address, bool write, bool present) {
+    if (!pendingFault.pending) {
+        pendingFault.fault = {address, write, present};
+        pendingFault.pending = true;
     }
-    
-    if (auto* region = findMappedRegion(address)) {
-        uint32_t value = region->readHandler(address);
-        if (accessCallback) accessCallback(address, value, false, 2);
-        return static_cast<uint16_t>(value);
+}
+
+bool XboxMemory::takeFault(Fault& fault) {
+    if (!pendingFault.pending) return false;
+    fault = pendingFault.fault;
+    pendingFault.pending = false;
+    return true;
+}
+
+void XboxMemory::clearFault() {
+    pendingFault.pending = false;
+}
+
+void XboxMemory::waitForReaders() const {
+    while (activeReaders.load() != 0) {
+        std::this_thread::yield();
     }
-    
-    LOGE("Read16 from unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
 }
 
-uint32_t XboxMemory::read32(uint32_t address) {
-    if (address % 4 != 0) {
-        LOGE("Unaligned read32 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
+size_t XboxMemory::WatchSet::startingBefore(uint64_t end) const {
+    return std::lower_bound(watches.begin(), watches.end(), end,
+                            [](const Watch& watch, uint64_t limit) { return watch.base < limit; }) -
+           watches.begin();
+}
+
+// Every watch overlapping [address, end) starts before end, and walking
+// back from the last of those can stop once no earlier watch reaches
+// address.
+bool XboxMemory::WatchSet::overlaps(uint32_t address, uint64_t end) const {
+    for (size_t i = startingBefore(end); i > 0 && maxEnd[i - 1] > address; i--) {
+        if (watches[i - 1].end > address) return true;
     }
+    return false;
+}
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 3)) {
-            return *reinterpret_cast<uint32_t*>(&cache.data[address - cache.base]);
+void XboxMemory::reportWatch(uint32_t address, uint32_t value, bool write, uint32_t size) {
+    const WatchSet* set = watchSet.load();
+    if (!set) return;
+    uint32_t kind = write ? WATCH_WRITE : WATCH_READ;
+    for (size_t i = set->startingBefore(static_cast<uint64_t>(address) + size); i > 0 && set->maxEnd[i - 1] > address;
+         i--) {
+        const Watch& watch = set->watches[i - 1];
+        if (watch.end > address && (watch.kinds & kind) && size >= watch.minAccess && size <= watch.maxAccess) {
+            (*watch.callback)(address, value, write, size);
         }
     }
+}
+
+// Reserves the 4 GB arena and maps the RAM memfd and a copy of the BIOS
+// into it. Everything else stays PROT_NONE.
+void XboxMemory::mapFastmem() {
+    if (ramFd < 0 || sizeof(void*) < 8) return;
 
-    if (address >= RAM_BASE && address + 3 < RAM_BASE + RAM_SIZE) {
-        uint32_t value;
-memcpy(&value, &ram[address - RAM_BASE], sizeof(value));
-return value;
+    void* arena = mmap(nullptr, static_cast<size_t>(FASTMEM_SIZE), PROT_NONE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (arena == MAP_FAILED) {
+        LOGW("Failed to reserve fastmem arena");
+        return;
     }
-    
-    if (auto* region = findMappedRegion(address)) {
-        uint32_t value = region->readHandler(address);
-        if (accessCallback) accessCallback(address, value, false, 4);
-        return value;
+
+    uint8_t* base = static_cast<uint8_t*>(arena);
+    if (mmap(base + RAM_BASE, RAM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, ramFd, 0) == MAP_FAILED ||
+        mmap(base + BIOS_BASE, BIOS_SIZE, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) == MAP_FAILED) {
+        LOGW("Failed to map guest memory into the fastmem arena");
+        munmap(arena, static_cast<size_t>(FASTMEM_SIZE));
+        return;
     }
-    
-    LOGE("Read32 from unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+
+    fastmemBase = base;
+    LOGI("Fastmem arena at %p", fastmemBase);
 }
 
-uint64_t XboxMemory::read64(uint32_t address) {
-    if (address % 8 != 0) {
-        LOGE("Unaligned read64 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
+// Code pages and pages under an open DMA window stay read-only in the arena
+// so that translated stores to them take the slow path, which reports the
+// write. Watched pages are not accessible there at all, so both loads and
+// stores come to the watch. -1 for pages that are not backed in the arena.
+int XboxMemory::fastmemProtection(uint32_t page) const {
+    uint32_t address = page << CODE_PAGE_SHIFT;
+
+    int protection;
+    if (address - RAM_BASE < RAM_SIZE) {
+        protection = isCodePage(page) || inDmaWindow(page) ? PROT_READ : PROT_READ | PROT_WRITE;
+    } else if (address - BIOS_BASE < BIOS_SIZE) {
+        protection = PROT_READ;
+    } else {
+        return -1;
     }
+    if (pageEntry(address) & PAGE_WATCHED) protection = PROT_NONE;
+    return protection;
+}
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 7)) {
-            return *reinterpret_cast<uint64_t*>(&cache.data[address - cache.base]);
+void XboxMemory::protectFastmemPage(uint32_t page) {
+    if (!fastmemBase) return;
+    std::lock_guard<std::mutex> lock(fastmemMutex);
+    protectFastmemPages(page, page);
+}
+
+void XboxMemory::protectFastmemRam() {
+    if (!fastmemBase) return;
+    std::lock_guard<std::mutex> lock(fastmemMutex);
+    protectFastmemPages(RAM_BASE >> CODE_PAGE_SHIFT, (RAM_BASE + RAM_SIZE - 1) >> CODE_PAGE_SHIFT);
+}
+
+// Runs of pages with the same protection share one mprotect, since DMA
+// windows and watches cover whole transfers.
+void XboxMemory::protectFastmemPages(uint32_t first, uint32_t last) {
+    uint32_t runStart = first;
+    int runProtection = fastmemProtection(first);
+    for (uint32_t page = first;; page++) {
+        int protection = page == last ? -2 : fastmemProtection(page + 1);
+        if (protection != runProtection) {
+            if (runProtection >= 0) {
+                mprotect(fastmemBase + (static_cast<uint64_t>(runStart) << CODE_PAGE_SHIFT),
+                         static_cast<size_t>(page - runStart + 1) << CODE_PAGE_SHIFT, runProtection);
+            }
+            runStart = page + 1;
+            runProtection = protection;
         }
+        if (page == last) break;
+    }
+}
+
+uint8_t* XboxMemory::getFastmemBase() const {
+    return fastmemBase;
+}
+
+bool XboxMemory::isFastmemAddress(const void* host) const {
+    const uint8_t* address = static_cast<const uint8_t*>(host);
+    return fastmemBase && address >= fastmemBase && address < fastmemBase + FASTMEM_SIZE;
+}
+
+void XboxMemory::allocateCacheBlock(MemoryCache& cache) {
+    cache.data = std::make_unique<uint8_t[]>(CACHE_BLOCK_SIZE);
+    cache.base = 0;
+    cache.size = 0;
+    cache.dirty = false;
+}
+
+uint8_t XboxMemory::read8(uint32_t address) {
+    uintptr_t entry = pageEntry(address);
+
+    if (uint8_t* host = pageHost(entry, address)) {
+        return *host;
     }
+    
+    ReadGuard guard(activeReaders);
+    uint8_t value;
+    if (uint8_t* host = pageHost(unwatched(entry), address)) {
+        value = *host;
+    } else if (auto* region = pageRegion(address)) {
+        value = region->read8(address);
+    } else {
+        raiseFault(address, false, false);
+        return 0;
+    }
+    if (entry & PAGE_WATCHED) reportWatch(address, value, false, 1);
+    return value;
+}
 
-    if (address >= RAM_BASE && address + 7 < RAM_BASE + RAM_SIZE) {
-        return *reinterpret_cast<uint64_t*>(&ram[address - RAM_BASE]);
+uint16_t XboxMemory::read16(uint32_t address) {
+    uintptr_t entry = pageEntry(address);
+
+    if (uint8_t* host = pageHost(entry, address); host && withinPage(address, 2)) {
+        return loadHost<uint16_t>(host);
+    }
+    if (!withinPage(address, 2)) {
+        return readSplit<uint16_t>(address);
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        uint64_t value = region->readHandler(address);
-        value |= static_cast<uint64_t>(region->readHandler(address + 4)) << 32;
-        if (accessCallback) accessCallback(address, static_cast<uint32_t>(value), false, 8);
-        return value;
+    ReadGuard guard(activeReaders);
+    uint16_t value;
+    if (uint8_t* host = pageHost(unwatched(entry), address)) {
+        value = loadHost<uint16_t>(host);
+    } else if (auto* region = pageRegion(address)) {
+        value = region->contains(address + 1) ? region->read16(address) : readBytes<uint16_t>(address);
+    } else {
+        raiseFault(address, false, false);
+        return 0;
+    }
+    if (entry & PAGE_WATCHED) reportWatch(address, value, false, 2);
+    return value;
+}
+
+uint32_t XboxMemory::read32(uint32_t address) {
+    uintptr_t entry = pageEntry(address);
+
+    if (uint8_t* host = pageHost(entry, address); host && withinPage(address, 4)) {
+        return loadHost<uint32_t>(host);
+    }
+    if (!withinPage(address, 4)) {
+        return readSplit<uint32_t>(address);
     }
     
-    LOGE("Read64 from unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    ReadGuard guard(activeReaders);
+    uint32_t value;
+    if (uint8_t* host = pageHost(unwatched(entry), address)) {
+        value = loadHost<uint32_t>(host);
+    } else if (auto* region = pageRegion(address)) {
+        value = region->contains(address + 3) ? region->read32(address) : readBytes<uint32_t>(address);
+    } else {
+        raiseFault(address, false, false);
+        return 0;
+    }
+    if (entry & PAGE_WATCHED) reportWatch(address, value, false, 4);
+    return value;
 }
 
-uint32x4_t XboxMemory::read128(uint32_t address) {
-    if (address % 16 != 0) {
-        LOGE("Unaligned read128 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
+uint64_t XboxMemory::read64(uint32_t address) {
+    uintptr_t entry = pageEntry(address);
+
+    if (uint8_t* host = pageHost(entry, address); host && withinPage(address, 8)) {
+        return loadHost<uint64_t>(host);
+    }
+    if (!withinPage(address, 8)) {
+        return readSplit<uint64_t>(address);
+    }
+    
+    ReadGuard guard(activeReaders);
+    uint64_t value;
+    if (uint8_t* host = pageHost(unwatched(entry), address)) {
+        value = loadHost<uint64_t>(host);
+    } else if (auto* region = pageRegion(address)) {
+        value = region->contains(address + 7) ? region->read64(address) : readBytes<uint64_t>(address);
+    } else {
+        raiseFault(address, false, false);
+        return 0;
     }
+    if (entry & PAGE_WATCHED) reportWatch(address, static_cast<uint32_t>(value), false, 8);
+    return value;
+}
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
+#ifdef __ARM_NEON
+uint32x4_t XboxMemory::read128(uint32_t address) {
+    uintptr_t entry = pageEntry(address);
     
-    if (address >= RAM_BASE && address + 15 < RAM_BASE + RAM_SIZE) {
-        return vld1q_u32(reinterpret_cast<uint32_t*>(&ram[address - RAM_BASE]));
+    if (uint8_t* host = pageHost(entry, address); host && withinPage(address, 16)) {
+        return vreinterpretq_u32_u8(vld1q_u8(host));
+    }
+    if (!withinPage(address, 16)) {
+        uint32_t words[4];
+        readBlock(address, words, sizeof(words));
+        return vld1q_u32(words);
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        uint32x4_t result;
+    ReadGuard guard(activeReaders);
+    uint32x4_t result;
+    if (uint8_t* host = pageHost(unwatched(entry), address)) {
+        result = vreinterpretq_u32_u8(vld1q_u8(host));
+    } else if (auto* region = pageRegion(address); region && region->contains(address + 15)) {
+        for (int i = 0; i < 4; i++) {
+            result[i] = region->read32(address + i*4);
+        }
+    } else if (region) {
         for (int i = 0; i < 4; i++) {
-            result[i] = region->readHandler(address + i*4);
+            result[i] = readBytes<uint32_t>(address + i*4);
         }
-        if (accessCallback) accessCallback(address, 0, false, 16);
-        return result;
+    } else {
+        raiseFault(address, false, false);
+        return vdupq_n_u32(0);
     }
-    
-    LOGE("Read128 from unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, 0, false, 16);
+    return result;
 }
+#endif
 
 void XboxMemory::write8(uint32_t address, uint8_t value) {
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address)) {
-            cache.data[address - cache.base] = value;
-            cache.dirty = true;
-            if (accessCallback) accessCallback(address, value, true, 1);
-            return;
-        }
-    }
+    uintptr_t entry = pageEntry(address);
 
-    if (address >= RAM_BASE && address < RAM_BASE + RAM_SIZE) {
-        ram[address - RAM_BASE] = value;
-        if (accessCallback) accessCallback(address, value, true, 1);
+    if (uint8_t* host = pageHostWritable(entry, address)) {
+        *host = value;
+        ramWritten(address, 1);
         return;
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        uint32_t current = region->readHandler(address);
-        current = (current & 0xFFFFFF00) | value;
-        region->writeHandler(address, current);
-        if (accessCallback) accessCallback(address, value, true, 1);
+    ReadGuard guard(activeReaders);
+    if (uint8_t* host = pageHostWritable(unwatched(entry), address)) {
+        *host = value;
+        ramWritten(address, 1);
+    } else if (auto* region = pageRegion(address)) {
+        region->write8(address, value);
+    } else {
+        raiseFault(address, true, unwatched(entry) != 0);
         return;
     }
-    
-    LOGE("Write8 to unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, value, true, 1);
 }
 
 void XboxMemory::write16(uint32_t address, uint16_t value) {
-    if (address % 2 != 0) {
-        LOGE("Unaligned write16 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
-    }
+    uintptr_t entry = pageEntry(address);
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 1)) {
-            *reinterpret_cast<uint16_t*>(&cache.data[address - cache.base]) = value;
-            cache.dirty = true;
-            if (accessCallback) accessCallback(address, value, true, 2);
-            return;
-        }
+    if (uint8_t* host = pageHostWritable(entry, address); host && withinPage(address, 2)) {
+        storeHost(host, value);
+        ramWritten(address, 2);
+        return;
     }
-
-    if (address >= RAM_BASE && address + 1 < RAM_BASE + RAM_SIZE) {
-        *reinterpret_cast<uint16_t*>(&ram[address - RAM_BASE]) = value;
-        if (accessCallback) accessCallback(address, value, true, 2);
+    if (!withinPage(address, 2)) {
+        writeSplit(address, value);
         return;
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        uint32_t current = region->readHandler(address);
-        current = (current & 0xFFFF0000) | value;
-        region->writeHandler(address, current);
-        if (accessCallback) accessCallback(address, value, true, 2);
+    ReadGuard guard(activeReaders);
+    if (uint8_t* host = pageHostWritable(unwatched(entry), address)) {
+        storeHost(host, value);
+        ramWritten(address, 2);
+    } else if (auto* region = pageRegion(address)) {
+        if (region->contains(address + 1)) {
+            region->write16(address, value);
+        } else {
+            writeBytes(address, value);
+        }
+    } else {
+        raiseFault(address, true, unwatched(entry) != 0);
         return;
     }
-    
-    LOGE("Write16 to unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, value, true, 2);
 }
 
 void XboxMemory::write32(uint32_t address, uint32_t value) {
-    if (address % 4 != 0) {
-        LOGE("Unaligned write32 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
-    }
+    uintptr_t entry = pageEntry(address);
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 3)) {
-            *reinterpret_cast<uint32_t*>(&cache.data[address - cache.base]) = value;
-            cache.dirty = true;
-            if (accessCallback) accessCallback(address, value, true, 4);
-            return;
-        }
+    if (uint8_t* host = pageHostWritable(entry, address); host && withinPage(address, 4)) {
+        storeHost(host, value);
+        ramWritten(address, 4);
+        return;
     }
-
-    if (address >= RAM_BASE && address + 3 < RAM_BASE + RAM_SIZE) {
-        *reinterpret_cast<uint32_t*>(&ram[address - RAM_BASE]) = value;
-        if (accessCallback) accessCallback(address, value, true, 4);
+    if (!withinPage(address, 4)) {
+        writeSplit(address, value);
         return;
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        region->writeHandler(address, value);
-        if (accessCallback) accessCallback(address, value, true, 4);
+    ReadGuard guard(activeReaders);
+    if (uint8_t* host = pageHostWritable(unwatched(entry), address)) {
+        storeHost(host, value);
+        ramWritten(address, 4);
+    } else if (auto* region = pageRegion(address)) {
+        if (region->contains(address + 3)) {
+            region->write32(address, value);
+        } else {
+            writeBytes(address, value);
+        }
+    } else {
+        raiseFault(address, true, unwatched(entry) != 0);
         return;
     }
-    
-    LOGE("Write32 to unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, value, true, 4);
 }
 
 void XboxMemory::write64(uint32_t address, uint64_t value) {
-    if (address % 8 != 0) {
-        LOGE("Unaligned write64 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
-    }
+    uintptr_t entry = pageEntry(address);
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    for (auto& cache : memoryCaches) {
-        if (cache.contains(address) && cache.contains(address + 7)) {
-            *reinterpret_cast<uint64_t*>(&cache.data[address - cache.base]) = value;
-            cache.dirty = true;
-            if (accessCallback) accessCallback(address, static_cast<uint32_t>(value), true, 8);
-            return;
-        }
+    if (uint8_t* host = pageHostWritable(entry, address); host && withinPage(address, 8)) {
+        storeHost(host, value);
+        ramWritten(address, 8);
+        return;
     }
-
-    if (address >= RAM_BASE && address + 7 < RAM_BASE + RAM_SIZE) {
-        *reinterpret_cast<uint64_t*>(&ram[address - RAM_BASE]) = value;
-        if (accessCallback) accessCallback(address, static_cast<uint32_t>(value), true, 8);
+    if (!withinPage(address, 8)) {
+        writeSplit(address, value);
         return;
     }
     
-    if (auto* region = findMappedRegion(address)) {
-        region->writeHandler(address, static_cast<uint32_t>(value));
-        region->writeHandler(address + 4, static_cast<uint32_t>(value >> 32));
-        if (accessCallback) accessCallback(address, static_cast<uint32_t>(value), true, 8);
+    ReadGuard guard(activeReaders);
+    if (uint8_t* host = pageHostWritable(unwatched(entry), address)) {
+        storeHost(host, value);
+        ramWritten(address, 8);
+    } else if (auto* region = pageRegion(address)) {
+        if (region->contains(address + 7)) {
+            region->write64(address, value);
+        } else {
+            writeBytes(address, value);
+        }
+    } else {
+        raiseFault(address, true, unwatched(entry) != 0);
         return;
     }
-    
-    LOGE("Write64 to unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, static_cast<uint32_t>(value), true, 8);
 }
 
+#ifdef __ARM_NEON
 void XboxMemory::write128(uint32_t address, uint32x4_t value) {
-    if (address % 16 != 0) {
-        LOGE("Unaligned write128 at 0x%08X", address);
-        throw std::runtime_error("Unaligned memory access");
-    }
-
-    std::lock_guard<std::mutex> lock(memoryMutex);
+    uintptr_t entry = pageEntry(address);
     
-    if (address >= RAM_BASE && address + 15 < RAM_BASE + RAM_SIZE) {
-        vst1q_u32(reinterpret_cast<uint32_t*>(&ram[address - RAM_BASE]), value);
-        if (accessCallback) accessCallback(address, 0, true, 16);
+    if (uint8_t* host = pageHostWritable(entry, address); host && withinPage(address, 16)) {
+        vst1q_u8(host, vreinterpretq_u8_u32(value));
+        ramWritten(address, 16);
+        return;
+    }
+    if (!withinPage(address, 16)) {
+        uint32_t words[4];
+        vst1q_u32(words, value);
+        writeBlock(address, words, sizeof(words));
         return;
     }
     
-    if (auto* region = findMappedRegion(address)) {
+    ReadGuard guard(activeReaders);
+    if (uint8_t* host = pageHostWritable(unwatched(entry), address)) {
+        vst1q_u8(host, vreinterpretq_u8_u32(value));
+        ramWritten(address, 16);
+    } else if (auto* region = pageRegion(address); region && region->contains(address + 15)) {
         for (int i = 0; i < 4; i++) {
-            region->writeHandler(address + i*4, value[i]);
+            region->write32(address + i*4, value[i]);
         }
-        if (accessCallback) accessCallback(address, 0, true, 16);
+    } else if (region) {
+        for (int i = 0; i < 4; i++) {
+            writeBytes<uint32_t>(address + i*4, value[i]);
+        }
+    } else {
+        raiseFault(address, true, unwatched(entry) != 0);
         return;
     }
-    
-    LOGE("Write128 to unmapped address 0x%08X", address);
-    throw std::runtime_error("Memory access violation");
+    if (entry & PAGE_WATCHED) reportWatch(address, 0, true, 16);
+}
+#endif
+
+XboxMemory::HostSpan XboxMemory::getHostSpan(uint32_t address, uint32_t size) const {
+    constexpr uint32_t PAGE_SIZE = 1u << CODE_PAGE_SHIFT;
+    uintptr_t entry = pageEntry(address);
+    uint8_t* data = pageHost(unwatched(entry), address);
+    bool writable = data && !(entry & PAGE_READONLY);
+    bool watched = (entry & PAGE_WATCHED) != 0;
+    uint32_t length = PAGE_SIZE - (address & PAGE_FLAGS);
+
+    // Following pages extend the run while they continue the same host
+    // mapping with the same flags.
+    if (data) {
+        for (uint32_t page = address >> CODE_PAGE_SHIFT; length < size && page + 1 < CODE_PAGE_COUNT; page++) {
+            uintptr_t next = pageTable[page + 1].load(std::memory_order_relaxed);
+            if (next != entry + PAGE_SIZE) break;
+            entry = next;
+            length += PAGE_SIZE;
+        }
+    }
+    return {data, std::min(length, size), writable, watched};
+}
+
+void XboxMemory::readBlock(uint32_t address, void* dest, uint32_t size) {
+    uint8_t* out = static_cast<uint8_t*>(dest);
+    while (size > 0) {
+        HostSpan span = getHostSpan(address, size);
+        if (span.data) {
+            memcpy(out, span.data, span.size);
+            if (span.watched) {
+                ReadGuard guard(activeReaders);
+                reportWatch(address, 0, false, span.size);
+            }
+        } else if (!unwatched(pageEntry(address))) {
+            raiseFault(address, false, false);
+            memset(out, 0, span.size);
+        } else {
+            for (uint32_t i = 0; i < span.size;) {
+                if (((address + i) & 3) == 0 && span.size - i >= 4) {
+                    uint32_t value = read32(address + i);
+                    memcpy(out + i, &value, sizeof(value));
+                    i += 4;
+                } else {
+                    out[i] = read8(address + i);
+                    i++;
+                }
+            }
+        }
+        address += span.size;
+        out += span.size;
+        size -= span.size;
+    }
+}
+
+void XboxMemory::writeBlock(uint32_t address, const void* src, uint32_t size) {
+    const uint8_t* in = static_cast<const uint8_t*>(src);
+    while (size > 0) {
+        HostSpan span = getHostSpan(address, size);
+        if (span.writable) {
+            memcpy(span.data, in, span.size);
+            notifyCodeWrite(address, span.size);
+            if (dmaWindowOpen.load(std::memory_order_relaxed)) noteDmaWindowWrite(address, span.size);
+            if (span.watched) {
+                ReadGuard guard(activeReaders);
+                reportWatch(address, 0, true, span.size);
+            }
+        } else if (span.data || !unwatched(pageEntry(address))) {
+            raiseFault(address, true, span.data != nullptr);
+        } else {
+            for (uint32_t i = 0; i < span.size;) {
+                if (((address + i) & 3) == 0 && span.size - i >= 4) {
+                    uint32_t value;
+                    memcpy(&value, in + i, sizeof(value));
+                    write32(address + i, value);
+                    i += 4;
+                } else {
+                    write8(address + i, in[i]);
+                    i++;
+                }
+            }
+        }
+        address += span.size;
+        in += span.size;
+        size -= span.size;
+    }
 }
 
 bool XboxMemory::loadBios(const std::string& path) {
@@ -346,14 +653,21 @@ bool XboxMemory::loadBios(const std::string& path) {
         return false;
     }
     
-    bios.resize(BIOS_SIZE); 
-    ssize_t bytesRead = read(fd, bios.data(), BIOS_SIZE);
+    ssize_t bytesRead = read(fd, bios, BIOS_SIZE);
     close(fd);
     
     if (bytesRead != BIOS_SIZE) {
         LOGE("Failed to read BIOS (expected %d bytes, got %d)", BIOS_SIZE, bytesRead);
         return false;
     }
+
+    if (fastmemBase) {
+        mprotect(fastmemBase + BIOS_BASE, BIOS_SIZE, PROT_READ | PROT_WRITE);
+        memcpy(fastmemBase + BIOS_BASE, bios, BIOS_SIZE);
+        for (uint32_t offset = 0; offset < BIOS_SIZE; offset += 1u << CODE_PAGE_SHIFT) {
+            protectFastmemPage((BIOS_BASE + offset) >> CODE_PAGE_SHIFT);
+        }
+    }
     
     LOGI("BIOS (1MB) loaded successfully"); 
     return true;
@@ -361,7 +675,9 @@ bool XboxMemory::loadBios(const std::string& path) {
 
 void XboxMemory::reset() {
     std::lock_guard<std::mutex> lock(memoryMutex);
-    std::fill(ram.begin(), ram.end(), 0);
+    releaseRam();
+    std::fill(codePageBits.begin(), codePageBits.end(), 0);
+    protectFastmemRam();
     
     for (auto& cache : memoryCaches) {
         cache.base = 0;
@@ -370,58 +686,49 @@ void XboxMemory::reset() {
     }
 }
 
-void XboxMemory::dmaTransfer(uint32_t src, uint32_t dest, uint32_t size) {
-    if (size == 0) return;
+bool XboxMemory::dmaTransfer(uint32_t src, uint32_t dest, uint32_t size, uint32_t tag) {
+    if (size == 0) return false;
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    if ((src >= RAM_BASE && src + size <= RAM_BASE + RAM_SIZE) &&
-        (dest >= RAM_BASE && dest + size <= RAM_BASE + RAM_SIZE)) {
-        
-        uint8_t* src_ptr = &ram[src - RAM_BASE];
-        uint8_t* dest_ptr = &ram[dest - RAM_BASE];
-        
-        if (size >= 64 && (src % 16 == 0) && (dest % 16 == 0)) {
-            uint32_t blocks = size / 16;
-            uint32_t* src32 = reinterpret_cast<uint32_t*>(src_ptr);
-            uint32_t* dest32 = reinterpret_cast<uint32_t*>(dest_ptr);
-            
-            for (uint32_t i = 0; i < blocks; i++) {
-                uint32x4_t data = vld1q_u32(src32);
-                vst1q_u32(dest32, data);
-                src32 += 4;
-                dest32 += 4;
-            }
-            
-            uint32_t remaining = size % 16;
-            if (remaining > 0) {
-                memcpy(dest32, src32, remaining);
-            }
-        } else {
-            memmove(dest_ptr, src_ptr, size);
-        }
-        
-        updateCache(dest, size);
-        return;
+    bool ram = isRamRange(src, size) && isRamRange(dest, size);
+    if (XboxDma* engine = dmaEngine.load(std::memory_order_acquire)) {
+        if (ram && engine->submit({src, dest, size, tag})) return true;
+        engine->drain();
+    }
+
+    if (ram) {
+        copyRam(src, dest, size);
+        notifyCodeWrite(dest, size);
+        return false;
     }
     
-    for (uint32_t i = 0; i < size; i++) {
-        uint8_t val = read8(src + i);
-        write8(dest + i, val);
+    uint8_t buffer[4096];
+    for (uint32_t done = 0; done < size;) {
+        uint32_t chunk = std::min<uint32_t>(size - done, sizeof(buffer));
+        readBlock(src + done, buffer, chunk);
+        writeBlock(dest + done, buffer, chunk);
+        done += chunk;
     }
+    return false;
+}
+
+bool XboxMemory::dmaTransferNEON(uint32_t src, uint32_t dest, uint32_t size, uint32_t tag) {
+    return dmaTransfer(src, dest, size, tag);
+}
+
+void XboxMemory::setDmaEngine(XboxDma* engine) {
+    dmaEngine.store(engine, std::memory_order_release);
 }
 
-void XboxMemory::dmaTransferNEON(uint32_t src, uint32_t dest, uint32_t size) {
+// The NEON kernel copies forwards 64 bytes at a time, so overlapping
+// ranges go through memmove instead.
+void XboxMemory::copyRam(uint32_t src, uint32_t dest, uint32_t size) {
     if (size == 0) return;
 
-    std::lock_guard<std::mutex> lock(memoryMutex);
-    
-    if ((src >= RAM_BASE && src + size <= RAM_BASE + RAM_SIZE) &&
-        (dest >= RAM_BASE && dest + size <= RAM_BASE + RAM_SIZE)) {
-        
-        uint8_t* src_ptr = &ram[src - RAM_BASE];
-        uint8_t* dest_ptr = &ram[dest - RAM_BASE];
-        
+    uint8_t* src_ptr = &ram[src - RAM_BASE];
+    uint8_t* dest_ptr = &ram[dest - RAM_BASE];
+
+#ifdef __ARM_NEON
+    if (src + size <= dest || dest + size <= src) {
         uint32_t blocks = size / 64;
         for (uint32_t i = 0; i < blocks; i++) {
             uint8x16x4_t data = vld4q_u8(src_ptr);
@@ -429,15 +736,67 @@ void XboxMemory::dmaTransferNEON(uint32_t src, uint32_t dest, uint32_t size) {
             src_ptr += 64;
             dest_ptr += 64;
         }
-        
+
         uint32_t remaining = size % 64;
         if (remaining) {
             memcpy(dest_ptr, src_ptr, remaining);
         }
-        
-        updateCache(dest, size);
     } else {
-        dmaTransfer(src, dest, size);
+        memmove(dest_ptr, src_ptr, size);
+    }
+#else
+    memmove(dest_ptr, src_ptr, size);
+#endif
+}
+
+void XboxMemory::openDmaWindow(uint32_t src, uint32_t dest, uint32_t size) {
+    dmaWindowSrc.store(src | static_cast<uint64_t>(size) << 32, std::memory_order_relaxed);
+    dmaWindowDest.store(dest | static_cast<uint64_t>(size) << 32, std::memory_order_relaxed);
+    dmaWindowWritten.store(false, std::memory_order_relaxed);
+    dmaWindowOpen.store(true, std::memory_order_seq_cst);
+    protectDmaWindow();
+}
+
+bool XboxMemory::closeDmaWindow() {
+    dmaWindowOpen.store(false, std::memory_order_seq_cst);
+    protectDmaWindow();
+    return dmaWindowWritten.exchange(false, std::memory_order_relaxed);
+}
+
+// Reapplies the arena protection of the window's RAM pages after it opens
+// or closes.
+void XboxMemory::protectDmaWindow() {
+    if (!fastmemBase) return;
+    std::lock_guard<std::mutex> lock(fastmemMutex);
+    for (const auto* window : {&dmaWindowSrc, &dmaWindowDest}) {
+        uint64_t range = window->load(std::memory_order_relaxed);
+        uint32_t base = static_cast<uint32_t>(range);
+        uint64_t end = std::min<uint64_t>(base + (range >> 32), RAM_BASE + RAM_SIZE);
+        if (base - RAM_BASE >= RAM_SIZE || end <= base) continue;
+        protectFastmemPages(base >> CODE_PAGE_SHIFT, static_cast<uint32_t>((end - 1) >> CODE_PAGE_SHIFT));
+    }
+}
+
+bool XboxMemory::inDmaWindow(uint32_t page) const {
+    if (!dmaWindowOpen.load(std::memory_order_relaxed)) return false;
+    uint64_t pageBase = static_cast<uint64_t>(page) << CODE_PAGE_SHIFT;
+    auto covers = [pageBase](uint64_t range) {
+        uint64_t base = static_cast<uint32_t>(range);
+        return base < pageBase + (1u << CODE_PAGE_SHIFT) && pageBase < base + (range >> 32);
+    };
+    return covers(dmaWindowSrc.load(std::memory_order_relaxed)) ||
+           covers(dmaWindowDest.load(std::memory_order_relaxed));
+}
+
+void XboxMemory::noteDmaWindowWrite(uint32_t address, uint32_t size) {
+    if (!dmaWindowOpen.load(std::memory_order_acquire)) return;
+    auto overlaps = [address, size](uint64_t range) {
+        uint32_t base = static_cast<uint32_t>(range);
+        return address - base < static_cast<uint32_t>(range >> 32) || base - address < size;
+    };
+    if (overlaps(dmaWindowSrc.load(std::memory_order_relaxed)) ||
+        overlaps(dmaWindowDest.load(std::memory_order_relaxed))) {
+        dmaWindowWritten.store(true, std::memory_order_relaxed);
     }
 }
 
@@ -483,15 +842,6 @@ void XboxMemory::invalidateCacheRange(uint32_t address, uint32_t size) {
     }
 }
 
-XboxMemory::MappedRegion* XboxMemory::findMappedRegion(uint32_t address) {
-    for (auto& region : mappedRegions) {
-        if (region.contains(address)) {
-            return &region;
-        }
-    }
-    return nullptr;
-}
-
 void XboxMemory::updateCache(uint32_t address, uint32_t size) {
     for (auto& cache : memoryCaches) {
         if (cache.size == 0) continue;
@@ -526,46 +876,178 @@ void XboxMemory::handleAPUWrite(uint32_t address, uint32_t value) {
     LOGI("APU write at 0x%08X: 0x%08X", address, value);
 }
 
-bool XboxMemory::mapRegion(uint32_t base, uint32_t size,
-                         std::function<uint32_t(uint32_t)> readHandler,
-                         std::function<void(uint32_t, uint32_t)> writeHandler) {
+bool XboxMemory::mapRegion(uint32_t base, uint32_t size, const MmioHandlers& handlers, void* context) {
+    if (!handlers.read32 || !handlers.write32) {
+        LOGE("Region 0x%08X needs 32-bit read and write handlers", base);
+        return false;
+    }
+
     std::lock_guard<std::mutex> lock(memoryMutex);
     
     for (const auto& region : mappedRegions) {
-        if (region.base == base) {
+        if (region->base == base) {
             LOGE("Region 0x%08X already mapped", base);
             return false;
         }
     }
     
-    mappedRegions.push_back({base, size, readHandler, writeHandler});
+    mappedRegions.push_back(std::make_unique<MappedRegion>(MappedRegion{base, size, handlers, context}));
+    assignRegionPages(mappedRegions.back().get());
     LOGI("Mapped region 0x%08X-0x%08X", base, base + size);
     return true;
 }
 
+// Pages are handed to the next region covering them, or unmapped, before
+// the record is freed; readers still inside a handler finish first.
 void XboxMemory::unmapRegion(uint32_t base) {
     std::lock_guard<std::mutex> lock(memoryMutex);
     
-    auto it = std::remove_if(mappedRegions.begin(), mappedRegions.end(),
-        [base](const MappedRegion& region) { return region.base == base; });
-    
-    if (it != mappedRegions.end()) {
-        mappedRegions.erase(it, mappedRegions.end());
-        LOGI("Unmapped region 0x%08X", base);
+    auto it = std::find_if(mappedRegions.begin(), mappedRegions.end(),
+        [base](const std::unique_ptr<MappedRegion>& region) { return region->base == base; });
+    if (it == mappedRegions.end()) return;
+
+    std::unique_ptr<MappedRegion> removed = std::move(*it);
+    mappedRegions.erase(it);
+    if (removed->size > 0) {
+        uintptr_t entry = reinterpret_cast<uintptr_t>(removed.get()) | PAGE_HANDLER;
+        uint32_t last = (removed->base + removed->size - 1) >> CODE_PAGE_SHIFT;
+        for (uint32_t page = removed->base >> CODE_PAGE_SHIFT;; page++) {
+            uintptr_t current = pageTable[page].load();
+            if (unwatched(current) == entry) {
+                pageTable[page].store(current & PAGE_WATCHED);
+            }
+            if (page == last) break;
+        }
+        for (const auto& region : mappedRegions) {
+            assignRegionPages(region.get());
+        }
+    }
+    waitForReaders();
+    LOGI("Unmapped region 0x%08X", base);
+}
+
+uint32_t XboxMemory::addWatch(const WatchRange& range, WatchCallback callback) {
+    if (range.size == 0 || !callback) return 0;
+
+    std::lock_guard<std::mutex> lock(memoryMutex);
+
+    Watch watch = {nextWatchId++, range.base, static_cast<uint64_t>(range.base) + range.size, range.kinds,
+                   range.minAccess, range.maxAccess, std::make_shared<WatchCallback>(std::move(callback))};
+    std::vector<Watch> watches;
+    if (const WatchSet* current = watchSet.load()) {
+        watches = current->watches;
+    }
+    auto position = std::upper_bound(watches.begin(), watches.end(), watch.base,
+                                     [](uint32_t base, const Watch& other) { return base < other.base; });
+    watches.insert(position, watch);
+
+    publishWatches(std::move(watches));
+    updateWatchedPages(watch.base, watch.end);
+    return watch.id;
+}
+
+void XboxMemory::removeWatch(uint32_t id) {
+    std::lock_guard<std::mutex> lock(memoryMutex);
+
+    const WatchSet* current = watchSet.load();
+    if (!current) return;
+    auto it = std::find_if(current->watches.begin(), current->watches.end(),
+                           [id](const Watch& watch) { return watch.id == id; });
+    if (it == current->watches.end()) return;
+
+    uint32_t base = it->base;
+    uint64_t end = it->end;
+    std::vector<Watch> watches = current->watches;
+    watches.erase(watches.begin() + (it - current->watches.begin()));
+
+    publishWatches(std::move(watches));
+    updateWatchedPages(base, end);
+}
+
+// Replaces the published set; the old one is freed once no reader can be
+// calling one of its callbacks.
+void XboxMemory::publishWatches(std::vector<Watch> watches) {
+    WatchSet* set = nullptr;
+    if (!watches.empty()) {
+        set = new WatchSet{std::move(watches), {}};
+        uint64_t furthest = 0;
+        for (const Watch& watch : set->watches) {
+            furthest = std::max(furthest, watch.end);
+            set->maxEnd.push_back(furthest);
+        }
+    }
+
+    WatchSet* previous = watchSet.exchange(set);
+    waitForReaders();
+    delete previous;
+}
+
+// Flags the pages of [base, end) that a watch still overlaps and clears
+// the rest, then updates their protection in the fastmem arena.
+void XboxMemory::updateWatchedPages(uint32_t base, uint64_t end) {
+    const WatchSet* set = watchSet.load();
+    uint32_t first = base >> CODE_PAGE_SHIFT;
+    uint32_t last = static_cast<uint32_t>((end - 1) >> CODE_PAGE_SHIFT);
+    for (uint32_t page = first;; page++) {
+        uint32_t pageBase = page << CODE_PAGE_SHIFT;
+        if (set && set->overlaps(pageBase, static_cast<uint64_t>(pageBase) + (1u << CODE_PAGE_SHIFT))) {
+            pageTable[page].fetch_or(PAGE_WATCHED);
+        } else {
+            pageTable[page].fetch_and(~PAGE_WATCHED);
+        }
+        if (page == last) break;
+    }
+    if (!fastmemBase) return;
+    std::lock_guard<std::mutex> lock(fastmemMutex);
+    protectFastmemPages(first, last);
+}
+
+void XboxMemory::markCodeRange(uint32_t address, uint32_t size) {
+    if (size == 0) return;
+    uint32_t last = (address + size - 1) >> CODE_PAGE_SHIFT;
+    for (uint32_t page = address >> CODE_PAGE_SHIFT;; page++) {
+        if (!isCodePage(page)) {
+            codePageBits[page >> 6].fetch_or(1ull << (page & 63));
+            protectFastmemPage(page);
+        }
+        if (page == last) break;
+    }
+}
+
+void XboxMemory::notifyCodeWrite(uint32_t address, uint32_t size) {
+    if (size == 0) return;
+    bool touched = false;
+    uint32_t last = (address + size - 1) >> CODE_PAGE_SHIFT;
+    for (uint32_t page = address >> CODE_PAGE_SHIFT;; page++) {
+        uint64_t bit = 1ull << (page & 63);
+        if (isCodePage(page) && (codePageBits[page >> 6].fetch_and(~bit) & bit)) {
+            protectFastmemPage(page);
+            touched = true;
+        }
+        if (page == last) break;
+    }
+    if (touched) {
+        ReadGuard guard(activeReaders);
+        if (CodeWriteCallback* callback = codeWriteCallback.load()) {
+            (*callback)(address, size);
+        }
     }
 }
 
-void XboxMemory::setAccessCallback(std::function<void(uint32_t, uint32_t, bool, uint32_t)> callback) {
+void XboxMemory::setCodeWriteCallback(std::function<void(uint32_t, uint32_t)> callback) {
     std::lock_guard<std::mutex> lock(memoryMutex);
-    accessCallback = callback;
+    CodeWriteCallback* previous =
+        codeWriteCallback.exchange(callback ? new CodeWriteCallback(std::move(callback)) : nullptr);
+    waitForReaders();
+    delete previous;
 }
 
 uint8_t* XboxMemory::getRamPointer() {
-    return ram.data();
+    return ram;
 }
 
 const uint8_t* XboxMemory::getBiosPointer() const {
-    return bios.data();
+    return bios;
 }
 
 uint32_t XboxMemory::getRamSize() const {
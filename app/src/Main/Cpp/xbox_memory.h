@@ -1,5 +1,7 @@
 #pragma once
+#include <atomic>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <string>
 #include <functional>
@@ -12,6 +14,8 @@
 #include <arm_neon.h>
 #endif
 
+class XboxDma;
+
 class XboxMemory {
 public:
     
@@ -33,9 +37,47 @@ public:
     static constexpr uint32_t CACHE_BLOCK_SIZE = 64 * 1024; 
     static constexpr uint32_t CACHE_BLOCK_COUNT = 8;
 
+    static constexpr uint32_t CODE_PAGE_SHIFT = 12;
+    static constexpr uint32_t CODE_PAGE_COUNT = 1u << (32 - CODE_PAGE_SHIFT);
+
+    // The whole 32-bit guest space plus a guard page for accesses that
+    // start just below 4 GB.
+    static constexpr uint64_t FASTMEM_SIZE = (1ull << 32) + (1u << CODE_PAGE_SHIFT);
+
+    // Entry points of a memory-mapped device, called with the context given
+    // to mapRegion. read32 and write32 are required. A missing narrower
+    // read returns the low bits of read32 and a missing narrower write
+    // merges into read32 and goes through write32. A missing 64-bit access
+    // is split into two 32-bit ones. Handlers are given unaligned addresses
+    // as the guest issued them.
+    struct MmioHandlers {
+        uint8_t (*read8)(void* context, uint32_t address);
+        uint16_t (*read16)(void* context, uint32_t address);
+        uint32_t (*read32)(void* context, uint32_t address);
+        uint64_t (*read64)(void* context, uint32_t address);
+        void (*write8)(void* context, uint32_t address, uint8_t value);
+        void (*write16)(void* context, uint32_t address, uint16_t value);
+        void (*write32)(void* context, uint32_t address, uint32_t value);
+        void (*write64)(void* context, uint32_t address, uint64_t value);
+    };
+
     XboxMemory();
     ~XboxMemory();
 
+    // Reads of unmapped addresses return zero, and writes to them or to the
+    // BIOS are dropped. Neither throws: the first such access since the
+    // calling thread last took its fault is recorded for that thread, and
+    // the CPU collects it at instruction and block boundaries. present is
+    // set when the page exists but does not allow the access.
+    struct Fault {
+        uint32_t address;
+        bool write;
+        bool present;
+    };
+    static bool faultPending() { return pendingFault.pending; }
+    static bool takeFault(Fault& fault);
+    static void clearFault();
+
     uint8_t read8(uint32_t address);
     uint16_t read16(uint32_t address);
     uint32_t read32(uint32_t address);
@@ -52,19 +94,98 @@ public:
     void write128(uint32_t address, uint32x4_t value);
 #endif
 
+    // The longest run starting at address, up to size bytes, that is one
+    // piece of host memory. data is nullptr over device and unmapped pages,
+    // and size then stops at the end of the page. A run does not mix watched
+    // and unwatched pages, and accesses through data are not reported to
+    // watches: a watched run, or a range that needs several runs, goes
+    // through readBlock/writeBlock. Anyone writing through data must call
+    // notifyCodeWrite().
+    struct HostSpan {
+        uint8_t* data;
+        uint32_t size;
+        bool writable;
+        bool watched;
+    };
+    HostSpan getHostSpan(uint32_t address, uint32_t size) const;
+
+    // Copies between guest memory and a host buffer, a memcpy per host run.
+    // Device pages are accessed a dword at a time where aligned and a byte
+    // at a time elsewhere; unmapped addresses fault like read8/write8. A
+    // watched run is reported as one access of its full length.
+    void readBlock(uint32_t address, void* dest, uint32_t size);
+    void writeBlock(uint32_t address, const void* src, uint32_t size);
+
     bool loadBios(const std::string& path);
     void reset();
 
-    void dmaTransfer(uint32_t src, uint32_t dest, uint32_t size);
-    void dmaTransferNEON(uint32_t src, uint32_t dest, uint32_t size);
+    // RAM to RAM transfers are queued on the attached DMA engine and return
+    // true; the engine's completion carries tag. Device pages, or a
+    // transfer the engine cannot take, are copied before returning false,
+    // after anything already queued.
+    bool dmaTransfer(uint32_t src, uint32_t dest, uint32_t size, uint32_t tag = 0);
+    bool dmaTransferNEON(uint32_t src, uint32_t dest, uint32_t size, uint32_t tag = 0);
+
+    // Called by XboxDma, which stays attached for its lifetime.
+    void setDmaEngine(XboxDma* engine);
+
+    static bool isRamRange(uint32_t address, uint32_t size) {
+        return size <= RAM_SIZE && address - RAM_BASE <= RAM_SIZE - size;
+    }
+
+    // RAM to RAM copy with the bulk-copy kernel, for the DMA paths. Takes
+    // no lock, like any other RAM access, and does not report code writes:
+    // the caller calls notifyCodeWrite() on the emulation thread.
+    void copyRam(uint32_t src, uint32_t dest, uint32_t size);
 
-    bool mapRegion(uint32_t base, uint32_t size,
-                 std::function<uint32_t(uint32_t)> readHandler,
-                 std::function<void(uint32_t, uint32_t)> writeHandler);
+    // Brackets a copy run by a DMA engine, one at a time. closeDmaWindow()
+    // reports whether a guest write landed in either range while the window
+    // was open. The window's pages are read-only in the fastmem arena
+    // meanwhile, so translated stores there take their slow path and are
+    // seen too. Writes racing the open or close may be counted either way.
+    void openDmaWindow(uint32_t src, uint32_t dest, uint32_t size);
+    bool closeDmaWindow();
+
+    // RAM and BIOS accesses take no lock. Regions, watches and callbacks may
+    // be changed while other threads access memory, but not from inside a
+    // region handler or callback: the change waits for those to return.
+    bool mapRegion(uint32_t base, uint32_t size, const MmioHandlers& handlers, void* context);
     
     void unmapRegion(uint32_t base);
    
-    void setAccessCallback(std::function<void(uint32_t, uint32_t, bool, uint32_t)> callback);
+    // Watches call back on guest accesses overlapping [base, base + size)
+    // whose kind is in kinds and whose size in bytes is within
+    // [minAccess, maxAccess]. Only pages holding a watch leave the fast
+    // path. value is the low 32 bits accessed, or 0 for block and 128-bit
+    // accesses. addWatch returns an id for removeWatch, or 0 if size is 0.
+    static constexpr uint32_t WATCH_READ = 1;
+    static constexpr uint32_t WATCH_WRITE = 2;
+
+    struct WatchRange {
+        uint32_t base;
+        uint32_t size;
+        uint32_t kinds;
+        uint32_t minAccess;
+        uint32_t maxAccess;
+    };
+    using WatchCallback = std::function<void(uint32_t address, uint32_t value, bool write, uint32_t size)>;
+    uint32_t addWatch(const WatchRange& range, WatchCallback callback);
+    void removeWatch(uint32_t id);
+
+    // Pages holding translated or pre-decoded guest code. A write to a marked
+    // page unmarks it and reports the written range to the code write callback,
+    // which runs on the writing thread. Anyone writing RAM through
+    // getRamPointer() must call notifyCodeWrite().
+    void markCodeRange(uint32_t address, uint32_t size);
+    void notifyCodeWrite(uint32_t address, uint32_t size);
+    void setCodeWriteCallback(std::function<void(uint32_t, uint32_t)> callback);
+
+    // Host view of the guest address space for translated code: guest
+    // address A lives at base + A. RAM and BIOS are mapped there; MMIO and
+    // unmapped ranges are not, and code pages are read-only, so accesses
+    // that need the slow path fault. nullptr when the host cannot reserve it.
+    uint8_t* getFastmemBase() const;
+    bool isFastmemAddress(const void* host) const;
 
     uint8_t* getRamPointer();
     const uint8_t* getBiosPointer() const;
@@ -77,24 +198,253 @@ public:
 
 private:
  
-    std::vector<uint8_t> ram;
-    std::vector<uint8_t> bios;
+    // RAM is a memfd mapped twice: ram is the view XboxMemory itself
+    // uses and is always writable, the fastmem view sits in the arena.
+    uint8_t* ram;
+    int ramFd;
+    uint8_t* fastmemBase;
+    // Page aligned like RAM, since page table entries keep flags in the low
+    // bits of the host address.
+    uint8_t* bios;
     
+    // Serializes changes to regions, callbacks and bulk RAM operations.
+    // Plain accesses never take it.
     mutable std::mutex memoryMutex;
+    // Serializes protection changes in the fastmem arena. Code writes and
+    // DMA windows make them from whichever thread they happen on.
+    std::mutex fastmemMutex;
 
-    struct MappedRegion {
+    // Aligned so that page table entries have room for their flags.
+    struct alignas(8) MappedRegion {
         uint32_t base;
         uint32_t size;
-        std::function<uint32_t(uint32_t)> readHandler;
-        std::function<void(uint32_t, uint32_t)> writeHandler;
+        MmioHandlers handlers;
+        void* context;
         
         bool contains(uint32_t addr) const {
             return addr >= base && addr < (base + size);
         }
+
+        uint8_t read8(uint32_t addr) const {
+            return handlers.read8 ? handlers.read8(context, addr) : static_cast<uint8_t>(handlers.read32(context, addr));
+        }
+
+        uint16_t read16(uint32_t addr) const {
+            return handlers.read16 ? handlers.read16(context, addr)
+                                   : static_cast<uint16_t>(handlers.read32(context, addr));
+        }
+
+        uint32_t read32(uint32_t addr) const { return handlers.read32(context, addr); }
+
+        uint64_t read64(uint32_t addr) const {
+            if (handlers.read64) return handlers.read64(context, addr);
+            return handlers.read32(context, addr) |
+                   (static_cast<uint64_t>(handlers.read32(context, addr + 4)) << 32);
+        }
+
+        void write8(uint32_t addr, uint8_t value) const {
+            if (handlers.write8) {
+                handlers.write8(context, addr, value);
+            } else {
+                handlers.write32(context, addr, (handlers.read32(context, addr) & 0xFFFFFF00) | value);
+            }
+        }
+
+        void write16(uint32_t addr, uint16_t value) const {
+            if (handlers.write16) {
+                handlers.write16(context, addr, value);
+            } else {
+                handlers.write32(context, addr, (handlers.read32(context, addr) & 0xFFFF0000) | value);
+            }
+        }
+
+        void write32(uint32_t addr, uint32_t value) const { handlers.write32(context, addr, value); }
+
+        void write64(uint32_t addr, uint64_t value) const {
+            if (handlers.write64) {
+                handlers.write64(context, addr, value);
+            } else {
+                handlers.write32(context, addr, static_cast<uint32_t>(value));
+                handlers.write32(context, addr + 4, static_cast<uint32_t>(value >> 32));
+            }
+        }
     };
-    std::vector<MappedRegion> mappedRegions;
+    std::vector<std::unique_ptr<MappedRegion>> mappedRegions;
+
+    using CodeWriteCallback = std::function<void(uint32_t, uint32_t)>;
+
+    // One entry per 4 KB guest page. Memory pages hold the host address of
+    // the page, flagged PAGE_READONLY for the BIOS; device pages point at
+    // the first region covering them, tagged with PAGE_HANDLER; zero is
+    // unmapped. Any of them may carry PAGE_WATCHED, which sends accesses to
+    // the slow path. Memory entries are fixed at construction, device
+    // entries are republished in place as regions come and go.
+    static constexpr uintptr_t PAGE_HANDLER = 1;
+    static constexpr uintptr_t PAGE_READONLY = 2;
+    static constexpr uintptr_t PAGE_WATCHED = 4;
+    static constexpr uintptr_t PAGE_FLAGS = (1u << CODE_PAGE_SHIFT) - 1;
+    std::vector<std::atomic<uintptr_t>> pageTable;
+
+    // Region records and callbacks are read through published pointers.
+    // Readers count themselves in for as long as they use one; a writer
+    // unpublishes the pointer, waits for the count to drain and only then
+    // frees the object, so readers never need the mutex.
+    std::atomic<uint32_t> activeReaders;
+
+    struct ReadGuard {
+        explicit ReadGuard(std::atomic<uint32_t>& readers) : readers(readers) { readers.fetch_add(1); }
+        ~ReadGuard() { readers.fetch_sub(1, std::memory_order_release); }
+        std::atomic<uint32_t>& readers;
+    };
+
+    void waitForReaders() const;
+
+    struct PendingFault {
+        Fault fault;
+        bool pending;
+    };
+    static thread_local PendingFault pendingFault;
+
+    static void raiseFault(uint32_t address, bool write, bool present);
+
+    uintptr_t pageEntry(uint32_t address) const {
+        return pageTable[address >> CODE_PAGE_SHIFT].load(std::memory_order_relaxed);
+    }
+
+    // nullptr for watched pages, so the fast paths skip them; the slow path
+    // looks through the flag with unwatched().
+    uint8_t* pageHost(uintptr_t entry, uint32_t address) const {
+        if (!entry || (entry & (PAGE_HANDLER | PAGE_WATCHED))) return nullptr;
+        return reinterpret_cast<uint8_t*>(entry & ~PAGE_FLAGS) + (address & PAGE_FLAGS);
+    }
+
+    uint8_t* pageHostWritable(uintptr_t entry, uint32_t address) const {
+        return (entry & PAGE_READONLY) ? nullptr : pageHost(entry, address);
+    }
+
+    static uintptr_t unwatched(uintptr_t entry) { return entry & ~PAGE_WATCHED; }
+
+    static bool withinPage(uint32_t address, uint32_t size) {
+        return (address & PAGE_FLAGS) <= PAGE_FLAGS + 1 - size;
+    }
+
+    // Host loads and stores of guest data, which x86 does not align.
+    template <typename T>
+    static T loadHost(const uint8_t* host) {
+        T value;
+        memcpy(&value, host, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    static void storeHost(uint8_t* host, T value) {
+        memcpy(host, &value, sizeof(T));
+    }
+
+    // An access straddling two pages is copied a host run at a time, so each
+    // side goes wherever its own page says. One running off the end of a
+    // region is done a byte at a time.
+    template <typename T>
+    T readSplit(uint32_t address) {
+        T value;
+        readBlock(address, &value, sizeof(T));
+        return value;
+    }
+
+    template <typename T>
+    void writeSplit(uint32_t address, T value) {
+        writeBlock(address, &value, sizeof(T));
+    }
+
+    template <typename T>
+    T readBytes(uint32_t address) {
+        T value = 0;
+        for (uint32_t i = 0; i < sizeof(T); i++) {
+            value |= static_cast<T>(read8(address + i)) << (8 * i);
+        }
+        return value;
+    }
+
+    template <typename T>
+    void writeBytes(uint32_t address, T value) {
+        for (uint32_t i = 0; i < sizeof(T); i++) {
+            write8(address + i, static_cast<uint8_t>(value >> (8 * i)));
+        }
+    }
+
+    // Only valid inside a ReadGuard. A region sharing its first page with
+    // an earlier region is not reachable through that page.
+    MappedRegion* pageRegion(uint32_t address) const {
+        uintptr_t entry = pageTable[address >> CODE_PAGE_SHIFT].load();
+        if (!(entry & PAGE_HANDLER)) return nullptr;
+        MappedRegion* region = reinterpret_cast<MappedRegion*>(entry & ~(PAGE_HANDLER | PAGE_WATCHED));
+        return region->contains(address) ? region : nullptr;
+    }
     
-    std::function<void(uint32_t, uint32_t, bool, uint32_t)> accessCallback;
+    // Watches sorted by base, with the furthest end among each watch and
+    // those before it, so the ones overlapping an access are found by a
+    // binary search and a short walk back. A set is never changed once
+    // published; adding or removing a watch publishes a new one.
+    struct Watch {
+        uint32_t id;
+        uint32_t base;
+        uint64_t end;
+        uint32_t kinds;
+        uint32_t minAccess;
+        uint32_t maxAccess;
+        std::shared_ptr<WatchCallback> callback;
+    };
+    struct WatchSet {
+        std::vector<Watch> watches;
+        std::vector<uint64_t> maxEnd;
+
+        size_t startingBefore(uint64_t end) const;
+        bool overlaps(uint32_t address, uint64_t end) const;
+    };
+    std::atomic<WatchSet*> watchSet;
+    uint32_t nextWatchId;
+
+    void publishWatches(std::vector<Watch> watches);
+    void updateWatchedPages(uint32_t base, uint64_t end);
+
+    // Only valid inside a ReadGuard.
+    void reportWatch(uint32_t address, uint32_t value, bool write, uint32_t size);
+
+    std::vector<std::atomic<uint64_t>> codePageBits;
+    std::atomic<CodeWriteCallback*> codeWriteCallback;
+
+    // The open DMA window, each range packed as base | size << 32.
+    std::atomic<bool> dmaWindowOpen;
+    std::atomic<uint64_t> dmaWindowSrc;
+    std::atomic<uint64_t> dmaWindowDest;
+    std::atomic<bool> dmaWindowWritten;
+    std::atomic<XboxDma*> dmaEngine;
+
+    void noteDmaWindowWrite(uint32_t address, uint32_t size);
+    bool inDmaWindow(uint32_t page) const;
+
+    bool isCodePage(uint32_t page) const {
+        return (codePageBits[page >> 6].load(std::memory_order_relaxed) >> (page & 63)) & 1;
+    }
+
+    // Bookkeeping for a store of size bytes within one RAM page, made
+    // through a host pointer.
+    void ramWritten(uint32_t address, uint32_t size) {
+        if (isCodePage(address >> CODE_PAGE_SHIFT)) notifyCodeWrite(address, size);
+        if (dmaWindowOpen.load(std::memory_order_relaxed)) noteDmaWindowWrite(address, size);
+    }
+
+    void allocateRam();
+    void releaseRam();
+    void buildPageTable();
+    void assignRegionPages(MappedRegion* region);
+    void mapFastmem();
+    int fastmemProtection(uint32_t page) const;
+    void protectFastmemPage(uint32_t page);
+    void protectFastmemRam();
+    void protectDmaWindow();
+    // Callers hold fastmemMutex.
+    void protectFastmemPages(uint32_t first, uint32_t last);
    
     struct MemoryCache {
         uint32_t base;
@@ -110,7 +460,6 @@ private:
     };
     std::vector<MemoryCache> memoryCaches;
 
-    MappedRegion* findMappedRegion(uint32_t address);
     void updateCache(uint32_t address, uint32_t size);
     void allocateCacheBlock(MemoryCache& cache);
     
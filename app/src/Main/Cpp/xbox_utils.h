@@ -4,7 +4,9 @@
 #include <vector>
 #include <functional>
 #include <chrono>
+#ifdef __ARM_NEON
 #include <arm_neon.h>
+#endif
 
 namespace XboxUtils {
     std::string formatHex(uint32_t value, uint8_t width = 8);
@@ -24,7 +26,9 @@ namespace XboxUtils {
     uint16_t swap16(uint16_t value);
     uint32_t swap32(uint32_t value);
     uint64_t swap64(uint64_t value);
+#ifdef __ARM_NEON
     uint32x4_t swap128(uint32x4_t value);
+#endif
     
     uint32_t setBit(uint32_t value, uint8_t bit);
     uint32_t clearBit(uint32_t value, uint8_t bit);